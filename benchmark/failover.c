@@ -0,0 +1,463 @@
+#include <argp.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/raft.h"
+#include "../include/raft/fixture.h"
+
+static char doc[] =
+    "Benchmark failover and leadership transfer under steady write load, "
+    "timing how long writes are unavailable";
+
+/* Order of fields: {NAME, KEY, ARG, FLAGS, DOC, GROUP}.*/
+static struct argp_option options[] = {
+    {"servers", 'n', "N", 0, "Number of voting servers (default 3)", 0},
+    {"rounds", 'r', "N", 0, "Number of failovers to measure (default 20)", 0},
+    {"fault", 'f', "FAULT",
+     0, "One of kill, stop or transfer (default kill)", 0},
+    {"election", 'e', "MSECS", 0, "Election timeout (default 1000)", 0},
+    {"heartbeat", 'h', "MSECS", 0, "Heartbeat timeout (default 100)", 0},
+    {"latency", 'l', "MSECS", 0, "Network latency (default 1)", 0},
+    {"interval", 'i', "MSECS", 0, "Time between writes (default 10)", 0},
+    {"pre-vote", 'p', NULL, 0, "Enable pre-vote", 0},
+    {"seed", 'S', "N", 0, "Seed for election timeouts (default 1)", 0},
+    {0}};
+
+enum { FAULT_KILL, FAULT_STOP, FAULT_TRANSFER };
+
+struct arguments
+{
+    int n;
+    int rounds;
+    int fault;
+    int election;
+    int heartbeat;
+    int latency;
+    int interval;
+    bool pre_vote;
+    unsigned seed;
+};
+
+static error_t argumentsParse(int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+    switch (key) {
+        case 'n':
+            arguments->n = atoi(arg);
+            break;
+        case 'r':
+            arguments->rounds = atoi(arg);
+            break;
+        case 'f':
+            if (strcmp(arg, "kill") == 0) {
+                arguments->fault = FAULT_KILL;
+            } else if (strcmp(arg, "stop") == 0) {
+                arguments->fault = FAULT_STOP;
+            } else if (strcmp(arg, "transfer") == 0) {
+                arguments->fault = FAULT_TRANSFER;
+            } else {
+                argp_error(state, "unknown fault %s", arg);
+            }
+            break;
+        case 'e':
+            arguments->election = atoi(arg);
+            break;
+        case 'h':
+            arguments->heartbeat = atoi(arg);
+            break;
+        case 'l':
+            arguments->latency = atoi(arg);
+            break;
+        case 'i':
+            arguments->interval = atoi(arg);
+            break;
+        case 'p':
+            arguments->pre_vote = true;
+            break;
+        case 'S':
+            arguments->seed = (unsigned)atoi(arg);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Give up on a round if writes are not back after this long. */
+#define MAX_OUTAGE 60000
+
+static int fsmApply(struct raft_fsm *fsm,
+                    struct raft_fsm_apply *req,
+                    const struct raft_buffer *buf,
+                    raft_fsm_apply_cb cb)
+{
+    (void)fsm;
+    (void)buf;
+    cb(req, NULL, 0);
+    return 0;
+}
+
+static int fsmSnapshot(struct raft_fsm *fsm,
+                       struct raft_buffer *bufs[],
+                       unsigned *n_bufs)
+{
+    (void)fsm;
+    *bufs = raft_malloc(sizeof **bufs);
+    if (*bufs == NULL) {
+        return RAFT_NOMEM;
+    }
+    (*bufs)[0].len = 8;
+    (*bufs)[0].base = raft_calloc(1, 8);
+    if ((*bufs)[0].base == NULL) {
+        raft_free(*bufs);
+        return RAFT_NOMEM;
+    }
+    *n_bufs = 1;
+    return 0;
+}
+
+static int fsmRestore(struct raft_fsm *fsm, struct raft_buffer *buf)
+{
+    (void)fsm;
+    raft_free(buf->base);
+    return 0;
+}
+
+/* Client submitting writes at a steady rate to whoever is the leader, and
+ * tracking when they fail or succeed around a fault. */
+struct client
+{
+    struct raft_fixture *f;
+    int type;             /* Fault to inject */
+    unsigned interval;    /* Time between writes */
+    raft_time next;       /* Time of the next write */
+    bool done;            /* Whether the round is over */
+    unsigned old_leader;  /* Leader at the time of the fault */
+    raft_time fault;      /* Time of the fault, or 0 if none yet */
+    raft_time last;       /* Last successful write */
+    raft_time before;     /* Last successful write before the fault */
+    raft_time elected;    /* New leader in charge */
+    raft_time committed;  /* First write submitted after the fault committed */
+    unsigned n_failed;    /* Writes that failed */
+    unsigned n_rejected;  /* Writes not submitted for lack of a leader */
+    struct raft_transfer transfer;
+    bool transferring;    /* Whether a leadership transfer is in progress */
+    unsigned n_transfers; /* Leadership transfers attempted */
+};
+
+struct write
+{
+    struct raft_apply req;
+    struct client *client;
+    raft_time submitted;
+};
+
+static void writeCb(struct raft_apply *req, int status, void *result)
+{
+    struct write *w = req->data;
+    struct client *c = w->client;
+    raft_time now = raft_fixture_time(c->f);
+    (void)result;
+
+    if (!c->done) {
+        if (status != 0) {
+            c->n_failed++;
+        } else {
+            c->last = now;
+            if (c->fault != 0 && w->submitted >= c->fault &&
+                c->committed == 0) {
+                c->committed = now;
+            }
+        }
+    }
+    raft_free(w);
+}
+
+static void clientSubmit(struct client *c)
+{
+    unsigned i = raft_fixture_leader_index(c->f);
+    struct raft_buffer buf;
+    struct write *w;
+    int rv;
+
+    if (i == raft_fixture_n(c->f)) {
+        c->n_rejected++;
+        return;
+    }
+    w = raft_malloc(sizeof *w);
+    buf.len = 8;
+    buf.base = raft_entry_malloc(buf.len);
+    assert(w != NULL && buf.base != NULL);
+    memset(buf.base, 0, buf.len);
+    w->req.data = w;
+    w->client = c;
+    w->submitted = raft_fixture_time(c->f);
+    rv = raft_apply(raft_fixture_get(c->f, i), &w->req, &buf, 1, writeCb);
+    if (rv != 0) {
+        raft_free(buf.base);
+        raft_free(w);
+        c->n_failed++;
+    }
+}
+
+static void transferCb(struct raft_transfer *req)
+{
+    struct client *c = req->data;
+    c->transferring = false;
+}
+
+/* Ask the old leader to transfer leadership to any other voter. If it can't
+ * start, e.g. because no voter is up to date, it's tried again later. */
+static void clientTransfer(struct client *c)
+{
+    int rv;
+
+    c->transfer.data = c;
+    rv = raft_transfer(raft_fixture_get(c->f, c->old_leader), &c->transfer, 0,
+                       transferCb);
+    if (rv != 0) {
+        return;
+    }
+    c->transferring = true;
+    c->n_transfers++;
+}
+
+/* Step the cluster, submitting writes when due, until @stop returns true or
+ * @max_msecs have elapsed. */
+static bool run(struct client *c,
+                bool (*stop)(struct client *c),
+                unsigned max_msecs)
+{
+    raft_time end = raft_fixture_time(c->f) + max_msecs;
+    unsigned i;
+
+    while (raft_fixture_time(c->f) < end) {
+        if (stop != NULL && stop(c)) {
+            return true;
+        }
+        if (raft_fixture_time(c->f) >= c->next) {
+            clientSubmit(c);
+            c->next = raft_fixture_time(c->f) + c->interval;
+        }
+        raft_fixture_step(c->f);
+        i = raft_fixture_leader_index(c->f);
+        if (c->fault != 0 && c->elected == 0 && i != raft_fixture_n(c->f) &&
+            i != c->old_leader) {
+            c->elected = raft_fixture_time(c->f);
+        }
+        /* A transfer gives up if the target didn't take over within an
+         * election timeout, in which case an operator would try again. */
+        if (c->type == FAULT_TRANSFER && c->fault != 0 && c->elected == 0 &&
+            !c->transferring && i == c->old_leader) {
+            clientTransfer(c);
+        }
+    }
+    return stop == NULL;
+}
+
+static bool recovered(struct client *c)
+{
+    return c->elected != 0 && c->committed != 0;
+}
+
+/* Inject the fault on the current leader. */
+static void fault(struct client *c)
+{
+    unsigned leader = raft_fixture_leader_index(c->f);
+    unsigned n = raft_fixture_n(c->f);
+    unsigned i;
+
+    c->old_leader = leader;
+    c->fault = raft_fixture_time(c->f);
+    c->before = c->last;
+    switch (c->type) {
+        case FAULT_KILL:
+            raft_fixture_kill(c->f, leader);
+            break;
+        case FAULT_STOP:
+            /* Like a SIGSTOP'ed process, the leader neither sends nor
+             * receives anything, but it doesn't know it. */
+            for (i = 0; i < n; i++) {
+                if (i != leader) {
+                    raft_fixture_saturate(c->f, leader, i);
+                    raft_fixture_saturate(c->f, i, leader);
+                }
+            }
+            break;
+        case FAULT_TRANSFER:
+            clientTransfer(c);
+            break;
+    }
+}
+
+struct summary
+{
+    const char *name;
+    raft_time min;
+    raft_time max;
+    raft_time sum;
+    unsigned n;
+};
+
+static void summaryAdd(struct summary *s, raft_time value)
+{
+    if (s->n == 0 || value < s->min) {
+        s->min = value;
+    }
+    if (value > s->max) {
+        s->max = value;
+    }
+    s->sum += value;
+    s->n++;
+}
+
+static void summaryReport(struct summary *s)
+{
+    printf("%-8s: min %6llu avg %6llu max %6llu msecs\n", s->name, s->min,
+           s->n > 0 ? s->sum / s->n : 0, s->max);
+}
+
+/* Run one failover, returning false if writes didn't come back. */
+static bool benchRound(struct arguments *arguments,
+                       struct raft_fsm *fsms,
+                       unsigned *seed,
+                       struct summary stats[3],
+                       struct client *c)
+{
+    struct raft_fixture f;
+    struct raft_configuration conf;
+    unsigned n = (unsigned)arguments->n;
+    unsigned election = (unsigned)arguments->election;
+    unsigned i;
+    bool ok;
+    int rv;
+
+    rv = raft_fixture_init(&f, n, fsms);
+    if (rv != 0) {
+        printf("fixture: %s\n", raft_strerror(rv));
+        return false;
+    }
+    for (i = 0; i < n; i++) {
+        struct raft *r = raft_fixture_get(&f, i);
+        raft_set_election_timeout(r, election);
+        raft_set_heartbeat_timeout(r, (unsigned)arguments->heartbeat);
+        raft_set_pre_vote(r, arguments->pre_vote);
+        raft_fixture_set_network_latency(&f, i, (unsigned)arguments->latency);
+        raft_fixture_set_randomized_election_timeout(
+            &f, i, election + (unsigned)rand_r(seed) % election);
+    }
+    rv = raft_fixture_configuration(&f, n, &conf);
+    if (rv != 0) {
+        printf("configuration: %s\n", raft_strerror(rv));
+        raft_fixture_close(&f);
+        return false;
+    }
+    rv = raft_fixture_bootstrap(&f, &conf);
+    raft_configuration_close(&conf);
+    if (rv == 0) {
+        rv = raft_fixture_start(&f);
+    }
+    if (rv != 0) {
+        printf("start: %s\n", raft_strerror(rv));
+        raft_fixture_close(&f);
+        return false;
+    }
+    if (!raft_fixture_step_until_has_leader(&f, 10 * election)) {
+        raft_fixture_close(&f);
+        return false;
+    }
+
+    /* Pick new election timeouts for the failover. */
+    for (i = 0; i < n; i++) {
+        raft_fixture_set_randomized_election_timeout(
+            &f, i, election + (unsigned)rand_r(seed) % election);
+    }
+
+    memset(c, 0, sizeof *c);
+    c->f = &f;
+    c->type = arguments->fault;
+    c->interval = (unsigned)arguments->interval;
+    c->old_leader = n;
+    run(c, NULL, 2 * election);
+    if (raft_fixture_leader_index(&f) == n) {
+        raft_fixture_close(&f);
+        return false;
+    }
+
+    fault(c);
+    ok = run(c, recovered, MAX_OUTAGE);
+    c->done = true;
+    if (ok) {
+        summaryAdd(&stats[0], c->elected - c->fault);
+        summaryAdd(&stats[1], c->committed - c->fault);
+        summaryAdd(&stats[2], c->committed - c->before);
+    }
+
+    raft_fixture_close(&f);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    struct argp argp = {options, argumentsParse, NULL, doc, 0, 0, 0};
+    struct arguments arguments;
+    struct raft_fsm fsms[RAFT_FIXTURE_MAX_SERVERS];
+    struct summary stats[3] = {{"leader", 0, 0, 0, 0},
+                            {"commit", 0, 0, 0, 0},
+                            {"outage", 0, 0, 0, 0}};
+    struct client client;
+    unsigned n_failed = 0;
+    unsigned n_rejected = 0;
+    unsigned n_lost = 0;
+    unsigned n_transfers = 0;
+    int i;
+
+    arguments.n = 3;
+    arguments.rounds = 20;
+    arguments.fault = FAULT_KILL;
+    arguments.election = 1000;
+    arguments.heartbeat = 100;
+    arguments.latency = 1;
+    arguments.interval = 10;
+    arguments.pre_vote = false;
+    arguments.seed = 1;
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    if (arguments.n < 2 || arguments.n > RAFT_FIXTURE_MAX_SERVERS ||
+        arguments.rounds <= 0 || arguments.election <= 0 ||
+        arguments.heartbeat <= 0 || arguments.latency < 0 ||
+        arguments.interval <= 0) {
+        printf("invalid arguments\n");
+        return -1;
+    }
+
+    memset(fsms, 0, sizeof fsms);
+    for (i = 0; i < arguments.n; i++) {
+        fsms[i].version = 1;
+        fsms[i].apply = fsmApply;
+        fsms[i].snapshot = fsmSnapshot;
+        fsms[i].restore = fsmRestore;
+    }
+
+    for (i = 0; i < arguments.rounds; i++) {
+        if (!benchRound(&arguments, fsms, &arguments.seed, stats, &client)) {
+            n_lost++;
+        }
+        n_failed += client.n_failed;
+        n_rejected += client.n_rejected;
+        n_transfers += client.n_transfers;
+    }
+
+    summaryReport(&stats[0]);
+    summaryReport(&stats[1]);
+    summaryReport(&stats[2]);
+    printf("%-8s: %u failed, %u without leader, %u rounds never recovered\n",
+           "errors", n_failed, n_rejected, n_lost);
+    if (arguments.fault == FAULT_TRANSFER) {
+        printf("%-8s: %u attempts\n", "transfer", n_transfers);
+    }
+    return 0;
+}
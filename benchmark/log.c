@@ -0,0 +1,218 @@
+#include <argp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/log.h"
+
+static char doc[] = "Benchmark in-memory raft log operations";
+
+/* Order of fields: {NAME, KEY, ARG, FLAGS, DOC, GROUP}.*/
+static struct argp_option options[] = {
+    {"entries", 'n', "N", 0, "Number of entries to append (default 1000000)",
+     0},
+    {"buf", 'b', "BUF", 0, "Entry payload size (default 64)", 0},
+    {"batch", 'B', "N", 0, "Entries per batch, 0 for none (default 0)", 0},
+    {"terms", 't', "N", 0, "Entries per term (default 1000)", 0},
+    {0}};
+
+struct arguments
+{
+    int n;
+    int buf;
+    int batch;
+    int terms;
+};
+
+static error_t argumentsParse(int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+    switch (key) {
+        case 'n':
+            arguments->n = atoi(arg);
+            break;
+        case 'b':
+            arguments->buf = atoi(arg);
+            break;
+        case 'B':
+            arguments->batch = atoi(arg);
+            break;
+        case 't':
+            arguments->terms = atoi(arg);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Save current time in 'time'. */
+static void timeNow(struct timespec *time)
+{
+    if (clock_gettime(CLOCK_MONOTONIC, time) != 0) {
+        perror("clock_gettime");
+        abort();
+    }
+}
+
+/* Nanoseconds elapsed since 'start'. */
+static long timeSince(struct timespec *start)
+{
+    struct timespec now;
+    timeNow(&now);
+    return (now.tv_sec - start->tv_sec) * 1000 * 1000 * 1000 - start->tv_nsec +
+           now.tv_nsec;
+}
+
+static void report(const char *op, long nsecs, int n)
+{
+    printf("%-8s: %8d ops take %6ld nanosecs on average\n", op, n,
+           nsecs / (n > 0 ? n : 1));
+}
+
+/* Append all entries, allocating a batch every arguments->batch entries. */
+static int benchAppend(struct raft_log *log, struct arguments *arguments)
+{
+    struct timespec start;
+    struct raft_buffer buf;
+    char *batch = NULL;
+    raft_term term = 1;
+    int i;
+    int rv;
+
+    timeNow(&start);
+    for (i = 0; i < arguments->n; i++) {
+        if (arguments->terms > 0 && i > 0 && i % arguments->terms == 0) {
+            term++;
+        }
+        buf.len = (size_t)arguments->buf;
+        if (arguments->batch > 0) {
+            int j = i % arguments->batch;
+            if (j == 0) {
+                batch = raft_malloc(buf.len * (size_t)arguments->batch);
+                if (batch == NULL) {
+                    printf("append: out of memory\n");
+                    return RAFT_NOMEM;
+                }
+            }
+            buf.base = batch + buf.len * (size_t)j;
+            rv = logAppend(log, term, RAFT_COMMAND, &buf, batch);
+        } else {
+            buf.base = raft_entry_malloc(buf.len);
+            if (buf.base == NULL) {
+                printf("append: out of memory\n");
+                return RAFT_NOMEM;
+            }
+            rv = logAppend(log, term, RAFT_COMMAND, &buf, NULL);
+        }
+        if (rv != 0) {
+            printf("append: %d\n", rv);
+            return rv;
+        }
+    }
+    report("append", timeSince(&start), arguments->n);
+    return 0;
+}
+
+static int benchGet(struct raft_log *log, struct arguments *arguments)
+{
+    struct timespec start;
+    size_t len = 0;
+    int i;
+
+    timeNow(&start);
+    for (i = 1; i <= arguments->n; i++) {
+        len += logGet(log, (raft_index)i)->buf.len;
+    }
+    report("get", timeSince(&start), arguments->n);
+    if (len != (size_t)arguments->n * (size_t)arguments->buf) {
+        printf("get: unexpected total length %zu\n", len);
+        return RAFT_CORRUPT;
+    }
+    return 0;
+}
+
+static int benchTermOf(struct raft_log *log, struct arguments *arguments)
+{
+    struct timespec start;
+    raft_term sum = 0;
+    unsigned seed = 1;
+    int i;
+
+    timeNow(&start);
+    for (i = 0; i < arguments->n; i++) {
+        seed = seed * 1103515245 + 12345;
+        sum += logTermOf(log, seed % (unsigned)arguments->n + 1);
+    }
+    report("term-of", timeSince(&start), arguments->n);
+    if (sum == 0) {
+        printf("term-of: missing terms\n");
+        return RAFT_CORRUPT;
+    }
+    return 0;
+}
+
+static int benchAcquire(struct raft_log *log, struct arguments *arguments)
+{
+    struct timespec start;
+    struct raft_entry array[64];
+    struct raft_entry *entries = array;
+    raft_index index = 1;
+    unsigned n;
+    int rv;
+
+    timeNow(&start);
+    while (index <= (raft_index)arguments->n) {
+        rv = logAcquire(log, index, &entries, &n, 64);
+        if (rv != 0) {
+            printf("acquire: %d\n", rv);
+            return rv;
+        }
+        logRelease(log, index, entries, n);
+        index += n;
+    }
+    report("acquire", timeSince(&start), arguments->n);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct argp argp = {options, argumentsParse, NULL, doc, 0, 0, 0};
+    struct arguments arguments;
+    struct raft_log log;
+    int rv;
+
+    arguments.n = 1000 * 1000;
+    arguments.buf = 64;
+    arguments.batch = 0;
+    arguments.terms = 1000;
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    if (arguments.n <= 0 || arguments.buf <= 0) {
+        printf("entries and buffer size must be positive\n");
+        return -1;
+    }
+
+    logInit(&log);
+    rv = benchAppend(&log, &arguments);
+    if (rv != 0) {
+        return rv;
+    }
+    rv = benchGet(&log, &arguments);
+    if (rv != 0) {
+        return rv;
+    }
+    rv = benchTermOf(&log, &arguments);
+    if (rv != 0) {
+        return rv;
+    }
+    rv = benchAcquire(&log, &arguments);
+    if (rv != 0) {
+        return rv;
+    }
+    logClose(&log);
+
+    return 0;
+}
@@ -0,0 +1,658 @@
+#include <argp.h>
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "../include/raft.h"
+#include "../include/raft/fixture.h"
+#include "../include/raft/uv.h"
+
+static char doc[] =
+    "Benchmark the snapshot path: take, put and get with the libuv raft_io "
+    "backend, then send and install a snapshot between two servers";
+
+/* Order of fields: {NAME, KEY, ARG, FLAGS, DOC, GROUP}.*/
+static struct argp_option options[] = {
+    {"dir", 'd', "DIR", 0, "Directory to use for temp files (default /tmp)", 0},
+    {"size", 's', "MB", 0, "Megabytes of FSM state (default 64)", 0},
+    {"compressibility", 'c', "PERCENT", 0,
+     "Percentage of the state made of zeros (default 50)", 0},
+    {"chunk", 'C', "KB", 0,
+     "Snapshot chunk size for the transfer, 0 for the default (default 0)", 0},
+    {0}};
+
+struct arguments
+{
+    char *dir;
+    int size;
+    int compressibility;
+    int chunk;
+};
+
+static error_t argumentsParse(int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+    switch (key) {
+        case 'd':
+            arguments->dir = arg;
+            break;
+        case 's':
+            arguments->size = atoi(arg);
+            break;
+        case 'c':
+            arguments->compressibility = atoi(arg);
+            break;
+        case 'C':
+            arguments->chunk = atoi(arg);
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Save current time in 'time'. */
+static void timeNow(struct timespec *time)
+{
+    if (clock_gettime(CLOCK_MONOTONIC, time) != 0) {
+        perror("clock_gettime");
+        abort();
+    }
+}
+
+/* Nanoseconds elapsed since 'start'. */
+static long timeSince(struct timespec *start)
+{
+    struct timespec now;
+    timeNow(&now);
+    return (now.tv_sec - start->tv_sec) * 1000 * 1000 * 1000 - start->tv_nsec +
+           now.tv_nsec;
+}
+
+/* Print the time a stage took, its throughput over @size bytes, the longest
+ * time the event loop was blocked during it and the peak RSS so far. */
+static void report(const char *stage, size_t size, long nsecs, long blocked)
+{
+    struct rusage usage;
+    double secs = (double)nsecs / (1000 * 1000 * 1000);
+
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%-16s: %6ld msecs %8.1f MB/s, blocked %6ld msecs, rss %6ld MB\n",
+           stage, nsecs / (1000 * 1000),
+           secs > 0 ? (double)size / (1024 * 1024) / secs : 0.0,
+           blocked / (1000 * 1000), usage.ru_maxrss / 1024);
+}
+
+/* Fill @len bytes of @buf with synthetic state, where @compressibility percent
+ * of each 4K block is zeros and the rest is random. */
+static void stateFill(char *buf, size_t len, int compressibility)
+{
+    size_t block = 4096;
+    size_t random = block * (size_t)(100 - compressibility) / 100;
+    unsigned long x = 88172645463325252UL;
+    size_t i;
+
+    memset(buf, 0, len);
+    for (i = 0; i < len; i++) {
+        if (i % block >= random) {
+            continue;
+        }
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        buf[i] = (char)x;
+    }
+}
+
+/* FSM holding an opaque blob of state, timing snapshots and restores. */
+struct fsm
+{
+    char *state;
+    size_t len;
+    unsigned n_snapshots; /* Number of snapshots taken */
+    long snapshot_ns;     /* Duration of the last snapshot */
+    long restore_ns;      /* Duration of the last restore */
+};
+
+static int fsmApply(struct raft_fsm *fsm,
+                    struct raft_fsm_apply *req,
+                    const struct raft_buffer *buf,
+                    raft_fsm_apply_cb cb)
+{
+    (void)fsm;
+    (void)buf;
+    cb(req, NULL, 0);
+    return 0;
+}
+
+static int fsmSnapshot(struct raft_fsm *fsm,
+                       struct raft_buffer *bufs[],
+                       unsigned *n_bufs)
+{
+    struct fsm *f = fsm->data;
+    struct timespec start;
+
+    timeNow(&start);
+    *bufs = raft_malloc(sizeof **bufs);
+    if (*bufs == NULL) {
+        return RAFT_NOMEM;
+    }
+    (*bufs)[0].len = f->len;
+    (*bufs)[0].base = raft_malloc(f->len);
+    if ((*bufs)[0].base == NULL) {
+        raft_free(*bufs);
+        return RAFT_NOMEM;
+    }
+    memcpy((*bufs)[0].base, f->state, f->len);
+    *n_bufs = 1;
+    f->n_snapshots++;
+    f->snapshot_ns = timeSince(&start);
+    return 0;
+}
+
+static int fsmRestore(struct raft_fsm *fsm, struct raft_buffer *buf)
+{
+    struct fsm *f = fsm->data;
+    struct timespec start;
+
+    timeNow(&start);
+    if (buf->len != f->len) {
+        return RAFT_MALFORMED;
+    }
+    memcpy(f->state, buf->base, buf->len);
+    raft_free(buf->base);
+    f->restore_ns = timeSince(&start);
+    return 0;
+}
+
+static int fsmInit(struct raft_fsm *fsm, struct fsm *f, size_t len)
+{
+    f->state = malloc(len);
+    if (f->state == NULL) {
+        return RAFT_NOMEM;
+    }
+    f->len = len;
+    f->n_snapshots = 0;
+    f->snapshot_ns = 0;
+    f->restore_ns = 0;
+    memset(fsm, 0, sizeof *fsm);
+    fsm->version = 1;
+    fsm->data = f;
+    fsm->apply = fsmApply;
+    fsm->snapshot = fsmSnapshot;
+    fsm->restore = fsmRestore;
+    return 0;
+}
+
+static void fsmClose(struct fsm *f)
+{
+    free(f->state);
+}
+
+/* Timer firing every millisecond, tracking how late the loop runs it. */
+struct monitor
+{
+    uv_timer_t timer;
+    struct timespec last;
+    long max_late; /* Longest delay past the expected firing time */
+};
+
+static void monitorCb(uv_timer_t *timer)
+{
+    struct monitor *m = timer->data;
+    long late = timeSince(&m->last) - 1000 * 1000;
+    if (late > m->max_late) {
+        m->max_late = late;
+    }
+    timeNow(&m->last);
+}
+
+/* The timer is initialized once per loop and reused across stages, since a
+ * closing handle can't be initialized again until its loop has run. */
+static void monitorInit(struct monitor *m, struct uv_loop_s *loop)
+{
+    uv_timer_init(loop, &m->timer);
+    m->timer.data = m;
+}
+
+static void monitorStart(struct monitor *m)
+{
+    m->max_late = 0;
+    timeNow(&m->last);
+    uv_timer_start(&m->timer, monitorCb, 1, 1);
+}
+
+static long monitorStop(struct monitor *m)
+{
+    uv_timer_stop(&m->timer);
+    return m->max_late > 0 ? m->max_late : 0;
+}
+
+/* The close completes when the loop runs, so invoke before backendClose(). */
+static void monitorClose(struct monitor *m)
+{
+    uv_close((uv_handle_t *)&m->timer, NULL);
+}
+
+struct backend
+{
+    struct uv_loop_s loop;
+    struct raft_uv_transport transport;
+    struct raft_io io;
+    bool closed;
+};
+
+static void backendCloseCb(struct raft_io *io)
+{
+    struct backend *b = io->data;
+    b->closed = true;
+}
+
+static int backendInit(struct backend *b, const char *dir, bool compressed)
+{
+    struct raft_snapshot *snapshot;
+    struct raft_entry *entries;
+    raft_index start_index;
+    raft_term term;
+    raft_id voted_for;
+    size_t n;
+    int rv;
+
+    uv_loop_init(&b->loop);
+    rv = raft_uv_tcp_init(&b->transport, &b->loop);
+    if (rv != 0) {
+        return rv;
+    }
+    rv = raft_uv_init(&b->io, &b->loop, dir, &b->transport);
+    if (rv != 0) {
+        printf("raft_uv_init: %s\n", b->io.errmsg);
+        return rv;
+    }
+    rv = raft_uv_set_snapshot_compression(&b->io, compressed);
+    if (rv != 0) {
+        printf("compression not available: %s\n", raft_strerror(rv));
+        return rv;
+    }
+    rv = b->io.init(&b->io, 1);
+    if (rv != 0) {
+        printf("init: %s\n", b->io.errmsg);
+        return rv;
+    }
+    rv = b->io.load(&b->io, &term, &voted_for, &snapshot, &start_index,
+                    &entries, &n);
+    if (rv != 0) {
+        printf("load: %s\n", b->io.errmsg);
+        return rv;
+    }
+    assert(snapshot == NULL && n == 0);
+    b->io.data = b;
+    b->closed = false;
+    return 0;
+}
+
+static void backendClose(struct backend *b)
+{
+    b->io.close(&b->io, true, backendCloseCb);
+    while (!b->closed) {
+        uv_run(&b->loop, UV_RUN_ONCE);
+    }
+    raft_uv_close(&b->io);
+    raft_uv_tcp_close(&b->transport);
+    uv_run(&b->loop, UV_RUN_DEFAULT);
+    uv_loop_close(&b->loop);
+}
+
+struct snapshotResult
+{
+    struct raft_snapshot *snapshot;
+    int status;
+    bool done;
+};
+
+static void putCb(struct raft_io_snapshot_put *req, int status)
+{
+    struct snapshotResult *result = req->data;
+    result->status = status;
+    result->done = true;
+}
+
+static void getCb(struct raft_io_snapshot_get *req,
+                  struct raft_snapshot *snapshot,
+                  int status)
+{
+    struct snapshotResult *result = req->data;
+    result->snapshot = snapshot;
+    result->status = status;
+    result->done = true;
+}
+
+/* Take a snapshot of @f, then store it and load it back, either compressed or
+ * not. */
+static int benchPutGet(const char *dir, struct raft_fsm *fsm, bool compressed)
+{
+    struct fsm *f = fsm->data;
+    struct backend b;
+    struct monitor monitor;
+    struct raft_io_snapshot_put put;
+    struct raft_io_snapshot_get get;
+    struct snapshotResult result;
+    struct raft_snapshot snapshot;
+    struct raft_snapshot *loaded;
+    struct timespec start;
+    char stage[32];
+    unsigned i;
+    int rv;
+
+    rv = backendInit(&b, dir, compressed);
+    if (rv != 0) {
+        return rv;
+    }
+    monitorInit(&monitor, &b.loop);
+
+    memset(&snapshot, 0, sizeof snapshot);
+    snapshot.index = 1;
+    snapshot.term = 1;
+    snapshot.configuration_index = 1;
+    raft_configuration_init(&snapshot.configuration);
+    rv = raft_configuration_add(&snapshot.configuration, 1, RAFT_VOTER);
+    if (rv != 0) {
+        printf("configuration: %s\n", raft_strerror(rv));
+        return rv;
+    }
+
+    timeNow(&start);
+    rv = fsm->snapshot(fsm, &snapshot.bufs, &snapshot.n_bufs);
+    if (rv != 0) {
+        printf("snapshot: %s\n", raft_strerror(rv));
+        return rv;
+    }
+    report("take", f->len, timeSince(&start), f->snapshot_ns);
+
+    snprintf(stage, sizeof stage, "put%s", compressed ? " compressed" : "");
+    monitorStart(&monitor);
+    result.done = false;
+    put.data = &result;
+    timeNow(&start);
+    rv = b.io.snapshot_put(&b.io, 0, &put, &snapshot, putCb);
+    if (rv != 0) {
+        printf("snapshot put: %s\n", b.io.errmsg);
+        return rv;
+    }
+    while (!result.done) {
+        uv_run(&b.loop, UV_RUN_ONCE);
+    }
+    if (result.status != 0) {
+        printf("snapshot put: %s\n", b.io.errmsg);
+        return result.status;
+    }
+    report(stage, f->len, timeSince(&start), monitorStop(&monitor));
+
+    for (i = 0; i < snapshot.n_bufs; i++) {
+        raft_free(snapshot.bufs[i].base);
+    }
+    raft_free(snapshot.bufs);
+    raft_configuration_close(&snapshot.configuration);
+
+    snprintf(stage, sizeof stage, "get%s", compressed ? " compressed" : "");
+    monitorStart(&monitor);
+    result.done = false;
+    get.data = &result;
+    timeNow(&start);
+    rv = b.io.snapshot_get(&b.io, &get, getCb);
+    if (rv != 0) {
+        printf("snapshot get: %s\n", b.io.errmsg);
+        return rv;
+    }
+    while (!result.done) {
+        uv_run(&b.loop, UV_RUN_ONCE);
+    }
+    if (result.status != 0) {
+        printf("snapshot get: %s\n", b.io.errmsg);
+        return result.status;
+    }
+    report(stage, f->len, timeSince(&start), monitorStop(&monitor));
+
+    loaded = result.snapshot;
+    assert(loaded->n_bufs == 1);
+    timeNow(&start);
+    rv = fsm->restore(fsm, &loaded->bufs[0]);
+    if (rv != 0) {
+        printf("restore: %s\n", raft_strerror(rv));
+        return rv;
+    }
+    report("restore", f->len, timeSince(&start), f->restore_ns);
+    raft_free(loaded->bufs);
+    raft_configuration_close(&loaded->configuration);
+    raft_free(loaded);
+
+    monitorClose(&monitor);
+    backendClose(&b);
+    return 0;
+}
+
+static void applyCb(struct raft_apply *req, int status, void *result)
+{
+    (void)status;
+    (void)result;
+    raft_free(req);
+}
+
+/* Step the fixture until @stop returns true, tracking the longest step. */
+static bool stepUntil(struct raft_fixture *f,
+                      bool (*stop)(struct raft_fixture *f, void *arg),
+                      void *arg,
+                      long *blocked)
+{
+    struct timespec start;
+    unsigned i;
+    long ns;
+
+    for (i = 0; i < 100000; i++) {
+        if (stop(f, arg)) {
+            return true;
+        }
+        timeNow(&start);
+        raft_fixture_step(f);
+        ns = timeSince(&start);
+        if (ns > *blocked) {
+            *blocked = ns;
+        }
+    }
+    return false;
+}
+
+static bool hasSnapshot(struct raft_fixture *f, void *arg)
+{
+    (void)arg;
+    return raft_fixture_get(f, 0)->log.snapshot.last_index > 0;
+}
+
+static bool hasInstalled(struct raft_fixture *f, void *arg)
+{
+    raft_index *index = arg;
+    return raft_last_applied(raft_fixture_get(f, 1)) >= *index;
+}
+
+/* Have a leader take a snapshot while a follower is disconnected, then
+ * reconnect the follower and time the InstallSnapshot transfer to it. */
+static int benchTransfer(struct raft_fsm fsms[2], struct arguments *arguments)
+{
+    struct fsm *follower = fsms[1].data;
+    struct raft_fixture f;
+    struct raft_configuration conf;
+    struct raft_buffer buf;
+    struct raft_apply *req;
+    struct raft *leader;
+    struct timespec start;
+    raft_index index;
+    long blocked = 0;
+    int rv;
+
+    rv = raft_fixture_init(&f, 2, fsms);
+    if (rv != 0) {
+        return rv;
+    }
+    rv = raft_fixture_configuration(&f, 1, &conf);
+    if (rv != 0) {
+        printf("configuration: %s\n", raft_strerror(rv));
+        return rv;
+    }
+    rv = raft_fixture_bootstrap(&f, &conf);
+    raft_configuration_close(&conf);
+    if (rv != 0) {
+        printf("bootstrap: %s\n", raft_strerror(rv));
+        return rv;
+    }
+    raft_fixture_disconnect(&f, 0, 1);
+    raft_fixture_disconnect(&f, 1, 0);
+
+    /* Being the only voter, the first server becomes leader right away. */
+    rv = raft_fixture_start(&f);
+    if (rv != 0) {
+        printf("start: %s\n", raft_strerror(rv));
+        return rv;
+    }
+    leader = raft_fixture_get(&f, 0);
+    assert(raft_state(leader) == RAFT_LEADER);
+    raft_set_snapshot_threshold(leader, 1);
+    raft_set_snapshot_trailing(leader, 0);
+    if (arguments->chunk > 0) {
+        raft_set_snapshot_chunk_size(leader,
+                                     (unsigned)arguments->chunk * 1024);
+    }
+
+    req = raft_malloc(sizeof *req);
+    buf.len = 8;
+    buf.base = raft_entry_malloc(buf.len);
+    assert(req != NULL && buf.base != NULL);
+    memset(buf.base, 0, buf.len);
+    rv = raft_apply(leader, req, &buf, 1, applyCb);
+    if (rv != 0) {
+        printf("apply: %s\n", raft_strerror(rv));
+        return rv;
+    }
+    index = raft_last_index(leader);
+    if (!stepUntil(&f, hasSnapshot, NULL, &blocked)) {
+        printf("no snapshot taken\n");
+        return RAFT_IOERR;
+    }
+
+    blocked = 0;
+    raft_fixture_reconnect(&f, 0, 1);
+    raft_fixture_reconnect(&f, 1, 0);
+    timeNow(&start);
+    if (!stepUntil(&f, hasInstalled, &index, &blocked)) {
+        printf("snapshot not installed\n");
+        return RAFT_IOERR;
+    }
+    report("transfer", follower->len, timeSince(&start), blocked);
+    report("install", follower->len, follower->restore_ns,
+           follower->restore_ns);
+
+    raft_fixture_close(&f);
+    return 0;
+}
+
+/* Remove all files in @dir and @dir itself. */
+static void removeDir(const char *dir)
+{
+    char path[PATH_MAX];
+    struct dirent *e;
+    DIR *d;
+
+    d = opendir(dir);
+    assert(d != NULL);
+    while ((e = readdir(d)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
+            continue;
+        }
+        if (snprintf(path, sizeof path, "%s/%s", dir, e->d_name) >=
+            (int)sizeof path) {
+            continue;
+        }
+        unlink(path);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+/* Run the put and get stages in a fresh directory. */
+static int benchStorage(struct raft_fsm *fsm,
+                        struct arguments *arguments,
+                        bool compressed)
+{
+    char dir[PATH_MAX];
+    int rv;
+
+    if (snprintf(dir, sizeof dir, "%s/raft-snapshot-XXXXXX", arguments->dir) >=
+        (int)sizeof dir) {
+        printf("directory path too long\n");
+        return -1;
+    }
+    if (mkdtemp(dir) == NULL) {
+        printf("mkdtemp: %s\n", strerror(errno));
+        return -1;
+    }
+    rv = benchPutGet(dir, fsm, compressed);
+    removeDir(dir);
+    return rv;
+}
+
+int main(int argc, char *argv[])
+{
+    struct argp argp = {options, argumentsParse, NULL, doc, 0, 0, 0};
+    struct arguments arguments;
+    struct raft_fsm fsms[2];
+    struct fsm state[2];
+    size_t len;
+    int rv;
+
+    arguments.dir = "/tmp";
+    arguments.size = 64;
+    arguments.compressibility = 50;
+    arguments.chunk = 0;
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    if (arguments.size <= 0 || arguments.compressibility < 0 ||
+        arguments.compressibility > 100 || arguments.chunk < 0) {
+        printf("size must be positive and compressibility within 0-100\n");
+        return -1;
+    }
+
+    len = (size_t)arguments.size * 1024 * 1024;
+    rv = fsmInit(&fsms[0], &state[0], len);
+    if (rv == 0) {
+        rv = fsmInit(&fsms[1], &state[1], len);
+    }
+    if (rv != 0) {
+        printf("fsm: %s\n", raft_strerror(rv));
+        return rv;
+    }
+    stateFill(state[0].state, len, arguments.compressibility);
+    memset(state[1].state, 0, len);
+
+    rv = benchStorage(&fsms[0], &arguments, false);
+    if (rv == 0) {
+        rv = benchStorage(&fsms[0], &arguments, true);
+        if (rv == RAFT_INVALID) {
+            /* Built without compression support. */
+            rv = 0;
+        }
+    }
+    if (rv == 0) {
+        rv = benchTransfer(fsms, &arguments);
+    }
+
+    fsmClose(&state[0]);
+    fsmClose(&state[1]);
+    return rv;
+}
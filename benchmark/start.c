@@ -0,0 +1,593 @@
+#include <argp.h>
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "../include/raft.h"
+#include "../include/raft/uv.h"
+#include "../src/byte.h"
+
+static char doc[] =
+    "Benchmark the cold start of a server using the libuv raft_io backend, "
+    "against a synthetic data directory";
+
+/* Order of fields: {NAME, KEY, ARG, FLAGS, DOC, GROUP}.*/
+static struct argp_option options[] = {
+    {"dir", 'd', "DIR", 0, "Directory to use for temp files (default /tmp)", 0},
+    {"size", 's', "MB", 0, "Megabytes of entries in the log (default 256)", 0},
+    {"segment", 'S', "MB", 0, "Segment size in megabytes (default 8)", 0},
+    {"min", 'm', "BYTES", 0, "Minimum entry payload size (default 64)", 0},
+    {"max", 'M', "BYTES", 0, "Maximum entry payload size (default 4096)", 0},
+    {"batch", 'B', "N", 0, "Entries per append request (default 16)", 0},
+    {"snapshot", 'z', "MB", 0, "Snapshot size in megabytes (default 0)", 0},
+    {"compress", 'c', NULL, 0, "Compress the snapshot", 0},
+    {0}};
+
+struct arguments
+{
+    char *dir;
+    int size;
+    int segment;
+    int min;
+    int max;
+    int batch;
+    int snapshot;
+    bool compress;
+};
+
+static error_t argumentsParse(int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+    switch (key) {
+        case 'd':
+            arguments->dir = arg;
+            break;
+        case 's':
+            arguments->size = atoi(arg);
+            break;
+        case 'S':
+            arguments->segment = atoi(arg);
+            break;
+        case 'm':
+            arguments->min = atoi(arg);
+            break;
+        case 'M':
+            arguments->max = atoi(arg);
+            break;
+        case 'B':
+            arguments->batch = atoi(arg);
+            break;
+        case 'z':
+            arguments->snapshot = atoi(arg);
+            break;
+        case 'c':
+            arguments->compress = true;
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Save current time in 'time'. */
+static void timeNow(struct timespec *time)
+{
+    if (clock_gettime(CLOCK_MONOTONIC, time) != 0) {
+        perror("clock_gettime");
+        abort();
+    }
+}
+
+/* Nanoseconds elapsed since 'start'. */
+static long timeSince(struct timespec *start)
+{
+    struct timespec now;
+    timeNow(&now);
+    return (now.tv_sec - start->tv_sec) * 1000 * 1000 * 1000 - start->tv_nsec +
+           now.tv_nsec;
+}
+
+static void report(const char *stage, unsigned long long nsecs)
+{
+    printf("%-8s: %8.1f msecs\n", stage, (double)nsecs / (1000 * 1000));
+}
+
+/* Transport that neither listens nor connects, since starting a single server
+ * doesn't need any network. */
+static int transportInit(struct raft_uv_transport *t,
+                         raft_id id,
+                         const char *address)
+{
+    (void)t;
+    (void)id;
+    (void)address;
+    return 0;
+}
+
+static int transportListen(struct raft_uv_transport *t, raft_uv_accept_cb cb)
+{
+    (void)t;
+    (void)cb;
+    return 0;
+}
+
+static int transportConnect(struct raft_uv_transport *t,
+                            struct raft_uv_connect *req,
+                            raft_id id,
+                            const char *address,
+                            raft_uv_connect_cb cb)
+{
+    (void)t;
+    (void)req;
+    (void)id;
+    (void)address;
+    (void)cb;
+    return RAFT_NOCONNECTION;
+}
+
+static void transportClose(struct raft_uv_transport *t,
+                           raft_uv_transport_close_cb cb)
+{
+    cb(t);
+}
+
+struct backend
+{
+    struct uv_loop_s loop;
+    struct raft_uv_transport transport;
+    struct raft_io io;
+    bool closed;
+};
+
+static void backendCloseCb(struct raft_io *io)
+{
+    struct backend *b = io->data;
+    b->closed = true;
+}
+
+static int backendInit(struct backend *b,
+                       const char *dir,
+                       struct arguments *arguments)
+{
+    int rv;
+
+    uv_loop_init(&b->loop);
+    memset(&b->transport, 0, sizeof b->transport);
+    b->transport.init = transportInit;
+    b->transport.listen = transportListen;
+    b->transport.connect = transportConnect;
+    b->transport.close = transportClose;
+    rv = raft_uv_init(&b->io, &b->loop, dir, &b->transport);
+    if (rv != 0) {
+        printf("raft_uv_init: %s\n", b->io.errmsg);
+        return rv;
+    }
+    raft_uv_set_segment_size(&b->io,
+                             (size_t)arguments->segment * 1024 * 1024);
+    rv = raft_uv_set_snapshot_compression(&b->io, arguments->compress);
+    if (rv != 0) {
+        printf("compression not available: %s\n", raft_strerror(rv));
+        return rv;
+    }
+    rv = b->io.init(&b->io, 1);
+    if (rv != 0) {
+        printf("init: %s\n", b->io.errmsg);
+        return rv;
+    }
+    b->io.data = b;
+    b->closed = false;
+    return 0;
+}
+
+/* Release everything returned by raft_io->load. */
+static void loadRelease(struct raft_snapshot *snapshot,
+                        struct raft_entry *entries,
+                        size_t n)
+{
+    void *batch = NULL;
+    unsigned i;
+    size_t j;
+
+    if (snapshot != NULL) {
+        raft_configuration_close(&snapshot->configuration);
+        for (i = 0; i < snapshot->n_bufs; i++) {
+            raft_free(snapshot->bufs[i].base);
+        }
+        raft_free(snapshot->bufs);
+        raft_free(snapshot);
+    }
+    for (j = 0; j < n; j++) {
+        if (entries[j].batch != batch) {
+            batch = entries[j].batch;
+            raft_free(batch);
+        }
+    }
+    raft_free(entries);
+}
+
+static int backendLoad(struct backend *b, raft_index *last_index)
+{
+    struct raft_snapshot *snapshot;
+    struct raft_entry *entries;
+    raft_index start_index;
+    raft_term term;
+    raft_id voted_for;
+    size_t n;
+    int rv;
+
+    rv = b->io.load(&b->io, &term, &voted_for, &snapshot, &start_index,
+                    &entries, &n);
+    if (rv != 0) {
+        printf("load: %s\n", b->io.errmsg);
+        return rv;
+    }
+    *last_index = start_index + n - 1;
+    loadRelease(snapshot, entries, n);
+    return 0;
+}
+
+static void backendClose(struct backend *b)
+{
+    b->io.close(&b->io, true, backendCloseCb);
+    while (!b->closed) {
+        uv_run(&b->loop, UV_RUN_ONCE);
+    }
+    raft_uv_close(&b->io);
+    uv_run(&b->loop, UV_RUN_DEFAULT);
+    uv_loop_close(&b->loop);
+}
+
+struct result
+{
+    int status;
+    bool done;
+};
+
+static void appendCb(struct raft_io_append *req, int status)
+{
+    struct result *result = req->data;
+    result->status = status;
+    result->done = true;
+}
+
+static void snapshotPutCb(struct raft_io_snapshot_put *req, int status)
+{
+    struct result *result = req->data;
+    result->status = status;
+    result->done = true;
+}
+
+/* Append entries with payload sizes spread uniformly between the minimum and
+ * maximum, until the log holds the requested amount of data. Sizes are rounded
+ * up to a multiple of 8 bytes, as required by the segment format. */
+static int generateEntries(struct backend *b,
+                           struct arguments *arguments,
+                           raft_index *last_index)
+{
+    struct raft_io_append req;
+    struct raft_entry *entries;
+    struct result result;
+    size_t total = (size_t)arguments->size * 1024 * 1024;
+    size_t written = 0;
+    unsigned seed = 1;
+    char *payload;
+    int i;
+    int rv;
+
+    payload = malloc(bytePad64((size_t)arguments->max));
+    entries = calloc((size_t)arguments->batch, sizeof *entries);
+    assert(payload != NULL && entries != NULL);
+    memset(payload, 'x', bytePad64((size_t)arguments->max));
+
+    while (written < total) {
+        for (i = 0; i < arguments->batch; i++) {
+            entries[i].term = 1;
+            entries[i].type = RAFT_COMMAND;
+            entries[i].buf.base = payload;
+            entries[i].buf.len = bytePad64(
+                (size_t)(arguments->min +
+                         rand_r(&seed) % (arguments->max - arguments->min + 1)));
+            written += entries[i].buf.len;
+        }
+        result.done = false;
+        req.data = &result;
+        rv = b->io.append(&b->io, &req, entries, (unsigned)arguments->batch,
+                          appendCb);
+        if (rv != 0) {
+            printf("append: %s\n", b->io.errmsg);
+            return rv;
+        }
+        while (!result.done) {
+            uv_run(&b->loop, UV_RUN_ONCE);
+        }
+        if (result.status != 0) {
+            printf("append: %s\n", b->io.errmsg);
+            return result.status;
+        }
+        *last_index += (raft_index)arguments->batch;
+    }
+    while (raft_uv_finalize_queue_len(&b->io) > 0) {
+        uv_run(&b->loop, UV_RUN_ONCE);
+    }
+
+    free(entries);
+    free(payload);
+    return 0;
+}
+
+/* Store a snapshot at the last index, keeping all entries. */
+static int generateSnapshot(struct backend *b,
+                            struct arguments *arguments,
+                            raft_index last_index)
+{
+    struct raft_io_snapshot_put req;
+    struct raft_snapshot snapshot;
+    struct raft_buffer buf;
+    struct result result;
+    unsigned seed = 1;
+    size_t i;
+    int rv;
+
+    buf.len = (size_t)arguments->snapshot * 1024 * 1024;
+    buf.base = malloc(buf.len);
+    assert(buf.base != NULL);
+    /* Half random, so compression has something to do. */
+    for (i = 0; i < buf.len; i++) {
+        ((char *)buf.base)[i] = i % 2 == 0 ? (char)rand_r(&seed) : 0;
+    }
+
+    memset(&snapshot, 0, sizeof snapshot);
+    snapshot.index = last_index;
+    snapshot.term = 1;
+    snapshot.configuration_index = 1;
+    raft_configuration_init(&snapshot.configuration);
+    rv = raft_configuration_add(&snapshot.configuration, 1, RAFT_VOTER);
+    if (rv != 0) {
+        printf("configuration: %s\n", raft_strerror(rv));
+        return rv;
+    }
+    snapshot.bufs = &buf;
+    snapshot.n_bufs = 1;
+
+    result.done = false;
+    req.data = &result;
+    rv = b->io.snapshot_put(&b->io, (unsigned)last_index, &req, &snapshot,
+                            snapshotPutCb);
+    if (rv != 0) {
+        printf("snapshot put: %s\n", b->io.errmsg);
+        return rv;
+    }
+    while (!result.done) {
+        uv_run(&b->loop, UV_RUN_ONCE);
+    }
+    if (result.status != 0) {
+        printf("snapshot put: %s\n", b->io.errmsg);
+        return result.status;
+    }
+
+    raft_configuration_close(&snapshot.configuration);
+    free(buf.base);
+    return 0;
+}
+
+/* Create a data directory with a bootstrapped log, the requested amount of
+ * entries and optionally a snapshot, using the backend's own writers. */
+static int generate(const char *dir, struct arguments *arguments)
+{
+    struct backend b;
+    struct raft_configuration conf;
+    struct timespec start;
+    raft_index last_index;
+    int rv;
+
+    timeNow(&start);
+    rv = backendInit(&b, dir, arguments);
+    if (rv != 0) {
+        return rv;
+    }
+    rv = backendLoad(&b, &last_index);
+    if (rv != 0) {
+        return rv;
+    }
+    raft_configuration_init(&conf);
+    rv = raft_configuration_add(&conf, 1, RAFT_VOTER);
+    if (rv != 0) {
+        printf("configuration: %s\n", raft_strerror(rv));
+        return rv;
+    }
+    rv = b.io.bootstrap(&b.io, &conf);
+    raft_configuration_close(&conf);
+    if (rv != 0) {
+        printf("bootstrap: %s\n", b.io.errmsg);
+        return rv;
+    }
+    backendClose(&b);
+
+    rv = backendInit(&b, dir, arguments);
+    if (rv != 0) {
+        return rv;
+    }
+    rv = backendLoad(&b, &last_index);
+    if (rv != 0) {
+        return rv;
+    }
+    rv = generateEntries(&b, arguments, &last_index);
+    if (rv != 0) {
+        return rv;
+    }
+    if (arguments->snapshot > 0) {
+        rv = generateSnapshot(&b, arguments, last_index);
+        if (rv != 0) {
+            return rv;
+        }
+    }
+    backendClose(&b);
+
+    printf("%-8s: %llu entries in %ld msecs\n", "generate", last_index,
+           timeSince(&start) / (1000 * 1000));
+    return 0;
+}
+
+static int fsmApply(struct raft_fsm *fsm,
+                    struct raft_fsm_apply *req,
+                    const struct raft_buffer *buf,
+                    raft_fsm_apply_cb cb)
+{
+    (void)fsm;
+    (void)buf;
+    cb(req, NULL, 0);
+    return 0;
+}
+
+static int fsmRestore(struct raft_fsm *fsm, struct raft_buffer *buf)
+{
+    (void)fsm;
+    raft_free(buf->base);
+    return 0;
+}
+
+static void closeCb(struct raft *r)
+{
+    struct backend *b = r->data;
+    b->closed = true;
+}
+
+/* Time a cold start of a server on the data directory. */
+static int benchStart(const char *dir, struct arguments *arguments)
+{
+    struct backend b;
+    struct raft_fsm fsm;
+    struct raft_uv_load_stats stats;
+    struct timespec start;
+    struct rusage usage;
+    struct raft raft;
+    long init;
+    long total;
+    int rv;
+
+    memset(&fsm, 0, sizeof fsm);
+    fsm.version = 1;
+    fsm.apply = fsmApply;
+    fsm.restore = fsmRestore;
+
+    timeNow(&start);
+    rv = backendInit(&b, dir, arguments);
+    if (rv != 0) {
+        return rv;
+    }
+    rv = raft_init(&raft, &b.io, &fsm, 1);
+    if (rv != 0) {
+        printf("raft_init: %s\n", raft_errmsg(&raft));
+        return rv;
+    }
+    raft.data = &b;
+    init = timeSince(&start);
+    rv = raft_start(&raft);
+    if (rv != 0) {
+        printf("raft_start: %s\n", raft_errmsg(&raft));
+        return rv;
+    }
+    total = timeSince(&start);
+
+    raft_uv_load_stats(&b.io, &stats);
+    report("init", (unsigned long long)init);
+    report("list", stats.list);
+    report("snapshot", stats.snapshot);
+    report("read", stats.read);
+    report("crc", stats.crc);
+    report("decode", stats.decode);
+    report("load", stats.total);
+    report("restore", (unsigned long long)(total - init) - stats.total);
+    report("total", (unsigned long long)total);
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%-8s: %u segments, %llu MB read, peak rss %ld MB\n", "usage",
+           stats.n_segments, stats.bytes_read >> 20, usage.ru_maxrss / 1024);
+
+    b.closed = false;
+    raft_close(&raft, true, closeCb);
+    while (!b.closed) {
+        uv_run(&b.loop, UV_RUN_ONCE);
+    }
+    raft_uv_close(&b.io);
+    uv_run(&b.loop, UV_RUN_DEFAULT);
+    uv_loop_close(&b.loop);
+    return 0;
+}
+
+/* Remove all files in @dir and @dir itself. */
+static void removeDir(const char *dir)
+{
+    char path[PATH_MAX];
+    struct dirent *e;
+    DIR *d;
+
+    d = opendir(dir);
+    assert(d != NULL);
+    while ((e = readdir(d)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
+            continue;
+        }
+        if (snprintf(path, sizeof path, "%s/%s", dir, e->d_name) >=
+            (int)sizeof path) {
+            continue;
+        }
+        unlink(path);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+int main(int argc, char *argv[])
+{
+    struct argp argp = {options, argumentsParse, NULL, doc, 0, 0, 0};
+    struct arguments arguments;
+    char dir[PATH_MAX];
+    int rv;
+
+    arguments.dir = "/tmp";
+    arguments.size = 256;
+    arguments.segment = 8;
+    arguments.min = 64;
+    arguments.max = 4096;
+    arguments.batch = 16;
+    arguments.snapshot = 0;
+    arguments.compress = false;
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    if (arguments.size <= 0 || arguments.segment <= 0 || arguments.min <= 0 ||
+        arguments.max <= 0 || arguments.batch <= 0 || arguments.snapshot < 0) {
+        printf("sizes and batch must be positive\n");
+        return -1;
+    }
+    if (arguments.min > arguments.max) {
+        printf("minimum payload size exceeds the maximum\n");
+        return -1;
+    }
+
+    if (snprintf(dir, sizeof dir, "%s/raft-start-XXXXXX", arguments.dir) >=
+        (int)sizeof dir) {
+        printf("directory path too long\n");
+        return -1;
+    }
+    if (mkdtemp(dir) == NULL) {
+        printf("mkdtemp: %s\n", strerror(errno));
+        return -1;
+    }
+
+    rv = generate(dir, &arguments);
+    if (rv == 0) {
+        rv = benchStart(dir, &arguments);
+    }
+
+    removeDir(dir);
+    return rv;
+}
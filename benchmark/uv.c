@@ -0,0 +1,471 @@
+#include <argp.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "../include/raft.h"
+#include "../include/raft/uv.h"
+
+static char doc[] =
+    "Benchmark the libuv raft_io backend, its page-cache policy and its "
+    "durability modes";
+
+/* Order of fields: {NAME, KEY, ARG, FLAGS, DOC, GROUP}.*/
+static struct argp_option options[] = {
+    {"dir", 'd', "DIR", 0, "Directory to use for temp files (default /tmp)", 0},
+    {"size", 's', "MB", 0, "Megabytes of entries to append (default 256)", 0},
+    {"buf", 'b', "BUF", 0, "Entry payload size (default 4096)", 0},
+    {"batch", 'B', "N", 0, "Entries per append request (default 16)", 0},
+    {"segment", 'S', "MB", 0, "Segment size in megabytes (default 8)", 0},
+    {"drop-behind", 'D', NULL, 0, "Drop segments from the page cache", 0},
+    {"readahead", 'r', "BYTES", OPTION_ARG_OPTIONAL,
+     "Prefetch segments when loading, up to BYTES each (default all)", 0},
+    {"relaxed", 'R', "MSECS", OPTION_ARG_OPTIONAL,
+     "Also append in relaxed durability mode, syncing every MSECS (default 10)",
+     0},
+    {0}};
+
+struct arguments
+{
+    char *dir;
+    int size;
+    int buf;
+    int batch;
+    int segment;
+    unsigned policy;
+    size_t readahead;
+    unsigned sync_interval; /* Relaxed mode sync interval, 0 to skip it */
+};
+
+static error_t argumentsParse(int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+    switch (key) {
+        case 'd':
+            arguments->dir = arg;
+            break;
+        case 's':
+            arguments->size = atoi(arg);
+            break;
+        case 'b':
+            arguments->buf = atoi(arg);
+            break;
+        case 'B':
+            arguments->batch = atoi(arg);
+            break;
+        case 'S':
+            arguments->segment = atoi(arg);
+            break;
+        case 'D':
+            arguments->policy |= RAFT_UV_DROP_BEHIND;
+            break;
+        case 'r':
+            arguments->policy |= RAFT_UV_READAHEAD;
+            arguments->readahead = arg != NULL ? (size_t)atol(arg) : 0;
+            break;
+        case 'R':
+            arguments->sync_interval = arg != NULL ? (unsigned)atoi(arg) : 10;
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Save current time in 'time'. */
+static void timeNow(struct timespec *time)
+{
+    if (clock_gettime(CLOCK_MONOTONIC, time) != 0) {
+        perror("clock_gettime");
+        abort();
+    }
+}
+
+/* Nanoseconds elapsed since 'start'. */
+static long timeSince(struct timespec *start)
+{
+    struct timespec now;
+    timeNow(&now);
+    return (now.tv_sec - start->tv_sec) * 1000 * 1000 * 1000 - start->tv_nsec +
+           now.tv_nsec;
+}
+
+/* Sum the pages of all closed segments in @dir and how many of them are
+ * resident in the page cache. */
+static int residency(const char *dir, size_t *resident, size_t *total)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    unsigned long long first;
+    unsigned long long last;
+    char path[PATH_MAX];
+    struct dirent *e;
+    struct stat st;
+    unsigned char *vec;
+    void *addr;
+    size_t n;
+    size_t i;
+    DIR *d;
+    int fd;
+
+    *resident = 0;
+    *total = 0;
+    d = opendir(dir);
+    if (d == NULL) {
+        perror("opendir");
+        return -1;
+    }
+    while ((e = readdir(d)) != NULL) {
+        if (sscanf(e->d_name, "%llu-%llu", &first, &last) != 2) {
+            continue;
+        }
+        if (snprintf(path, sizeof path, "%s/%s", dir, e->d_name) >=
+            (int)sizeof path) {
+            continue;
+        }
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            perror("open");
+            goto err;
+        }
+        if (fstat(fd, &st) != 0) {
+            perror("fstat");
+            goto err_after_open;
+        }
+        if (st.st_size == 0) {
+            close(fd);
+            continue;
+        }
+        n = ((size_t)st.st_size + (size_t)page - 1) / (size_t)page;
+        addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            perror("mmap");
+            goto err_after_open;
+        }
+        vec = malloc(n);
+        if (vec == NULL) {
+            perror("malloc");
+            goto err_after_mmap;
+        }
+        if (mincore(addr, (size_t)st.st_size, vec) != 0) {
+            perror("mincore");
+            goto err_after_malloc;
+        }
+        for (i = 0; i < n; i++) {
+            *resident += vec[i] & 1;
+        }
+        *total += n;
+        free(vec);
+        munmap(addr, (size_t)st.st_size);
+        close(fd);
+    }
+    closedir(d);
+    return 0;
+
+err_after_malloc:
+    free(vec);
+err_after_mmap:
+    munmap(addr, (size_t)st.st_size);
+err_after_open:
+    close(fd);
+err:
+    closedir(d);
+    return -1;
+}
+
+static void reportResidency(const char *phase, const char *dir)
+{
+    size_t resident;
+    size_t total;
+    if (residency(dir, &resident, &total) != 0) {
+        return;
+    }
+    printf("%-8s: %zu of %zu segment pages in page cache (%.1f%%)\n", phase,
+           resident, total, total > 0 ? 100.0 * (double)resident / (double)total
+                                      : 0.0);
+}
+
+struct backend
+{
+    struct uv_loop_s loop;
+    struct raft_uv_transport transport;
+    struct raft_io io;
+    bool closed;
+};
+
+static void backendCloseCb(struct raft_io *io)
+{
+    struct backend *b = io->data;
+    b->closed = true;
+}
+
+static int backendInit(struct backend *b,
+                       const char *dir,
+                       struct arguments *arguments,
+                       int mode)
+{
+    int rv;
+
+    uv_loop_init(&b->loop);
+    rv = raft_uv_tcp_init(&b->transport, &b->loop);
+    if (rv != 0) {
+        return rv;
+    }
+    rv = raft_uv_init(&b->io, &b->loop, dir, &b->transport);
+    if (rv != 0) {
+        printf("raft_uv_init: %s\n", b->io.errmsg);
+        return rv;
+    }
+    raft_uv_set_segment_size(&b->io,
+                             (size_t)arguments->segment * 1024 * 1024);
+    raft_uv_set_page_cache_policy(&b->io, arguments->policy,
+                                  arguments->readahead);
+    rv = raft_uv_set_durability(&b->io, mode, arguments->sync_interval, 0);
+    if (rv != 0) {
+        printf("set durability: %s\n", raft_strerror(rv));
+        return rv;
+    }
+    rv = b->io.init(&b->io, 1);
+    if (rv != 0) {
+        printf("init: %s\n", b->io.errmsg);
+        return rv;
+    }
+    b->io.data = b;
+    b->closed = false;
+    return 0;
+}
+
+static void backendClose(struct backend *b)
+{
+    b->io.close(&b->io, true, backendCloseCb);
+    while (!b->closed) {
+        uv_run(&b->loop, UV_RUN_ONCE);
+    }
+    raft_uv_close(&b->io);
+    raft_uv_tcp_close(&b->transport);
+    uv_run(&b->loop, UV_RUN_DEFAULT);
+    uv_loop_close(&b->loop);
+}
+
+struct appendResult
+{
+    int status;
+    bool done;
+};
+
+static void appendCb(struct raft_io_append *req, int status)
+{
+    struct appendResult *result = req->data;
+    result->status = status;
+    result->done = true;
+}
+
+/* Append entries using the given durability mode. In relaxed mode, also report
+ * how long it takes for all of them to be synced. */
+static int benchAppend(const char *dir, struct arguments *arguments, int mode)
+{
+    const char *phase = mode == RAFT_UV_RELAXED ? "relaxed" : "append";
+    struct backend b;
+    struct raft_io_append req;
+    struct appendResult result;
+    struct raft_entry *entries;
+    struct timespec start;
+    size_t total = (size_t)arguments->size * 1024 * 1024;
+    size_t per_append = (size_t)arguments->buf * (size_t)arguments->batch;
+    size_t n = total / per_append;
+    void *payload;
+    size_t i;
+    int rv;
+
+    rv = backendInit(&b, dir, arguments, mode);
+    if (rv != 0) {
+        return rv;
+    }
+
+    payload = malloc((size_t)arguments->buf);
+    entries = calloc((size_t)arguments->batch, sizeof *entries);
+    if (payload == NULL || entries == NULL) {
+        printf("append: out of memory\n");
+        backendClose(&b);
+        free(entries);
+        free(payload);
+        return RAFT_NOMEM;
+    }
+    memset(payload, 'x', (size_t)arguments->buf);
+    for (i = 0; i < (size_t)arguments->batch; i++) {
+        entries[i].term = 1;
+        entries[i].type = RAFT_COMMAND;
+        entries[i].buf.base = payload;
+        entries[i].buf.len = (size_t)arguments->buf;
+    }
+
+    timeNow(&start);
+    for (i = 0; i < n; i++) {
+        result.done = false;
+        req.data = &result;
+        rv = b.io.append(&b.io, &req, entries, (unsigned)arguments->batch,
+                         appendCb);
+        if (rv != 0) {
+            printf("append: %s\n", b.io.errmsg);
+            return rv;
+        }
+        while (!result.done) {
+            uv_run(&b.loop, UV_RUN_ONCE);
+        }
+        if (result.status != 0) {
+            printf("append: %s\n", b.io.errmsg);
+            return result.status;
+        }
+    }
+    while (raft_uv_finalize_queue_len(&b.io) > 0) {
+        uv_run(&b.loop, UV_RUN_ONCE);
+    }
+    printf("%-8s: %zu MB in %ld msecs\n", phase, n * per_append >> 20,
+           timeSince(&start) / (1000 * 1000));
+    if (mode == RAFT_UV_RELAXED) {
+        while (b.io.durable_index(&b.io) < n * (size_t)arguments->batch) {
+            uv_run(&b.loop, UV_RUN_ONCE);
+        }
+        printf("%-8s: %zu MB in %ld msecs\n", "durable", n * per_append >> 20,
+               timeSince(&start) / (1000 * 1000));
+    }
+
+    backendClose(&b);
+    free(entries);
+    free(payload);
+    reportResidency(phase, dir);
+    return 0;
+}
+
+static int benchLoad(const char *dir, struct arguments *arguments)
+{
+    struct backend b;
+    struct raft_snapshot *snapshot;
+    struct raft_entry *entries;
+    struct timespec start;
+    raft_index start_index;
+    raft_term term;
+    raft_id voted_for;
+    void *batch = NULL;
+    size_t n;
+    size_t i;
+    int rv;
+
+    rv = backendInit(&b, dir, arguments, RAFT_UV_DURABLE);
+    if (rv != 0) {
+        return rv;
+    }
+
+    timeNow(&start);
+    rv = b.io.load(&b.io, &term, &voted_for, &snapshot, &start_index,
+                   &entries, &n);
+    if (rv != 0) {
+        printf("load: %s\n", b.io.errmsg);
+        return rv;
+    }
+    printf("%-8s: %zu entries in %ld msecs\n", "load", n,
+           timeSince(&start) / (1000 * 1000));
+
+    for (i = 0; i < n; i++) {
+        if (entries[i].batch != batch) {
+            batch = entries[i].batch;
+            raft_free(batch);
+        }
+    }
+    raft_free(entries);
+
+    backendClose(&b);
+    reportResidency("load", dir);
+    return 0;
+}
+
+/* Remove all files in @dir and @dir itself. */
+static void removeDir(const char *dir)
+{
+    char path[PATH_MAX];
+    struct dirent *e;
+    DIR *d;
+
+    d = opendir(dir);
+    if (d == NULL) {
+        perror("opendir");
+        return;
+    }
+    while ((e = readdir(d)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
+            continue;
+        }
+        if (snprintf(path, sizeof path, "%s/%s", dir, e->d_name) >=
+            (int)sizeof path) {
+            continue;
+        }
+        unlink(path);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+int main(int argc, char *argv[])
+{
+    struct argp argp = {options, argumentsParse, NULL, doc, 0, 0, 0};
+    struct arguments arguments;
+    char dir[PATH_MAX];
+    int rv;
+
+    arguments.dir = "/tmp";
+    arguments.size = 256;
+    arguments.buf = 4096;
+    arguments.batch = 16;
+    arguments.segment = 8;
+    arguments.policy = 0;
+    arguments.readahead = 0;
+    arguments.sync_interval = 0;
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    if (arguments.size <= 0 || arguments.buf <= 0 || arguments.batch <= 0 ||
+        arguments.segment <= 0) {
+        printf("sizes and batch must be positive\n");
+        return -1;
+    }
+
+    if (snprintf(dir, sizeof dir, "%s/raft-uv-XXXXXX", arguments.dir) >=
+        (int)sizeof dir) {
+        printf("directory path too long\n");
+        return -1;
+    }
+    if (mkdtemp(dir) == NULL) {
+        printf("mkdtemp: %s\n", strerror(errno));
+        return -1;
+    }
+
+    rv = benchAppend(dir, &arguments, RAFT_UV_DURABLE);
+    if (rv == 0) {
+        rv = benchLoad(dir, &arguments);
+    }
+    removeDir(dir);
+    if (rv != 0 || arguments.sync_interval == 0) {
+        return rv;
+    }
+
+    if (snprintf(dir, sizeof dir, "%s/raft-uv-XXXXXX", arguments.dir) >=
+        (int)sizeof dir) {
+        printf("directory path too long\n");
+        return -1;
+    }
+    if (mkdtemp(dir) == NULL) {
+        printf("mkdtemp: %s\n", strerror(errno));
+        return -1;
+    }
+    rv = benchAppend(dir, &arguments, RAFT_UV_RELAXED);
+    removeDir(dir);
+    return rv;
+}
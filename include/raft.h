@@ -180,9 +180,56 @@ RAFT_API unsigned long long raft_digest(const char *text, unsigned long long n);
 enum {
     RAFT_COMMAND = 1, /* Command for the application FSM. */
     RAFT_BARRIER,     /* Wait for all previous commands to be applied. */
-    RAFT_CHANGE       /* Raft configuration change. */
+    RAFT_CHANGE,      /* Raft configuration change. */
+    RAFT_SEGMENTS,    /* Command made of multiple buffers, see below. */
+    RAFT_PACKED       /* Several commands packed together, see below. */
 };
 
+/**
+ * Data of a #RAFT_SEGMENTS entry.
+ *
+ * Such entries only exist in the in-memory log of the leader that created them
+ * via raft_apply_segments(): the @buf attribute of the entry points to this
+ * structure and its @len is the total size of the command data. The entry is
+ * written to disk and sent to other servers as a regular #RAFT_COMMAND entry
+ * whose data is the concatenation of the segments.
+ */
+struct raft_segments
+{
+    unsigned n;                /* Number of segments. */
+    struct raft_buffer bufs[]; /* Command data, in order. */
+};
+
+/**
+ * Iterator over the commands of a #RAFT_PACKED entry.
+ *
+ * A leader configured with raft_set_pack() packs small commands submitted
+ * while its previous entries are still being written into a single entry. The
+ * data of such an entry is the number of commands as a 64-bit little endian
+ * integer, followed by each command as its 64-bit length and its data padded
+ * to 8 bytes.
+ */
+struct raft_packed
+{
+    const void *cursor; /* Position of the next command, private. */
+    const void *end;    /* End of the entry data, private. */
+    unsigned n;         /* Number of commands. */
+    unsigned i;         /* Index of the next command. */
+};
+
+/**
+ * Initialize an iterator over the commands packed in the given entry data.
+ * Return #RAFT_MALFORMED if the data is not a valid packed entry.
+ */
+RAFT_API int raft_packed_init(struct raft_packed *p,
+                              const struct raft_buffer *buf);
+
+/**
+ * Fill @cmd with the next command and return true, or return false if all
+ * commands have been consumed. The command data points into the entry.
+ */
+RAFT_API bool raft_packed_next(struct raft_packed *p, struct raft_buffer *cmd);
+
 /**
  * A single entry in the raft log.
  *
@@ -234,19 +281,54 @@ struct raft_entry_ref
     raft_term term;              /* Term of the entry being ref-counted. */
     raft_index index;            /* Index of the entry being ref-counted. */
     unsigned short count;        /* Number of references. */
+    unsigned batch;              /* Batch table item of a held payload, or 0. */
     struct raft_entry_ref *next; /* Next item in the bucket (for collisions). */
 };
 
+/**
+ * Compact in-memory representation of a log entry.
+ *
+ * The term is not stored in the slot, see @raft_log_term, and the batch is
+ * stored as a position in the log's batch table.
+ */
+struct raft_log_slot
+{
+    void *base;          /* Entry data. */
+    unsigned len;        /* Entry data length. */
+    unsigned type : 4;   /* Type (FSM command, barrier, config change). */
+    unsigned batch : 28; /* Position in the batch table plus one, or zero. */
+};
+
+/**
+ * Run of consecutive log entries sharing the same term.
+ */
+struct raft_log_term
+{
+    raft_index index; /* Index of the first entry of the run. */
+    raft_term term;   /* Term of all entries of the run. */
+};
+
+/**
+ * Batch referenced by log entries.
+ */
+struct raft_log_batch
+{
+    void *batch;   /* Batch memory, or NULL if the table item is free. */
+    unsigned refs; /* Entries not yet destroyed, or next free item. */
+    bool entry;    /* Whether @batch is the payload of a single entry. */
+};
+
 /**
  * In-memory cache of the persistent raft log stored on disk.
  *
  * The raft log cache is implemented as a circular buffer of log entries, which
  * makes some frequent operations very efficient (e.g. deleting the first N
- * entries when snapshotting).
+ * entries when snapshotting). Entries are kept in the compact @raft_log_slot
+ * form and materialized as @raft_entry when accessed.
  */
 struct raft_log
 {
-    struct raft_entry *entries;  /* Circular buffer of log entries. */
+    struct raft_log_slot *slots; /* Circular buffer of log entries. */
     size_t size;                 /* Number of available slots in the buffer. */
     size_t front, back;          /* Indexes of used slots [front, back). */
     raft_index offset;           /* Index of first entry is offset+1. */
@@ -258,6 +340,13 @@ struct raft_log
         raft_term last_term;   /* Term of last index. */
     } snapshot;
     struct raft_log_hook *hook;  /* Hook functions for log.  */
+    struct raft_log_term *terms; /* Term runs, ordered by index. */
+    size_t n_terms;              /* Number of term runs. */
+    size_t terms_size;           /* Capacity of the term runs array. */
+    struct raft_log_batch *batches; /* Batch table. */
+    size_t batches_size;         /* Capacity of the batch table. */
+    size_t batches_free;         /* First free batch table item plus one. */
+    struct raft_entry get;       /* Entry materialized by the last get. */
 };
 
 /**
@@ -303,6 +392,8 @@ struct raft_append_entries
     raft_index snapshot_index;  /* Index of current snapshot */
     unsigned trailing;          /* Trailing for last snapshot */
     raft_time timestamp;        /* Time in microseconds. */
+    unsigned election_timeout;  /* Leader's adaptive timeouts in ms, */
+    unsigned heartbeat_timeout; /* 0 if it uses static ones. */
 };
 
 /**
@@ -331,6 +422,80 @@ struct raft_install_snapshot
     struct raft_buffer data;        /* Raw snapshot data. */
 };
 
+/**
+ * Maximum length of the name of a file of a file-based snapshot, including the
+ * terminating null byte.
+ */
+#define RAFT_SNAPSHOT_NAME_LEN 128
+
+/**
+ * A file of a file-based snapshot.
+ */
+struct raft_snapshot_file
+{
+    char name[RAFT_SNAPSHOT_NAME_LEN]; /* Relative to the snapshot directory */
+    unsigned long long size;           /* Size in bytes */
+};
+
+/**
+ * Hold the arguments of an InstallSnapshotChunk RPC.
+ *
+ * File-based snapshots are sent one chunk at a time, and the leader waits for
+ * each chunk to be acknowledged before sending the next one. An empty chunk at
+ * the start of the first file asks the receiver where to resume from.
+ */
+struct raft_install_snapshot_chunk
+{
+    raft_term term;                    /* Leader's term. */
+    raft_index last_index;             /* Index of last entry in the snapshot. */
+    raft_term last_term;               /* Term of last_index. */
+    struct raft_configuration conf;    /* Config as of last_index. */
+    raft_index conf_index;             /* Commit index of conf. */
+    unsigned n_files;                  /* Number of files in the snapshot. */
+    unsigned file;                     /* Index of the file of this chunk. */
+    char name[RAFT_SNAPSHOT_NAME_LEN]; /* Name of the file. */
+    unsigned long long size;           /* Size of the file. */
+    unsigned long long offset;         /* Offset of the chunk in the file. */
+    struct raft_buffer data;           /* Chunk data. */
+};
+
+/**
+ * Hold the result of an InstallSnapshotChunk RPC.
+ */
+struct raft_install_snapshot_chunk_result
+{
+    raft_term term;            /* Receiver's current term. */
+    raft_index last_index;     /* Index of the snapshot being received. */
+    unsigned file;             /* Next file expected. */
+    unsigned long long offset; /* Next offset expected in that file. */
+};
+
+/**
+ * Hold the arguments of a Forward RPC.
+ *
+ * The Forward RPC is invoked by followers to submit to the leader a batch of
+ * commands passed to raft_apply(). The @data buffer holds the number of
+ * commands, followed by the length and the 8-byte padded payload of each.
+ */
+struct raft_forward
+{
+    raft_term term;          /* Follower's current term. */
+    unsigned long long id;   /* Batch ID, unique per follower. */
+    struct raft_buffer data; /* Encoded commands. */
+};
+
+/**
+ * Hold the result of a Forward RPC, sent once the forwarded commands have
+ * been applied by the leader or have failed.
+ */
+struct raft_forward_result
+{
+    raft_term term;         /* Leader's current term. */
+    unsigned long long id;  /* Batch ID. */
+    int status;             /* 0 or the error the batch failed with. */
+    raft_index index;       /* Index of the first command of the batch. */
+};
+
 /**
  * Hold the arguments of a TimeoutNow RPC.
  *
@@ -353,7 +518,11 @@ enum {
     RAFT_IO_REQUEST_VOTE,
     RAFT_IO_REQUEST_VOTE_RESULT,
     RAFT_IO_INSTALL_SNAPSHOT,
-    RAFT_IO_TIMEOUT_NOW
+    RAFT_IO_TIMEOUT_NOW,
+    RAFT_IO_INSTALL_SNAPSHOT_CHUNK,
+    RAFT_IO_INSTALL_SNAPSHOT_CHUNK_RESULT,
+    RAFT_IO_FORWARD,
+    RAFT_IO_FORWARD_RESULT
 };
 
 /**
@@ -370,6 +539,10 @@ struct raft_message
         struct raft_append_entries_result append_entries_result;
         struct raft_install_snapshot install_snapshot;
         struct raft_timeout_now timeout_now;
+        struct raft_install_snapshot_chunk install_snapshot_chunk;
+        struct raft_install_snapshot_chunk_result install_snapshot_chunk_result;
+        struct raft_forward forward;
+        struct raft_forward_result forward_result;
     };
 };
 
@@ -392,6 +565,12 @@ struct raft_snapshot
      * there will always be a single buffer. */
     struct raft_buffer *bufs;
     unsigned n_bufs;
+
+    /* Content of a file-based snapshot, see raft_fsm->checkpoint. In that case
+     * bufs is NULL and n_bufs is 0, and the fields below are set instead. */
+    char *dir;                        /* Directory holding the files */
+    struct raft_snapshot_file *files; /* Files in the directory */
+    unsigned n_files;
 };
 
 /**
@@ -442,6 +621,45 @@ struct raft_io_snapshot_get
     raft_io_snapshot_get_cb cb; /* Request callback */
 };
 
+/**
+ * Asynchronous request to read a chunk of a file-based snapshot.
+ */
+struct raft_io_snapshot_read;
+typedef void (*raft_io_snapshot_read_cb)(struct raft_io_snapshot_read *req,
+                                         int status);
+struct raft_io_snapshot_read
+{
+    void *data;                  /* User data */
+    raft_io_snapshot_read_cb cb; /* Request callback */
+};
+
+/**
+ * Asynchronous request to write a chunk of a file-based snapshot being
+ * received.
+ */
+struct raft_io_snapshot_write;
+typedef void (*raft_io_snapshot_write_cb)(struct raft_io_snapshot_write *req,
+                                          int status);
+struct raft_io_snapshot_write
+{
+    void *data;                   /* User data */
+    raft_io_snapshot_write_cb cb; /* Request callback */
+};
+
+/**
+ * Asynchronous request to read entries of the log stored on disk.
+ */
+struct raft_io_entries_read;
+typedef void (*raft_io_entries_read_cb)(struct raft_io_entries_read *req,
+                                        struct raft_entry entries[],
+                                        unsigned n,
+                                        int status);
+struct raft_io_entries_read
+{
+    void *data;                  /* User data */
+    raft_io_entries_read_cb cb;  /* Request callback */
+};
+
 /**
  * Asynchronous request to store term and vote.
  */
@@ -578,6 +796,49 @@ struct raft_io
      * state of this raft I/O instance,
      */
     unsigned short state;
+    /* Fields below added since version 2. */
+    /* Optional, read up to buf->len bytes at @offset of the @file'th file of a
+     * file-based snapshot returned by @snapshot_get, setting buf->len to the
+     * number of bytes read. Required to send file-based snapshots. */
+    int (*snapshot_read)(struct raft_io *io,
+                         struct raft_io_snapshot_read *req,
+                         const struct raft_snapshot *snapshot,
+                         unsigned file,
+                         unsigned long long offset,
+                         struct raft_buffer *buf,
+                         raft_io_snapshot_read_cb cb);
+    /* Optional, write @buf at @offset of the @file'th file, with the given
+     * name, of the file-based snapshot with the given term and index being
+     * received. Data staged for any other snapshot is discarded, and so is the
+     * data staged for this one when writing the first file at offset 0, since
+     * the transfer started over. A file-based snapshot with no dir passed to
+     * @snapshot_put adopts the staged files. Required to receive file-based
+     * snapshots. */
+    int (*snapshot_write)(struct raft_io *io,
+                          struct raft_io_snapshot_write *req,
+                          raft_term term,
+                          raft_index index,
+                          unsigned file,
+                          const char *name,
+                          unsigned long long offset,
+                          const struct raft_buffer *buf,
+                          raft_io_snapshot_write_cb cb);
+    /* Fields below added since version 3. */
+    /* Optional, read at most @max entries starting at @index from the log
+     * stored on disk. Fewer entries may be returned, but at least one, or the
+     * request fails with #RAFT_NOTFOUND if the entry at @index is not on disk.
+     * The entries array and the batches of its entries are owned by the
+     * callback. Required to stream entries that were removed from memory. */
+    int (*entries_read)(struct raft_io *io,
+                        struct raft_io_entries_read *req,
+                        raft_index index,
+                        unsigned max,
+                        raft_io_entries_read_cb cb);
+    /* Fields below added since version 4. */
+    /* Optional, return the index of the last entry known to be on stable
+     * storage. Implementations completing append requests before their data
+     * is synced return a value lagging behind the last appended entry. */
+    raft_index (*durable_index)(struct raft_io *io);
 };
 
 struct raft_fsm_apply;
@@ -589,6 +850,18 @@ struct raft_fsm_apply {
         raft_fsm_apply_cb cb;
 };
 
+struct raft; /* Forward declaration. */
+
+/**
+ * Payload of an applied entry kept by the FSM, see @raft_fsm->apply_hold.
+ */
+struct raft_payload
+{
+    struct raft *raft;      /* Instance the entry belongs to. */
+    struct raft_buffer buf; /* Entry data, must not be modified. */
+    unsigned id;            /* Internal reference to the payload memory. */
+};
+
 struct raft_fsm
 {
     int version;
@@ -601,6 +874,45 @@ struct raft_fsm
                     struct raft_buffer *bufs[],
                     unsigned *n_bufs);
     int (*restore)(struct raft_fsm *fsm, struct raft_buffer *buf);
+    /* Fields below added since version 2. */
+    /* Optional, apply a command submitted with raft_apply_segments() without
+     * concatenating its segments. */
+    int (*apply_segments)(struct raft_fsm *fsm,
+                          struct raft_fsm_apply *req,
+                          const struct raft_buffer bufs[],
+                          unsigned n,
+                          raft_fsm_apply_cb cb);
+    /* Fields below added since version 3. */
+    /* Optional, apply all the commands of a #RAFT_PACKED entry. The result
+     * passed to @cb must be an array holding the result of each command, which
+     * only needs to be valid for the duration of the callback. On failure none
+     * of the commands must have been applied, since the whole entry is applied
+     * again. If not set, each command is submitted to @apply in turn, and a
+     * retry resumes at the command that failed. */
+    int (*apply_packed)(struct raft_fsm *fsm,
+                        struct raft_fsm_apply *req,
+                        struct raft_packed *cmds,
+                        raft_fsm_apply_cb cb);
+    /* Fields below added since version 4. */
+    /* Optional, take a file-based snapshot instead of calling @snapshot: create
+     * a directory holding only regular files with a consistent copy of the
+     * state, e.g. hard links to immutable files, and return its path allocated
+     * with raft_malloc(). The directory is handed over to the I/O backend. */
+    int (*checkpoint)(struct raft_fsm *fsm, char **dir);
+    /* Restore a file-based snapshot. The directory stays owned by the I/O
+     * backend, so its files must be linked or copied out of it. */
+    int (*restore_dir)(struct raft_fsm *fsm, const char *dir);
+    /* Fields below added since version 5. */
+    /* Optional, apply a #RAFT_COMMAND entry like @apply, but let the FSM keep
+     * its payload instead of copying it. Once this returns 0 the FSM owns
+     * @payload and must pass it to raft_payload_release() when done with it,
+     * at the latest before the raft instance is closed. The payload memory is
+     * shared with the log, and if the entry was received in a batch the whole
+     * batch stays allocated until released. */
+    int (*apply_hold)(struct raft_fsm *fsm,
+                      struct raft_fsm_apply *req,
+                      struct raft_payload *payload,
+                      raft_fsm_apply_cb cb);
 };
 
 /**
@@ -637,8 +949,6 @@ struct raft_progress
     bool lagged;                  /* Whether replica is lagged. */
 };
 
-struct raft; /* Forward declaration. */
-
 /**
  * Close callback.
  *
@@ -690,6 +1000,20 @@ struct raft_snapshot_sample {
 	raft_index index;
 };
 
+/* Freshness sample taken from an AppendEntries request received by a
+ * follower. */
+struct raft_read_sample {
+	raft_term term; // Term of the leader that sent the request
+	raft_index commit; // Leader commit index carried by the request
+	raft_time leader_time; // Leader time_us when the request was sent
+	raft_time local_time; // Local time_us when the request was received
+};
+
+#define RAFT_READ_SAMPLES 8
+
+/* Number of heartbeat round trips kept to derive adaptive timeouts. */
+#define RAFT_RTT_SAMPLES 64
+
 struct raft_snapshot_sampler {
 	raft_time span; // Time span between first and last sample
 	raft_time period; // Sample period in ms
@@ -720,6 +1044,48 @@ struct raft_log_hook {
      */
 	void (*entry_release)(struct raft_log_hook *h,
                           const struct raft_entry *entry, raft_index index);
+	/**
+     * Range variant of entry_add, called once for the @n entries added
+     * starting at @first. When set, entry_add is not invoked. Long spans may
+     * be delivered in several consecutive calls.
+     */
+	void (*entries_add)(struct raft_log_hook *h, raft_index first,
+                        unsigned n, const struct raft_entry entries[]);
+	/**
+     * Range variant of entry_remove, called before the @n entries starting at
+     * @first are removed. When set, entry_remove is not invoked.
+     */
+	void (*entries_remove)(struct raft_log_hook *h, raft_index first,
+                           unsigned n, const struct raft_entry entries[]);
+};
+
+/**
+ * Maximum number of servers whose match index is published.
+ */
+#define RAFT_PUBLISHED_MAX_PEERS 16
+
+/**
+ * Replication progress of a server, as published by the leader.
+ */
+struct raft_published_peer
+{
+    raft_id id;             /* Server ID. */
+    raft_index match_index; /* Highest index known to be replicated. */
+};
+
+/**
+ * Copy of the key state of a server, readable from any thread.
+ */
+struct raft_published
+{
+    unsigned short state;    /* RAFT_UNAVAILABLE, RAFT_FOLLOWER, ... */
+    raft_term term;          /* Current term. */
+    raft_id leader_id;       /* Known leader, 0 if none. */
+    raft_index commit_index; /* Highest index known to be committed. */
+    raft_index last_applied; /* Highest index applied to the FSM. */
+    raft_index last_stored;  /* Highest index persisted locally. */
+    unsigned n_peers;        /* Entries in @peers, only set on leaders. */
+    struct raft_published_peer peers[RAFT_PUBLISHED_MAX_PEERS];
 };
 
 /**
@@ -888,6 +1254,19 @@ struct raft
         struct raft_snapshot pending;    /* In progress snapshot */
         struct raft_io_snapshot_put put; /* Store snapshot request */
         struct raft_configuration configuration;
+        void *cache;                     /* Shared copy being sent */
+        unsigned chunk_size;             /* Chunk size of file-based sends */
+        void *sends[2];                  /* File-based snapshots being sent */
+        struct                           /* File-based snapshot being received */
+        {
+            raft_id leader;            /* Sender of the snapshot */
+            raft_index index;          /* Snapshot last index, or 0 */
+            raft_term term;            /* Snapshot last term */
+            unsigned n_files;          /* Number of files in the snapshot */
+            unsigned file;             /* Next file expected */
+            unsigned long long offset; /* Next offset in that file */
+            bool writing;              /* Whether a chunk is being written */
+        } recv;
     } snapshot;
 
     raft_state_change_cb state_change_cb;
@@ -934,6 +1313,8 @@ struct raft
     /* Fields for cope with append */
     unsigned nr_appending_requests;
     int prev_append_status;
+    /* Entries of the latest AppendEntries request, shared by followers. */
+    void *append_payload;
 
     /* Quorum type */
     enum raft_quorum quorum;
@@ -954,6 +1335,94 @@ struct raft
     } metric;
     unsigned ticks;
     unsigned tick_snapshot_frequency;
+    /* Follower read freshness tracking. */
+    struct {
+        struct raft_read_sample fresh;   /* Newest sample known applied */
+        struct raft_read_sample pending[RAFT_READ_SAMPLES]; /* Not applied */
+        unsigned n_pending;              /* Number of pending samples */
+        raft_term verified_term;         /* Term whose commit is trusted */
+        void *reqs[2];                   /* Waiting follower read requests */
+    } follower_read;
+    /* Limit of in-flight FSM apply requests. */
+    struct {
+        unsigned max_entries;            /* Max in-flight entries, 0 no limit */
+        size_t max_bytes;                /* Max in-flight bytes, 0 no limit */
+        bool adaptive;                   /* Size window from apply latency */
+        raft_time target_latency;        /* Latency target of adaptive mode */
+        unsigned window;                 /* Current adaptive entry window */
+        unsigned acked;                  /* Completions in current round */
+        bool slow;                       /* Latency target missed in round */
+        size_t bytes;                    /* In-flight payload bytes */
+        bool throttled;                  /* Apply stopped by the window */
+        unsigned long long nr_throttled; /* Times apply was throttled */
+        raft_index held_index;           /* Entry held back, or 0 */
+        raft_time held_since;            /* When @held_index was held back */
+        struct raft_metric fsm_latency;  /* Time spent in the FSM */
+        struct raft_metric held_latency; /* Time held back by the window */
+    } apply_window;
+    /* Packing of small commands into a single entry. */
+    struct {
+        unsigned max_cmds;               /* Max commands per entry, 0 off */
+        size_t max_bytes;                /* Max command bytes per entry */
+        size_t max_cmd_size;             /* Max size of a packable command */
+        void *buf;                       /* Entry being packed */
+        size_t len;                      /* Used bytes of @buf */
+        unsigned n;                      /* Commands in @buf */
+        void *reqs[2];                   /* Requests of the packed commands */
+        unsigned long long nr_packed;    /* Packed entries appended */
+        raft_index partial_index;        /* Packed entry partially applied */
+        unsigned partial_n;              /* Commands of it already applied */
+    } pack;
+    /* Subscribers to the stream of committed entries. */
+    struct {
+        unsigned max_lag;                /* Entries kept for slow subscribers */
+        void *subs[2];                   /* Active subscriptions */
+    } cdc;
+    /* Event loop stall watchdog. */
+    struct {
+        raft_time threshold;             /* Slow callback threshold, 0 off */
+        raft_time last_tick;             /* time() of the last tick */
+        bool ticked;                     /* Whether @last_tick is set */
+        unsigned long long nr_stalls;    /* Callbacks slower than threshold */
+        raft_time max_duration;          /* Slowest callback */
+        raft_time max_tick_lateness;     /* Largest tick delay */
+        struct raft_metric tick_lateness; /* Tick delay past the interval */
+    } watchdog;
+    /* Resource usage accounting. */
+    struct {
+        bool cpu;                        /* Whether CPU time is measured */
+        unsigned long long cpu_ns;       /* CPU time spent in callbacks */
+        unsigned long long nr_callbacks; /* Callbacks measured */
+        unsigned long long bytes_appended; /* Entry payload bytes written */
+    } usage;
+    /* RTT-adaptive election and heartbeat timeouts. */
+    struct {
+        unsigned min_election;           /* Lower bound, 0 if disabled */
+        unsigned max_election;           /* Upper bound */
+        unsigned election_timeout;       /* Configured static timeouts */
+        unsigned heartbeat_timeout;
+        raft_time rtt[RAFT_RTT_SAMPLES]; /* Heartbeat round trips in us */
+        unsigned n_rtt;                  /* Samples in @rtt */
+        unsigned next_rtt;               /* Slot of the next sample */
+    } adaptive;
+    /* Forwarding of commands submitted to followers. */
+    struct {
+        bool enabled;                    /* Whether followers forward */
+        unsigned long long next_id;      /* ID of the next batch */
+        void *buf;                       /* Commands waiting to be sent */
+        size_t len;                      /* Used bytes of @buf */
+        size_t cap;                      /* Allocated bytes of @buf */
+        unsigned n;                      /* Commands in @buf */
+        void *reqs[2];                   /* Requests of the commands in @buf */
+        void *batches[2];                /* Batches sent to the leader */
+        bool sending;                    /* Whether a batch is being sent */
+        unsigned long long nr_batches;   /* Batches sent */
+    } forward;
+    /* State published for readers on other threads. */
+    struct {
+        unsigned long seq;               /* Odd while being updated */
+        struct raft_published state;     /* Last published copy */
+    } published;
 };
 
 RAFT_API int raft_init(struct raft *r,
@@ -1055,6 +1524,12 @@ RAFT_API void raft_set_install_snapshot_timeout(struct raft *r, unsigned msecs);
  */
 RAFT_API void raft_set_snapshot_threshold(struct raft *r, unsigned n);
 
+/**
+ * Maximum size of the chunks file-based snapshots are sent in. The default is
+ * 1 megabyte.
+ */
+RAFT_API void raft_set_snapshot_chunk_size(struct raft *r, unsigned size);
+
 /**
  * Enable or disable pre-vote support. Pre-vote is turned off by default.
  */
@@ -1122,6 +1597,13 @@ RAFT_API raft_index raft_last_applied(struct raft *r);
  */
 RAFT_API raft_index raft_commit_index(struct raft *r);
 
+/**
+ * Return the index of the last entry known to be on stable storage, which lags
+ * behind raft_last_index() if the io completes appends before syncing them.
+ * Snapshots are never taken past this index.
+ */
+RAFT_API raft_index raft_durable_index(struct raft *r);
+
 /* Common fields across client request types. */
 #define RAFT__REQUEST \
     void *data;       \
@@ -1168,6 +1650,28 @@ RAFT_API int raft_apply(struct raft *r,
                         const unsigned n,
                         raft_apply_cb cb);
 
+/**
+ * Like raft_apply(), but the data of each command is made of one or more
+ * segments, which are written to disk and sent to other servers without being
+ * concatenated in memory first.
+ *
+ * The i'th command is made of the next @n_segs[i] buffers of @segs. Ownership
+ * of the memory of each segment is transferred as for raft_apply(). The FSM
+ * receives the segments via its @apply_segments method if it implements it,
+ * or a concatenated copy of them otherwise.
+ */
+RAFT_API int raft_apply_segments(struct raft *r,
+                                 struct raft_apply *req,
+                                 const struct raft_buffer segs[],
+                                 const unsigned n_segs[],
+                                 const unsigned n,
+                                 raft_apply_cb cb);
+
+/**
+ * Release a payload kept by the FSM, see @raft_fsm->apply_hold.
+ */
+RAFT_API void raft_payload_release(struct raft_payload *payload);
+
 /**
  * Asynchronous request to append a barrier entry.
  */
@@ -1404,6 +1908,14 @@ struct raft_hook
                                 struct raft_append_entries_result *result,
                                 bool *discard);
     unsigned (*max_dynamic_trailing)(struct raft_hook *h);
+    /**
+     * Range variant of entry_after_append_fn, called once for the @n entries
+     * appended starting at @first. When set, entry_after_append_fn is not
+     * invoked.
+     */
+    void (*entries_after_append_fn)(struct raft_hook *h, raft_index first,
+                                    unsigned n,
+                                    const struct raft_entry entries[]);
 };
 
 RAFT_API void raft_set_hook(struct raft *r, struct raft_hook * hook);
@@ -1581,6 +2093,308 @@ RAFT_API bool raft_check_entry_replication_quorum(struct raft *r,
  */
 RAFT_API void raft_set_tick_snapshot_frequency(struct raft *r, unsigned freq);
 
+/**
+ * Freshness of the FSM state of a follower.
+ *
+ * The FSM is known to contain every entry that the leader had committed at
+ * @leader_time (measured with the leader's time_us clock), since the follower
+ * received an AppendEntries request sent at that time whose leader commit
+ * index is not greater than @applied_index. The request was received at
+ * @fresh_as_of (measured with the local time_us clock), which is what the
+ * @staleness value is computed from. Note that the one-way network delay of
+ * that request is not accounted for.
+ */
+struct raft_follower_read_state
+{
+    raft_index applied_index; /* Highest entry applied to the FSM */
+    raft_index fresh_index;   /* Leader commit index of the fresh sample */
+    raft_time leader_time;    /* Leader time of the fresh sample */
+    raft_time fresh_as_of;    /* Local receive time of the fresh sample */
+    raft_time staleness;      /* Local time elapsed since @fresh_as_of */
+};
+
+/**
+ * Staleness reported when no AppendEntries request has been applied yet.
+ */
+#define RAFT_STALENESS_UNKNOWN ((raft_time)-1)
+
+/**
+ * Fill @state with the current freshness of the FSM. This is a local
+ * operation, no message is sent.
+ */
+RAFT_API void raft_follower_read_state(struct raft *r,
+                                       struct raft_follower_read_state *state);
+
+/**
+ * Asynchronous request to wait until the staleness of a follower's FSM falls
+ * below a given bound.
+ */
+struct raft_follower_read;
+typedef void (*raft_follower_read_cb)(struct raft_follower_read *req,
+                                      int status);
+struct raft_follower_read
+{
+    RAFT__REQUEST;
+    raft_time max_staleness;
+    raft_time timeout;
+    raft_follower_read_cb cb;
+};
+
+/**
+ * Wait until the staleness of the FSM is at most @max_staleness (in time_us
+ * units), then invoke @cb with status 0 and @req->index set to the applied
+ * index. If the bound is already met, @cb is invoked before returning.
+ *
+ * If @timeout is not zero and the bound is not met within @timeout time_us
+ * units, @cb is invoked with #RAFT_BUSY. If the server stops being a follower
+ * @cb is invoked with #RAFT_CANCELED.
+ *
+ * Return #RAFT_BADROLE if this server is not a follower.
+ */
+RAFT_API int raft_follower_read(struct raft *r,
+                                struct raft_follower_read *req,
+                                raft_time max_staleness,
+                                raft_time timeout,
+                                raft_follower_read_cb cb);
+
+struct raft_apply_window_setting {
+    /* Max number of in-flight FSM apply requests, 0 for no limit. */
+    unsigned max_entries;
+    /* Max payload bytes of in-flight FSM apply requests, 0 for no limit. */
+    size_t max_bytes;
+    /* Size the entry window from the observed apply latency, without
+     * exceeding @max_entries. */
+    bool adaptive;
+    /* Apply latency targeted in adaptive mode, in time_us units. */
+    raft_time target_latency;
+};
+
+/**
+ * Limit the number of committed entries handed to the FSM at the same time.
+ * Further entries are applied as in-flight ones complete.
+ */
+RAFT_API void raft_set_apply_window(
+    struct raft *r,
+    const struct raft_apply_window_setting *setting);
+
+struct raft_apply_window_stats {
+    unsigned nr_applying;            /* In-flight FSM apply requests */
+    size_t applying_bytes;           /* Payload bytes being applied */
+    raft_index nr_pending;           /* Committed entries not applying */
+    unsigned window;                 /* Current entry window, 0 no limit */
+    unsigned long long nr_throttled; /* Times apply was throttled */
+    raft_time apply_latency;         /* Average time spent in the FSM */
+    raft_time queue_latency;         /* Average time held back by the window */
+};
+
+/**
+ * Get apply queue depth and latency metrics.
+ *
+ * The apply latency is sampled from the submission of a command to the FSM
+ * until its completion. The queue latency is sampled for each committed entry
+ * that the window held back, from the first time it was held back until it is
+ * submitted to the FSM.
+ */
+RAFT_API void raft_apply_window_stats(struct raft *r,
+                                      struct raft_apply_window_stats *stats);
+
+struct raft_pack_setting {
+    /* Max number of commands packed in an entry, 0 to disable packing. */
+    unsigned max_cmds;
+    /* Max total size of the commands packed in an entry. */
+    size_t max_bytes;
+    /* Commands bigger than this get their own entry. */
+    size_t max_cmd_size;
+};
+
+/**
+ * Pack commands submitted with raft_apply() while previous entries are still
+ * being written into #RAFT_PACKED entries. Each request still gets its own
+ * callback and result. All the FSMs in the cluster must handle packed entries,
+ * which the default fallback to @apply ensures. If a command fails, the
+ * requests of the commands applied before it still succeed, and the other ones
+ * fail with the error.
+ */
+RAFT_API void raft_set_pack(struct raft *r,
+                            const struct raft_pack_setting *setting);
+
+/**
+ * Subscription to the stream of committed entries.
+ */
+struct raft_cdc;
+typedef void (*raft_cdc_cb)(struct raft_cdc *sub,
+                            raft_index index,
+                            const struct raft_entry entries[],
+                            unsigned n,
+                            int status);
+struct raft_cdc
+{
+    void *data;     /* User data */
+    raft_cdc_cb cb; /* Delivery callback */
+    /* Fields below are private. */
+    struct raft *raft;
+    raft_index next_index;      /* Index of the next entry to deliver */
+    unsigned max_batch;         /* Max entries delivered at a time */
+    raft_index index;           /* Index of the batch being consumed */
+    struct raft_entry *entries; /* Batch being consumed, or NULL */
+    unsigned n;                 /* Number of entries in the batch */
+    struct raft_entry *disk;    /* Entries read from disk, or NULL */
+    unsigned n_disk;            /* Number of entries read from disk */
+    unsigned disk_offset;       /* First entry of @disk not delivered yet */
+    void *read;                 /* Pending read from disk, or NULL */
+    bool delivering;            /* Whether @cb is running */
+    void *queue[2];
+};
+
+/**
+ * Start streaming the committed entries from @index onward to @cb, at most
+ * @max_batch at a time.
+ *
+ * Each batch is delivered with the index of its first entry. The entries are
+ * views into the log, valid until raft_cdc_release() is called, and no other
+ * batch is delivered before that. If the entries at @index were already
+ * removed from memory they are read from disk. Log compaction keeps up to
+ * raft_set_cdc_max_lag() entries not yet consumed by the slowest subscriber.
+ *
+ * If the stream can't continue @cb is invoked with no entries and a non-zero
+ * status, #RAFT_NOTFOUND if the next entry is gone from disk too, or
+ * #RAFT_CANCELED when the instance is closed, and the subscription ends.
+ * Any batch not released by then is no longer valid.
+ */
+RAFT_API int raft_cdc_subscribe(struct raft *r,
+                                struct raft_cdc *sub,
+                                raft_index index,
+                                unsigned max_batch,
+                                raft_cdc_cb cb);
+
+/**
+ * Release the batch last delivered to @sub, letting the next one be delivered.
+ * It can be called from within the callback.
+ */
+RAFT_API void raft_cdc_release(struct raft_cdc *sub);
+
+/**
+ * End a subscription, releasing its current batch if any. The callback is not
+ * invoked anymore. When called from within the callback, @sub must stay
+ * allocated until the callback returns.
+ */
+RAFT_API void raft_cdc_unsubscribe(struct raft_cdc *sub);
+
+/**
+ * Max number of entries that log compaction keeps for the slowest subscriber.
+ * This is not added to the snapshot trailing: compaction keeps the larger of
+ * the two, so subscribers lagging further behind than both read entries from
+ * disk while they are there. The default is 8192.
+ */
+RAFT_API void raft_set_cdc_max_lag(struct raft *r, unsigned n);
+
+struct raft_watchdog_stats {
+        unsigned long long nr_stalls; /* Callbacks slower than the threshold */
+        raft_time max_duration;       /* Slowest callback, in time_us units */
+        raft_time tick_lateness;      /* Average tick delay, in msecs */
+        raft_time max_tick_lateness;  /* Largest tick delay, in msecs */
+};
+
+/**
+ * Time the tick, recv, append, send and apply callbacks of the library, and
+ * record the ones taking at least @threshold time_us units into the event
+ * recorder. Also sample how late ticks fire compared to the heartbeat
+ * timeout. A zero threshold, the default, disables the watchdog.
+ */
+RAFT_API void raft_set_watchdog(struct raft *r, raft_time threshold);
+
+/**
+ * Get the stall watchdog metrics.
+ */
+RAFT_API void raft_watchdog_stats(struct raft *r,
+                                  struct raft_watchdog_stats *stats);
+
+struct raft_usage {
+        unsigned long long cpu_ns;         /* CPU time spent in callbacks */
+        unsigned long long nr_callbacks;   /* Callbacks measured */
+        unsigned long long bytes_appended; /* Entry payload bytes written */
+};
+
+/**
+ * Measure the CPU time of the calling thread spent in the callbacks timed by
+ * the watchdog, so the load of each instance can be told apart when many of
+ * them share a process. Off by default, since it reads the thread CPU clock
+ * twice per callback.
+ */
+RAFT_API void raft_set_cpu_accounting(struct raft *r, bool enabled);
+
+/**
+ * Get the resources used by this instance. Disk and network usage of the
+ * raft_io backend, if tracked, is exposed by the backend itself.
+ */
+RAFT_API void raft_usage(struct raft *r, struct raft_usage *usage);
+
+/**
+ * Derive the election and heartbeat timeouts from the round-trip times of the
+ * heartbeats sent by the leader, instead of using the static ones.
+ *
+ * The leader sets the election timeout to ten times the 99th percentile of the
+ * recent round trips to all servers, bounded by @min_election and
+ * @max_election milliseconds, and the heartbeat timeout to a tenth of it. The
+ * heartbeat timeout set with raft_set_heartbeat_timeout() remains the tick
+ * interval and a lower bound. The chosen values are carried by AppendEntries
+ * requests, and followers adopt them whether or not they enable this mode
+ * themselves. Pass 0 for both bounds to go back to the static timeouts.
+ *
+ * Return #RAFT_INVALID if @min_election is larger than @max_election or not
+ * larger than the heartbeat timeout.
+ */
+RAFT_API int raft_set_adaptive_timeouts(struct raft *r,
+                                        unsigned min_election,
+                                        unsigned max_election);
+
+struct raft_adaptive_timeouts
+{
+    unsigned election_timeout;  /* Election timeout in use, in ms */
+    unsigned heartbeat_timeout; /* Heartbeat timeout in use, in ms */
+    raft_time rtt;              /* 99th percentile round trip, in us */
+    unsigned n_samples;         /* Round trips it was computed from */
+};
+
+/**
+ * Get the timeouts currently in use and, on the leader, the round-trip
+ * percentile they were derived from.
+ */
+RAFT_API void raft_adaptive_timeouts(struct raft *r,
+                                     struct raft_adaptive_timeouts *out);
+
+/**
+ * Let followers accept raft_apply() requests and forward their commands to the
+ * current leader, instead of failing them with #RAFT_NOTLEADER. Off by
+ * default.
+ *
+ * Commands submitted while a batch is being sent are queued and sent together
+ * in the next batch once the send completes. The callback of a forwarded
+ * request fires when the leader reports that its commands were applied, with
+ * @req->index set to the index of its first command and a #NULL result, since
+ * the FSM result lives on the leader; the local FSM applies the commands once
+ * they are replicated here, which may happen later. The request fails with
+ * #RAFT_NOTLEADER if no leader is known or the batch reached the leader of a
+ * newer term, with #RAFT_LEADERSHIPLOST if the leader changes or the server
+ * stops being a follower, and with #RAFT_NOCONNECTION if the batch can't be
+ * sent or no result arrives within twice the election timeout. In these cases
+ * the commands might still have been committed. If the batch of a request
+ * can't be sent right away, raft_apply() returns the error and the callback
+ * doesn't fire.
+ *
+ * Commands made of segments, see raft_apply_segments(), are not forwarded.
+ */
+RAFT_API void raft_set_forwarding(struct raft *r, bool enabled);
+
+/**
+ * Get a consistent copy of the state last published by this instance. Unlike
+ * the other getters, this can be called from any thread: the copy is updated
+ * by the thread driving the instance whenever its state changes, and reading
+ * it never blocks that thread. The leader ID is the last one known and is not
+ * checked for staleness, see raft_leader() for that.
+ */
+RAFT_API void raft_published(struct raft *r, struct raft_published *out);
+
 #undef RAFT__REQUEST
 
 #endif /* RAFT_H */
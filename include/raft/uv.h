@@ -89,6 +89,18 @@ RAFT_API int raft_uv_init(struct raft_io *io,
  */
 RAFT_API void raft_uv_close(struct raft_io *io);
 
+/**
+ * Keep snapshots and metadata files in directories other than the one passed
+ * to raft_uv_init(), which then only holds log segments. This way the log can
+ * live on a low-latency device, while snapshots go to bulk storage. A NULL
+ * directory keeps the respective files in the segments directory.
+ *
+ * Must be called before io->init(). Existing files are not moved.
+ */
+RAFT_API int raft_uv_set_dirs(struct raft_io *io,
+                              const char *snapshot_dir,
+                              const char *metadata_dir);
+
 /**
  * Set the block size that will be used for direct I/O.
  *
@@ -115,6 +127,21 @@ RAFT_API void raft_uv_set_segment_size(struct raft_io *io, size_t size);
  */
 RAFT_API int raft_uv_set_snapshot_compression(struct raft_io *io, bool compressed);
 
+/**
+ * Turn background compression of closed segments on or off.
+ *
+ * Once finalized, closed segments are rewritten as LZ4 frames made of
+ * independent blocks and transparently decompressed when loaded. Segments
+ * holding any of the last @tail entries are left alone, since they are the
+ * ones most likely to be sent to lagging followers.
+ *
+ * Returns non-0 on failure, e.g. when no suitable compression library is
+ * found. By default closed segments are not compressed.
+ */
+RAFT_API int raft_uv_set_segment_compression(struct raft_io *io,
+                                             bool compressed,
+                                             raft_index tail);
+
 /**
  * Set how many milliseconds to wait between subsequent retries when
  * establishing a connection with another server. The default is 1000
@@ -122,6 +149,99 @@ RAFT_API int raft_uv_set_snapshot_compression(struct raft_io *io, bool compresse
  */
 RAFT_API void raft_uv_set_connect_retry_delay(struct raft_io *io, unsigned msecs);
 
+/**
+ * Page-cache policy flags, see raft_uv_set_page_cache_policy().
+ */
+#define RAFT_UV_DROP_BEHIND (1 << 0) /* Evict segments once written or loaded */
+#define RAFT_UV_READAHEAD (1 << 1)   /* Prefetch segments being loaded */
+
+/**
+ * Set how segment files interact with the page cache when buffered I/O is
+ * used.
+ *
+ * With #RAFT_UV_DROP_BEHIND, finalized segments and segments loaded at startup
+ * are evicted from the page cache, so they don't push out the FSM's data.
+ *
+ * With #RAFT_UV_READAHEAD, loading segments asks the kernel to prefetch the
+ * next segment while the current one is being decoded. If @readahead is not
+ * zero, at most that many bytes of each segment are prefetched.
+ *
+ * The default is no policy.
+ */
+RAFT_API void raft_uv_set_page_cache_policy(struct raft_io *io,
+                                            unsigned flags,
+                                            size_t readahead);
+
+/**
+ * Durability modes, see raft_uv_set_durability().
+ */
+#define RAFT_UV_DURABLE 0 /* Appends complete once entries are synced */
+#define RAFT_UV_RELAXED 1 /* Appends complete once entries are written */
+
+/**
+ * Set when append requests complete.
+ *
+ * With #RAFT_UV_RELAXED, open segments are written through the page cache
+ * and append requests complete without waiting for the data to hit the disk.
+ * A background fdatasync() of the open segments runs every @sync_interval
+ * milliseconds and after @sync_bytes bytes have been written; a zero value
+ * disables the respective trigger, but not both. The index of the last synced
+ * entry is reported by the io's durable_index() method.
+ *
+ * Entries acknowledged but not yet synced can be lost on power failure, so
+ * this trades the durability of the last few entries for append throughput.
+ *
+ * Must be called before the first append. The default is #RAFT_UV_DURABLE.
+ */
+RAFT_API int raft_uv_set_durability(struct raft_io *io,
+                                    int mode,
+                                    unsigned sync_interval,
+                                    size_t sync_bytes);
+
+/**
+ * Return the number of closed open segments that are waiting to be finalized,
+ * or that are being finalized.
+ */
+RAFT_API unsigned raft_uv_finalize_queue_len(struct raft_io *io);
+
+/**
+ * Disk and network usage of a libuv-based raft_io instance.
+ */
+struct raft_uv_usage
+{
+    unsigned long long bytes_appended; /* Bytes written to open segments */
+    unsigned long long bytes_synced;   /* Bytes of open segments synced */
+    unsigned long long bytes_sent;     /* Bytes of messages sent */
+    unsigned long long bytes_received; /* Bytes of messages received */
+};
+
+/**
+ * Get the disk and network usage of this instance. The counters are plain
+ * fields updated in the loop thread, so reading them is cheap.
+ */
+RAFT_API void raft_uv_usage(struct raft_io *io, struct raft_uv_usage *usage);
+
+/**
+ * Time spent in each stage of the last call to raft_io->load, in nanoseconds.
+ */
+struct raft_uv_load_stats
+{
+    unsigned long long total;     /* Whole load */
+    unsigned long long list;      /* Listing the data directories */
+    unsigned long long snapshot;  /* Reading and decompressing the snapshot */
+    unsigned long long read;      /* Reading and decompressing segments */
+    unsigned long long crc;       /* Verifying segment checksums */
+    unsigned long long decode;    /* Decoding entries */
+    unsigned n_segments;          /* Number of segments loaded */
+    unsigned long long bytes_read; /* Bytes of segments loaded */
+};
+
+/**
+ * Get the breakdown of the time it took to load the data directory.
+ */
+RAFT_API void raft_uv_load_stats(struct raft_io *io,
+                                 struct raft_uv_load_stats *stats);
+
 /**
  * Emit low-level debug messages using the given tracer.
  */
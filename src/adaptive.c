@@ -0,0 +1,185 @@
+#include "adaptive.h"
+
+#include <stdlib.h>
+
+#include "election.h"
+#include "err.h"
+#include "tracing.h"
+
+#ifdef ENABLE_TRACE
+#define tracef(...) Tracef(r->tracer, __VA_ARGS__)
+#else
+#define tracef(...)
+#endif
+
+/* Round trips needed before the timeouts are derived from them. */
+#define ADAPTIVE_MIN_SAMPLES 8
+
+/* Ratio between the election timeout and the round trip, and between the
+ * election and heartbeat timeouts. Chapter 9 recommends an election timeout of
+ * 10-20 times the one-way network latency. */
+#define ADAPTIVE_FACTOR 10
+
+void adaptiveInit(struct raft *r)
+{
+    r->adaptive.min_election = 0;
+    r->adaptive.max_election = 0;
+    r->adaptive.election_timeout = r->election_timeout;
+    r->adaptive.heartbeat_timeout = r->heartbeat_timeout;
+    r->adaptive.n_rtt = 0;
+    r->adaptive.next_rtt = 0;
+}
+
+/* Go back to the configured static timeouts. */
+static void adaptiveRestore(struct raft *r)
+{
+    r->election_timeout = r->adaptive.election_timeout;
+    r->heartbeat_timeout = r->adaptive.heartbeat_timeout;
+}
+
+void adaptiveReset(struct raft *r)
+{
+    r->adaptive.n_rtt = 0;
+    r->adaptive.next_rtt = 0;
+    if (r->adaptive.min_election == 0) {
+        adaptiveRestore(r);
+    }
+}
+
+void adaptiveSample(struct raft *r, raft_time timestamp)
+{
+    raft_time now;
+
+    if (r->adaptive.min_election == 0) {
+        return;
+    }
+    now = r->io->time_us(r->io);
+    if (now <= timestamp) {
+        return;
+    }
+    r->adaptive.rtt[r->adaptive.next_rtt] = now - timestamp;
+    r->adaptive.next_rtt = (r->adaptive.next_rtt + 1) % RAFT_RTT_SAMPLES;
+    if (r->adaptive.n_rtt < RAFT_RTT_SAMPLES) {
+        r->adaptive.n_rtt += 1;
+    }
+}
+
+static int adaptiveCompare(const void *a, const void *b)
+{
+    raft_time x = *(const raft_time *)a;
+    raft_time y = *(const raft_time *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Return the 99th percentile of the sampled round trips. */
+static raft_time adaptiveRtt(struct raft *r)
+{
+    raft_time rtt[RAFT_RTT_SAMPLES];
+    unsigned n = r->adaptive.n_rtt;
+    unsigned i;
+
+    if (n == 0) {
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        rtt[i] = r->adaptive.rtt[i];
+    }
+    qsort(rtt, n, sizeof *rtt, adaptiveCompare);
+    return rtt[(n * 99 + 99) / 100 - 1];
+}
+
+void adaptiveTick(struct raft *r)
+{
+    unsigned election;
+    unsigned heartbeat;
+    raft_time rtt;
+
+    if (r->adaptive.min_election == 0 ||
+        r->adaptive.n_rtt < ADAPTIVE_MIN_SAMPLES) {
+        return;
+    }
+
+    rtt = (adaptiveRtt(r) + 999) / 1000;
+    if (rtt > r->adaptive.max_election / ADAPTIVE_FACTOR) {
+        election = r->adaptive.max_election;
+    } else {
+        election = (unsigned)rtt * ADAPTIVE_FACTOR;
+    }
+    if (election < r->adaptive.min_election) {
+        election = r->adaptive.min_election;
+    }
+    heartbeat = election / ADAPTIVE_FACTOR;
+    if (heartbeat < r->adaptive.heartbeat_timeout) {
+        heartbeat = r->adaptive.heartbeat_timeout;
+    }
+
+    if (election != r->election_timeout || heartbeat != r->heartbeat_timeout) {
+        tracef("adaptive timeouts election %u heartbeat %u rtt %llu ms",
+               election, heartbeat, rtt);
+        r->election_timeout = election;
+        r->heartbeat_timeout = heartbeat;
+    }
+}
+
+void adaptivePrepare(struct raft *r, struct raft_append_entries *args)
+{
+    if (r->adaptive.min_election == 0) {
+        args->election_timeout = 0;
+        args->heartbeat_timeout = 0;
+        return;
+    }
+    args->election_timeout = r->election_timeout;
+    args->heartbeat_timeout = r->heartbeat_timeout;
+}
+
+void adaptiveLearn(struct raft *r, const struct raft_append_entries *args)
+{
+    unsigned election = args->election_timeout;
+    unsigned heartbeat = args->heartbeat_timeout;
+
+    if (election == 0) {
+        election = r->adaptive.election_timeout;
+        heartbeat = r->adaptive.heartbeat_timeout;
+    } else if (heartbeat == 0 || heartbeat >= election) {
+        return;
+    }
+    if (election == r->election_timeout && heartbeat == r->heartbeat_timeout) {
+        return;
+    }
+
+    tracef("adopt leader timeouts election %u heartbeat %u", election,
+           heartbeat);
+    r->election_timeout = election;
+    r->heartbeat_timeout = heartbeat;
+    electionResetTimer(r);
+}
+
+int raft_set_adaptive_timeouts(struct raft *r,
+                               unsigned min_election,
+                               unsigned max_election)
+{
+    if (min_election == 0 && max_election == 0) {
+        r->adaptive.min_election = 0;
+        r->adaptive.max_election = 0;
+        adaptiveRestore(r);
+        return 0;
+    }
+    if (min_election > max_election ||
+        min_election <= r->adaptive.heartbeat_timeout) {
+        ErrMsgFromCode(r->errmsg, RAFT_INVALID);
+        return RAFT_INVALID;
+    }
+    r->adaptive.min_election = min_election;
+    r->adaptive.max_election = max_election;
+    return 0;
+}
+
+void raft_adaptive_timeouts(struct raft *r, struct raft_adaptive_timeouts *out)
+{
+    out->election_timeout = r->election_timeout;
+    out->heartbeat_timeout = r->heartbeat_timeout;
+    out->rtt = adaptiveRtt(r);
+    out->n_samples = r->adaptive.n_rtt;
+}
+
+#undef tracef
@@ -0,0 +1,29 @@
+/* Election and heartbeat timeouts derived from heartbeat round-trip times. */
+
+#ifndef ADAPTIVE_H_
+#define ADAPTIVE_H_
+
+#include "../include/raft.h"
+
+/* Initialize the adaptive timeouts state of a raft instance. */
+void adaptiveInit(struct raft *r);
+
+/* Drop the round trips sampled in a previous term, and go back to the static
+ * timeouts if the adaptive mode is off. Must be invoked when becoming
+ * leader. */
+void adaptiveReset(struct raft *r);
+
+/* Record the round trip of a heartbeat sent at the given time_us(). */
+void adaptiveSample(struct raft *r, raft_time timestamp);
+
+/* Recompute the timeouts of a leader from the sampled round trips. */
+void adaptiveTick(struct raft *r);
+
+/* Fill the timeouts carried by an AppendEntries request sent by a leader. */
+void adaptivePrepare(struct raft *r, struct raft_append_entries *args);
+
+/* Adopt the timeouts carried by an AppendEntries request from the current
+ * leader. */
+void adaptiveLearn(struct raft *r, const struct raft_append_entries *args);
+
+#endif /* ADAPTIVE_H_ */
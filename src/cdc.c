@@ -0,0 +1,311 @@
+#include "cdc.h"
+
+#include "assert.h"
+#include "entry.h"
+#include "event.h"
+#include "log.h"
+#include "queue.h"
+#include "tracing.h"
+
+#ifdef ENABLE_TRACE
+#define tracef(...) Tracef(r->tracer, __VA_ARGS__)
+#else
+#define tracef(...)
+#endif
+
+#define CDC_SUBS(R) ((queue *)&(R)->cdc.subs)
+#define DEFAULT_CDC_MAX_LAG 8192
+
+/* Pending read of entries from disk. It outlives the subscription that started
+ * it if that ends first. */
+struct cdcRead
+{
+    struct raft_io_entries_read req;
+    struct raft_cdc *sub; /* Subscription waiting for the entries, or NULL */
+};
+
+void cdcInit(struct raft *r)
+{
+    r->cdc.max_lag = DEFAULT_CDC_MAX_LAG;
+    QUEUE_INIT(CDC_SUBS(r));
+}
+
+/* Release the batch being consumed, if any. */
+static void cdcDrop(struct raft_cdc *sub)
+{
+    struct raft *r = sub->raft;
+
+    if (sub->entries == NULL) {
+        return;
+    }
+    if (sub->disk == NULL) {
+        logRelease(&r->log, sub->index, sub->entries, sub->n);
+        raft_free(sub->entries);
+    } else if (sub->disk_offset == sub->n_disk) {
+        entryBatchesDestroy(sub->disk, sub->n_disk);
+        sub->disk = NULL;
+    }
+    sub->entries = NULL;
+    sub->n = 0;
+}
+
+/* Remove a subscription, releasing everything it holds. */
+static void cdcDetach(struct raft_cdc *sub)
+{
+    struct cdcRead *read = sub->read;
+
+    cdcDrop(sub);
+    if (sub->disk != NULL) {
+        entryBatchesDestroy(sub->disk, sub->n_disk);
+        sub->disk = NULL;
+    }
+    if (read != NULL) {
+        read->sub = NULL;
+        sub->read = NULL;
+    }
+    QUEUE_REMOVE((queue *)&sub->queue);
+    sub->raft = NULL;
+}
+
+/* End a subscription, notifying its callback. */
+static void cdcEnd(struct raft_cdc *sub, int status)
+{
+    raft_index index = sub->next_index;
+
+    cdcDetach(sub);
+    sub->cb(sub, index, NULL, 0, status);
+}
+
+static void cdcPump(struct raft_cdc *sub);
+
+static void cdcReadCb(struct raft_io_entries_read *req,
+                      struct raft_entry entries[],
+                      unsigned n,
+                      int status)
+{
+    struct cdcRead *read = req->data;
+    struct raft_cdc *sub = read->sub;
+    struct raft *r;
+
+    raft_free(read);
+    if (sub == NULL) {
+        if (status == 0) {
+            entryBatchesDestroy(entries, n);
+        }
+        return;
+    }
+    r = sub->raft;
+    sub->read = NULL;
+
+    if (status != 0) {
+        evtErrf("E-1528-317", "raft(%llx) cdc read at %llu failed %d", r->id,
+                sub->next_index, status);
+        cdcEnd(sub, status);
+        return;
+    }
+    assert(n > 0);
+
+    sub->disk = entries;
+    sub->n_disk = n;
+    sub->disk_offset = 0;
+    cdcPump(sub);
+}
+
+/* Read the next entries from disk, since they are not in memory anymore. */
+static int cdcRead(struct raft_cdc *sub, unsigned max)
+{
+    struct raft *r = sub->raft;
+    struct cdcRead *read;
+    int rv;
+
+    if (r->io->version < 3 || r->io->entries_read == NULL) {
+        return RAFT_NOTFOUND;
+    }
+
+    read = raft_malloc(sizeof *read);
+    if (read == NULL) {
+        return RAFT_NOMEM;
+    }
+    read->req.data = read;
+    read->sub = sub;
+
+    tracef("cdc read %u entries at %llu", max, sub->next_index);
+    rv = r->io->entries_read(r->io, &read->req, sub->next_index, max,
+                             cdcReadCb);
+    if (rv != 0) {
+        raft_free(read);
+        return rv;
+    }
+    sub->read = read;
+    return 0;
+}
+
+/* Set up the next batch of entries, or start reading it from disk. */
+static int cdcNext(struct raft_cdc *sub)
+{
+    struct raft *r = sub->raft;
+    raft_index pending = r->commit_index - sub->next_index + 1;
+    unsigned max = sub->max_batch;
+    unsigned n;
+    int rv;
+
+    if (pending < max) {
+        max = (unsigned)pending;
+    }
+
+    if (sub->disk != NULL) {
+        n = sub->n_disk - sub->disk_offset;
+        if (n > max) {
+            n = max;
+        }
+        sub->entries = &sub->disk[sub->disk_offset];
+        sub->disk_offset += n;
+    } else if (logGet(&r->log, sub->next_index) != NULL) {
+        sub->entries = raft_malloc(max * sizeof *sub->entries);
+        if (sub->entries == NULL) {
+            return RAFT_NOMEM;
+        }
+        rv = logAcquire(&r->log, sub->next_index, &sub->entries, &n, max);
+        assert(rv == 0);
+        assert(n > 0);
+    } else {
+        return cdcRead(sub, max);
+    }
+
+    sub->index = sub->next_index;
+    sub->n = n;
+    sub->next_index += n;
+    return 0;
+}
+
+/* Deliver batches until the subscriber holds one, a read from disk is needed
+ * or all committed entries have been delivered. */
+static void cdcPump(struct raft_cdc *sub)
+{
+    int rv;
+
+    while (sub->raft != NULL && sub->entries == NULL && sub->read == NULL &&
+           sub->next_index <= sub->raft->commit_index) {
+        rv = cdcNext(sub);
+        if (rv != 0) {
+            struct raft *r = sub->raft;
+            evtErrf("E-1528-318", "raft(%llx) cdc at %llu failed %d", r->id,
+                    sub->next_index, rv);
+            cdcEnd(sub, rv);
+            return;
+        }
+        if (sub->entries == NULL) {
+            return;
+        }
+        sub->delivering = true;
+        sub->cb(sub, sub->index, sub->entries, sub->n, 0);
+        sub->delivering = false;
+    }
+}
+
+void cdcUpdate(struct raft *r)
+{
+    queue *head;
+    queue *next;
+
+    head = QUEUE_HEAD(CDC_SUBS(r));
+    while (head != CDC_SUBS(r)) {
+        struct raft_cdc *sub = QUEUE_DATA(head, struct raft_cdc, queue);
+        /* The callback might end this subscription, but not others. */
+        next = QUEUE_NEXT(head);
+        cdcPump(sub);
+        head = next;
+    }
+}
+
+unsigned cdcTrailing(struct raft *r,
+                     raft_index snapshot_index,
+                     unsigned trailing)
+{
+    raft_index slowest = 0;
+    raft_index lag;
+    queue *head;
+
+    QUEUE_FOREACH(head, CDC_SUBS(r))
+    {
+        struct raft_cdc *sub = QUEUE_DATA(head, struct raft_cdc, queue);
+        if (slowest == 0 || sub->next_index < slowest) {
+            slowest = sub->next_index;
+        }
+    }
+    if (slowest == 0 || slowest > snapshot_index) {
+        return trailing;
+    }
+
+    lag = snapshot_index - slowest + 1;
+    if (lag > r->cdc.max_lag) {
+        lag = r->cdc.max_lag;
+    }
+    return lag > trailing ? (unsigned)lag : trailing;
+}
+
+void cdcClose(struct raft *r)
+{
+    while (!QUEUE_IS_EMPTY(CDC_SUBS(r))) {
+        queue *head = QUEUE_HEAD(CDC_SUBS(r));
+        cdcEnd(QUEUE_DATA(head, struct raft_cdc, queue), RAFT_CANCELED);
+    }
+}
+
+int raft_cdc_subscribe(struct raft *r,
+                       struct raft_cdc *sub,
+                       raft_index index,
+                       unsigned max_batch,
+                       raft_cdc_cb cb)
+{
+    assert(cb != NULL);
+    if (index == 0 || max_batch == 0) {
+        evtErrf("E-1528-316", "raft(%llx) cdc subscribe at %llu max %u",
+                r->id, index, max_batch);
+        return RAFT_INVALID;
+    }
+
+    sub->cb = cb;
+    sub->raft = r;
+    sub->next_index = index;
+    sub->max_batch = max_batch;
+    sub->index = 0;
+    sub->entries = NULL;
+    sub->n = 0;
+    sub->disk = NULL;
+    sub->n_disk = 0;
+    sub->disk_offset = 0;
+    sub->read = NULL;
+    sub->delivering = false;
+    QUEUE_PUSH(CDC_SUBS(r), (queue *)&sub->queue);
+
+    tracef("cdc subscribe at %llu", index);
+    cdcPump(sub);
+    return 0;
+}
+
+void raft_cdc_release(struct raft_cdc *sub)
+{
+    if (sub->raft == NULL) {
+        return;
+    }
+    cdcDrop(sub);
+    if (!sub->delivering) {
+        cdcPump(sub);
+    }
+}
+
+void raft_cdc_unsubscribe(struct raft_cdc *sub)
+{
+    if (sub->raft == NULL) {
+        return;
+    }
+    cdcDetach(sub);
+}
+
+void raft_set_cdc_max_lag(struct raft *r, unsigned n)
+{
+    r->cdc.max_lag = n;
+}
+
+#undef tracef
@@ -0,0 +1,25 @@
+/* Change-data-capture stream of committed entries. */
+
+#ifndef CDC_H_
+#define CDC_H_
+
+#include "../include/raft.h"
+
+/* Initialize the subscription state of a raft instance. */
+void cdcInit(struct raft *r);
+
+/* Deliver newly committed entries to the subscribers that are not consuming a
+ * batch. Must be invoked whenever commit_index advances. */
+void cdcUpdate(struct raft *r);
+
+/* Return the number of trailing entries that log compaction at
+ * @snapshot_index should keep, extending @trailing for the slowest subscriber
+ * up to the configured max lag. */
+unsigned cdcTrailing(struct raft *r,
+                     raft_index snapshot_index,
+                     unsigned trailing);
+
+/* End all subscriptions with #RAFT_CANCELED. */
+void cdcClose(struct raft *r);
+
+#endif /* CDC_H_ */
@@ -2,8 +2,10 @@
 #include "assert.h"
 #include "configuration.h"
 #include "err.h"
+#include "forward.h"
 #include "log.h"
 #include "membership.h"
+#include "pack.h"
 #include "progress.h"
 #include "queue.h"
 #include "replication.h"
@@ -18,21 +20,26 @@
 #define tracef(...)
 #endif
 
-int raft_apply(struct raft *r,
-               struct raft_apply *req,
-               const struct raft_buffer bufs[],
-               const unsigned n,
-               raft_apply_cb cb)
+/* Append the given commands to the log and replicate them. If @n_segs is not
+ * #NULL the commands are made of segments, see raft_apply_segments(). */
+static int clientApply(struct raft *r,
+                       struct raft_apply *req,
+                       const struct raft_buffer bufs[],
+                       const unsigned n_segs[],
+                       const unsigned n,
+                       raft_apply_cb cb)
 {
-    const struct raft_entry *entry;
     raft_index index;
-    unsigned i;
     int rv;
 
     assert(r != NULL);
     assert(bufs != NULL);
     assert(n > 0);
 
+    if (forwardAccepts(r, n_segs)) {
+        return forwardSubmit(r, req, bufs, n, cb);
+    }
+
     if (r->state != RAFT_LEADER || r->transfer != NULL
         || r->leader_state.removed_from_cluster) {
         rv = RAFT_NOTLEADER;
@@ -41,6 +48,15 @@ int raft_apply(struct raft *r,
         goto err;
     }
 
+    if (n_segs == NULL && packAccepts(r, bufs, n)) {
+        rv = packSubmit(r, req, &bufs[0], cb);
+        if (rv != 0) {
+            goto err;
+        }
+        return 0;
+    }
+    packFlush(r);
+
     /* Index of the first entry being appended. */
     index = logLastIndex(&r->log) + 1;
     tracef("%u commands starting at %lld", n, index);
@@ -48,9 +64,14 @@ int raft_apply(struct raft *r,
     req->type = RAFT_COMMAND;
     req->index = index;
     req->cb = cb;
+    QUEUE_INIT(&req->queue);
 
     /* Append the new entries to the log. */
-    rv = logAppendCommands(&r->log, r->current_term, bufs, n);
+    if (n_segs == NULL) {
+        rv = logAppendCommands(&r->log, r->current_term, bufs, n);
+    } else {
+        rv = logAppendSegments(&r->log, r->current_term, bufs, n_segs, n);
+    }
     if (rv != 0) {
         evtErrf("E-1528-074", "raft(%llx) append cmd failed %d", r->id, rv);
         goto err;
@@ -63,12 +84,7 @@ int raft_apply(struct raft *r,
     }
     hookRequestAccept(r, index);
 
-    for (i = 0; i < n; ++i) {
-        entry = logGet(&r->log, index + i);
-        assert(entry);
-        assert(entry->type == RAFT_COMMAND);
-        r->hook->entry_after_append_fn(r->hook, index + i, entry);
-    }
+    hookEntriesAfterAppend(r, index, n);
 
     rv = replicationTrigger(r, index);
     if (rv != 0) {
@@ -87,6 +103,32 @@ err:
     return rv;
 }
 
+int raft_apply(struct raft *r,
+               struct raft_apply *req,
+               const struct raft_buffer bufs[],
+               const unsigned n,
+               raft_apply_cb cb)
+{
+    return clientApply(r, req, bufs, NULL, n, cb);
+}
+
+int raft_apply_segments(struct raft *r,
+                        struct raft_apply *req,
+                        const struct raft_buffer segs[],
+                        const unsigned n_segs[],
+                        const unsigned n,
+                        raft_apply_cb cb)
+{
+    assert(n_segs != NULL);
+    return clientApply(r, req, segs, n_segs, n, cb);
+}
+
+void raft_payload_release(struct raft_payload *payload)
+{
+    logUnhold(&payload->raft->log, payload->id);
+    raft_free(payload);
+}
+
 int raft_barrier(struct raft *r, struct raft_barrier *req, raft_barrier_cb cb)
 {
     raft_index index;
@@ -100,6 +142,8 @@ int raft_barrier(struct raft *r, struct raft_barrier *req, raft_barrier_cb cb)
         goto err;
     }
 
+    packFlush(r);
+
     /* TODO: use a completely empty buffer */
     buf.len = 0;
     buf.base = NULL;
@@ -128,7 +172,7 @@ int raft_barrier(struct raft *r, struct raft_barrier *req, raft_barrier_cb cb)
     entry = logGet(&r->log, index);
     assert(entry);
     assert(entry->type == RAFT_BARRIER);
-    r->hook->entry_after_append_fn(r->hook, index, entry);
+    hookEntriesAfterAppend(r, index, 1);
 
     rv = replicationTrigger(r, index);
     if (rv != 0) {
@@ -158,6 +202,8 @@ static int clientChangeConfiguration(
     const struct raft_entry *entry;
     unsigned server_index;
 
+    packFlush(r);
+
     /* Index of the entry being appended. */
     index = logLastIndex(&r->log) + 1;
 
@@ -175,7 +221,7 @@ static int clientChangeConfiguration(
     entry = logGet(&r->log, index);
     assert(entry);
     assert(entry->type == RAFT_CHANGE);
-    r->hook->entry_after_append_fn(r->hook, index, entry);
+    hookEntriesAfterAppend(r, index, 1);
     hookConfChange(r, configuration);
 
     rv = progressRebuildArray(r, configuration);
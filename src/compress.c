@@ -151,6 +151,115 @@ err:
 #endif /* LZ4_AVAILABLE */
 }
 
+int CompressStream(struct raft_buffer bufs[], unsigned n_bufs,
+                   bool independent,
+                   int (*write)(void *arg, const void *buf, size_t len),
+                   void *arg, char *errmsg)
+{
+#ifndef LZ4_AVAILABLE
+    (void) bufs;
+    (void) n_bufs;
+    (void) independent;
+    (void) write;
+    (void) arg;
+    ErrMsgPrintf(errmsg, "LZ4 not available");
+    return RAFT_INVALID;
+#else
+    assert(bufs != NULL);
+    assert(n_bufs > 0);
+    assert(write != NULL);
+    assert(errmsg != NULL);
+
+    int rv = RAFT_IOERR;
+    size_t src_size = 0;
+    size_t src_offset = 0;
+    size_t dst_size = 0;
+    size_t ret = 0; /* Return value of LZ4F_XXX functions */
+    void *dst;
+
+    for (unsigned i = 0; i < n_bufs; ++i) {
+        src_size += bufs[i].len;
+    }
+
+    LZ4F_preferences_t lz4_pref;
+    memset(&lz4_pref, 0, sizeof(lz4_pref));
+    lz4_pref.frameInfo.contentChecksumFlag = 1;
+    lz4_pref.frameInfo.contentSize = src_size;
+    if (independent) {
+        lz4_pref.frameInfo.blockMode = LZ4F_blockIndependent;
+        lz4_pref.frameInfo.blockSizeID = LZ4F_max1MB;
+    }
+
+    LZ4F_compressionContext_t ctx;
+    ret = LZ4F_createCompressionContext(&ctx, LZ4F_VERSION);
+    if (LZ4F_isError(ret)) {
+        ErrMsgPrintf(errmsg, "LZ4F_createCompressionContext %s",
+                     LZ4F_getErrorName(ret));
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+
+    /* Large enough for the frame header, any single chunk and the frame
+     * footer. */
+    dst_size = LZ4F_compressBound(MEGABYTE, &lz4_pref) +
+               LZ4F_HEADER_SIZE_MAX_RAFT;
+    dst = raft_malloc(dst_size);
+    if (dst == NULL) {
+        rv = RAFT_NOMEM;
+        goto err_after_ctx_alloc;
+    }
+
+    ret = LZ4F_compressBegin(ctx, dst, dst_size, &lz4_pref);
+    if (LZ4F_isError(ret)) {
+        ErrMsgPrintf(errmsg, "LZ4F_compressBegin %s", LZ4F_getErrorName(ret));
+        rv = RAFT_IOERR;
+        goto err_after_buff_alloc;
+    }
+    rv = write(arg, dst, ret);
+    if (rv != 0) {
+        goto err_after_buff_alloc;
+    }
+
+    for (unsigned i = 0; i < n_bufs; ++i) {
+        src_offset = 0;
+        while (src_offset < bufs[i].len) {
+            src_size = min(bufs[i].len - src_offset, (size_t)MEGABYTE);
+            ret = LZ4F_compressUpdate(ctx, dst, dst_size,
+                                      (char*)bufs[i].base + src_offset,
+                                      src_size, NULL);
+            if (LZ4F_isError(ret)) {
+                ErrMsgPrintf(errmsg, "LZ4F_compressUpdate %s",
+                             LZ4F_getErrorName(ret));
+                rv = RAFT_IOERR;
+                goto err_after_buff_alloc;
+            }
+            if (ret > 0) {
+                rv = write(arg, dst, ret);
+                if (rv != 0) {
+                    goto err_after_buff_alloc;
+                }
+            }
+            src_offset += src_size;
+        }
+    }
+
+    ret = LZ4F_compressEnd(ctx, dst, dst_size, NULL);
+    if (LZ4F_isError(ret)) {
+        ErrMsgPrintf(errmsg, "LZ4F_compressEnd %s", LZ4F_getErrorName(ret));
+        rv = RAFT_IOERR;
+        goto err_after_buff_alloc;
+    }
+    rv = write(arg, dst, ret);
+
+err_after_buff_alloc:
+    raft_free(dst);
+err_after_ctx_alloc:
+    LZ4F_freeCompressionContext(ctx);
+err:
+    return rv;
+#endif /* LZ4_AVAILABLE */
+}
+
 int Decompress(struct raft_buffer buf, struct raft_buffer *decompressed,
                char *errmsg)
 {
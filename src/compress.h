@@ -17,6 +17,18 @@
 int Compress(struct raft_buffer bufs[], unsigned n_bufs,
              struct raft_buffer *compressed, char *errmsg);
 
+/*
+ * Compresses the content of `bufs` chunk by chunk, passing each compressed
+ * chunk to `write` as soon as it's produced. Only a scratch buffer bounded by
+ * the chunk size is allocated. If `independent` is set, the frame is made of
+ * independent 1MB blocks, each of which can be decoded on its own. Returns a
+ * non-0 value upon failure, including when `write` fails.
+ */
+int CompressStream(struct raft_buffer bufs[], unsigned n_bufs,
+                   bool independent,
+                   int (*write)(void *arg, const void *buf, size_t len),
+                   void *arg, char *errmsg);
+
 /*
  * Decompresses the content of `buf` into a newly allocated buffer that is
  * returned to the caller through `decompressed`. Returns a non-0 value upon
@@ -1,14 +1,20 @@
 #include "convert.h"
 
+#include "adaptive.h"
 #include "assert.h"
 #include "configuration.h"
 #include "election.h"
+#include "forward.h"
 #include "log.h"
 #include "membership.h"
+#include "pack.h"
 #include "progress.h"
+#include "publish.h"
 #include "queue.h"
+#include "read.h"
 #include "request.h"
 #include "replication.h"
+#include "snapshot_transfer.h"
 #include "tracing.h"
 #include "event.h"
 
@@ -43,6 +49,8 @@ static void convertClearFollower(struct raft *r)
     r->follower_state.current_leader.snapshot_index = 0;
     r->follower_state.current_leader.trailing = 0;
     r->follower_aux.match_leader = false;
+    readCancel(r, RAFT_CANCELED);
+    forwardCancel(r, RAFT_LEADERSHIPLOST);
 }
 
 /* Clear candidate state. */
@@ -56,8 +64,8 @@ static void convertClearCandidate(struct raft *r)
 
 static void convertFailApply(struct raft_apply *req)
 {
-    if (req != NULL && req->cb != NULL) {
-        req->cb(req, RAFT_LEADERSHIPLOST, NULL);
+    if (req != NULL) {
+        packFireApply(req, RAFT_LEADERSHIPLOST, NULL, false, 0);
     }
 }
 
@@ -78,12 +86,15 @@ static void convertFailChange(struct raft_change *req)
 /* Clear leader state. */
 static void convertClearLeader(struct raft *r)
 {
+    snapshotTransferAbortAll(r);
+
     if (r->leader_state.progress != NULL) {
         raft_free(r->leader_state.progress);
         r->leader_state.progress = NULL;
     }
 
     /* Fail all outstanding requests */
+    packCancel(r, RAFT_LEADERSHIPLOST);
     while (requestRegNumRequests(&r->leader_state.reg)) {
         struct request *req = requestRegDequeue(&r->leader_state.reg);
 	if (req == NULL)
@@ -137,6 +148,7 @@ void convertToFollower(struct raft *r)
     r->follower_state.current_leader.id = 0;
     r->follower_state.current_leader.snapshot_index = 0;
     r->follower_state.current_leader.trailing = r->snapshot.trailing;
+    publishUpdate(r);
     if (r->state_change_cb)
 		r->state_change_cb(r, RAFT_FOLLOWER);
 }
@@ -254,6 +266,7 @@ int convertToCandidate(struct raft *r, bool disrupt_leader)
         evtErrf("E-1528-125", "raft(%llx) election start failed", r->id, rv);
         return rv;
     }
+    publishUpdate(r);
     if (r->state_change_cb)
 		r->state_change_cb(r, RAFT_CANDIDATE);
     return 0;
@@ -268,6 +281,7 @@ int convertToLeader(struct raft *r)
 
     /* Reset timers */
     r->election_timer_start = r->io->time(r->io);
+    adaptiveReset(r);
 
     /* ReInit request registry */
     requestRegInit(&r->leader_state.reg);
@@ -292,6 +306,7 @@ int convertToLeader(struct raft *r)
     r->leader_state.replica_sync_between_min_max_timeout = 0;
 
 
+    publishUpdate(r);
     if (r->state_change_cb)
 		r->state_change_cb(r, RAFT_LEADER);
     return 0;
@@ -305,6 +320,7 @@ void convertToUnavailable(struct raft *r)
     }
     convertClear(r);
     convertSetState(r, RAFT_UNAVAILABLE);
+    publishUpdate(r);
     if (r->state_change_cb)
 		r->state_change_cb(r, RAFT_UNAVAILABLE);
 }
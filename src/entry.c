@@ -50,10 +50,62 @@ void entryNonBatchDestroyPrefix(struct raft_entry *entries,
 }
 
 
+unsigned short entryEncodedType(const struct raft_entry *entry)
+{
+    if (entry->type == RAFT_SEGMENTS) {
+        return RAFT_COMMAND;
+    }
+    return entry->type;
+}
+
+void entryDataCopy(const struct raft_entry *entry, void *dst)
+{
+    const struct raft_segments *segs;
+    uint8_t *cursor = dst;
+    unsigned i;
+
+    if (entry->type != RAFT_SEGMENTS) {
+        if (entry->buf.len > 0) {
+            memcpy(dst, entry->buf.base, entry->buf.len);
+        }
+        return;
+    }
+
+    segs = entry->buf.base;
+    for (i = 0; i < segs->n; i++) {
+        if (segs->bufs[i].len > 0) {
+            memcpy(cursor, segs->bufs[i].base, segs->bufs[i].len);
+            cursor += segs->bufs[i].len;
+        }
+    }
+}
+
+void entryDataFree(unsigned short type, void *base)
+{
+    struct raft_segments *segs;
+    unsigned i;
+
+    if (base == NULL) {
+        return;
+    }
+    if (type != RAFT_SEGMENTS) {
+        raft_entry_free(base);
+        return;
+    }
+
+    segs = base;
+    for (i = 0; i < segs->n; i++) {
+        if (segs->bufs[i].base != NULL) {
+            raft_entry_free(segs->bufs[i].base);
+        }
+    }
+    raft_free(segs);
+}
+
 int entryCopy(const struct raft_entry *src, struct raft_entry *dst)
 {
     dst->term = src->term;
-    dst->type = src->type;
+    dst->type = entryEncodedType(src);
     dst->buf.len = src->buf.len;
     if (src->buf.len > 0) {
 	    dst->buf.base = raft_entry_malloc(dst->buf.len);
@@ -61,7 +113,7 @@ int entryCopy(const struct raft_entry *src, struct raft_entry *dst)
                 evtErrf("E-1528-139", "%s", "entry malloc");
                 return RAFT_NOMEM;
 	    }
-	    memcpy(dst->buf.base, src->buf.base, dst->buf.len);
+	    entryDataCopy(src, dst->buf.base);
     } else {
 	    dst->buf.base = NULL;
     }
@@ -109,12 +161,12 @@ int entryBatchCopy(const struct raft_entry *src,
 
     for (i = 0; i < n; i++) {
         (*dst)[i].term = src[i].term;
-        (*dst)[i].type = src[i].type;
+        (*dst)[i].type = entryEncodedType(&src[i]);
         (*dst)[i].buf.base = cursor;
         (*dst)[i].buf.len = src[i].buf.len;
         (*dst)[i].batch = batch;
 	if (src[i].buf.len > 0) {
-		memcpy((*dst)[i].buf.base, src[i].buf.base, src[i].buf.len);
+		entryDataCopy(&src[i], (*dst)[i].buf.base);
 		cursor += src[i].buf.len;
 	} else {
 		(*dst)[i].buf.base = NULL;
@@ -12,11 +12,23 @@ void entryNonBatchDestroyPrefix(struct raft_entry *entries,
                                size_t n,
                                size_t prefix);
 
-/* Create a copy of a log entry, including its data. */
+/* Type of the given entry as written to disk and sent to other servers. */
+unsigned short entryEncodedType(const struct raft_entry *entry);
+
+/* Copy the data of the given entry into @dst, which must have room for
+ * entry->buf.len bytes. */
+void entryDataCopy(const struct raft_entry *entry, void *dst);
+
+/* Release the data of an entry of the given type that does not belong to a
+ * batch. */
+void entryDataFree(unsigned short type, void *base);
+
+/* Create a copy of a log entry, including its data. The data of a
+ * #RAFT_SEGMENTS entry is concatenated into a #RAFT_COMMAND entry. */
 int entryCopy(const struct raft_entry *src, struct raft_entry *dst);
 
 /* Create a single batch of entries containing a copy of the given entries,
- * including their data. */
+ * including their data, concatenating the data of #RAFT_SEGMENTS entries. */
 int entryBatchCopy(const struct raft_entry *src,
                    struct raft_entry **dst,
                    size_t n);
@@ -1,9 +1,13 @@
 #include "../include/raft/fixture.h"
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "assert.h"
 #include "configuration.h"
@@ -31,7 +35,7 @@
 #define DISK_LATENCY 10
 
 /* To keep in sync with raft.h */
-#define N_MESSAGE_TYPES 7
+#define N_MESSAGE_TYPES 11
 
 /* Maximum number of peer stub instances connected to a certain stub
  * instance. This should be enough for testing purposes. */
@@ -44,7 +48,16 @@
     queue queue                /* Link the I/O pending requests queue. */
 
 /* Request type codes. */
-enum { APPEND = 1, SEND, TRANSMIT, SNAPSHOT_PUT, SNAPSHOT_GET };
+enum {
+    APPEND = 1,
+    SEND,
+    TRANSMIT,
+    SNAPSHOT_PUT,
+    SNAPSHOT_GET,
+    SNAPSHOT_READ,
+    SNAPSHOT_WRITE,
+    ENTRIES_READ
+};
 
 /* Abstract base type for an asynchronous request submitted to the stub I/o
  * implementation. */
@@ -88,6 +101,39 @@ struct snapshot_get
     struct raft_io_snapshot_get *req;
 };
 
+/* Pending request to read a chunk of a file-based snapshot. */
+struct snapshot_read
+{
+    REQUEST;
+    struct raft_io_snapshot_read *req;
+    const struct raft_snapshot *snapshot;
+    unsigned file;
+    unsigned long long offset;
+    struct raft_buffer *buf;
+};
+
+/* Pending request to write a chunk of a file-based snapshot being received. */
+struct snapshot_write
+{
+    REQUEST;
+    struct raft_io_snapshot_write *req;
+    raft_term term;
+    raft_index index;
+    unsigned file;
+    char name[RAFT_SNAPSHOT_NAME_LEN];
+    unsigned long long offset;
+    const struct raft_buffer *buf;
+};
+
+/* Pending request to read persisted entries. */
+struct entries_read
+{
+    REQUEST;
+    struct raft_io_entries_read *req;
+    raft_index index;
+    unsigned max;
+};
+
 /* Message that has been written to the network and is waiting to be delivered
  * (or discarded). */
 struct transmit
@@ -119,6 +165,12 @@ struct io
 
     /* Log */
     struct raft_snapshot *snapshot; /* Latest snapshot */
+    struct
+    {
+        char *dir;         /* Files of a snapshot being received, or NULL */
+        raft_term term;    /* Term of the snapshot being received */
+        raft_index index;  /* Index of the snapshot being received */
+    } stage;
     struct raft_entry *entries;     /* Array or persisted entries */
     size_t n;                       /* Size of the persisted entries array */
 
@@ -244,7 +296,79 @@ static void ioFlushAppend(struct io *s, struct append *append)
     raft_free(append);
 }
 
-/* Flush a snapshot put request, copying the snapshot data. */
+/* Remove all files in @dir and @dir itself. */
+static void ioRemoveDir(const char *dir)
+{
+    char path[1024];
+    struct dirent *e;
+    DIR *d;
+
+    d = opendir(dir);
+    if (d == NULL) {
+        return;
+    }
+    while ((e = readdir(d)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
+            continue;
+        }
+        snprintf(path, sizeof path, "%s/%s", dir, e->d_name);
+        unlink(path);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+/* Release a stored snapshot, along with its files if it's file-based. */
+static void ioSnapshotClose(struct raft_snapshot *snapshot)
+{
+    if (snapshotHasFiles(snapshot) && snapshot->dir != NULL) {
+        ioRemoveDir(snapshot->dir);
+    }
+    snapshotClose(snapshot);
+}
+
+/* Fill the file list of a stored file-based snapshot. Names that don't fit in
+ * a file entry are rejected rather than truncated. */
+static int ioListSnapshotFiles(struct raft_snapshot *snapshot)
+{
+    char path[1024];
+    struct dirent *e;
+    struct stat st;
+    DIR *d;
+
+    raft_free(snapshot->files);
+    snapshot->files = NULL;
+    snapshot->n_files = 0;
+
+    d = opendir(snapshot->dir);
+    assert(d != NULL);
+    while ((e = readdir(d)) != NULL) {
+        struct raft_snapshot_file *file;
+        size_t len = strlen(e->d_name);
+        snprintf(path, sizeof path, "%s/%s", snapshot->dir, e->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (len >= RAFT_SNAPSHOT_NAME_LEN) {
+            closedir(d);
+            return RAFT_INVALID;
+        }
+        snapshot->files = raft_realloc(
+            snapshot->files, (snapshot->n_files + 1) * sizeof *snapshot->files);
+        assert(snapshot->files != NULL);
+        file = &snapshot->files[snapshot->n_files];
+        memset(file->name, 0, sizeof file->name);
+        memcpy(file->name, e->d_name, len);
+        file->size = (unsigned long long)st.st_size;
+        snapshot->n_files++;
+    }
+    closedir(d);
+    return 0;
+}
+
+/* Flush a snapshot put request, copying the snapshot data. File-based
+ * snapshots are stored in place, adopting the staged files if no directory is
+ * given. */
 static void ioFlushSnapshotPut(struct io *s, struct snapshot_put *r)
 {
     int rv;
@@ -253,12 +377,32 @@ static void ioFlushSnapshotPut(struct io *s, struct snapshot_put *r)
         s->snapshot = raft_malloc(sizeof *s->snapshot);
         assert(s->snapshot != NULL);
     } else {
-        snapshotClose(s->snapshot);
+        ioSnapshotClose(s->snapshot);
     }
 
     rv = snapshotCopy(r->snapshot, s->snapshot);
     assert(rv == 0);
 
+    if (snapshotHasFiles(s->snapshot)) {
+        if (s->snapshot->dir == NULL) {
+            assert(s->stage.dir != NULL);
+            assert(s->stage.index == s->snapshot->index);
+            s->snapshot->dir = s->stage.dir;
+            s->stage.dir = NULL;
+        }
+        rv = ioListSnapshotFiles(s->snapshot);
+        if (rv != 0) {
+            ioSnapshotClose(s->snapshot);
+            raft_free(s->snapshot);
+            s->snapshot = NULL;
+            if (r->req->cb != NULL) {
+                r->req->cb(r->req, rv);
+            }
+            raft_free(r);
+            return;
+        }
+    }
+
     if (r->trailing == 0) {
         rv = s->io->truncate(s->io, 1);
         assert(rv == 0);
@@ -284,6 +428,87 @@ static void ioFlushSnapshotGet(struct io *s, struct snapshot_get *r)
     raft_free(r);
 }
 
+/* Flush a snapshot read request, reading the chunk from its file. */
+static void ioFlushSnapshotRead(struct io *s, struct snapshot_read *r)
+{
+    char path[1024];
+    ssize_t n = -1;
+    int fd;
+    (void)s;
+
+    snprintf(path, sizeof path, "%s/%s", r->snapshot->dir,
+             r->snapshot->files[r->file].name);
+    fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        n = pread(fd, r->buf->base, r->buf->len, (off_t)r->offset);
+        close(fd);
+    }
+    if (n >= 0) {
+        r->buf->len = (size_t)n;
+    }
+    r->req->cb(r->req, n >= 0 ? 0 : RAFT_IOERR);
+    raft_free(r);
+}
+
+/* Flush a snapshot write request, writing the chunk to the staging area. */
+static void ioFlushSnapshotWrite(struct io *s, struct snapshot_write *r)
+{
+    char path[1024];
+    ssize_t n = -1;
+    int fd;
+
+    /* Discard whatever was staged for another snapshot, or for this one if
+     * the transfer started over. */
+    if (s->stage.dir != NULL &&
+        (s->stage.term != r->term || s->stage.index != r->index ||
+         (r->file == 0 && r->offset == 0))) {
+        ioRemoveDir(s->stage.dir);
+        raft_free(s->stage.dir);
+        s->stage.dir = NULL;
+    }
+    if (s->stage.dir == NULL) {
+        s->stage.dir = raft_malloc(sizeof "/tmp/raft-fixture-XXXXXX");
+        assert(s->stage.dir != NULL);
+        strcpy(s->stage.dir, "/tmp/raft-fixture-XXXXXX");
+        if (mkdtemp(s->stage.dir) == NULL) {
+            assert(0);
+        }
+        s->stage.term = r->term;
+        s->stage.index = r->index;
+    }
+
+    snprintf(path, sizeof path, "%s/%s", s->stage.dir, r->name);
+    fd = open(path, O_WRONLY | O_CREAT | (r->offset == 0 ? O_TRUNC : 0), 0600);
+    if (fd >= 0) {
+        n = pwrite(fd, r->buf->base, r->buf->len, (off_t)r->offset);
+        close(fd);
+    }
+    r->req->cb(r->req, n == (ssize_t)r->buf->len ? 0 : RAFT_IOERR);
+    raft_free(r);
+}
+
+/* Flush an entries read request, copying the persisted entries. */
+static void ioFlushEntriesRead(struct io *s, struct entries_read *r)
+{
+    struct raft_entry *entries;
+    size_t n;
+    int rv;
+
+    if (r->index == 0 || r->index > s->n) {
+        r->req->cb(r->req, NULL, 0, RAFT_NOTFOUND);
+        raft_free(r);
+        return;
+    }
+    n = s->n - (size_t)(r->index - 1);
+    if (n > r->max) {
+        n = r->max;
+    }
+    rv = entryBatchCopy(&s->entries[r->index - 1], &entries, n);
+    assert(rv == 0);
+    r->req->cb(r->req, entries, (unsigned)n, 0);
+    raft_free(r);
+}
+
 /* Search for the peer with the given ID. */
 static struct peer *ioGetPeer(struct io *io, raft_id id)
 {
@@ -319,6 +544,22 @@ static void copyInstallSnapshot(const struct raft_install_snapshot *src,
     assert(dst->data.base != NULL);
     memcpy(dst->data.base, src->data.base, src->data.len);
 }
+
+/* Copy the dynamically allocated memory of an InstallSnapshotChunk message. */
+static void copyInstallSnapshotChunk(
+    const struct raft_install_snapshot_chunk *src,
+    struct raft_install_snapshot_chunk *dst)
+{
+    int rv;
+    rv = configurationCopy(&src->conf, &dst->conf);
+    assert(rv == 0);
+    dst->data.base = NULL;
+    if (src->data.len > 0) {
+        dst->data.base = raft_malloc(dst->data.len);
+        assert(dst->data.base != NULL);
+        memcpy(dst->data.base, src->data.base, src->data.len);
+    }
+}
 static void mockLoadEntries(struct io *io, struct raft_append_entries *dst, bool *flag)
 {
     unsigned i;
@@ -378,6 +619,16 @@ static void ioFlushSend(struct io *io, struct send *send)
         case RAFT_IO_INSTALL_SNAPSHOT:
             copyInstallSnapshot(&src->install_snapshot, &dst->install_snapshot);
             break;
+        case RAFT_IO_INSTALL_SNAPSHOT_CHUNK:
+            copyInstallSnapshotChunk(&src->install_snapshot_chunk,
+                                     &dst->install_snapshot_chunk);
+            break;
+        case RAFT_IO_FORWARD:
+            dst->forward.data.base = raft_malloc(src->forward.data.len);
+            assert(dst->forward.data.base != NULL);
+            memcpy(dst->forward.data.base, src->forward.data.base,
+                   src->forward.data.len);
+            break;
     }
 
     io->n_send[send->message.type]++;
@@ -385,7 +636,10 @@ static void ioFlushSend(struct io *io, struct send *send)
     if (src->type == RAFT_IO_APPEND_ENTRIES) {
         for (i = 0; i < src->append_entries.n_entries; i++)
             if (flags[i] == true){
+                /* The entries array may be shared with other requests. */
                 raft_entry_free(src->append_entries.entries[i].buf.base);
+                src->append_entries.entries[i].buf.base = NULL;
+                src->append_entries.entries[i].buf.len = 0;
             }
     }
     raft_free(flags);
@@ -413,6 +667,13 @@ static void ioDestroyTransmit(struct transmit *transmit)
             raft_configuration_close(&message->install_snapshot.conf);
             raft_free(message->install_snapshot.data.base);
             break;
+        case RAFT_IO_INSTALL_SNAPSHOT_CHUNK:
+            raft_configuration_close(&message->install_snapshot_chunk.conf);
+            raft_free(message->install_snapshot_chunk.data.base);
+            break;
+        case RAFT_IO_FORWARD:
+            raft_free(message->forward.data.base);
+            break;
     }
     raft_free(transmit);
 }
@@ -444,6 +705,15 @@ static void ioFlushAll(struct io *io)
             case SNAPSHOT_GET:
                 ioFlushSnapshotGet(io, (struct snapshot_get *)r);
                 break;
+            case SNAPSHOT_READ:
+                ioFlushSnapshotRead(io, (struct snapshot_read *)r);
+                break;
+            case SNAPSHOT_WRITE:
+                ioFlushSnapshotWrite(io, (struct snapshot_write *)r);
+                break;
+            case ENTRIES_READ:
+                ioFlushEntriesRead(io, (struct entries_read *)r);
+                break;
             default:
                 assert(0);
         }
@@ -695,6 +965,91 @@ static int ioMethodSnapshotGet(struct raft_io *raft_io,
     return 0;
 }
 
+static int ioMethodSnapshotRead(struct raft_io *raft_io,
+                                struct raft_io_snapshot_read *req,
+                                const struct raft_snapshot *snapshot,
+                                unsigned file,
+                                unsigned long long offset,
+                                struct raft_buffer *buf,
+                                raft_io_snapshot_read_cb cb)
+{
+    struct io *io = raft_io->impl;
+    struct snapshot_read *r;
+
+    r = raft_malloc(sizeof *r);
+    assert(r != NULL);
+
+    r->type = SNAPSHOT_READ;
+    r->req = req;
+    r->req->cb = cb;
+    r->snapshot = snapshot;
+    r->file = file;
+    r->offset = offset;
+    r->buf = buf;
+    r->completion_time = *io->time + io->disk_latency;
+
+    QUEUE_PUSH(&io->requests, &r->queue);
+
+    return 0;
+}
+
+static int ioMethodSnapshotWrite(struct raft_io *raft_io,
+                                 struct raft_io_snapshot_write *req,
+                                 raft_term term,
+                                 raft_index index,
+                                 unsigned file,
+                                 const char *name,
+                                 unsigned long long offset,
+                                 const struct raft_buffer *buf,
+                                 raft_io_snapshot_write_cb cb)
+{
+    struct io *io = raft_io->impl;
+    struct snapshot_write *r;
+
+    r = raft_malloc(sizeof *r);
+    assert(r != NULL);
+
+    r->type = SNAPSHOT_WRITE;
+    r->req = req;
+    r->req->cb = cb;
+    r->term = term;
+    r->index = index;
+    r->file = file;
+    memset(r->name, 0, sizeof r->name);
+    strncpy(r->name, name, sizeof r->name - 1);
+    r->offset = offset;
+    r->buf = buf;
+    r->completion_time = *io->time + io->disk_latency;
+
+    QUEUE_PUSH(&io->requests, &r->queue);
+
+    return 0;
+}
+
+static int ioMethodEntriesRead(struct raft_io *raft_io,
+                               struct raft_io_entries_read *req,
+                               raft_index index,
+                               unsigned max,
+                               raft_io_entries_read_cb cb)
+{
+    struct io *io = raft_io->impl;
+    struct entries_read *r;
+
+    r = raft_malloc(sizeof *r);
+    assert(r != NULL);
+
+    r->type = ENTRIES_READ;
+    r->req = req;
+    r->req->cb = cb;
+    r->index = index;
+    r->max = max;
+    r->completion_time = *io->time + io->disk_latency;
+
+    QUEUE_PUSH(&io->requests, &r->queue);
+
+    return 0;
+}
+
 static raft_time ioMethodTime(struct raft_io *raft_io)
 {
     struct io *io = raft_io->impl;
@@ -862,6 +1217,9 @@ static int ioInit(struct raft_io *raft_io, unsigned index, raft_time *time)
     io->term = 0;
     io->voted_for = 0;
     io->snapshot = NULL;
+    io->stage.dir = NULL;
+    io->stage.term = 0;
+    io->stage.index = 0;
     io->entries = NULL;
     io->n = 0;
     QUEUE_INIT(&io->requests);
@@ -878,6 +1236,7 @@ static int ioInit(struct raft_io *raft_io, unsigned index, raft_time *time)
     io->n_append = 0;
 
     raft_io->impl = io;
+    raft_io->version = 4;
     raft_io->init = ioMethodInit;
     raft_io->close = ioMethodClose;
     raft_io->start = ioMethodStart;
@@ -892,6 +1251,10 @@ static int ioInit(struct raft_io *raft_io, unsigned index, raft_time *time)
     raft_io->send = ioMethodSend;
     raft_io->snapshot_put = ioMethodSnapshotPut;
     raft_io->snapshot_get = ioMethodSnapshotGet;
+    raft_io->snapshot_read = ioMethodSnapshotRead;
+    raft_io->snapshot_write = ioMethodSnapshotWrite;
+    raft_io->entries_read = ioMethodEntriesRead;
+    raft_io->durable_index = NULL; /* Appends are durable once completed */
     raft_io->time = ioMethodTime;
     raft_io->time_us = ioMethodTime;
     raft_io->random = ioMethodRandom;
@@ -913,9 +1276,13 @@ void ioClose(struct raft_io *raft_io)
         raft_free(io->entries);
     }
     if (io->snapshot != NULL) {
-        snapshotClose(io->snapshot);
+        ioSnapshotClose(io->snapshot);
         raft_free(io->snapshot);
     }
+    if (io->stage.dir != NULL) {
+        ioRemoveDir(io->stage.dir);
+        raft_free(io->stage.dir);
+    }
     raft_free(io);
 }
 
@@ -983,6 +1350,7 @@ int raft_fixture_init(struct raft_fixture *f, unsigned n, struct raft_fsm *fsms)
 
     f->time = 0;
     f->n = n;
+    f->leader_id = 0;
 
     /* Initialize all servers */
     for (i = 0; i < n; i++) {
@@ -1218,6 +1586,51 @@ static bool updateLeaderAndCheckElectionSafety(struct raft_fixture *f)
     return changed;
 }
 
+/* Return the data of the given entry, concatenating it into @tmp if the entry
+ * is made of segments. */
+static const void *entryData(const struct raft_entry *entry, void **tmp)
+{
+    *tmp = NULL;
+    if (entry->type != RAFT_SEGMENTS) {
+        return entry->buf.base;
+    }
+    *tmp = raft_malloc(entry->buf.len > 0 ? entry->buf.len : 1);
+    assert(*tmp != NULL);
+    entryDataCopy(entry, *tmp);
+    return *tmp;
+}
+
+/* Whether two entries have the same term, type and data, where a
+ * #RAFT_SEGMENTS entry matches the equivalent #RAFT_COMMAND one. */
+static bool entryEqual(const struct raft_entry *entry1,
+                       const struct raft_entry *entry2)
+{
+    const void *data1;
+    const void *data2;
+    void *tmp1;
+    void *tmp2;
+    bool equal;
+
+    if (entry1->term != entry2->term ||
+        entryEncodedType(entry1) != entryEncodedType(entry2) ||
+        entry1->buf.len != entry2->buf.len) {
+        return false;
+    }
+    if (entry1->buf.len == 0) {
+        return true;
+    }
+    data1 = entryData(entry1, &tmp1);
+    data2 = entryData(entry2, &tmp2);
+    equal = memcmp(data1, data2, entry1->buf.len) == 0;
+    if (tmp1 != NULL) {
+        raft_free(tmp1);
+    }
+    if (tmp2 != NULL) {
+        raft_free(tmp2);
+    }
+    return equal;
+}
+
 /* Check for leader append-only.
  *
  * From figure 3.2:
@@ -1247,7 +1660,6 @@ static void checkLeaderAppendOnly(struct raft_fixture *f)
     for (index = 1; index <= last; index++) {
         const struct raft_entry *entry1;
         const struct raft_entry *entry2;
-        size_t i;
 
         entry1 = logGet(&f->log, index);
         entry2 = logGet(&raft->log, index);
@@ -1261,12 +1673,7 @@ static void checkLeaderAppendOnly(struct raft_fixture *f)
         }
 
         /* Entry was not overwritten. */
-        assert(entry1->type == entry2->type);
-        assert(entry1->term == entry2->term);
-        for (i = 0; i < entry1->buf.len; i++) {
-            assert(((uint8_t *)entry1->buf.base)[i] ==
-                   ((uint8_t *)entry2->buf.base)[i]);
-        }
+        assert(entryEqual(entry1, entry2));
     }
 }
 
@@ -1298,11 +1705,12 @@ static void copyLeaderLog(struct raft_fixture *f)
 	    if (buf.len > 0) {
 		    buf.base = raft_entry_malloc(buf.len);
 		    assert(buf.base != NULL);
-		    memcpy(buf.base, entry->buf.base, buf.len);
+		    entryDataCopy(entry, buf.base);
 	    } else {
 		    buf.base = NULL;
         }
-        rv = logAppend(&f->log, entry->term, entry->type, &buf, NULL);
+        rv = logAppend(&f->log, entry->term, entryEncodedType(entry), &buf,
+                       NULL);
         assert(rv == 0);
     }
     logRelease(&raft->log, 1, entries, n);
@@ -1406,6 +1814,18 @@ static void completeRequest(struct raft_fixture *f, unsigned i, raft_time t)
             ioFlushSnapshotGet(io, (struct snapshot_get *)r);
             f->event.type = RAFT_FIXTURE_DISK;
             break;
+        case SNAPSHOT_READ:
+            ioFlushSnapshotRead(io, (struct snapshot_read *)r);
+            f->event.type = RAFT_FIXTURE_DISK;
+            break;
+        case SNAPSHOT_WRITE:
+            ioFlushSnapshotWrite(io, (struct snapshot_write *)r);
+            f->event.type = RAFT_FIXTURE_DISK;
+            break;
+        case ENTRIES_READ:
+            ioFlushEntriesRead(io, (struct entries_read *)r);
+            f->event.type = RAFT_FIXTURE_DISK;
+            break;
         default:
             assert(0);
     }
@@ -2476,10 +2896,7 @@ static bool raft_fixture_entry_cmp(const struct raft_entry *dst,
 	assert(dst);
 	assert(src);
 
-	return dst->term == src->term
-		&& dst->type == src->type
-		&& dst->buf.len == src->buf.len
-		&& memcmp(dst->buf.base, src->buf.base, dst->buf.len) == 0;
+	return entryEqual(dst, src);
 }
 
 bool raft_fixture_log_cmp(struct raft_fixture *f, unsigned i, unsigned j)
@@ -0,0 +1,611 @@
+#include "forward.h"
+
+#include <string.h>
+
+#include "assert.h"
+#include "byte.h"
+#include "err.h"
+#include "event.h"
+#include "queue.h"
+#include "recv.h"
+#include "tracing.h"
+
+#ifdef ENABLE_TRACE
+#define tracef(...) Tracef(r->tracer, __VA_ARGS__)
+#else
+#define tracef(...)
+#endif
+
+#define FORWARD_REQS(R) ((queue *)&(R)->forward.reqs)
+#define FORWARD_BATCHES(R) ((queue *)&(R)->forward.batches)
+
+/* Size of the header of a batch and of each command in it. */
+#define FORWARD_HEADER_SIZE sizeof(uint64_t)
+
+/* Batch of commands sent to the leader, waiting for its result. While a
+ * request is queued or sent, its index field holds its number of commands. */
+struct forwardBatch
+{
+    unsigned long long id; /* Batch ID */
+    raft_id leader;        /* Leader the batch was sent to */
+    raft_time time;        /* When the batch was sent */
+    queue reqs;            /* Requests of the commands in the batch */
+    queue queue;           /* Link in the list of sent batches */
+};
+
+/* Follower request to send a batch. */
+struct forwardSend
+{
+    struct raft *raft;
+    unsigned long long id;
+    void *buf;
+    size_t len; /* Used bytes of @buf */
+    size_t cap; /* Capacity of @buf */
+    unsigned n; /* Commands in @buf */
+    struct raft_io_send req;
+};
+
+/* Leader request to apply the commands of a batch. */
+struct forwardApply
+{
+    struct raft *raft;
+    raft_id from;
+    unsigned long long id;
+    struct raft_apply req;
+};
+
+/* Leader request to send the result of a batch. */
+struct forwardReply
+{
+    struct raft_io_send req;
+};
+
+void forwardInit(struct raft *r)
+{
+    r->forward.enabled = false;
+    r->forward.next_id = 1;
+    r->forward.buf = NULL;
+    r->forward.len = 0;
+    r->forward.cap = 0;
+    r->forward.n = 0;
+    r->forward.sending = false;
+    r->forward.nr_batches = 0;
+    QUEUE_INIT(FORWARD_REQS(r));
+    QUEUE_INIT(FORWARD_BATCHES(r));
+}
+
+void forwardClose(struct raft *r)
+{
+    assert(QUEUE_IS_EMPTY(FORWARD_REQS(r)));
+    assert(QUEUE_IS_EMPTY(FORWARD_BATCHES(r)));
+    raft_free(r->forward.buf);
+    r->forward.buf = NULL;
+}
+
+/* Move all elements of @from to the tail of @to. */
+static void forwardMove(queue *from, queue *to)
+{
+    queue *head;
+    while (!QUEUE_IS_EMPTY(from)) {
+        head = QUEUE_HEAD(from);
+        QUEUE_REMOVE(head);
+        QUEUE_PUSH(to, head);
+    }
+}
+
+/* Fire the callbacks of the given requests. If @status is 0 the commands of
+ * the requests start at @index. */
+static void forwardFire(queue *reqs, int status, raft_index index)
+{
+    struct raft_apply *req;
+    raft_index n;
+    queue *head;
+
+    while (!QUEUE_IS_EMPTY(reqs)) {
+        head = QUEUE_HEAD(reqs);
+        QUEUE_REMOVE(head);
+        req = QUEUE_DATA(head, struct raft_apply, queue);
+        n = req->index;
+        req->index = status == 0 ? index : 0;
+        index += n;
+        if (req->cb != NULL) {
+            req->cb(req, status, NULL);
+        }
+    }
+}
+
+/* Fail the requests whose commands are waiting to be sent. */
+static void forwardFailQueued(struct raft *r, int status)
+{
+    queue reqs;
+
+    QUEUE_INIT(&reqs);
+    forwardMove(FORWARD_REQS(r), &reqs);
+    r->forward.len = 0;
+    r->forward.n = 0;
+    forwardFire(&reqs, status, 0);
+}
+
+/* Remove a sent batch and complete its requests. */
+static void forwardFinish(struct forwardBatch *batch,
+                          int status,
+                          raft_index index)
+{
+    QUEUE_REMOVE(&batch->queue);
+    forwardFire(&batch->reqs, status, index);
+    raft_free(batch);
+}
+
+static struct forwardBatch *forwardFind(struct raft *r, unsigned long long id)
+{
+    struct forwardBatch *batch;
+    queue *head;
+
+    QUEUE_FOREACH(head, FORWARD_BATCHES(r))
+    {
+        batch = QUEUE_DATA(head, struct forwardBatch, queue);
+        if (batch->id == id) {
+            return batch;
+        }
+    }
+    return NULL;
+}
+
+bool forwardAccepts(struct raft *r, const unsigned n_segs[])
+{
+    return r->forward.enabled && r->state == RAFT_FOLLOWER && n_segs == NULL;
+}
+
+static int forwardFlush(struct raft *r);
+static void forwardSendCb(struct raft_io_send *req, int status)
+{
+    struct forwardSend *send = req->data;
+    struct raft *r = send->raft;
+    struct forwardBatch *batch;
+    int rv;
+
+    raft_free(send->buf);
+    r->forward.sending = false;
+    if (status != 0) {
+        batch = forwardFind(r, send->id);
+        if (batch != NULL) {
+            evtWarnf("W-1528-321", "raft(%llx) forward batch %llu failed %d",
+                     r->id, send->id, status);
+            forwardFinish(batch, RAFT_NOCONNECTION, 0);
+        }
+    }
+    raft_free(send);
+
+    /* Send the commands queued in the meantime. */
+    if (r->state == RAFT_FOLLOWER) {
+        rv = forwardFlush(r);
+        if (rv != 0) {
+            forwardFailQueued(r, rv);
+        }
+    }
+}
+
+/* Send the queued commands to the leader as a single batch. On failure the
+ * commands stay queued and no callback fires. */
+static int forwardFlush(struct raft *r)
+{
+    struct forwardBatch *batch;
+    struct forwardSend *send;
+    struct raft_message message;
+    raft_id leader = r->follower_state.current_leader.id;
+    void *cursor;
+    int rv;
+
+    if (r->forward.n == 0) {
+        return 0;
+    }
+    assert(!r->forward.sending);
+
+    if (r->state != RAFT_FOLLOWER || leader == 0) {
+        return RAFT_NOTLEADER;
+    }
+
+    batch = raft_malloc(sizeof *batch);
+    if (batch == NULL) {
+        goto oom;
+    }
+    send = raft_malloc(sizeof *send);
+    if (send == NULL) {
+        goto oom_after_batch_alloc;
+    }
+
+    cursor = r->forward.buf;
+    bytePut64(&cursor, r->forward.n);
+
+    batch->id = r->forward.next_id++;
+    batch->leader = leader;
+    batch->time = r->io->time(r->io);
+    QUEUE_INIT(&batch->reqs);
+    forwardMove(FORWARD_REQS(r), &batch->reqs);
+    QUEUE_PUSH(FORWARD_BATCHES(r), &batch->queue);
+
+    message.type = RAFT_IO_FORWARD;
+    message.server_id = leader;
+    message.forward.term = r->current_term;
+    message.forward.id = batch->id;
+    message.forward.data.base = r->forward.buf;
+    message.forward.data.len = r->forward.len;
+    tracef("forward %u commands to %llu", r->forward.n, leader);
+
+    send->raft = r;
+    send->id = batch->id;
+    send->buf = r->forward.buf;
+    send->req.data = send;
+    send->len = r->forward.len;
+    send->cap = r->forward.cap;
+    send->n = r->forward.n;
+    r->forward.buf = NULL;
+    r->forward.len = 0;
+    r->forward.cap = 0;
+    r->forward.n = 0;
+    r->forward.nr_batches += 1;
+
+    r->forward.sending = true;
+    rv = r->io->send(r->io, &send->req, &message, forwardSendCb);
+    if (rv != 0) {
+        evtWarnf("W-1528-322", "raft(%llx) forward send failed %d", r->id, rv);
+        /* Queue the commands back. */
+        r->forward.sending = false;
+        r->forward.buf = send->buf;
+        r->forward.len = send->len;
+        r->forward.cap = send->cap;
+        r->forward.n = send->n;
+        r->forward.nr_batches -= 1;
+        QUEUE_REMOVE(&batch->queue);
+        forwardMove(&batch->reqs, FORWARD_REQS(r));
+        raft_free(batch);
+        raft_free(send);
+        return RAFT_NOCONNECTION;
+    }
+    return 0;
+
+oom_after_batch_alloc:
+    raft_free(batch);
+oom:
+    evtErrf("E-1528-323", "raft(%llx) forward batch alloc failed", r->id);
+    return RAFT_NOMEM;
+}
+
+int forwardSubmit(struct raft *r,
+                  struct raft_apply *req,
+                  const struct raft_buffer bufs[],
+                  unsigned n,
+                  raft_apply_cb cb)
+{
+    size_t len;
+    size_t cap;
+    void *buf;
+    void *cursor;
+    unsigned i;
+    int rv;
+
+    if (r->follower_state.current_leader.id == 0) {
+        rv = RAFT_NOTLEADER;
+        ErrMsgFromCode(r->errmsg, rv);
+        evtErrf("E-1528-324", "raft(%llx) forward without leader", r->id);
+        return rv;
+    }
+
+    len = r->forward.n == 0 ? FORWARD_HEADER_SIZE : r->forward.len;
+    for (i = 0; i < n; i++) {
+        len += FORWARD_HEADER_SIZE + bytePad64(bufs[i].len);
+    }
+    if (len > r->forward.cap) {
+        cap = r->forward.cap == 0 ? 4096 : r->forward.cap;
+        while (cap < len) {
+            cap *= 2;
+        }
+        buf = raft_realloc(r->forward.buf, cap);
+        if (buf == NULL) {
+            rv = RAFT_NOMEM;
+            ErrMsgOom(r->errmsg);
+            evtErrf("E-1528-325", "raft(%llx) forward buffer alloc failed",
+                    r->id);
+            return rv;
+        }
+        r->forward.buf = buf;
+        r->forward.cap = cap;
+    }
+
+    if (r->forward.n == 0) {
+        r->forward.len = FORWARD_HEADER_SIZE;
+    }
+    cursor = (uint8_t *)r->forward.buf + r->forward.len;
+    for (i = 0; i < n; i++) {
+        bytePut64(&cursor, bufs[i].len);
+        if (bufs[i].len > 0) {
+            memcpy(cursor, bufs[i].base, bufs[i].len);
+            memset((uint8_t *)cursor + bufs[i].len, 0,
+                   bytePad64(bufs[i].len) - bufs[i].len);
+        }
+        cursor = (uint8_t *)cursor + bytePad64(bufs[i].len);
+    }
+    r->forward.len = len;
+    r->forward.n += n;
+
+    req->time = r->io->time(r->io);
+    req->type = RAFT_COMMAND;
+    req->index = n;
+    req->cb = cb;
+    QUEUE_PUSH(FORWARD_REQS(r), &req->queue);
+
+    /* Nothing else is queued when no batch is being sent, so a failure to send
+     * this one is returned, leaving the buffers to the caller. */
+    if (!r->forward.sending) {
+        rv = forwardFlush(r);
+        if (rv != 0) {
+            assert(r->forward.n == n);
+            QUEUE_REMOVE(&req->queue);
+            r->forward.len = 0;
+            r->forward.n = 0;
+            ErrMsgFromCode(r->errmsg, rv);
+            return rv;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        raft_entry_free(bufs[i].base);
+    }
+    return 0;
+}
+
+void forwardTick(struct raft *r)
+{
+    struct forwardBatch *batch;
+    raft_time now;
+    queue expired;
+    queue *head;
+    queue *next;
+
+    if (QUEUE_IS_EMPTY(FORWARD_BATCHES(r))) {
+        return;
+    }
+
+    /* Collect the batches first, since callbacks may send new ones. */
+    QUEUE_INIT(&expired);
+    now = r->io->time(r->io);
+    head = QUEUE_HEAD(FORWARD_BATCHES(r));
+    while (head != FORWARD_BATCHES(r)) {
+        next = QUEUE_NEXT(head);
+        batch = QUEUE_DATA(head, struct forwardBatch, queue);
+        if (batch->leader != r->follower_state.current_leader.id ||
+            now - batch->time >= 2 * (raft_time)r->election_timeout) {
+            QUEUE_REMOVE(head);
+            QUEUE_PUSH(&expired, head);
+        }
+        head = next;
+    }
+
+    while (!QUEUE_IS_EMPTY(&expired)) {
+        head = QUEUE_HEAD(&expired);
+        batch = QUEUE_DATA(head, struct forwardBatch, queue);
+        evtWarnf("W-1528-326", "raft(%llx) forward batch %llu to %llx expired",
+                 r->id, batch->id, batch->leader);
+        forwardFinish(batch,
+                      batch->leader != r->follower_state.current_leader.id
+                          ? RAFT_LEADERSHIPLOST
+                          : RAFT_NOCONNECTION,
+                      0);
+    }
+}
+
+void forwardCancel(struct raft *r, int status)
+{
+    struct forwardBatch *batch;
+    queue batches;
+    queue *head;
+
+    QUEUE_INIT(&batches);
+    forwardMove(FORWARD_BATCHES(r), &batches);
+    while (!QUEUE_IS_EMPTY(&batches)) {
+        head = QUEUE_HEAD(&batches);
+        batch = QUEUE_DATA(head, struct forwardBatch, queue);
+        forwardFinish(batch, status, 0);
+    }
+    forwardFailQueued(r, status);
+}
+
+static void forwardReplyCb(struct raft_io_send *req, int status)
+{
+    struct forwardReply *reply = req->data;
+    (void)status;
+    raft_free(reply);
+}
+
+/* Send the result of a batch back to the follower that forwarded it. */
+static void forwardReply(struct raft *r,
+                         raft_id to,
+                         unsigned long long id,
+                         int status,
+                         raft_index index)
+{
+    struct forwardReply *reply;
+    struct raft_message message;
+    int rv;
+
+    reply = raft_malloc(sizeof *reply);
+    if (reply == NULL) {
+        evtErrf("E-1528-327", "raft(%llx) forward reply alloc failed", r->id);
+        return;
+    }
+    reply->req.data = reply;
+
+    message.type = RAFT_IO_FORWARD_RESULT;
+    message.server_id = to;
+    message.forward_result.term = r->current_term;
+    message.forward_result.id = id;
+    message.forward_result.status = status;
+    message.forward_result.index = index;
+
+    rv = r->io->send(r->io, &reply->req, &message, forwardReplyCb);
+    if (rv != 0) {
+        evtWarnf("W-1528-328", "raft(%llx) forward reply to %llx failed %d",
+                 r->id, to, rv);
+        raft_free(reply);
+    }
+}
+
+static void forwardApplyCb(struct raft_apply *req, int status, void *result)
+{
+    struct forwardApply *apply = req->data;
+    struct raft *r = apply->raft;
+    (void)result;
+
+    if (r->state != RAFT_UNAVAILABLE) {
+        forwardReply(r, apply->from, apply->id, status,
+                     status == 0 ? req->index : 0);
+    }
+    raft_free(apply);
+}
+
+/* Decode the commands of a batch into newly allocated entry buffers. */
+static int forwardDecode(const struct raft_buffer *data,
+                         struct raft_buffer **bufs,
+                         unsigned *n)
+{
+    const void *cursor = data->base;
+    size_t left = data->len;
+    uint64_t count;
+    uint64_t len;
+    unsigned i;
+
+    if (left < FORWARD_HEADER_SIZE) {
+        return RAFT_MALFORMED;
+    }
+    count = byteGet64(&cursor);
+    left -= FORWARD_HEADER_SIZE;
+    if (count == 0 || count > left / FORWARD_HEADER_SIZE) {
+        return RAFT_MALFORMED;
+    }
+
+    *bufs = raft_calloc((size_t)count, sizeof **bufs);
+    if (*bufs == NULL) {
+        return RAFT_NOMEM;
+    }
+    for (i = 0; i < count; i++) {
+        if (left < FORWARD_HEADER_SIZE) {
+            goto malformed;
+        }
+        len = byteGet64(&cursor);
+        left -= FORWARD_HEADER_SIZE;
+        if (len > left || bytePad64((size_t)len) > left) {
+            goto malformed;
+        }
+        (*bufs)[i].len = (size_t)len;
+        (*bufs)[i].base = raft_entry_malloc((size_t)len);
+        if ((*bufs)[i].base == NULL) {
+            goto oom;
+        }
+        memcpy((*bufs)[i].base, cursor, (size_t)len);
+        cursor = (const uint8_t *)cursor + bytePad64((size_t)len);
+        left -= bytePad64((size_t)len);
+    }
+    *n = (unsigned)count;
+    return 0;
+
+malformed:
+    while (i > 0) {
+        raft_entry_free((*bufs)[--i].base);
+    }
+    raft_free(*bufs);
+    return RAFT_MALFORMED;
+oom:
+    while (i > 0) {
+        raft_entry_free((*bufs)[--i].base);
+    }
+    raft_free(*bufs);
+    return RAFT_NOMEM;
+}
+
+int recvForward(struct raft *r, raft_id id, struct raft_forward *args)
+{
+    struct forwardApply *apply;
+    struct raft_buffer *bufs;
+    unsigned n;
+    unsigned i;
+    int match;
+    int rv;
+
+    /* A batch sent in an older term was meant for an older leader. The reply
+     * carries the current term, which the follower adopts. */
+    recvCheckMatchingTerms(r, args->term, &match);
+    assert(match <= 0);
+    if (match < 0 || r->state != RAFT_LEADER || r->transfer != NULL ||
+        r->leader_state.removed_from_cluster) {
+        rv = RAFT_NOTLEADER;
+        goto reply;
+    }
+
+    rv = forwardDecode(&args->data, &bufs, &n);
+    if (rv != 0) {
+        evtWarnf("W-1528-329", "raft(%llx) decode forward from %llx failed %d",
+                 r->id, id, rv);
+        goto reply;
+    }
+
+    apply = raft_malloc(sizeof *apply);
+    if (apply == NULL) {
+        rv = RAFT_NOMEM;
+        goto err_after_decode;
+    }
+    apply->raft = r;
+    apply->from = id;
+    apply->id = args->id;
+    apply->req.data = apply;
+
+    tracef("apply %u commands forwarded by %llu", n, id);
+    rv = raft_apply(r, &apply->req, bufs, n, forwardApplyCb);
+    if (rv != 0) {
+        raft_free(apply);
+        goto err_after_decode;
+    }
+    raft_free(bufs);
+    raft_free(args->data.base);
+    return 0;
+
+err_after_decode:
+    for (i = 0; i < n; i++) {
+        raft_entry_free(bufs[i].base);
+    }
+    raft_free(bufs);
+reply:
+    raft_free(args->data.base);
+    forwardReply(r, id, args->id, rv, 0);
+    return 0;
+}
+
+int recvForwardResult(struct raft *r,
+                      raft_id id,
+                      const struct raft_forward_result *result)
+{
+    struct forwardBatch *batch;
+    int match;
+
+    recvCheckMatchingTerms(r, result->term, &match);
+    assert(match <= 0);
+    if (match < 0) {
+        tracef("ignore forward result %llu from older term %llu", result->id,
+               result->term);
+        return 0;
+    }
+
+    batch = forwardFind(r, result->id);
+    if (batch == NULL || batch->leader != id) {
+        tracef("ignore result of unknown forward batch %llu", result->id);
+        return 0;
+    }
+    forwardFinish(batch, result->status, result->index);
+    return 0;
+}
+
+void raft_set_forwarding(struct raft *r, bool enabled)
+{
+    r->forward.enabled = enabled;
+}
+
+#undef tracef
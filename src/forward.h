@@ -0,0 +1,40 @@
+/* Forwarding of commands submitted to followers to the leader. */
+
+#ifndef FORWARD_H_
+#define FORWARD_H_
+
+#include "../include/raft.h"
+
+/* Initialize the forwarding state of a raft instance. */
+void forwardInit(struct raft *r);
+
+/* Release the memory used by the forwarding state. */
+void forwardClose(struct raft *r);
+
+/* Whether a raft_apply() request submitted to this server should be forwarded
+ * to the leader. */
+bool forwardAccepts(struct raft *r, const unsigned n_segs[]);
+
+/* Queue the commands of a raft_apply() request for forwarding, taking
+ * ownership of their memory on success. */
+int forwardSubmit(struct raft *r,
+                  struct raft_apply *req,
+                  const struct raft_buffer bufs[],
+                  unsigned n,
+                  raft_apply_cb cb);
+
+/* Fail batches whose leader changed or whose result is overdue. */
+void forwardTick(struct raft *r);
+
+/* Fail all queued and sent forwarded requests with the given status. */
+void forwardCancel(struct raft *r, int status);
+
+/* Handle a batch of commands forwarded by a follower. */
+int recvForward(struct raft *r, raft_id id, struct raft_forward *args);
+
+/* Handle the result of a batch of commands forwarded to the leader. */
+int recvForwardResult(struct raft *r,
+                      raft_id id,
+                      const struct raft_forward_result *result);
+
+#endif /* FORWARD_H_ */
@@ -1,8 +1,10 @@
 #include "../include/raft.h"
 #include "request.h"
 #include "assert.h"
+#include "log.h"
 
 #define HOOK_MAX_BATCH_SIZE 128
+#define HOOK_MAX_SPAN_SIZE 64
 #ifndef min
 #define min(a, b) ((a) < (b) ? (a) : (b))
 #endif
@@ -223,4 +225,33 @@ unsigned hookMaxDynamicTrailing(struct raft *r, unsigned def)
 	if (r->hook->max_dynamic_trailing)
 		return r->hook->max_dynamic_trailing(r->hook);
 	return def;
-}
\ No newline at end of file
+}
+
+void hookEntriesAfterAppend(struct raft *r, raft_index index, unsigned n)
+{
+	struct raft_entry entries[HOOK_MAX_SPAN_SIZE];
+	const struct raft_entry *entry;
+	unsigned i;
+	unsigned k;
+
+	if (!r->hook->entries_after_append_fn) {
+		for (i = 0; i < n; ++i) {
+			entry = logGet(&r->log, index + i);
+			assert(entry);
+			r->hook->entry_after_append_fn(r->hook, index + i, entry);
+		}
+		return;
+	}
+
+	while (n > 0) {
+		k = min(n, HOOK_MAX_SPAN_SIZE);
+		for (i = 0; i < k; ++i) {
+			entry = logGet(&r->log, index + i);
+			assert(entry);
+			entries[i] = *entry;
+		}
+		r->hook->entries_after_append_fn(r->hook, index, k, entries);
+		index += k;
+		n -= k;
+	}
+}
@@ -24,4 +24,8 @@ bool hookEntryShouldApply(struct raft *r, raft_index index,
 
 unsigned hookMaxDynamicTrailing(struct raft *r, unsigned def);
 
+/* Invoke the after append hook for the @n entries starting at @index, using
+ * the range variant if set. */
+void hookEntriesAfterAppend(struct raft *r, raft_index index, unsigned n);
+
 #endif //HOOK_H
@@ -1,16 +1,21 @@
 #include "log.h"
 
+#include <limits.h>
 #include <string.h>
 #include <stdint.h>
 
 #include "../include/raft.h"
 #include "assert.h"
 #include "configuration.h"
+#include "entry.h"
 #include "event.h"
 
 #ifndef max
 #define max(a, b) ((a) < (b) ? (b) : (a))
 #endif
+
+/* Maximum number of entries passed to a single range hook invocation. */
+#define LOG_HOOK_SPAN 64
 /* Calculate the reference count hash table key for the given log entry index in
  * an hash table of the given size.
  *
@@ -42,6 +47,7 @@ static int refsTryInsert(struct raft_entry_ref *table,
                          const raft_term term,
                          const raft_index index,
                          const unsigned short count,
+                         const unsigned batch,
                          bool *collision)
 {
     struct raft_entry_ref *bucket;    /* Bucket associated with this index. */
@@ -110,6 +116,7 @@ fill:
     slot->term = term;
     slot->index = index;
     slot->count = count;
+    slot->batch = batch;
     slot->next = NULL;
 
     *collision = false;
@@ -145,7 +152,7 @@ static int refsMove(struct raft_entry_ref *bucket,
 
         /* Insert the reference count for this entry into the new table. */
         rv = refsTryInsert(table, size, slot->term, slot->index, slot->count,
-                           &collision);
+                           slot->batch, &collision);
 
         next_slot = slot->next;
 
@@ -242,7 +249,8 @@ static int refsInit(struct raft_log *l,
         bool collision;
         int rc;
 
-        rc = refsTryInsert(l->refs, l->refs_size, term, index, 1, &collision);
+        rc = refsTryInsert(l->refs, l->refs_size, term, index, 1, 0,
+                           &collision);
         if (rc != 0) {
             evtErrf("E-1528-145", "%s", "malloc");
             return RAFT_NOMEM;
@@ -263,10 +271,10 @@ static int refsInit(struct raft_log *l,
     return RAFT_NOMEM;
 }
 
-/* Increment the refcount of the entry with the given term and index. */
-static void refsIncr(struct raft_log *l,
-                     const raft_term term,
-                     const raft_index index)
+/* Return the refcount slot of the entry with the given term and index. */
+static struct raft_entry_ref *refsLookup(struct raft_log *l,
+                                         const raft_term term,
+                                         const raft_index index)
 {
     size_t key;                  /* Hash table key for the given index. */
     struct raft_entry_ref *slot; /* Slot for the given term/index */
@@ -289,15 +297,24 @@ static void refsIncr(struct raft_log *l,
         slot = slot->next;
     }
     assert(slot != NULL);
+    return slot;
+}
 
-    slot->count++;
+/* Increment the refcount of the entry with the given term and index. */
+static void refsIncr(struct raft_log *l,
+                     const raft_term term,
+                     const raft_index index)
+{
+    refsLookup(l, term, index)->count++;
 }
 
 /* Decrement the refcount of the entry with the given index. Return a boolean
- * indicating whether the entry has now zero references. */
+ * indicating whether the entry has now zero references, in which case @batch
+ * is set to the batch table item recorded for its payload, if any. */
 static bool refsDecr(struct raft_log *l,
                      const raft_term term,
-                     const raft_index index)
+                     const raft_index index,
+                     unsigned *batch)
 {
     size_t key;                       /* Hash table key for the given index. */
     struct raft_entry_ref *slot;      /* Slot for the given term/index */
@@ -329,6 +346,7 @@ static bool refsDecr(struct raft_log *l,
         /* The entry is still referenced. */
         return false;
     }
+    *batch = slot->batch;
 
     /* If the refcount has dropped to zero, delete the slot. */
     if (prev_slot != NULL) {
@@ -347,10 +365,211 @@ static bool refsDecr(struct raft_log *l,
     return true;
 }
 
+/* Return the position of the term run containing the entry with the given
+ * index, which must be in the log. */
+static size_t termsLocate(struct raft_log *l, raft_index index)
+{
+    size_t lo = 0;
+    size_t hi = l->n_terms;
+
+    assert(l->n_terms > 0);
+    assert(index >= l->terms[0].index);
+
+    /* Most lookups are for recent entries. */
+    if (index >= l->terms[l->n_terms - 1].index) {
+        return l->n_terms - 1;
+    }
+
+    /* Find the last run starting at or before the given index. */
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (l->terms[mid].index <= index) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Return the term of the entry with the given index, which must be in the
+ * log. */
+static raft_term termAt(struct raft_log *l, raft_index index)
+{
+    return l->terms[termsLocate(l, index)].term;
+}
+
+/* Ensure that there's room for a new run if an entry with the given term gets
+ * appended. */
+static int termsEnsure(struct raft_log *l, raft_term term)
+{
+    struct raft_log_term *terms;
+    size_t size;
+
+    if (l->n_terms > 0 && l->terms[l->n_terms - 1].term == term) {
+        return 0;
+    }
+    if (l->n_terms < l->terms_size) {
+        return 0;
+    }
+
+    size = l->terms_size == 0 ? 4 : l->terms_size * 2;
+    terms = raft_realloc(l->terms, size * sizeof *terms);
+    if (terms == NULL) {
+        evtErrf("E-1528-276", "%s", "realloc");
+        return RAFT_NOMEM;
+    }
+    l->terms = terms;
+    l->terms_size = size;
+    return 0;
+}
+
+/* Record that the entry with the given index has the given term. Entries must
+ * be recorded in index order. */
+static void termsPush(struct raft_log *l, raft_index index, raft_term term)
+{
+    if (l->n_terms > 0) {
+        assert(index > l->terms[l->n_terms - 1].index);
+        if (l->terms[l->n_terms - 1].term == term) {
+            return;
+        }
+    }
+    assert(l->n_terms < l->terms_size);
+    l->terms[l->n_terms].index = index;
+    l->terms[l->n_terms].term = term;
+    l->n_terms++;
+}
+
+/* Drop the runs of all entries from the given index onward. */
+static void termsRemoveSuffix(struct raft_log *l, raft_index index)
+{
+    while (l->n_terms > 0 && l->terms[l->n_terms - 1].index >= index) {
+        l->n_terms--;
+    }
+}
+
+/* Drop the runs of all entries before the given index. */
+static void termsRemovePrefix(struct raft_log *l, raft_index index)
+{
+    size_t n = 0;
+
+    while (n + 1 < l->n_terms && l->terms[n + 1].index <= index) {
+        n++;
+    }
+    if (n > 0) {
+        l->n_terms -= n;
+        memmove(l->terms, &l->terms[n], l->n_terms * sizeof *l->terms);
+    }
+}
+
+/* Ensure that there's at least one free item in the batch table. */
+static int batchesEnsure(struct raft_log *l)
+{
+    struct raft_log_batch *batches;
+    size_t size;
+    size_t i;
+
+    if (l->batches_free != 0) {
+        return 0;
+    }
+
+    size = l->batches_size == 0 ? 8 : l->batches_size * 2;
+    if (size >= (1U << 28)) {
+        evtErrf("E-1528-277", "too many batches %zu", l->batches_size);
+        return RAFT_TOOMANY;
+    }
+    batches = raft_realloc(l->batches, size * sizeof *batches);
+    if (batches == NULL) {
+        evtErrf("E-1528-278", "%s", "realloc");
+        return RAFT_NOMEM;
+    }
+
+    /* Link the new items into the free list. */
+    for (i = size; i > l->batches_size; i--) {
+        batches[i - 1].batch = NULL;
+        batches[i - 1].refs = (unsigned)l->batches_free;
+        l->batches_free = i;
+    }
+    l->batches = batches;
+    l->batches_size = size;
+    return 0;
+}
+
+/* Return the position plus one of the given batch in the batch table, taking a
+ * reference to it. Entries of the same batch are appended next to each other,
+ * so the batch of the previous slot is the only candidate to share. */
+static unsigned batchGet(struct raft_log *l,
+                         void *batch,
+                         const struct raft_log_slot *prev)
+{
+    struct raft_log_batch *item;
+    unsigned id;
+
+    if (batch == NULL) {
+        return 0;
+    }
+
+    if (prev != NULL && prev->batch != 0 &&
+        l->batches[prev->batch - 1].batch == batch) {
+        id = prev->batch;
+        l->batches[id - 1].refs++;
+        return id;
+    }
+
+    assert(l->batches_free != 0);
+    id = (unsigned)l->batches_free;
+    item = &l->batches[id - 1];
+    l->batches_free = item->refs;
+    item->batch = batch;
+    item->refs = 1;
+    item->entry = false;
+    return id;
+}
+
+/* Drop a reference to the batch at the given position plus one, releasing its
+ * memory if @destroy is true and there are no more references. */
+static void batchPut(struct raft_log *l, unsigned id, bool destroy)
+{
+    struct raft_log_batch *item;
+
+    assert(id > 0 && id <= l->batches_size);
+    item = &l->batches[id - 1];
+    assert(item->batch != NULL);
+    assert(item->refs > 0);
+
+    item->refs--;
+    if (item->refs > 0) {
+        return;
+    }
+    if (destroy) {
+        if (item->entry) {
+            raft_entry_free(item->batch);
+        } else {
+            raft_free(item->batch);
+        }
+    }
+    item->batch = NULL;
+    item->refs = (unsigned)l->batches_free;
+    l->batches_free = id;
+}
+
+/* Fill @entry with the content of the given slot. */
+static void slotToEntry(const struct raft_log *l,
+                        const struct raft_log_slot *slot,
+                        raft_term term,
+                        struct raft_entry *entry)
+{
+    entry->term = term;
+    entry->type = slot->type;
+    entry->buf.base = slot->base;
+    entry->buf.len = slot->len;
+    entry->batch = slot->batch != 0 ? l->batches[slot->batch - 1].batch : NULL;
+}
+
 void logInit(struct raft_log *l)
 {
     assert(l != NULL);
-    l->entries = NULL;
+    l->slots = NULL;
     l->size = 0;
     l->front = l->back = 0;
     l->offset = 0;
@@ -359,6 +578,13 @@ void logInit(struct raft_log *l)
     l->snapshot.last_index = 0;
     l->snapshot.last_term = 0;
     l->hook = NULL;
+    l->terms = NULL;
+    l->n_terms = 0;
+    l->terms_size = 0;
+    l->batches = NULL;
+    l->batches_size = 0;
+    l->batches_free = 0;
+    memset(&l->get, 0, sizeof l->get);
 }
 
 /* Return the index of the i'th entry in the log. */
@@ -375,10 +601,10 @@ static size_t positionAt(struct raft_log *l, size_t i)
     return (l->front + i) & (l->size - 1);
 }
 
-/* Return the i'th entry in the log. */
-static struct raft_entry *entryAt(struct raft_log *l, size_t i)
+/* Return the i'th slot in the log. */
+static struct raft_log_slot *slotAt(struct raft_log *l, size_t i)
 {
-    return &l->entries[positionAt(l, i)];
+    return &l->slots[positionAt(l, i)];
 }
 
 static void hookClose(struct raft_log *l)
@@ -390,72 +616,123 @@ static void hookClose(struct raft_log *l)
     hook->log_close(hook);
 }
 
-static void hookEntryAdd(struct raft_log *l, struct raft_entry *entry,
-                             raft_index index)
+static void hookEntryAdd(struct raft_log *l, struct raft_log_slot *slot,
+                         raft_term term, raft_index index)
 {
     struct raft_log_hook *hook = l->hook;
+    struct raft_entry entry;
 
-    if (!hook || !hook->entry_add)
+    if (!hook || !hook->entry_add || hook->entries_add)
         return;
-    hook->entry_add(hook, entry, index);
+    slotToEntry(l, slot, term, &entry);
+    hook->entry_add(hook, &entry, index);
 }
 
-static void hookEntryRemove(struct raft_log *l, struct raft_entry *entry,
-                                raft_index index)
+static void hookEntryRemove(struct raft_log *l, struct raft_log_slot *slot,
+                            raft_term term, raft_index index)
 {
     struct raft_log_hook *hook = l->hook;
+    struct raft_entry entry;
 
-    if (!hook || !hook->entry_remove)
+    if (!hook || !hook->entry_remove || hook->entries_remove)
         return;
-    hook->entry_remove(hook, entry, index);
+    slotToEntry(l, slot, term, &entry);
+    hook->entry_remove(hook, &entry, index);
 }
 
-void logClose(struct raft_log *l)
+/* Pass the @n entries starting at @first to the given range hook, in spans of
+ * at most LOG_HOOK_SPAN entries. */
+static void hookSpan(struct raft_log *l,
+                     raft_index first,
+                     size_t n,
+                     void (*fn)(struct raft_log_hook *h,
+                                raft_index first,
+                                unsigned n,
+                                const struct raft_entry entries[]))
 {
-    void *batch = NULL; /* Last batch that has been freed */
+    struct raft_entry entries[LOG_HOOK_SPAN];
+    size_t i;
+    unsigned k;
+
+    while (n > 0) {
+        k = (unsigned)(n < LOG_HOOK_SPAN ? n : LOG_HOOK_SPAN);
+        for (i = 0; i < k; i++) {
+            raft_index index = first + i;
+            slotToEntry(l, slotAt(l, (size_t)(index - l->offset - 1)),
+                        termAt(l, index), &entries[i]);
+        }
+        fn(l->hook, first, k, entries);
+        first += k;
+        n -= k;
+    }
+}
+
+static void hookEntriesAdd(struct raft_log *l, raft_index first, size_t n)
+{
+    struct raft_log_hook *hook = l->hook;
+
+    if (!hook || !hook->entries_add || n == 0)
+        return;
+    hookSpan(l, first, n, hook->entries_add);
+}
+
+static void hookEntriesRemove(struct raft_log *l, raft_index first, size_t n)
+{
+    struct raft_log_hook *hook = l->hook;
 
+    if (!hook || !hook->entries_remove || n == 0)
+        return;
+    hookSpan(l, first, n, hook->entries_remove);
+}
+
+void logClose(struct raft_log *l)
+{
     assert(l != NULL);
 
-    if (l->entries != NULL) {
+    if (l->slots != NULL) {
         size_t i;
         size_t n = logNumEntries(l);
 
+        if (n > 0) {
+            hookEntriesRemove(l, indexAt(l, 0), n);
+        }
+
         for (i = 0; i < n; i++) {
-            struct raft_entry *entry = entryAt(l, i);
+            struct raft_log_slot *slot = slotAt(l, i);
             raft_index index = indexAt(l, i);
             size_t key = refsKey(index, l->refs_size);
-            struct raft_entry_ref *slot = &l->refs[key];
+            struct raft_entry_ref *ref = &l->refs[key];
 
-            hookEntryRemove(l, entry, index);
+            hookEntryRemove(l, slot, termAt(l, index), index);
             /* We require that there are no outstanding references to active
              * entries. */
-            assert(slot->count == 1);
+            assert(ref->count == 1);
 
             /* TODO: we should support the case where the bucket has more than
              * one slot. */
-            assert(slot->next == NULL);
+            assert(ref->next == NULL);
 
             /* Release the memory used by the entry data (either directly or via
              * a batch). */
-            if (entry->batch == NULL) {
-                if (entry->buf.base != NULL) {
-                    raft_entry_free(entry->buf.base);
-                }
+            if (slot->batch == 0) {
+                entryDataFree(slot->type, slot->base);
             } else {
-                if (entry->batch != batch) {
-                    /* This batch was not released yet, so let's do it now. */
-                    batch = entry->batch;
-		    raft_free(entry->batch);
-                }
+                batchPut(l, slot->batch, true);
             }
         }
 
-        raft_free(l->entries);
+        raft_free(l->slots);
     }
 
     if (l->refs != NULL) {
         raft_free(l->refs);
     }
+    if (l->terms != NULL) {
+        raft_free(l->terms);
+    }
+    if (l->batches != NULL) {
+        raft_free(l->batches);
+    }
     hookClose(l);
 }
 
@@ -476,9 +753,9 @@ void logStart(struct raft_log *l,
 /* Ensure that the entries array has enough free slots for adding a new entry. */
 static int ensureCapacity(struct raft_log *l)
 {
-    struct raft_entry *entries; /* New entries array */
-    size_t n;                   /* Current number of entries */
-    size_t size;                /* Size of the new array */
+    struct raft_log_slot *slots; /* New slots array */
+    size_t n;                    /* Current number of entries */
+    size_t size;                 /* Size of the new array */
     size_t i;
 
     n = logNumEntries(l);
@@ -494,24 +771,24 @@ static int ensureCapacity(struct raft_log *l)
     else
         size = l->size * 2;
 
-    entries = raft_calloc(size, sizeof *entries);
-    if (entries == NULL) {
+    slots = raft_calloc(size, sizeof *slots);
+    if (slots == NULL) {
         evtErrf("E-1528-148", "%s", "calloc");
         return RAFT_NOMEM;
     }
 
-    /* Copy all active old entries to the beginning of the newly allocated
+    /* Copy all active old slots to the beginning of the newly allocated
      * array. */
     for (i = 0; i < n; i++) {
-        memcpy(&entries[i], entryAt(l, i), sizeof *entries);
+        memcpy(&slots[i], slotAt(l, i), sizeof *slots);
     }
 
-    /* Release the old entries array. */
-    if (l->entries != NULL) {
-        raft_free(l->entries);
+    /* Release the old slots array. */
+    if (l->slots != NULL) {
+        raft_free(l->slots);
     }
 
-    l->entries = entries;
+    l->slots = slots;
     l->size = size;
     l->front = 0;
     l->back = n;
@@ -519,20 +796,31 @@ static int ensureCapacity(struct raft_log *l)
     return 0;
 }
 
-int logAppend(struct raft_log *l,
-              const raft_term term,
-              const unsigned short type,
-              const struct raft_buffer *buf,
-              void *batch)
+/* Append a new entry to the log, without invoking the range hooks. */
+static int appendEntry(struct raft_log *l,
+                       const raft_term term,
+                       const unsigned short type,
+                       const struct raft_buffer *buf,
+                       void *batch)
 {
     int rv;
-    struct raft_entry *entry;
+    struct raft_log_slot *slot;
+    struct raft_log_slot *prev;
     raft_index index;
+    size_t n;
 
     assert(l != NULL);
     assert(term > 0);
-    assert(type == RAFT_CHANGE || type == RAFT_BARRIER || type == RAFT_COMMAND);
+    assert(type == RAFT_CHANGE || type == RAFT_BARRIER ||
+           type == RAFT_COMMAND || type == RAFT_SEGMENTS ||
+           type == RAFT_PACKED);
     assert(buf != NULL);
+    assert(type != RAFT_SEGMENTS || batch == NULL);
+
+    if (buf->len > UINT_MAX) {
+        evtErrf("E-1528-279", "entry too big %zu", buf->len);
+        return RAFT_TOOBIG;
+    }
 
     rv = ensureCapacity(l);
     if (rv != 0) {
@@ -540,6 +828,18 @@ int logAppend(struct raft_log *l,
         return rv;
     }
 
+    rv = termsEnsure(l, term);
+    if (rv != 0) {
+        return rv;
+    }
+
+    if (batch != NULL) {
+        rv = batchesEnsure(l);
+        if (rv != 0) {
+            return rv;
+        }
+    }
+
     index = logLastIndex(l) + 1;
 
     rv = refsInit(l, term, index);
@@ -548,44 +848,150 @@ int logAppend(struct raft_log *l,
         return rv;
     }
 
-    entry = &l->entries[l->back];
-    entry->term = term;
-    entry->type = type;
-    entry->buf = *buf;
-    entry->batch = batch;
+    n = logNumEntries(l);
+    prev = n > 0 ? slotAt(l, n - 1) : NULL;
+    slot = &l->slots[l->back];
+    slot->base = buf->base;
+    slot->len = (unsigned)buf->len;
+    slot->type = (unsigned)type & 0xfu;
+    slot->batch = batchGet(l, batch, prev) & 0xfffffffu;
+    termsPush(l, index, term);
 
     assert((l->size & (l->size - 1)) == 0);
     l->back += 1;
     l->back = l->back & (l->size - 1);
 
-    hookEntryAdd(l, entry, index);
+    hookEntryAdd(l, slot, term, index);
 
     return 0;
 }
 
+int logAppend(struct raft_log *l,
+              const raft_term term,
+              const unsigned short type,
+              const struct raft_buffer *buf,
+              void *batch)
+{
+    int rv;
+
+    rv = appendEntry(l, term, type, buf, batch);
+    if (rv != 0) {
+        return rv;
+    }
+    hookEntriesAdd(l, logLastIndex(l), 1);
+    return 0;
+}
+
+int logAppendEntries(struct raft_log *l,
+                     const struct raft_entry entries[],
+                     const unsigned n)
+{
+    raft_index first;
+    unsigned i;
+    int rv = 0;
+
+    assert(l != NULL);
+    assert(n == 0 || entries != NULL);
+
+    first = logLastIndex(l) + 1;
+    for (i = 0; i < n; i++) {
+        const struct raft_entry *entry = &entries[i];
+        rv = appendEntry(l, entry->term, entry->type, &entry->buf,
+                         entry->batch);
+        if (rv != 0) {
+            evtErrf("E-1528-290", "log append failed %d", rv);
+            break;
+        }
+    }
+
+    hookEntriesAdd(l, first, i);
+    if (rv != 0 && i > 0) {
+        logDiscard(l, first);
+    }
+    return rv;
+}
+
 int logAppendCommands(struct raft_log *l,
                       const raft_term term,
                       const struct raft_buffer bufs[],
                       const unsigned n)
 {
+    raft_index first;
     unsigned i;
-    int rv;
+    int rv = 0;
 
     assert(l != NULL);
     assert(term > 0);
     assert(bufs != NULL);
     assert(n > 0);
 
+    first = logLastIndex(l) + 1;
     for (i = 0; i < n; i++) {
         const struct raft_buffer *buf = &bufs[i];
-	rv = logAppend(l, term, RAFT_COMMAND, buf, NULL);
+        rv = appendEntry(l, term, RAFT_COMMAND, buf, NULL);
         if (rv != 0) {
             evtErrf("E-1528-151", "log append failed %d", rv);
-            return rv;
+            break;
+        }
+    }
+
+    hookEntriesAdd(l, first, i);
+    return rv;
+}
+
+int logAppendSegments(struct raft_log *l,
+                      const raft_term term,
+                      const struct raft_buffer segs[],
+                      const unsigned n_segs[],
+                      const unsigned n)
+{
+    struct raft_segments *data;
+    struct raft_buffer buf;
+    raft_index first;
+    unsigned i;
+    unsigned j;
+    int rv;
+
+    assert(l != NULL);
+    assert(term > 0);
+    assert(segs != NULL);
+    assert(n_segs != NULL);
+    assert(n > 0);
+
+    first = logLastIndex(l) + 1;
+    for (i = 0; i < n; i++) {
+        assert(n_segs[i] > 0);
+        data = raft_malloc(sizeof *data + n_segs[i] * sizeof *data->bufs);
+        if (data == NULL) {
+            evtErrf("E-1528-280", "%s", "malloc");
+            rv = RAFT_NOMEM;
+            goto err;
+        }
+        data->n = n_segs[i];
+        buf.base = data;
+        buf.len = 0;
+        for (j = 0; j < data->n; j++) {
+            data->bufs[j] = segs[j];
+            buf.len += segs[j].len;
+        }
+        rv = appendEntry(l, term, RAFT_SEGMENTS, &buf, NULL);
+        if (rv != 0) {
+            evtErrf("E-1528-281", "log append failed %d", rv);
+            raft_free(data);
+            goto err;
         }
+        segs += data->n;
     }
 
+    hookEntriesAdd(l, first, n);
     return 0;
+
+err:
+    hookEntriesAdd(l, first, i);
+    if (logLastIndex(l) >= first) {
+        logDiscard(l, first);
+    }
+    return rv;
 }
 
 int logAppendConfiguration(struct raft_log *l,
@@ -681,14 +1087,15 @@ raft_term logTermOf(struct raft_log *l, const raft_index index)
          * matches the one in the snapshot. */
         i = locateEntry(l, index);
         if (i != l->size) {
-            assert(l->entries[i].term == l->snapshot.last_term);
+            assert(termAt(l, index) == l->snapshot.last_term);
         }
         return l->snapshot.last_term;
     }
 
     i = locateEntry(l, index);
     assert(i < l->size);
-    return l->entries[i].term;
+    (void)i;
+    return termAt(l, index);
 }
 
 raft_index logSnapshotIndex(struct raft_log *l)
@@ -717,7 +1124,8 @@ const struct raft_entry *logGet(struct raft_log *l, const raft_index index)
 
     assert(i < l->size);
 
-    return &l->entries[i];
+    slotToEntry(l, &l->slots[i], termAt(l, index), &l->get);
+    return &l->get;
 }
 
 size_t logNumEntriesFromIndex(struct raft_log *l, raft_index index)
@@ -740,6 +1148,7 @@ int logAcquire(struct raft_log *l,
 {
     size_t i;
     size_t j;
+    size_t t;
 
     assert(l != NULL);
     assert(index > 0);
@@ -770,11 +1179,17 @@ int logAcquire(struct raft_log *l,
 	    *n = max;
     }
 
+    /* Locate the term run of the first entry, then walk runs along. */
+    t = termsLocate(l, index);
+
     assert((l->size & (l->size - 1)) == 0);
     for (j = 0; j < *n; j++) {
         size_t k = (i + j) & (l->size - 1);
         struct raft_entry *entry = &(*entries)[j];
-        *entry = l->entries[k];
+        while (t + 1 < l->n_terms && l->terms[t + 1].index <= index + j) {
+            t++;
+        }
+        slotToEntry(l, &l->slots[k], l->terms[t].term, entry);
         refsIncr(l, entry->term, index + j);
     }
 
@@ -787,23 +1202,47 @@ void logAddRef(struct raft_log *l, const struct raft_entry *entry,
     refsIncr(l, entry->term, index);
 }
 
-/* Return true if the given batch is referenced by any entry currently in the
- * log. */
-static bool isBatchReferenced(struct raft_log *l, const void *batch)
+int logHold(struct raft_log *l, const raft_index index, unsigned *id)
 {
+    struct raft_log_slot *slot;
+    struct raft_log_batch *item;
     size_t i;
+    int rv;
+
+    i = locateEntry(l, index);
+    assert(i < l->size);
+    slot = &l->slots[i];
+    assert(slot->type == RAFT_COMMAND);
+
+    if (slot->base == NULL) {
+        *id = 0;
+        return 0;
+    }
 
-    /* Iterate through all live entries to see if there's one
-     * belonging to the same batch. This is slightly inefficient but
-     * this code path should be taken very rarely in practice. */
-    for (i = 0; i < logNumEntries(l); i++) {
-        struct raft_entry *entry = entryAt(l, i);
-        if (entry->batch == batch) {
-            return true;
+    /* Move a payload that is not part of a batch to a batch of its own, so it
+     * outlives the entry. Entries acquired before this point still point to
+     * no batch, so the refcount of the entry records where it went. */
+    if (slot->batch == 0) {
+        rv = batchesEnsure(l);
+        if (rv != 0) {
+            return rv;
         }
+        slot->batch = batchGet(l, slot->base, NULL) & 0xfffffffu;
+        l->batches[slot->batch - 1].entry = true;
+        refsLookup(l, termAt(l, index), index)->batch = slot->batch;
     }
 
-    return false;
+    item = &l->batches[slot->batch - 1];
+    item->refs++;
+    *id = slot->batch;
+    return 0;
+}
+
+void logUnhold(struct raft_log *l, unsigned id)
+{
+    if (id != 0) {
+        batchPut(l, id, true);
+    }
 }
 
 void logRelease(struct raft_log *l,
@@ -812,32 +1251,28 @@ void logRelease(struct raft_log *l,
                 const unsigned n)
 {
     size_t i;
-    void *batch = NULL; /* Last batch whose memory was freed */
 
     assert(l != NULL);
     assert((entries == NULL && n == 0) || (entries != NULL && n > 0));
 
     for (i = 0; i < n; i++) {
         struct raft_entry *entry = &entries[i];
+        unsigned id;
         bool unref;
 
-        unref = refsDecr(l, entry->term, index + i);
+        unref = refsDecr(l, entry->term, index + i, &id);
 
         /* If there are no outstanding references to this entry, free its
-         * payload if it's not part of a batch, or check if we can free the
-         * batch itself. */
+         * payload if it's not part of a batch, or drop its reference to the
+         * batch. The entry is no longer in the log, so its batch is the one
+         * recorded in the refcount when the entry was removed, or when its
+         * payload was moved to a batch of its own by logHold(). */
         if (unref) {
-            if (entries[i].batch == NULL) {
-                if (entry->buf.base != NULL) {
-                    raft_entry_free(entries[i].buf.base);
-                }
+            assert(id != 0 || entry->batch == NULL);
+            if (id != 0) {
+                batchPut(l, id, true);
             } else {
-                if (entry->batch != batch) {
-                    if (!isBatchReferenced(l, entry->batch)) {
-                        batch = entry->batch;
-                        raft_free(entry->batch);
-                    }
-                }
+                entryDataFree(entry->type, entry->buf.base);
             }
         }
     }
@@ -849,29 +1284,33 @@ static void clearIfEmpty(struct raft_log *l)
     if (logNumEntries(l) > 0) {
         return;
     }
-    raft_free(l->entries);
-    l->entries = NULL;
+    raft_free(l->slots);
+    l->slots = NULL;
     l->size = 0;
     l->front = 0;
     l->back = 0;
+    l->n_terms = 0;
 }
 
-/* Destroy an entry, possibly releasing the memory of its buffer. */
-static void destroyEntry(struct raft_log *l, struct raft_entry *entry)
+/* Destroy an entry that has no more references, possibly releasing the memory
+ * of its buffer. */
+static void destroySlot(struct raft_log *l,
+                        struct raft_log_slot *slot,
+                        bool destroy)
 {
-    if (entry->batch == NULL) {
-        if (entry->buf.base != NULL) {
-            raft_entry_free(entry->buf.base);
-            entry->buf.base = NULL;
-            entry->buf.len = 0;
+    if (slot->batch == 0) {
+        if (destroy) {
+            entryDataFree(slot->type, slot->base);
+        } else if (slot->type == RAFT_SEGMENTS) {
+            /* The segment list was allocated by the log itself. */
+            raft_free(slot->base);
         }
     } else {
-        if(entry->buf.base != NULL)
-        if (!isBatchReferenced(l, entry->batch)) {
-	    raft_free(entry->batch);
-            entry->batch = NULL;
-        }
+        batchPut(l, slot->batch, destroy);
     }
+    slot->base = NULL;
+    slot->len = 0;
+    slot->batch = 0;
 }
 
 /* Core logic of @logTruncate and @logDiscard, removing all log entries from
@@ -890,9 +1329,13 @@ static void removeSuffix(struct raft_log *l,
 
     /* Number of entries to delete */
     n = (size_t)(logLastIndex(l) - start) + 1;
+    hookEntriesRemove(l, start, n);
 
     for (i = 0; i < n; i++) {
-        struct raft_entry *entry;
+        struct raft_log_slot *slot;
+        raft_index rindex = start + n - i - 1;
+        raft_term term = termAt(l, rindex);
+        unsigned id;
         bool unref;
 
         if (l->back == 0) {
@@ -901,16 +1344,21 @@ static void removeSuffix(struct raft_log *l,
             l->back--;
         }
 
-        entry = &l->entries[l->back];
+        slot = &l->slots[l->back];
 
-        hookEntryRemove(l, entry, start + n - i - 1);
-        unref = refsDecr(l, entry->term, start + n - i - 1);
+        hookEntryRemove(l, slot, term, rindex);
+        unref = refsDecr(l, term, rindex, &id);
 
-        if (unref && destroy) {
-            destroyEntry(l, entry);
+        /* Entries discarded without being destroyed are owned by the caller,
+         * only their batch reference is dropped. */
+        if (unref) {
+            destroySlot(l, slot, destroy);
+        } else {
+            refsLookup(l, term, rindex)->batch = slot->batch;
         }
     }
 
+    termsRemoveSuffix(l, start);
     clearIfEmpty(l);
 }
 
@@ -940,13 +1388,17 @@ static void removePrefix(struct raft_log *l, const raft_index index)
 
     /* Number of entries to delete */
     n = (size_t)(index - indexAt(l, 0)) + 1;
+    hookEntriesRemove(l, indexAt(l, 0), n);
 
     for (i = 0; i < n; i++) {
-        struct raft_entry *entry;
+        struct raft_log_slot *slot;
+        raft_term term;
+        unsigned id;
         bool unref;
 
         rindex = indexAt(l, 0);
-        entry = &l->entries[l->front];
+        term = termAt(l, rindex);
+        slot = &l->slots[l->front];
 
         if (l->front == l->size - 1) {
             l->front = 0;
@@ -955,14 +1407,17 @@ static void removePrefix(struct raft_log *l, const raft_index index)
         }
         l->offset++;
 
-        hookEntryRemove(l, entry, rindex);
-        unref = refsDecr(l, entry->term, l->offset);
+        hookEntryRemove(l, slot, term, rindex);
+        unref = refsDecr(l, term, l->offset, &id);
 
         if (unref) {
-            destroyEntry(l, entry);
+            destroySlot(l, slot, true);
+        } else {
+            refsLookup(l, term, l->offset)->batch = slot->batch;
         }
     }
 
+    termsRemovePrefix(l, l->offset + 1);
     clearIfEmpty(l);
 }
 
@@ -1009,7 +1464,7 @@ raft_term logStartTerm(struct raft *r)
 {
     if (logStartIndex(r) == 0)
         return 0;
-    return r->log.entries[r->log.front].term;
+    return r->log.terms[0].term;
 }
 
 void logSetHook(struct raft_log *l, struct raft_log_hook *hook)
@@ -44,9 +44,12 @@ raft_term logTermOf(struct raft_log *l, raft_index index);
  * snapshots. */
 raft_index logSnapshotIndex(struct raft_log *l);
 
-/* Get the entry with the given index. * The returned pointer remains valid only
- * as long as no API that might delete the entry with the given index is
- * invoked. Return #NULL if there is no such entry. */
+/* Get the entry with the given index. The returned entry is a copy kept in
+ * the log itself, so the pointer and the buffer struct it contains remain valid
+ * only until the next call to logGet() on the same log: callers that hand the
+ * buffer out must copy the entry first. The payload remains valid as long as no
+ * API that might delete the entry with the given index is invoked. Return #NULL
+ * if there is no such entry. */
 const struct raft_entry *logGet(struct raft_log *l, const raft_index index);
 
 /* Append a new entry to the log. */
@@ -56,12 +59,27 @@ int logAppend(struct raft_log *l,
 	      const struct raft_buffer *buf,
 	      void *batch);
 
+/* Append a series of entries, invoking the range hooks once for the whole
+ * series. On failure the entries already appended are discarded. */
+int logAppendEntries(struct raft_log *l,
+                     const struct raft_entry entries[],
+                     const unsigned n);
+
 /* Convenience to append a series of #RAFT_COMMAND entries. */
 int logAppendCommands(struct raft_log *l,
                       const raft_term term,
                       const struct raft_buffer bufs[],
                       const unsigned n);
 
+/* Convenience to append a series of #RAFT_SEGMENTS entries, the i'th one made
+ * of the next @n_segs[i] buffers of @segs. On failure the ownership of the
+ * segments memory stays with the caller. */
+int logAppendSegments(struct raft_log *l,
+                      const raft_term term,
+                      const struct raft_buffer segs[],
+                      const unsigned n_segs[],
+                      const unsigned n);
+
 /* Convenience to encode and append a single #RAFT_CHANGE entry. */
 int logAppendConfiguration(struct raft_log *l,
                            const raft_term term,
@@ -86,6 +104,15 @@ void logRelease(struct raft_log *l,
 void logAddRef(struct raft_log *l, const struct raft_entry *entry,
                raft_index index);
 
+/* Take a reference to the payload of the RAFT_COMMAND entry at the given
+ * index, which stays valid after the entry leaves the log, until logUnhold()
+ * is called with the returned @id. Holding an entry of a batch keeps the whole
+ * batch alive. */
+int logHold(struct raft_log *l, raft_index index, unsigned *id);
+
+/* Drop a reference taken with logHold(). */
+void logUnhold(struct raft_log *l, unsigned id);
+
 /* Delete all entries from the given index (included) onwards. If the log is
  * empty this is a no-op. If @index is lower than or equal to the index of the
  * first entry in the log, then the log will become empty. */
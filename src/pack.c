@@ -0,0 +1,443 @@
+#include "pack.h"
+
+#include <string.h>
+
+#include "assert.h"
+#include "byte.h"
+#include "event.h"
+#include "hook.h"
+#include "log.h"
+#include "queue.h"
+#include "replication.h"
+#include "request.h"
+#include "tracing.h"
+
+#ifdef ENABLE_TRACE
+#define tracef(...) Tracef(r->tracer, __VA_ARGS__)
+#else
+#define tracef(...)
+#endif
+
+#define PACK_REQS(R) ((queue *)&(R)->pack.reqs)
+
+/* Size of the header of a packed entry and of each packed command. */
+#define PACK_HEADER_SIZE sizeof(uint64_t)
+
+void packInit(struct raft *r)
+{
+    r->pack.max_cmds = 0;
+    r->pack.max_bytes = 0;
+    r->pack.max_cmd_size = 0;
+    r->pack.buf = NULL;
+    r->pack.len = 0;
+    r->pack.n = 0;
+    r->pack.nr_packed = 0;
+    r->pack.partial_index = 0;
+    r->pack.partial_n = 0;
+    QUEUE_INIT(PACK_REQS(r));
+}
+
+void packClose(struct raft *r)
+{
+    assert(QUEUE_IS_EMPTY(PACK_REQS(r)));
+    if (r->pack.buf != NULL) {
+        raft_entry_free(r->pack.buf);
+        r->pack.buf = NULL;
+    }
+}
+
+/* Size of an entry holding as many commands as possible. */
+static size_t packCapacity(struct raft *r)
+{
+    return PACK_HEADER_SIZE + r->pack.max_cmds * PACK_HEADER_SIZE +
+           bytePad64(r->pack.max_bytes + r->pack.max_cmds * 7);
+}
+
+/* Size of the commands data packed so far, including padding. */
+static size_t packDataLen(struct raft *r)
+{
+    if (r->pack.n == 0) {
+        return 0;
+    }
+    return r->pack.len - PACK_HEADER_SIZE - r->pack.n * PACK_HEADER_SIZE;
+}
+
+bool packAccepts(struct raft *r, const struct raft_buffer bufs[], unsigned n)
+{
+    if (r->pack.max_cmds == 0 || n != 1 ||
+        bufs[0].len > r->pack.max_cmd_size) {
+        return false;
+    }
+
+    /* Don't delay commands if nothing is being written, since there would be
+     * nothing to pack them with. */
+    return r->pack.n > 0 || r->nr_appending_requests > 0;
+}
+
+int packSubmit(struct raft *r,
+               struct raft_apply *req,
+               const struct raft_buffer *buf,
+               raft_apply_cb cb)
+{
+    void *cursor;
+
+    if (r->pack.n == r->pack.max_cmds ||
+        packDataLen(r) + buf->len > r->pack.max_bytes) {
+        packFlush(r);
+    }
+
+    if (r->pack.buf == NULL) {
+        r->pack.buf = raft_entry_malloc(packCapacity(r));
+        if (r->pack.buf == NULL) {
+            evtErrf("E-1528-283", "%s", "entry malloc");
+            return RAFT_NOMEM;
+        }
+    }
+
+    req->time = r->io->time(r->io);
+    req->type = RAFT_COMMAND;
+    req->index = 0;
+    req->cb = cb;
+    QUEUE_INIT(&req->queue);
+
+    if (r->pack.n == 0) {
+        r->pack.len = PACK_HEADER_SIZE;
+    }
+    assert(r->pack.len + PACK_HEADER_SIZE + bytePad64(buf->len) <=
+           packCapacity(r));
+    cursor = (uint8_t *)r->pack.buf + r->pack.len;
+    bytePut64(&cursor, buf->len);
+    if (buf->len > 0) {
+        memcpy(cursor, buf->base, buf->len);
+        memset((uint8_t *)cursor + buf->len, 0,
+               bytePad64(buf->len) - buf->len);
+    }
+    r->pack.len += PACK_HEADER_SIZE + bytePad64(buf->len);
+    r->pack.n += 1;
+    raft_entry_free(buf->base);
+
+    QUEUE_PUSH(PACK_REQS(r), &req->queue);
+    return 0;
+}
+
+void packFlush(struct raft *r)
+{
+    struct raft_apply *first;
+    struct raft_apply *req;
+    const struct raft_entry *entry;
+    struct raft_buffer buf;
+    raft_index index;
+    queue *head;
+    void *cursor;
+    int rv;
+
+    if (r->pack.n == 0) {
+        return;
+    }
+    assert(r->state == RAFT_LEADER);
+
+    buf.base = r->pack.buf;
+    buf.len = r->pack.len;
+    cursor = buf.base;
+    bytePut64(&cursor, r->pack.n);
+    index = logLastIndex(&r->log) + 1;
+    tracef("pack %u commands at %lld", r->pack.n, index);
+
+    /* Chain the requests to the first one, which is the one registered. */
+    head = QUEUE_HEAD(PACK_REQS(r));
+    QUEUE_REMOVE(head);
+    first = QUEUE_DATA(head, struct raft_apply, queue);
+    QUEUE_INIT(&first->queue);
+    first->index = index;
+    while (!QUEUE_IS_EMPTY(PACK_REQS(r))) {
+        head = QUEUE_HEAD(PACK_REQS(r));
+        QUEUE_REMOVE(head);
+        req = QUEUE_DATA(head, struct raft_apply, queue);
+        req->index = index;
+        QUEUE_PUSH(&first->queue, head);
+    }
+
+    r->pack.buf = NULL;
+    r->pack.len = 0;
+    r->pack.n = 0;
+
+    rv = logAppend(&r->log, r->current_term, RAFT_PACKED, &buf, NULL);
+    if (rv != 0) {
+        evtErrf("E-1528-284", "raft(%llx) append packed failed %d", r->id, rv);
+        goto err;
+    }
+
+    rv = requestRegEnqueue(&r->leader_state.reg, (struct request *)first);
+    if (rv != 0) {
+        evtErrf("E-1528-285", "raft(%llx) append to registry failed %d", r->id,
+                rv);
+        goto err_after_log_append;
+    }
+    hookRequestAccept(r, index);
+
+    entry = logGet(&r->log, index);
+    assert(entry);
+    hookEntriesAfterAppend(r, index, 1);
+
+    rv = replicationTrigger(r, index);
+    if (rv != 0) {
+        evtErrf("E-1528-286", "raft(%llx) replication trigger failed %d", r->id,
+                rv);
+        goto err_after_reg_append;
+    }
+
+    r->pack.nr_packed += 1;
+    return;
+
+err_after_reg_append:
+    requestRegDel(&r->leader_state.reg, index);
+err_after_log_append:
+    logDiscard(&r->log, index);
+err:
+    raft_entry_free(buf.base);
+    packFireApply(first, rv, NULL, false, 0);
+}
+
+void packCancel(struct raft *r, int status)
+{
+    struct raft_apply *req;
+    queue *head;
+
+    while (!QUEUE_IS_EMPTY(PACK_REQS(r))) {
+        head = QUEUE_HEAD(PACK_REQS(r));
+        QUEUE_REMOVE(head);
+        req = QUEUE_DATA(head, struct raft_apply, queue);
+        if (req->cb != NULL) {
+            req->cb(req, status, NULL);
+        }
+    }
+    r->pack.len = 0;
+    r->pack.n = 0;
+}
+
+void packFireApply(struct raft_apply *req,
+                   int status,
+                   void *result,
+                   bool packed,
+                   unsigned n_applied)
+{
+    struct raft_apply *sub;
+    void **results = packed ? result : NULL;
+    queue chain;
+    queue *head;
+    unsigned i = 1;
+
+    /* Detach the chain first, since callbacks might release requests. */
+    QUEUE_INIT(&chain);
+    while (!QUEUE_IS_EMPTY(&req->queue)) {
+        head = QUEUE_HEAD(&req->queue);
+        QUEUE_REMOVE(head);
+        QUEUE_PUSH(&chain, head);
+    }
+
+    if (req->cb != NULL) {
+        req->cb(req, n_applied > 0 ? 0 : status,
+                packed ? (results ? results[0] : NULL) : result);
+    }
+    while (!QUEUE_IS_EMPTY(&chain)) {
+        head = QUEUE_HEAD(&chain);
+        QUEUE_REMOVE(head);
+        sub = QUEUE_DATA(head, struct raft_apply, queue);
+        if (sub->cb != NULL) {
+            sub->cb(sub, i < n_applied ? 0 : status,
+                    results ? results[i] : NULL);
+        }
+        i++;
+    }
+}
+
+/* State of a packed entry whose commands are submitted one at a time to an FSM
+ * that does not implement apply_packed. */
+struct packApplyReq
+{
+    struct raft_fsm_apply req;     /* Request of the current command */
+    struct raft *raft;             /* Instance applying the entry */
+    raft_index index;              /* Index of the entry */
+    struct raft_fsm *fsm;          /* FSM applying the commands */
+    struct raft_fsm_apply *parent; /* Request of the whole entry */
+    raft_fsm_apply_cb cb;          /* Callback of the whole entry */
+    struct raft_packed cmds;       /* Commands left */
+    void **results;                /* Result of each command */
+};
+
+static void packApplyCb(struct raft_fsm_apply *req, void *result, int status);
+
+/* Submit the next command to the FSM. */
+static int packApplyNext(struct packApplyReq *p)
+{
+    struct raft_buffer cmd;
+    bool ok;
+
+    ok = raft_packed_next(&p->cmds, &cmd);
+    assert(ok);
+    (void)ok;
+    return p->fsm->apply(p->fsm, &p->req, &cmd, packApplyCb);
+}
+
+/* Record how far the entry got, so that a retry skips the commands already
+ * applied, and fire the callback of the entry. */
+static void packApplyDone(struct packApplyReq *p, int status)
+{
+    struct raft *r = p->raft;
+
+    if (status != 0) {
+        r->pack.partial_index = p->index;
+        r->pack.partial_n = p->cmds.i - 1;
+    } else if (r->pack.partial_index == p->index) {
+        r->pack.partial_index = 0;
+        r->pack.partial_n = 0;
+    }
+    p->cb(p->parent, p->results, status);
+    raft_free(p->results);
+    raft_free(p);
+}
+
+static void packApplyCb(struct raft_fsm_apply *req, void *result, int status)
+{
+    struct packApplyReq *p = req->data;
+    int rv;
+
+    p->results[p->cmds.i - 1] = result;
+    if (status != 0 || p->cmds.i == p->cmds.n) {
+        packApplyDone(p, status);
+        return;
+    }
+    rv = packApplyNext(p);
+    if (rv != 0) {
+        packApplyDone(p, rv);
+    }
+}
+
+unsigned packApplied(struct raft *r, raft_index index)
+{
+    return r->pack.partial_index == index ? r->pack.partial_n : 0;
+}
+
+int packApply(struct raft *r,
+              struct raft_fsm_apply *req,
+              raft_index index,
+              const struct raft_buffer *buf,
+              raft_fsm_apply_cb cb)
+{
+    struct raft_fsm *fsm = r->fsm;
+    struct packApplyReq *p;
+    struct raft_packed cmds;
+    struct raft_buffer cmd;
+    unsigned i;
+    int rv;
+
+    rv = raft_packed_init(&cmds, buf);
+    if (rv != 0) {
+        evtErrf("E-1528-287", "malformed packed entry %zu", buf->len);
+        return rv;
+    }
+
+    if (fsm->version >= 3 && fsm->apply_packed != NULL) {
+        return fsm->apply_packed(fsm, req, &cmds, cb);
+    }
+
+    if (cmds.n == packApplied(r, index)) {
+        cb(req, NULL, 0);
+        return 0;
+    }
+
+    p = raft_malloc(sizeof *p);
+    if (p == NULL) {
+        evtErrf("E-1528-288", "%s", "malloc");
+        return RAFT_NOMEM;
+    }
+    p->results = raft_calloc(cmds.n, sizeof *p->results);
+    if (p->results == NULL) {
+        evtErrf("E-1528-289", "%s", "calloc");
+        raft_free(p);
+        return RAFT_NOMEM;
+    }
+    p->req.data = p;
+    p->raft = r;
+    p->index = index;
+    p->fsm = fsm;
+    p->parent = req;
+    p->cb = cb;
+    p->cmds = cmds;
+
+    /* Resume after the commands applied by a previous attempt. */
+    for (i = 0; i < packApplied(r, index); i++) {
+        raft_packed_next(&p->cmds, &cmd);
+    }
+
+    rv = packApplyNext(p);
+    if (rv != 0) {
+        raft_free(p->results);
+        raft_free(p);
+    }
+    return rv;
+}
+
+int raft_packed_init(struct raft_packed *p, const struct raft_buffer *buf)
+{
+    const void *cursor = buf->base;
+    const uint8_t *end = (const uint8_t *)buf->base + buf->len;
+    uint64_t n;
+    uint64_t i;
+
+    if (buf->len < PACK_HEADER_SIZE) {
+        return RAFT_MALFORMED;
+    }
+    n = byteGet64(&cursor);
+    p->cursor = cursor;
+    p->end = end;
+    p->i = 0;
+
+    /* Check that all commands are within bounds. */
+    for (i = 0; i < n; i++) {
+        uint64_t len;
+        if ((size_t)(end - (const uint8_t *)cursor) < PACK_HEADER_SIZE) {
+            return RAFT_MALFORMED;
+        }
+        len = byteGet64(&cursor);
+        if (len > (size_t)(end - (const uint8_t *)cursor) ||
+            bytePad64(len) > (size_t)(end - (const uint8_t *)cursor)) {
+            return RAFT_MALFORMED;
+        }
+        cursor = (const uint8_t *)cursor + bytePad64(len);
+    }
+    p->n = (unsigned)n;
+
+    return 0;
+}
+
+bool raft_packed_next(struct raft_packed *p, struct raft_buffer *cmd)
+{
+    const void *cursor = p->cursor;
+
+    if (p->i == p->n) {
+        return false;
+    }
+    cmd->len = byteGet64(&cursor);
+    cmd->base = (void *)cursor;
+    p->cursor = (const uint8_t *)cursor + bytePad64(cmd->len);
+    p->i++;
+    return true;
+}
+
+void raft_set_pack(struct raft *r, const struct raft_pack_setting *setting)
+{
+    assert(QUEUE_IS_EMPTY(PACK_REQS(r)));
+    if (r->pack.buf != NULL) {
+        raft_entry_free(r->pack.buf);
+        r->pack.buf = NULL;
+    }
+    r->pack.max_cmds = setting->max_cmds;
+    r->pack.max_bytes = setting->max_bytes;
+    r->pack.max_cmd_size = setting->max_cmd_size;
+    if (r->pack.max_cmd_size > r->pack.max_bytes) {
+        r->pack.max_cmd_size = r->pack.max_bytes;
+    }
+}
+
+#undef tracef
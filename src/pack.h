@@ -0,0 +1,55 @@
+/* Packing of small client commands into a single log entry. */
+
+#ifndef PACK_H_
+#define PACK_H_
+
+#include "../include/raft.h"
+
+/* Initialize the packing state of a raft instance. */
+void packInit(struct raft *r);
+
+/* Release the memory used by the packing state. */
+void packClose(struct raft *r);
+
+/* Whether a raft_apply() request for the given commands should be packed
+ * together with other ones instead of getting its own entries. */
+bool packAccepts(struct raft *r, const struct raft_buffer bufs[], unsigned n);
+
+/* Add the command of an accepted request to the entry being packed, taking
+ * ownership of its memory on success. */
+int packSubmit(struct raft *r,
+               struct raft_apply *req,
+               const struct raft_buffer *buf,
+               raft_apply_cb cb);
+
+/* Append the entry being packed, if any, to the log and replicate it. Must be
+ * invoked before appending any other entry, to preserve ordering. Failures are
+ * reported through the callbacks of the packed requests. */
+void packFlush(struct raft *r);
+
+/* Fail all requests whose commands are being packed. */
+void packCancel(struct raft *r, int status);
+
+/* Fire the callback of a raft_apply() request and of all the requests packed
+ * in the same entry. If @packed is true @result is the array of results of
+ * each packed command. The first @n_applied requests succeed regardless of
+ * @status, since their commands were applied. */
+void packFireApply(struct raft_apply *req,
+                   int status,
+                   void *result,
+                   bool packed,
+                   unsigned n_applied);
+
+/* Number of commands of the #RAFT_PACKED entry at @index applied by an attempt
+ * that failed. */
+unsigned packApplied(struct raft *r, raft_index index);
+
+/* Submit the commands of the #RAFT_PACKED entry at @index to the FSM, skipping
+ * the ones already applied by a previous attempt. */
+int packApply(struct raft *r,
+              struct raft_fsm_apply *req,
+              raft_index index,
+              const struct raft_buffer *buf,
+              raft_fsm_apply_cb cb);
+
+#endif /* PACK_H_ */
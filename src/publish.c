@@ -0,0 +1,111 @@
+#include "publish.h"
+
+#include <string.h>
+
+/* The published state is guarded by a sequence lock: the writer makes the
+ * sequence number odd while it updates the copy, and readers retry if they
+ * saw it odd or changed across their read. Every field is accessed atomically,
+ * so concurrent accesses are not data races. */
+
+#define publishStore(FIELD, VALUE) \
+    __atomic_store_n(&(FIELD), (VALUE), __ATOMIC_RELAXED)
+#define publishLoad(FIELD) __atomic_load_n(&(FIELD), __ATOMIC_RELAXED)
+
+/* Fill @p with the current state of @r. */
+static void publishCollect(struct raft *r, struct raft_published *p)
+{
+    unsigned i;
+
+    memset(p, 0, sizeof *p);
+    p->state = r->state;
+    p->term = r->current_term;
+    p->commit_index = r->commit_index;
+    p->last_applied = r->last_applied;
+    p->last_stored = r->last_stored;
+
+    switch (r->state) {
+        case RAFT_FOLLOWER:
+            p->leader_id = r->follower_state.current_leader.id;
+            break;
+        case RAFT_LEADER:
+            p->leader_id = r->transfer == NULL ? r->id : 0;
+            if (r->leader_state.progress == NULL) {
+                break;
+            }
+            for (i = 0; i < r->configuration.n &&
+                        p->n_peers < RAFT_PUBLISHED_MAX_PEERS;
+                 i++) {
+                p->peers[p->n_peers].id = r->configuration.servers[i].id;
+                p->peers[p->n_peers].match_index =
+                    r->leader_state.progress[i].match_index;
+                p->n_peers++;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void publishInit(struct raft *r)
+{
+    r->published.seq = 0;
+    memset(&r->published.state, 0, sizeof r->published.state);
+}
+
+void publishUpdate(struct raft *r)
+{
+    struct raft_published *dst = &r->published.state;
+    struct raft_published p;
+    unsigned long seq = r->published.seq;
+    unsigned i;
+
+    publishCollect(r, &p);
+    if (memcmp(&p, dst, sizeof p) == 0) {
+        return;
+    }
+
+    publishStore(r->published.seq, seq + 1);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    publishStore(dst->state, p.state);
+    publishStore(dst->term, p.term);
+    publishStore(dst->leader_id, p.leader_id);
+    publishStore(dst->commit_index, p.commit_index);
+    publishStore(dst->last_applied, p.last_applied);
+    publishStore(dst->last_stored, p.last_stored);
+    publishStore(dst->n_peers, p.n_peers);
+    for (i = 0; i < RAFT_PUBLISHED_MAX_PEERS; i++) {
+        publishStore(dst->peers[i].id, p.peers[i].id);
+        publishStore(dst->peers[i].match_index, p.peers[i].match_index);
+    }
+    __atomic_store_n(&r->published.seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void raft_published(struct raft *r, struct raft_published *out)
+{
+    const struct raft_published *src = &r->published.state;
+    unsigned long seq;
+    unsigned i;
+
+    do {
+        seq = __atomic_load_n(&r->published.seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        out->state = publishLoad(src->state);
+        out->term = publishLoad(src->term);
+        out->leader_id = publishLoad(src->leader_id);
+        out->commit_index = publishLoad(src->commit_index);
+        out->last_applied = publishLoad(src->last_applied);
+        out->last_stored = publishLoad(src->last_stored);
+        out->n_peers = publishLoad(src->n_peers);
+        for (i = 0; i < RAFT_PUBLISHED_MAX_PEERS; i++) {
+            out->peers[i].id = publishLoad(src->peers[i].id);
+            out->peers[i].match_index = publishLoad(src->peers[i].match_index);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) ||
+             seq != __atomic_load_n(&r->published.seq, __ATOMIC_RELAXED));
+}
+
+#undef publishLoad
+#undef publishStore
@@ -0,0 +1,15 @@
+/* Publication of key state for readers running on other threads. */
+
+#ifndef PUBLISH_H_
+#define PUBLISH_H_
+
+#include "../include/raft.h"
+
+/* Initialize the published state of a raft instance. */
+void publishInit(struct raft *r);
+
+/* Publish the current state, if it changed since the last update. Must be
+ * called from the thread driving the instance. */
+void publishUpdate(struct raft *r);
+
+#endif /* PUBLISH_H_ */
@@ -2,12 +2,15 @@
 
 #include <string.h>
 
+#include "adaptive.h"
 #include "assert.h"
 #include "byte.h"
+#include "cdc.h"
 #include "configuration.h"
 #include "convert.h"
 #include "election.h"
 #include "err.h"
+#include "forward.h"
 #include "heap.h"
 #include "log.h"
 #include "membership.h"
@@ -19,12 +22,20 @@
 #include "progress.h"
 #include "tick.h"
 #include "replication.h"
+#include "read.h"
+#include "metric.h"
+#include "pack.h"
+#include "snapshot_cache.h"
+#include "snapshot_transfer.h"
+#include "publish.h"
+#include "watchdog.h"
 
 #define DEFAULT_ELECTION_TIMEOUT 1000 /* One second */
 #define DEFAULT_HEARTBEAT_TIMEOUT 100 /* One tenth of a second */
 #define DEFAULT_INSTALL_SNAPSHOT_TIMEOUT 30000 /* 30 seconds */
 #define DEFAULT_SNAPSHOT_THRESHOLD 1024
 #define DEFAULT_SNAPSHOT_TRAILING 2048
+#define DEFAULT_SNAPSHOT_CHUNK_SIZE (1024 * 1024) /* One megabyte */
 #define DEFAULT_MESSAGE_LOG_THRESHOLD 16
 #define DEFAULT_INFLIGHT_LOG_THRESHOLD 0
 #define DEFAULT_SYNC_REPLICATION_TIMEOUT_MIN 1000
@@ -38,6 +49,8 @@
 #define DEFAULT_MAX_CATCH_UP_ROUNDS 10
 #define DEFAULT_MAX_CATCH_UP_ROUND_DURATION (5 * 1000)
 #define DEFAULT_TICK_SNAPSHOT_FREQUENCY (1)
+/* Initial entry window of the adaptive apply mode when no limit is set. */
+#define DEFAULT_ADAPTIVE_APPLY_WINDOW 64
 
 int raft_init(struct raft *r,
               struct raft_io *io,
@@ -73,6 +86,9 @@ int raft_init(struct raft *r,
     r->snapshot.trailing = DEFAULT_SNAPSHOT_TRAILING;
     raft_configuration_init(&r->snapshot.configuration);
     r->snapshot.put.data = NULL;
+    snapshotCacheInit(r);
+    r->snapshot.chunk_size = DEFAULT_SNAPSHOT_CHUNK_SIZE;
+    snapshotTransferInit(r);
     r->close_cb = NULL;
     memset(r->errmsg, 0, sizeof r->errmsg);
     r->pre_vote = false;
@@ -87,6 +103,7 @@ int raft_init(struct raft *r,
     r->sync_replica_timeout_max = DEFAULT_SYNC_REPLICATION_TIMEOUT_MAX;
     r->nr_appending_requests = 0;
     r->prev_append_status = 0;
+    r->append_payload = NULL;
     r->quorum = RAFT_MAJORITY;
     r->non_voter_grant_vote = false;
     r->enable_request_hook = false;
@@ -97,6 +114,27 @@ int raft_init(struct raft *r,
     r->metric.ae_sample_rate = 0;
     r->ticks = 0;
     r->tick_snapshot_frequency = DEFAULT_TICK_SNAPSHOT_FREQUENCY;
+    readInit(r);
+    packInit(r);
+    adaptiveInit(r);
+    forwardInit(r);
+    cdcInit(r);
+    watchdogInit(r);
+    publishInit(r);
+    r->apply_window.max_entries = 0;
+    r->apply_window.max_bytes = 0;
+    r->apply_window.adaptive = false;
+    r->apply_window.target_latency = 0;
+    r->apply_window.window = 0;
+    r->apply_window.acked = 0;
+    r->apply_window.slow = false;
+    r->apply_window.bytes = 0;
+    r->apply_window.throttled = false;
+    r->apply_window.nr_throttled = 0;
+    r->apply_window.held_index = 0;
+    r->apply_window.held_since = 0;
+    metricInit(&r->apply_window.fsm_latency);
+    metricInit(&r->apply_window.held_latency);
     rv = r->io->init(r->io, r->id);
     r->state_change_cb = NULL;
     if (rv != 0) {
@@ -124,6 +162,8 @@ int raft_io_state(struct raft_io *io)
 static void ioCloseCb(struct raft_io *io)
 {
     struct raft *r = io->data;
+    packClose(r);
+    forwardClose(r);
     logClose(&r->log);
     raft_configuration_close(&r->configuration);
     raft_configuration_close(&r->snapshot.configuration);
@@ -138,6 +178,7 @@ void raft_close(struct raft *r, bool clean, void (*cb)(struct raft *r))
     if (r->state != RAFT_UNAVAILABLE) {
         convertToUnavailable(r);
     }
+    cdcClose(r);
     r->close_cb = cb;
     r->io->close(r->io, clean, ioCloseCb);
 }
@@ -145,11 +186,13 @@ void raft_close(struct raft *r, bool clean, void (*cb)(struct raft *r))
 void raft_set_election_timeout(struct raft *r, const unsigned msecs)
 {
     r->election_timeout = msecs;
+    r->adaptive.election_timeout = msecs;
 }
 
 void raft_set_heartbeat_timeout(struct raft *r, const unsigned msecs)
 {
     r->heartbeat_timeout = msecs;
+    r->adaptive.heartbeat_timeout = msecs;
 }
 
 void raft_set_install_snapshot_timeout(struct raft *r, const unsigned msecs)
@@ -167,6 +210,11 @@ void raft_set_snapshot_trailing(struct raft *r, unsigned n)
     r->snapshot.trailing = n;
 }
 
+void raft_set_snapshot_chunk_size(struct raft *r, unsigned size)
+{
+    r->snapshot.chunk_size = size > 0 ? size : DEFAULT_SNAPSHOT_CHUNK_SIZE;
+}
+
 void raft_set_max_catch_up_rounds(struct raft *r, unsigned n)
 {
     r->max_catch_up_rounds = n;
@@ -606,4 +654,33 @@ void raft_set_tick_snapshot_frequency(struct raft *r, unsigned freq)
 {
     assert(freq);
     r->tick_snapshot_frequency = freq;
-}
\ No newline at end of file
+}
+
+void raft_set_apply_window(struct raft *r,
+                           const struct raft_apply_window_setting *setting)
+{
+    assert(!setting->adaptive || setting->target_latency > 0);
+
+    r->apply_window.max_entries = setting->max_entries;
+    r->apply_window.max_bytes = setting->max_bytes;
+    r->apply_window.adaptive = setting->adaptive;
+    r->apply_window.target_latency = setting->target_latency;
+    r->apply_window.window = setting->max_entries;
+    if (setting->adaptive && r->apply_window.window == 0) {
+        r->apply_window.window = DEFAULT_ADAPTIVE_APPLY_WINDOW;
+    }
+    r->apply_window.acked = 0;
+    r->apply_window.slow = false;
+}
+
+void raft_apply_window_stats(struct raft *r,
+                             struct raft_apply_window_stats *stats)
+{
+    stats->nr_applying = r->nr_applying;
+    stats->applying_bytes = r->apply_window.bytes;
+    stats->nr_pending = r->commit_index - r->last_applying;
+    stats->window = r->apply_window.window;
+    stats->nr_throttled = r->apply_window.nr_throttled;
+    stats->apply_latency = r->apply_window.fsm_latency.latency;
+    stats->queue_latency = r->apply_window.held_latency.latency;
+}
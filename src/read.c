@@ -0,0 +1,206 @@
+#include "read.h"
+
+#include <string.h>
+
+#include "assert.h"
+#include "event.h"
+#include "log.h"
+#include "queue.h"
+#include "tracing.h"
+
+#ifdef ENABLE_TRACE
+#define tracef(...) Tracef(r->tracer, __VA_ARGS__)
+#else
+#define tracef(...)
+#endif
+
+#define READ_REQS(R) ((queue *)&(R)->follower_read.reqs)
+
+void readInit(struct raft *r)
+{
+    memset(&r->follower_read.fresh, 0, sizeof r->follower_read.fresh);
+    r->follower_read.n_pending = 0;
+    r->follower_read.verified_term = 0;
+    QUEUE_INIT(READ_REQS(r));
+}
+
+/* Return the local time elapsed since the fresh sample was received. */
+static raft_time readStaleness(struct raft *r)
+{
+    raft_time now;
+
+    if (r->follower_read.fresh.term == 0) {
+        return RAFT_STALENESS_UNKNOWN;
+    }
+
+    now = r->io->time_us(r->io);
+    if (now <= r->follower_read.fresh.local_time) {
+        return 0;
+    }
+    return now - r->follower_read.fresh.local_time;
+}
+
+/* The commit index sent by a leader can be trusted only after the leader has
+ * committed an entry of its own term, since before that point it might lag
+ * behind entries committed by a previous leader. */
+static bool readSampleTrusted(struct raft *r,
+                              const struct raft_read_sample *sample)
+{
+    if (sample->term == r->follower_read.verified_term) {
+        return true;
+    }
+    if (logTermOf(&r->log, sample->commit) != sample->term) {
+        return false;
+    }
+    r->follower_read.verified_term = sample->term;
+    return true;
+}
+
+void readRecordAppendEntries(struct raft *r,
+                             const struct raft_append_entries *args)
+{
+    struct raft_read_sample *sample;
+    unsigned n = r->follower_read.n_pending;
+
+    if (args->timestamp == 0) {
+        return;
+    }
+
+    /* Samples are ordered by commit index. When there's no room left, replace
+     * the newest one, keeping the ones that will be applied first. */
+    if (n == RAFT_READ_SAMPLES) {
+        n -= 1;
+    } else {
+        r->follower_read.n_pending += 1;
+    }
+    sample = &r->follower_read.pending[n];
+    sample->term = args->term;
+    sample->commit = args->leader_commit;
+    sample->leader_time = args->timestamp;
+    sample->local_time = r->io->time_us(r->io);
+
+    readUpdate(r);
+}
+
+void readUpdate(struct raft *r)
+{
+    struct raft_follower_read *req;
+    raft_time staleness;
+    queue *head;
+    queue *next;
+    unsigned i = 0;
+
+    while (i < r->follower_read.n_pending &&
+           r->follower_read.pending[i].commit <= r->last_applied) {
+        if (readSampleTrusted(r, &r->follower_read.pending[i])) {
+            r->follower_read.fresh = r->follower_read.pending[i];
+        }
+        i++;
+    }
+    if (i > 0) {
+        r->follower_read.n_pending -= i;
+        memmove(r->follower_read.pending, &r->follower_read.pending[i],
+                r->follower_read.n_pending * sizeof(struct raft_read_sample));
+    }
+
+    if (QUEUE_IS_EMPTY(READ_REQS(r))) {
+        return;
+    }
+
+    staleness = readStaleness(r);
+    head = QUEUE_HEAD(READ_REQS(r));
+    while (head != READ_REQS(r)) {
+        next = QUEUE_NEXT(head);
+        req = QUEUE_DATA(head, struct raft_follower_read, queue);
+        if (staleness <= req->max_staleness) {
+            QUEUE_REMOVE(head);
+            req->index = r->last_applied;
+            req->cb(req, 0);
+        }
+        head = next;
+    }
+}
+
+void readTick(struct raft *r)
+{
+    struct raft_follower_read *req;
+    raft_time now;
+    queue *head;
+    queue *next;
+
+    if (QUEUE_IS_EMPTY(READ_REQS(r))) {
+        return;
+    }
+
+    now = r->io->time_us(r->io);
+    head = QUEUE_HEAD(READ_REQS(r));
+    while (head != READ_REQS(r)) {
+        next = QUEUE_NEXT(head);
+        req = QUEUE_DATA(head, struct raft_follower_read, queue);
+        if (req->timeout != 0 && now >= req->time + req->timeout) {
+            evtWarnf("W-1528-274", "raft(%llx) follower read timeout %llu",
+                     r->id, req->timeout);
+            QUEUE_REMOVE(head);
+            req->cb(req, RAFT_BUSY);
+        }
+        head = next;
+    }
+}
+
+void readCancel(struct raft *r, int status)
+{
+    struct raft_follower_read *req;
+    queue *head;
+
+    while (!QUEUE_IS_EMPTY(READ_REQS(r))) {
+        head = QUEUE_HEAD(READ_REQS(r));
+        req = QUEUE_DATA(head, struct raft_follower_read, queue);
+        QUEUE_REMOVE(head);
+        req->cb(req, status);
+    }
+}
+
+void raft_follower_read_state(struct raft *r,
+                              struct raft_follower_read_state *state)
+{
+    state->applied_index = r->last_applied;
+    state->fresh_index = r->follower_read.fresh.commit;
+    state->leader_time = r->follower_read.fresh.leader_time;
+    state->fresh_as_of = r->follower_read.fresh.local_time;
+    state->staleness = readStaleness(r);
+}
+
+int raft_follower_read(struct raft *r,
+                       struct raft_follower_read *req,
+                       raft_time max_staleness,
+                       raft_time timeout,
+                       raft_follower_read_cb cb)
+{
+    int rv;
+
+    assert(cb != NULL);
+    if (r->state != RAFT_FOLLOWER) {
+        rv = RAFT_BADROLE;
+        evtErrf("E-1528-273", "raft(%llx) follower read in state %d", r->id,
+                r->state);
+        return rv;
+    }
+
+    req->time = r->io->time_us(r->io);
+    req->index = 0;
+    req->max_staleness = max_staleness;
+    req->timeout = timeout;
+    req->cb = cb;
+
+    if (readStaleness(r) <= max_staleness) {
+        req->index = r->last_applied;
+        cb(req, 0);
+        return 0;
+    }
+
+    tracef("follower read waits for staleness %llu", max_staleness);
+    QUEUE_PUSH(READ_REQS(r), &req->queue);
+    return 0;
+}
+
+#undef tracef
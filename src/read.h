@@ -0,0 +1,27 @@
+/* Bounded-staleness reads served by followers. */
+
+#ifndef READ_H_
+#define READ_H_
+
+#include "../include/raft.h"
+
+/* Initialize the follower read state of a raft instance. */
+void readInit(struct raft *r);
+
+/* Record the freshness sample carried by an AppendEntries request received
+ * from the current leader. */
+void readRecordAppendEntries(struct raft *r,
+                             const struct raft_append_entries *args);
+
+/* Promote pending samples whose commit index has been applied and complete
+ * waiting read requests that are now fresh enough. Must be invoked whenever
+ * last_applied advances. */
+void readUpdate(struct raft *r);
+
+/* Fail waiting read requests whose timeout has expired. */
+void readTick(struct raft *r);
+
+/* Fail all waiting read requests with the given status. */
+void readCancel(struct raft *r, int status);
+
+#endif /* READ_H_ */
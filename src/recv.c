@@ -3,6 +3,7 @@
 #include "assert.h"
 #include "convert.h"
 #include "entry.h"
+#include "forward.h"
 #include "heap.h"
 #include "log.h"
 #include "membership.h"
@@ -15,6 +16,8 @@
 #include "string.h"
 #include "tracing.h"
 #include "event.h"
+#include "publish.h"
+#include "watchdog.h"
 
 #ifdef ENABLE_TRACE
 #define tracef(...) Tracef(r->tracer, __VA_ARGS__)
@@ -90,6 +93,13 @@ static void freeRaftMessageData(struct raft_message *message)
             raft_configuration_close(&message->install_snapshot.conf);
             raft_free(message->install_snapshot.data.base);
             break;
+        case RAFT_IO_INSTALL_SNAPSHOT_CHUNK:
+            raft_configuration_close(&message->install_snapshot_chunk.conf);
+            raft_free(message->install_snapshot_chunk.data.base);
+            break;
+        case RAFT_IO_FORWARD:
+            raft_free(message->forward.data.base);
+            break;
         }
 }
 
@@ -164,6 +174,18 @@ static int recvEnsureMatchingTerm(struct raft *r,
     case RAFT_IO_TIMEOUT_NOW:
         term = message->timeout_now.term;
         break;
+    case RAFT_IO_INSTALL_SNAPSHOT_CHUNK:
+        term = message->install_snapshot_chunk.term;
+        break;
+    case RAFT_IO_INSTALL_SNAPSHOT_CHUNK_RESULT:
+        term = message->install_snapshot_chunk_result.term;
+        break;
+    case RAFT_IO_FORWARD:
+        term = message->forward.term;
+        break;
+    case RAFT_IO_FORWARD_RESULT:
+        term = message->forward_result.term;
+        break;
     case RAFT_IO_REQUEST_VOTE:
         if (message->request_vote.disrupt_leader) {
             term = message->request_vote.term;
@@ -202,7 +224,7 @@ static int recvMessage(struct raft *r, struct raft_message *message)
     bool async;
 
     if (message->type < RAFT_IO_APPEND_ENTRIES ||
-        message->type > RAFT_IO_TIMEOUT_NOW) {
+        message->type > RAFT_IO_FORWARD_RESULT) {
         tracef("received unknown message type type: %d", message->type);
         evtErrf("E-1528-174", "raft(%llx) received unknown message type %d",
 		r->id, message->type);
@@ -255,6 +277,21 @@ static int recvMessage(struct raft *r, struct raft_message *message)
                                 message->server_id,
                                 &message->timeout_now);
             break;
+        case RAFT_IO_INSTALL_SNAPSHOT_CHUNK:
+            rv = recvInstallSnapshotChunk(r, message->server_id,
+                                          &message->install_snapshot_chunk);
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT_CHUNK_RESULT:
+            rv = recvInstallSnapshotChunkResult(
+                r, message->server_id, &message->install_snapshot_chunk_result);
+            break;
+        case RAFT_IO_FORWARD:
+            rv = recvForward(r, message->server_id, &message->forward);
+            break;
+        case RAFT_IO_FORWARD_RESULT:
+            rv = recvForwardResult(r, message->server_id,
+                                   &message->forward_result);
+            break;
     };
 
     if (rv != 0 && rv != RAFT_NOCONNECTION) {
@@ -275,9 +312,8 @@ static int recvMessage(struct raft *r, struct raft_message *message)
     return 0;
 }
 
-void recvCb(struct raft_io *io, struct raft_message *message)
+static void recvRun(struct raft *r, struct raft_message *message)
 {
-    struct raft *r = io->data;
     int rv;
     if (r->state == RAFT_UNAVAILABLE ||
             r->io->state != RAFT_IO_AVAILABLE) {
@@ -292,6 +328,17 @@ void recvCb(struct raft_io *io, struct raft_message *message)
     }
 }
 
+void recvCb(struct raft_io *io, struct raft_message *message)
+{
+    struct raft *r = io->data;
+    struct watchdogTimer timer;
+
+    watchdogEnter(r, &timer);
+    recvRun(r, message);
+    publishUpdate(r);
+    watchdogExit(r, &timer, "recv");
+}
+
 void recvCheckMatchingTerms(struct raft *r, raft_term term, int *match)
 {
     if (term < r->current_term) {
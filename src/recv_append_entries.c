@@ -1,10 +1,12 @@
 #include "recv_append_entries.h"
 
+#include "adaptive.h"
 #include "assert.h"
 #include "convert.h"
 #include "entry.h"
 #include "heap.h"
 #include "log.h"
+#include "read.h"
 #include "recv.h"
 #include "replication.h"
 #include "tracing.h"
@@ -144,6 +146,12 @@ int recvAppendEntries(struct raft *r,
     /* Reset the election timer. */
     r->election_timer_start = r->io->time(r->io);
 
+    /* Remember how fresh the leader state carried by this request is. */
+    readRecordAppendEntries(r, args);
+
+    /* Follow the timeouts chosen by the leader. */
+    adaptiveLearn(r, args);
+
     if (hookHackAppendEntries(r, args, result, &discard)) {
         if (discard)
             goto err_free_args;
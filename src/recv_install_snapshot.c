@@ -5,6 +5,7 @@
 #include "log.h"
 #include "recv.h"
 #include "replication.h"
+#include "snapshot_transfer.h"
 #include "tracing.h"
 
 #ifdef ENABLE_TRACE
@@ -95,4 +96,119 @@ reply:
     return 0;
 }
 
+/* Send an AppendEntries result in reply to a snapshot chunk. */
+static int installSnapshotChunkReply(struct raft *r,
+                                     raft_id id,
+                                     raft_index rejected,
+                                     raft_index last_log_index)
+{
+    struct raft_io_send *req;
+    struct raft_message message;
+    struct raft_append_entries_result *result = &message.append_entries_result;
+    int rv;
+
+    result->term = r->current_term;
+    result->rejected = rejected;
+    result->last_log_index = last_log_index;
+
+    message.type = RAFT_IO_APPEND_ENTRIES_RESULT;
+    message.server_id = id;
+
+    req = raft_malloc(sizeof *req);
+    if (req == NULL) {
+        return RAFT_NOMEM;
+    }
+    req->data = r;
+
+    rv = r->io->send(r->io, req, &message, installSnapshotSendCb);
+    if (rv != 0) {
+        raft_free(req);
+        return rv;
+    }
+
+    return 0;
+}
+
+int recvInstallSnapshotChunk(struct raft *r,
+                             const raft_id id,
+                             struct raft_install_snapshot_chunk *args)
+{
+    raft_term local_term;
+    int rv;
+    int match;
+
+    recvCheckMatchingTerms(r, args->term, &match);
+    assert(match <= 0);
+
+    if (match < 0) {
+        tracef("local term is higher -> reject ");
+        goto reject;
+    }
+
+    assert(r->state == RAFT_FOLLOWER || r->state == RAFT_CANDIDATE);
+    assert(r->current_term == args->term);
+    if (r->state == RAFT_CANDIDATE) {
+        tracef("discovered leader -> step down ");
+        convertToFollower(r);
+    }
+
+    rv = recvUpdateLeader(r, id);
+    if (rv != 0) {
+        goto out;
+    }
+    r->election_timer_start = r->io->time(r->io);
+
+    /* If we are taking a snapshot ourselves or installing a snapshot, ignore
+     * the chunk, the leader will eventually retry. */
+    if (r->snapshot.pending.term != 0 || r->snapshot.put.data != NULL) {
+        goto out;
+    }
+
+    /* If our last snapshot is more up-to-date, or we already have all entries
+     * in the snapshot, this is a no-op. */
+    local_term = logTermOf(&r->log, args->last_index);
+    if (r->log.snapshot.last_index >= args->last_index ||
+        (local_term != 0 && local_term >= args->last_term)) {
+        raft_configuration_close(&args->conf);
+        raft_free(args->data.base);
+        return installSnapshotChunkReply(r, id, 0, args->last_index);
+    }
+
+    return snapshotTransferRecv(r, id, args);
+
+reject:
+    raft_configuration_close(&args->conf);
+    raft_free(args->data.base);
+    return installSnapshotChunkReply(r, id, args->last_index,
+                                     logLastIndex(&r->log));
+
+out:
+    raft_configuration_close(&args->conf);
+    raft_free(args->data.base);
+    return rv;
+}
+
+int recvInstallSnapshotChunkResult(
+    struct raft *r,
+    const raft_id id,
+    const struct raft_install_snapshot_chunk_result *result)
+{
+    int match;
+
+    if (r->state != RAFT_LEADER) {
+        tracef("local server is not leader -> ignore");
+        return 0;
+    }
+
+    recvCheckMatchingTerms(r, result->term, &match);
+    assert(match <= 0);
+    if (match < 0) {
+        tracef("local term is higher -> ignore ");
+        return 0;
+    }
+
+    snapshotTransferAck(r, id, result);
+    return 0;
+}
+
 #undef tracef
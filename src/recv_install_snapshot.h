@@ -10,4 +10,15 @@ int recvInstallSnapshot(struct raft *r,
                         raft_id id,
                         struct raft_install_snapshot *args);
 
+/* Process an InstallSnapshotChunk RPC from the given server. */
+int recvInstallSnapshotChunk(struct raft *r,
+                             raft_id id,
+                             struct raft_install_snapshot_chunk *args);
+
+/* Process an InstallSnapshotChunk RPC result from the given server. */
+int recvInstallSnapshotChunkResult(
+    struct raft *r,
+    raft_id id,
+    const struct raft_install_snapshot_chunk_result *result);
+
 #endif /* RECV_INSTALL_SNAPSHOT_H_ */
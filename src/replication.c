@@ -1,6 +1,8 @@
 #include <string.h>
 #include <stdlib.h>
+#include "adaptive.h"
 #include "assert.h"
+#include "cdc.h"
 #include "configuration.h"
 #include "convert.h"
 #include "entry.h"
@@ -11,11 +13,15 @@
 #include "heap.h"
 #include "log.h"
 #include "membership.h"
+#include "pack.h"
 #include "progress.h"
 #include "queue.h"
+#include "read.h"
 #include "replication.h"
 #include "request.h"
 #include "snapshot.h"
+#include "snapshot_cache.h"
+#include "snapshot_transfer.h"
 #include "tracing.h"
 #include "event.h"
 #include "hook.h"
@@ -23,6 +29,8 @@
 #include "byte.h"
 #include "snapshot_sampler.h"
 #include "metric.h"
+#include "publish.h"
+#include "watchdog.h"
 
 #ifdef ENABLE_TRACE
 #define tracef(...) Tracef(r->tracer, __VA_ARGS__)
@@ -42,8 +50,79 @@
 #define PKT_ID_BITS 32
 #define DEFAULT_MAX_DYNAMIC_TRAILING 128
 
+/* Return a payload with the entries to send starting at @index, sharing the one
+ * of the latest request if it's for the same range in the current term. Set
+ * @payload to NULL if there are no entries to send. */
+static int appendEntriesPayloadGet(struct raft *r,
+                                   raft_index index,
+                                   struct appendEntriesPayload **payload)
+{
+    struct appendEntriesPayload *p = r->append_payload;
+    struct raft_entry *entries;
+    raft_index last = logLastIndex(&r->log);
+    unsigned n = 0;
+    int rv;
+
+    *payload = NULL;
+    if (index <= last) {
+        n = (unsigned)min(last - index + 1, (raft_index)r->message_log_threshold);
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    if (p != NULL && p->term == r->current_term && p->index == index &&
+        p->n == n) {
+        p->refs += 1;
+        *payload = p;
+        return 0;
+    }
+
+    p = raft_malloc(sizeof *p + n * sizeof *p->entries);
+    if (p == NULL) {
+        return RAFT_NOMEM;
+    }
+    entries = p->entries;
+    rv = logAcquire(&r->log, index, &entries, &p->n, n);
+    if (rv != 0) {
+        raft_free(p);
+        return rv;
+    }
+    if (p->n == 0) {
+        raft_free(p);
+        return 0;
+    }
+    p->term = r->current_term;
+    p->index = index;
+    p->refs = 1;
+    r->append_payload = p;
+    *payload = p;
+    return 0;
+}
+
+/* Drop a reference to a payload, releasing its entries when it was the last
+ * one. */
+static void appendEntriesPayloadPut(struct raft *r,
+                                    struct appendEntriesPayload *p)
+{
+    if (p == NULL) {
+        return;
+    }
+    assert(p->refs > 0);
+    p->refs -= 1;
+    if (p->refs > 0) {
+        return;
+    }
+    if (r->append_payload == p) {
+        r->append_payload = NULL;
+    }
+    /* Tell the log that we're done referencing these entries. */
+    logRelease(&r->log, p->index, p->entries, p->n);
+    raft_free(p);
+}
+
 /* Callback invoked after request to send an AppendEntries RPC has completed. */
-static void sendAppendEntriesCb(struct raft_io_send *send, const int status)
+static void sendAppendEntriesDone(struct raft_io_send *send, const int status)
 {
     struct sendAppendEntries *req = send->data;
     struct raft *r = req->raft;
@@ -60,13 +139,22 @@ static void sendAppendEntriesCb(struct raft_io_send *send, const int status)
         }
     }
 
-    /* Tell the log that we're done referencing these entries. */
-    if (req->n) {
-        logRelease(&r->log, req->index, req->entries, req->n);
-    }
+    appendEntriesPayloadPut(r, req->payload);
     raft_free(req);
 }
 
+static void sendAppendEntriesCb(struct raft_io_send *send, const int status)
+{
+    struct sendAppendEntries *req = send->data;
+    struct raft *r = req->raft;
+    struct watchdogTimer timer;
+
+    watchdogEnter(r, &timer);
+    sendAppendEntriesDone(send, status);
+    publishUpdate(r);
+    watchdogExit(r, &timer, "send append entries");
+}
+
 static raft_index nextPktId(struct raft *r)
 {
     assert(RAFT_PKT_BITS == (PKT_TERM_BITS + PKT_ID_BITS));
@@ -101,22 +189,27 @@ static int sendAppendEntries(struct raft *r,
     args->snapshot_index = r->log.snapshot.last_index;
     args->trailing = r->snapshot.trailing;
     args->timestamp = r->io->time_us(r->io);
+    adaptivePrepare(r, args);
 
-    req = raft_malloc(sizeof(*req) +
-		      sizeof(*req->entries) * r->message_log_threshold);
+    req = raft_malloc(sizeof(*req));
     if (req == NULL) {
         rv = RAFT_NOMEM;
         evtErrf("E-1528-179", "%s", "malloc");
         goto err_req_alloc;
     }
 
-    args->entries = req->entries;
-    rv = logAcquire(&r->log, next_index, &args->entries, &args->n_entries,
-                   r->message_log_threshold);
+    rv = appendEntriesPayloadGet(r, next_index, &req->payload);
     if (rv != 0) {
         evtErrf("E-1528-180", "raft(%llx) log acquire failed %d", r->id, rv);
         goto err_after_req_alloc;
     }
+    if (req->payload != NULL) {
+        args->entries = req->payload->entries;
+        args->n_entries = req->payload->n;
+    } else {
+        args->entries = NULL;
+        args->n_entries = 0;
+    }
 
     /* From Section 3.5:
      *
@@ -143,11 +236,9 @@ static int sendAppendEntries(struct raft *r,
 
 
     req->raft = r;
-    req->index = args->prev_log_index + 1;
-    req->n = args->n_entries;
     req->server_id = server->id;
     req->send.data = req;
-    optimistic_next_index = req->index + req->n;
+    optimistic_next_index = next_index + args->n_entries;
 
     rv = r->io->send(r->io, &req->send, &message, sendAppendEntriesCb);
     if (rv != 0) {
@@ -164,7 +255,7 @@ static int sendAppendEntries(struct raft *r,
     progressUpdateLastSend(r, i);
     return 0;
 err_after_entries_acquired:
-    logRelease(&r->log, next_index, args->entries, args->n_entries);
+    appendEntriesPayloadPut(r, req->payload);
 err_after_req_alloc:
     raft_free(req);
 err_req_alloc:
@@ -176,11 +267,11 @@ err_req_alloc:
  * raft_io_>send(). */
 struct sendInstallSnapshot
 {
-    struct raft *raft;               /* Instance sending the snapshot. */
-    struct raft_io_snapshot_get get; /* Snapshot get request. */
-    struct raft_io_send send;        /* Underlying I/O send request. */
-    struct raft_snapshot *snapshot;  /* Snapshot to send. */
-    raft_id server_id;               /* Destination server. */
+    struct raft *raft;              /* Instance sending the snapshot. */
+    struct snapshotCacheGet get;    /* Shared snapshot get request. */
+    struct raft_io_send send;       /* Underlying I/O send request. */
+    struct raft_snapshot *snapshot; /* Snapshot to send. */
+    raft_id server_id;              /* Destination server. */
 };
 
 static void sendInstallSnapshotCb(struct raft_io_send *send, int status)
@@ -200,12 +291,11 @@ static void sendInstallSnapshotCb(struct raft_io_send *send, int status)
         }
     }
 
-    snapshotClose(req->snapshot);
-    raft_free(req->snapshot);
+    snapshotCacheRelease(&req->get);
     raft_free(req);
 }
 
-static void sendSnapshotGetCb(struct raft_io_snapshot_get *get,
+static void sendSnapshotGetCb(struct snapshotCacheGet *get,
                               struct raft_snapshot *snapshot,
                               int status)
 {
@@ -241,6 +331,18 @@ static void sendSnapshotGetCb(struct raft_io_snapshot_get *get,
         goto abort_with_snapshot;
     }
 
+    if (snapshotHasFiles(snapshot)) {
+        rv = snapshotTransferStart(r, i, &req->get, snapshot);
+        if (rv != 0) {
+            if (rv != RAFT_NOCONNECTION)
+                evtErrf("E-1528-308", "raft(%llx) send snapshot files failed %d",
+                        r->id, rv);
+            goto abort_with_snapshot;
+        }
+        raft_free(req);
+        goto out;
+    }
+
     assert(snapshot->n_bufs == 1);
 
     message.type = RAFT_IO_INSTALL_SNAPSHOT;
@@ -269,8 +371,7 @@ static void sendSnapshotGetCb(struct raft_io_snapshot_get *get,
     goto out;
 
 abort_with_snapshot:
-    snapshotClose(snapshot);
-    raft_free(snapshot);
+    snapshotCacheRelease(&req->get);
 abort:
     if (r->state == RAFT_LEADER && server != NULL &&
         progress_state_is_snapshot) {
@@ -300,10 +401,14 @@ static int sendSnapshot(struct raft *r, const unsigned i)
     request->server_id = server->id;
     request->get.data = request;
 
+    /* The callback fires right away if the snapshot is already loaded, so
+     * record the send time first. */
+    progressUpdateSnapshotLastSend(r, i);
+
     /* TODO: make sure that the I/O implementation really returns the latest
      * snapshot *at this time* and not any snapshot that might be stored at a
      * later point. Otherwise the progress snapshot_index would be wrong. */
-    rv = r->io->snapshot_get(r->io, &request->get, sendSnapshotGetCb);
+    rv = snapshotCacheGet(r, &request->get, sendSnapshotGetCb);
     if (rv != 0) {
         evtErrf("E-1528-184", "raft(%llx) snapshot get failed %d", r->id, rv);
         goto err_after_req_alloc;
@@ -311,9 +416,7 @@ static int sendSnapshot(struct raft *r, const unsigned i)
 
     if (r->state != RAFT_LEADER) {
         evtNoticef("N-1528-040", "raft(%llx) leader has step down after get snapshot", r->id);
-        return 0;
     }
-    progressUpdateSnapshotLastSend(r, i);
     return 0;
 
 err_after_req_alloc:
@@ -450,6 +553,17 @@ int replicationHeartbeat(struct raft *r)
     return triggerAll(r);
 }
 
+/* Account the payload of entries written to disk. */
+static void accountAppended(struct raft *r,
+                            const struct raft_entry *entries,
+                            unsigned n)
+{
+    unsigned i;
+    for (i = 0; i < n; i++) {
+        r->usage.bytes_appended += entries[i].buf.len;
+    }
+}
+
 /* Context for a write log entries request that was submitted by a leader. */
 struct appendLeader
 {
@@ -519,8 +633,7 @@ static void fireRequestCb(struct raft *r, raft_index index, int status)
     switch (req->type) {
         case RAFT_COMMAND:
             apply = (struct raft_apply *)req;
-            if (apply->cb)
-                apply->cb(apply, status, NULL);
+            packFireApply(apply, status, NULL, false, 0);
 	    break;
         case RAFT_BARRIER:
             barrier = (struct raft_barrier *)req;
@@ -530,8 +643,7 @@ static void fireRequestCb(struct raft *r, raft_index index, int status)
     };
 }
 
-/* Invoked once a disk write request for new entries has been completed. */
-static void appendLeaderCb(struct raft_io_append *req, int status)
+static void appendLeaderDone(struct raft_io_append *req, int status)
 {
     struct appendLeader *request = req->data;
     struct raft *r = request->raft;
@@ -623,6 +735,27 @@ out:
         }
     }
     raft_free(request);
+
+    /* Write out the commands packed while this write was in flight. */
+    if (r->state == RAFT_LEADER && r->nr_appending_requests == 0) {
+        packFlush(r);
+    }
+}
+
+/* Invoked once a disk write request for new entries has been completed. */
+static void appendLeaderCb(struct raft_io_append *req, int status)
+{
+    struct appendLeader *request = req->data;
+    struct raft *r = request->raft;
+    struct watchdogTimer timer;
+
+    if (status == 0) {
+        accountAppended(r, request->entries, request->n);
+    }
+    watchdogEnter(r, &timer);
+    appendLeaderDone(req, status);
+    publishUpdate(r);
+    watchdogExit(r, &timer, "append leader");
 }
 
 /* Submit a disk write for all entries from the given index onward. */
@@ -729,6 +862,10 @@ static int triggerActualPromotion(struct raft *r)
 
     server = &r->configuration.servers[server_index];
 
+    /* Commands packed so far were submitted before the promotion, so they
+     * must precede the RAFT_CHANGE entry. */
+    packFlush(r);
+
     /* Update our current configuration. */
     old_role = server->role;
     if (r->leader_state.remove_id == 0) {
@@ -755,7 +892,7 @@ static int triggerActualPromotion(struct raft *r)
     entry = logGet(&r->log, index);
     assert(entry);
     assert(entry->type == RAFT_CHANGE);
-    r->hook->entry_after_append_fn(r->hook, index, entry);
+    hookEntriesAfterAppend(r, index, 1);
 
     evtNoticef("N-1528-044", "raft(%llx) promotee %llx promoted to voter ", r->id,
 	       r->leader_state.promotee_id);
@@ -832,6 +969,12 @@ int replicationUpdate(struct raft *r, const raft_id id, unsigned i,
      *     decrement nextIndex and retry.
      */
     if (result->rejected > 0) {
+        /* Heartbeats sent while snapshot files are in flight are rejected
+         * until the follower installs the snapshot, the transfer itself
+         * times out if it stalls. */
+        if (p->state == PROGRESS__SNAPSHOT && snapshotTransferActive(r, id)) {
+            return 0;
+        }
         if (p->state != PROGRESS__SNAPSHOT)
             evtNoticef("N-1528-045", "raft(%llx) %llx %d rejected %lu %lu %lu %lu",
                 r->id, id, i, result->rejected, result->last_log_index,
@@ -890,6 +1033,9 @@ int replicationUpdate(struct raft *r, const raft_id id, unsigned i,
     if (result->n_entries && result->timestamp) {
         trySampleAELatency(r, p, result->timestamp);
     }
+    if (!result->n_entries && result->timestamp) {
+        adaptiveSample(r, result->timestamp);
+    }
 
     if (!updated) {
         return 0;
@@ -994,7 +1140,7 @@ struct appendFollower
     struct raft_entry entries[];
 };
 
-static void appendFollowerCb(struct raft_io_append *req, int status)
+static void appendFollowerDone(struct raft_io_append *req, int status)
 {
     struct appendFollower *request = req->data;
     struct raft *r = request->raft;
@@ -1109,6 +1255,21 @@ out:
     raft_free(request);
 }
 
+static void appendFollowerCb(struct raft_io_append *req, int status)
+{
+    struct appendFollower *request = req->data;
+    struct raft *r = request->raft;
+    struct watchdogTimer timer;
+
+    if (status == 0) {
+        accountAppended(r, request->args.entries, request->args.n_entries);
+    }
+    watchdogEnter(r, &timer);
+    appendFollowerDone(req, status);
+    publishUpdate(r);
+    watchdogExit(r, &timer, "append follower");
+}
+
 /* Check the log matching property against an incoming AppendEntries request.
  *
  * From Figure 3.1:
@@ -1248,7 +1409,6 @@ int replicationAppend(struct raft *r,
     int match;
     size_t n;
     size_t i;
-    size_t j;
     int rv;
     raft_index args_last_index = args->prev_log_index + args->n_entries;
 
@@ -1348,18 +1508,15 @@ int replicationAppend(struct raft *r,
     /* Update our in-memory log to reflect that we received these entries. We'll
      * notify the leader of a successful append once the write entries request
      * that we issue below actually completes.  */
-    for (j = 0; j < n; j++) {
-        struct raft_entry *entry = &args->entries[i + j];
-         /* TODO This copy should not strictly be necessary, as the batch logic will
-          * take care of freeing the batch buffer in which the entries are received.
-          * However, this would lead to memory spikes in certain edge cases.
-          * https://github.com/canonical/dqlite/issues/276
-          */
-        rv = logAppend(&r->log, entry->term, entry->type, &entry->buf, entry->batch);
-        if (rv != 0) {
-            evtErrf("E-1528-214", "raft(%llx) log append failed %d", r->id, rv);
-            goto err_after_request_alloc;
-        }
+    /* TODO This copy should not strictly be necessary, as the batch logic will
+     * take care of freeing the batch buffer in which the entries are received.
+     * However, this would lead to memory spikes in certain edge cases.
+     * https://github.com/canonical/dqlite/issues/276
+     */
+    rv = logAppendEntries(&r->log, &args->entries[i], (unsigned)n);
+    if (rv != 0) {
+        evtErrf("E-1528-214", "raft(%llx) log append failed %d", r->id, rv);
+        goto err_after_request_alloc;
     }
 
     request->args.entries = request->entries;
@@ -1368,7 +1525,7 @@ int replicationAppend(struct raft *r,
                     &request->args.n_entries, (unsigned)n);
     if (rv != 0) {
         evtErrf("E-1528-215", "raft(%llx) log acquire failed %d", r->id, rv);
-        goto err_after_request_alloc;
+        goto err_after_log_append;
     }
 
     assert(request->args.n_entries == n);
@@ -1401,14 +1558,13 @@ err_after_acquire_entries:
     /* Release the entries related to the IO request */
     logRelease(&r->log, request->index, request->args.entries,
                request->args.n_entries);
-err_after_request_alloc:
+err_after_log_append:
     /* Release all entries added to the in-memory log, making
      * sure the in-memory log and disk don't diverge, leading
      * to future log entries not being persisted to disk.
      */
-    if (j != 0) {
-        logDiscard(&r->log, request->index);
-    }
+    logDiscard(&r->log, request->index);
+err_after_request_alloc:
     raft_free(request);
 err:
     assert(rv != 0);
@@ -1419,8 +1575,62 @@ struct recvInstallSnapshot
 {
     struct raft *raft;
     struct raft_snapshot snapshot;
+    struct raft_io_snapshot_get get; /* Load of a file-based snapshot */
 };
 
+/* Restore a file-based snapshot once it has been stored, the directory holding
+ * its files is only known after loading it back. */
+static void installSnapshotGetCb(struct raft_io_snapshot_get *get,
+                                 struct raft_snapshot *loaded,
+                                 int status)
+{
+    struct recvInstallSnapshot *request = get->data;
+    struct raft *r = request->raft;
+    struct raft_snapshot *snapshot = &request->snapshot;
+    struct raft_append_entries_result result;
+    int rv;
+
+    r->snapshot.put.data = NULL;
+
+    result.term = r->current_term;
+    result.rejected = snapshot->index;
+
+    if (status != 0) {
+        evtErrf("E-1528-309", "raft(%llx) load snapshot %llu failed %d", r->id,
+                snapshot->index, status);
+        goto out;
+    }
+    if (r->state == RAFT_UNAVAILABLE || loaded->index != snapshot->index) {
+        goto out_after_load;
+    }
+
+    rv = snapshotRestore(r, loaded);
+    if (rv != 0) {
+        tracef("restore snapshot %llu: %s", snapshot->index,
+               raft_strerror(rv));
+        goto out_after_load;
+    }
+    raft_free(loaded);
+
+    tracef("restored snapshot with last index %llu", snapshot->index);
+    snapshotCacheInvalidate(r);
+    readUpdate(r);
+
+    result.rejected = 0;
+    goto out;
+
+out_after_load:
+    snapshotClose(loaded);
+    raft_free(loaded);
+out:
+    raft_configuration_close(&snapshot->configuration);
+    if (r->state != RAFT_UNAVAILABLE) {
+        result.last_log_index = r->last_stored;
+        sendAppendEntriesResult(r, &result);
+    }
+    raft_free(request);
+}
+
 static void installSnapshotCb(struct raft_io_snapshot_put *req, int status)
 {
     struct recvInstallSnapshot *request = req->data;
@@ -1446,6 +1656,19 @@ static void installSnapshotCb(struct raft_io_snapshot_put *req, int status)
         goto discard;
     }
 
+    if (snapshotHasFiles(snapshot)) {
+        r->snapshot.put.data = request;
+        request->get.data = request;
+        rv = r->io->snapshot_get(r->io, &request->get, installSnapshotGetCb);
+        if (rv == 0) {
+            return;
+        }
+        evtErrf("E-1528-310", "raft(%llx) snapshot get failed %d", r->id, rv);
+        r->snapshot.put.data = NULL;
+        result.rejected = snapshot->index;
+        goto discard;
+    }
+
     /* From Figure 5.3:
      *
      *   7. Discard the entire log
@@ -1461,6 +1684,8 @@ static void installSnapshotCb(struct raft_io_snapshot_put *req, int status)
     }
 
     tracef("restored snapshot with last index %llu", snapshot->index);
+    snapshotCacheInvalidate(r);
+    readUpdate(r);
 
     result.rejected = 0;
 
@@ -1469,7 +1694,9 @@ static void installSnapshotCb(struct raft_io_snapshot_put *req, int status)
 discard:
     /* In case of error we must also free the snapshot data buffer and free the
      * configuration. */
-    raft_free(snapshot->bufs[0].base);
+    if (!snapshotHasFiles(snapshot)) {
+        raft_free(snapshot->bufs[0].base);
+    }
     raft_configuration_close(&snapshot->configuration);
 
 respond:
@@ -1546,6 +1773,9 @@ int replicationInstallSnapshot(struct raft *r,
     }
     snapshot->bufs[0] = args->data;
     snapshot->n_bufs = 1;
+    snapshot->dir = NULL;
+    snapshot->files = NULL;
+    snapshot->n_files = 0;
 
     assert(r->snapshot.put.data == NULL);
     r->snapshot.put.data = request;
@@ -1569,6 +1799,55 @@ err:
     return rv;
 }
 
+int replicationInstallSnapshotFiles(struct raft *r,
+                                    struct raft_install_snapshot_chunk *args)
+{
+    struct recvInstallSnapshot *request;
+    struct raft_snapshot *snapshot;
+    int rv;
+
+    assert(r->state == RAFT_FOLLOWER);
+    assert(r->snapshot.pending.term == 0 && r->snapshot.put.data == NULL);
+
+    request = raft_malloc(sizeof *request);
+    if (request == NULL) {
+        evtErrf("E-1528-311", "%s", "malloc");
+        return RAFT_NOMEM;
+    }
+    request->raft = r;
+
+    /* Preemptively update our in-memory state. */
+    logRestore(&r->log, args->last_index, args->last_term);
+
+    r->last_stored = 0;
+
+    /* No buffers and no directory: the I/O implementation stores the files
+     * it received for this snapshot. */
+    snapshot = &request->snapshot;
+    snapshot->term = args->last_term;
+    snapshot->index = args->last_index;
+    snapshot->configuration_index = args->conf_index;
+    snapshot->configuration = args->conf;
+    snapshot->bufs = NULL;
+    snapshot->n_bufs = 0;
+    snapshot->dir = NULL;
+    snapshot->files = NULL;
+    snapshot->n_files = args->n_files;
+
+    r->snapshot.put.data = request;
+    rv = r->io->snapshot_put(r->io,
+                             0 /* zero trailing means replace everything */,
+                             &r->snapshot.put, snapshot, installSnapshotCb);
+    if (rv != 0) {
+        evtErrf("E-1528-312", "raft(%llx) snapshot put failed %d", r->id, rv);
+        r->snapshot.put.data = NULL;
+        raft_free(request);
+        return rv;
+    }
+
+    return 0;
+}
+
 struct applyCmd
 {
     struct raft *raft;          	/* Instance that has submitted the request */
@@ -1576,10 +1855,111 @@ struct applyCmd
     struct raft_fsm_apply req;
     struct raft_entry entry;
     bool incRef;
+    size_t len;                 	/* Payload size accounted in the window */
+    raft_time start;            	/* Time the FSM apply was submitted */
+    void *flat;                 	/* Concatenated segments, if any */
+    bool packed;                	/* Whether the entry is RAFT_PACKED */
 };
-static void applyCommandCb(struct raft_fsm_apply *req,
-                           void *result,
-                           int status)
+
+/* Whether dispatching another entry of the given size would exceed the apply
+ * window. At least one entry is always allowed in flight. */
+static bool applyWindowFull(struct raft *r, size_t len)
+{
+    unsigned max_entries = r->apply_window.adaptive
+                               ? r->apply_window.window
+                               : r->apply_window.max_entries;
+
+    if (r->nr_applying == 0) {
+        return false;
+    }
+    if (max_entries != 0 && r->nr_applying >= max_entries) {
+        return true;
+    }
+    if (r->apply_window.max_bytes != 0 &&
+        r->apply_window.bytes + len > r->apply_window.max_bytes) {
+        return true;
+    }
+    return false;
+}
+
+/* Additive increase, multiplicative decrease of the adaptive entry window,
+ * evaluated once per window worth of completions. */
+static void applyWindowAdapt(struct raft *r, raft_time latency)
+{
+    unsigned window = r->apply_window.window;
+
+    if (latency > r->apply_window.target_latency) {
+        r->apply_window.slow = true;
+    }
+    r->apply_window.acked += 1;
+    if (r->apply_window.acked < window) {
+        return;
+    }
+
+    if (r->apply_window.slow) {
+        window = max(window / 2, 1);
+    } else if (r->apply_window.max_entries == 0 ||
+               window < r->apply_window.max_entries) {
+        window += 1;
+    }
+    if (window != r->apply_window.window) {
+        evtInfof("I-1528-275", "raft(%llx) apply window %u -> %u latency %llu",
+                 r->id, r->apply_window.window, window, latency);
+        r->apply_window.window = window;
+    }
+    r->apply_window.acked = 0;
+    r->apply_window.slow = false;
+}
+
+/* Hold back the entry at @index because the window is full, remembering when
+ * it was first held back. */
+static void applyWindowHold(struct raft *r, raft_index index)
+{
+    r->apply_window.throttled = true;
+    r->apply_window.nr_throttled += 1;
+    if (r->apply_window.held_index != index) {
+        r->apply_window.held_index = index;
+        r->apply_window.held_since = r->io->time_us(r->io);
+    }
+}
+
+/* Sample the time the entry at @index spent held back by the window, if it
+ * was, now that it's being dispatched. */
+static void applyWindowDispatch(struct raft *r, raft_index index)
+{
+    raft_time now;
+
+    if (r->apply_window.held_index == 0 ||
+        r->apply_window.held_index > index) {
+        return;
+    }
+    if (r->apply_window.held_index == index) {
+        now = r->io->time_us(r->io);
+        metricSampleLatency(&r->apply_window.held_latency,
+                            now > r->apply_window.held_since
+                                ? now - r->apply_window.held_since
+                                : 0);
+    }
+    r->apply_window.held_index = 0;
+}
+
+/* Account for the completion of an in-flight apply request. */
+static void applyWindowRelease(struct raft *r, struct applyCmd *request)
+{
+    raft_time now = r->io->time_us(r->io);
+    raft_time latency = now > request->start ? now - request->start : 0;
+
+    assert(r->apply_window.bytes >= request->len);
+    r->apply_window.bytes -= request->len;
+    metricSampleLatency(&r->apply_window.fsm_latency, latency);
+    if (r->apply_window.adaptive) {
+        applyWindowAdapt(r, latency);
+    }
+}
+
+static void applyCommandDone(struct raft_fsm_apply *req,
+                             void *result,
+                             int status)
 {
     struct applyCmd *request = req->data;
     struct raft *r = request->raft;
@@ -1590,8 +1970,11 @@ static void applyCommandCb(struct raft_fsm_apply *req,
 
     if (request->incRef)
         logRelease(&r->log, request->index, &request->entry, 1);
+    if (request->flat != NULL)
+        raft_free(request->flat);
     assert(r->nr_applying);
     r->nr_applying -= 1;
+    applyWindowRelease(r, request);
     if (r->last_applied + 1 != index) {
         evtNoticef("N-1528-052", "%llx apply index not match %llu/%llu status %d", r->id,
             index, r->last_applied, status);
@@ -1600,9 +1983,10 @@ static void applyCommandCb(struct raft_fsm_apply *req,
     hookRequestApplyDone(r, index);
 
     creq = (struct raft_apply *)getRequest(r, index);
-    if (creq != NULL && creq->cb != NULL) {
+    if (creq != NULL) {
         assert(creq->type == RAFT_COMMAND);
-        creq->cb(creq, status, result);
+        packFireApply(creq, status, result, request->packed,
+                      status != 0 ? packApplied(r, index) : 0);
     }
     raft_free(request);
 
@@ -1635,11 +2019,15 @@ static void applyCommandCb(struct raft_fsm_apply *req,
 err_skip_failed:
     assert(r->last_applied + 1 == index);
     r->last_applied = index;
+    readUpdate(r);
     if (r->nr_applying == 0) {
         r->last_applying = r->last_applied;
     }
 
-    if (r->last_applied == r->last_applying) {
+    /* Resume applying once all in-flight entries are done, or as soon as
+     * there's room again in the apply window. */
+    if (r->last_applied == r->last_applying ||
+        (r->apply_window.throttled && !applyWindowFull(r, 0))) {
         if (r->state == RAFT_LEADER ||
                 r->state == RAFT_FOLLOWER) {
             int rv = replicationApply(r);
@@ -1651,7 +2039,80 @@ err_skip_failed:
         }
     }
 }
-/* Apply a RAFT_COMMAND entry that has been committed. */
+
+static void applyCommandCb(struct raft_fsm_apply *req,
+                           void *result,
+                           int status)
+{
+    struct applyCmd *request = req->data;
+    struct raft *r = request->raft;
+    struct watchdogTimer timer;
+
+    watchdogEnter(r, &timer);
+    applyCommandDone(req, result, status);
+    publishUpdate(r);
+    watchdogExit(r, &timer, "apply");
+}
+
+/* Submit the data of a RAFT_SEGMENTS entry to the FSM, concatenating its
+ * segments if the FSM can't apply them directly. */
+static int applySegments(struct raft *r,
+                         struct applyCmd *request,
+                         const struct raft_entry *entry)
+{
+    const struct raft_segments *segs = entry->buf.base;
+    struct raft_buffer buf;
+
+    if (r->fsm->version >= 2 && r->fsm->apply_segments != NULL) {
+        return r->fsm->apply_segments(r->fsm, &request->req, segs->bufs,
+                                      segs->n, applyCommandCb);
+    }
+
+    buf.len = entry->buf.len;
+    buf.base = raft_malloc(buf.len > 0 ? buf.len : 1);
+    if (buf.base == NULL) {
+        evtErrf("E-1528-282", "%s", "malloc");
+        return RAFT_NOMEM;
+    }
+    entryDataCopy(entry, buf.base);
+    request->flat = buf.base;
+    return r->fsm->apply(r->fsm, &request->req, &buf, applyCommandCb);
+}
+
+/* Submit a RAFT_COMMAND entry to an FSM that keeps its payload, handing over a
+ * reference to the payload instead of letting the FSM copy it. */
+static int applyHold(struct raft *r,
+                     struct applyCmd *request,
+                     raft_index index,
+                     const struct raft_entry *entry)
+{
+    struct raft_payload *payload;
+    int rv;
+
+    payload = raft_malloc(sizeof *payload);
+    if (payload == NULL) {
+        evtErrf("E-1528-314", "%s", "malloc");
+        return RAFT_NOMEM;
+    }
+    payload->raft = r;
+    payload->buf = entry->buf;
+    rv = logHold(&r->log, index, &payload->id);
+    if (rv != 0) {
+        evtErrf("E-1528-315", "raft(%llx) hold entry %llu failed %d", r->id,
+                index, rv);
+        raft_free(payload);
+        return rv;
+    }
+
+    rv = r->fsm->apply_hold(r->fsm, &request->req, payload, applyCommandCb);
+    if (rv != 0) {
+        raft_payload_release(payload);
+    }
+    return rv;
+}
+
+/* Apply a RAFT_COMMAND, RAFT_SEGMENTS or RAFT_PACKED entry that has been
+ * committed. */
 static int applyCommand(struct raft *r,
                         const raft_index index,
                         const struct raft_entry *entry)
@@ -1671,20 +2132,41 @@ static int applyCommand(struct raft *r,
     request->index = index;
     request->req.data = request;
     request->incRef = r->state == RAFT_LEADER && r->quorum != RAFT_FULL;
-
+    request->len = entry->buf.len;
+    request->start = r->io->time_us(r->io);
+    request->flat = NULL;
+    request->packed = entry->type == RAFT_PACKED;
+
+    /* The entry returned by logGet() is only valid until the next call, so
+     * give the FSM a buffer owned by the request. */
+    request->entry = *entry;
+    entry = &request->entry;
     if (request->incRef) {
-        request->entry = *entry;
         logAddRef(&r->log, entry, index);
     }
 
-    rv = r->fsm->apply(r->fsm,
-                       &request->req,
-                       &entry->buf,
-                       applyCommandCb);
+    /* Account for the request before submitting it, since the FSM might
+     * invoke the callback synchronously. */
+    r->apply_window.bytes += request->len;
+    if (entry->type == RAFT_SEGMENTS) {
+        rv = applySegments(r, request, entry);
+    } else if (entry->type == RAFT_PACKED) {
+        rv = packApply(r, &request->req, index, &entry->buf, applyCommandCb);
+    } else if (r->fsm->version >= 5 && r->fsm->apply_hold != NULL) {
+        rv = applyHold(r, request, index, entry);
+    } else {
+        rv = r->fsm->apply(r->fsm,
+                           &request->req,
+                           &entry->buf,
+                           applyCommandCb);
+    }
     if (rv != 0) {
         evtErrf("E-1528-223", "raft(%llx) apply failed %d", r->id, rv);
         if (request->incRef)
-            logRelease(&r->log, index, (struct raft_entry *)entry, 1);
+            logRelease(&r->log, index, &request->entry, 1);
+        if (request->flat != NULL)
+            raft_free(request->flat);
+        r->apply_window.bytes -= request->len;
         raft_free(request);
     }
 
@@ -1749,7 +2231,7 @@ static void applyChange(struct raft *r, const raft_index index)
 
 static raft_index nextSnapshotIndex(struct raft *r)
 {
-	raft_index snapshot_index = min(r->last_applied, r->last_stored);
+	raft_index snapshot_index = min(r->last_applied, raft_durable_index(r));
 	raft_index hook_snapshot_index = 0;
 
 	if (r->hook->get_next_snapshot_index)
@@ -1758,7 +2240,7 @@ static raft_index nextSnapshotIndex(struct raft *r)
 	if (r->state == RAFT_FOLLOWER && r->sync_snapshot) {
 		snapshot_index =
 			min(r->follower_state.current_leader.snapshot_index,
-			    min(r->last_applied, r->last_stored));
+			    min(r->last_applied, raft_durable_index(r)));
 	}
 
 	if (hook_snapshot_index != 0)
@@ -1827,7 +2309,11 @@ static void takeSnapshotCb(struct raft_io_snapshot_put *req, int status)
         goto out;
     }
 
-    logSnapshot(&r->log, snapshot->index, r->snapshot.trailing);
+    /* Subscribers might have consumed more entries since the snapshot was
+     * put, so what they need is figured out again. */
+    logSnapshot(&r->log, snapshot->index,
+                cdcTrailing(r, snapshot->index, r->snapshot.trailing));
+    snapshotCacheInvalidate(r);
 out:
     snapshotClose(&r->snapshot.pending);
     r->snapshot.pending.term = 0;
@@ -1855,7 +2341,17 @@ static int doSnapshot(struct raft *r, raft_index snapshot_index,
 
     snapshot->configuration_index = r->configuration_index;
 
-    rv = r->fsm->snapshot(r->fsm, &snapshot->bufs, &snapshot->n_bufs);
+    snapshot->files = NULL;
+    snapshot->n_files = 0;
+    if (r->fsm->version >= 4 && r->fsm->checkpoint != NULL) {
+        snapshot->bufs = NULL;
+        snapshot->n_bufs = 0;
+        snapshot->dir = NULL;
+        rv = r->fsm->checkpoint(r->fsm, &snapshot->dir);
+    } else {
+        snapshot->dir = NULL;
+        rv = r->fsm->snapshot(r->fsm, &snapshot->bufs, &snapshot->n_bufs);
+    }
     if (rv != 0) {
         evtErrf("E-1528-227", "raft(%llx) snapshot failed %d", r->id, rv);
         /* Ignore transient errors. We'll retry next time. */
@@ -1868,8 +2364,9 @@ static int doSnapshot(struct raft *r, raft_index snapshot_index,
     r->snapshot.trailing = trailing;
     assert(r->snapshot.put.data == NULL);
     r->snapshot.put.data = r;
-    rv = r->io->snapshot_put(r->io, r->snapshot.trailing, &r->snapshot.put,
-                             snapshot, takeSnapshotCb);
+    rv = r->io->snapshot_put(r->io,
+                             cdcTrailing(r, snapshot_index, trailing),
+                             &r->snapshot.put, snapshot, takeSnapshotCb);
     if (rv != 0) {
         evtErrf("E-1528-228", "raft(%llx) snapshot put failed %d", r->id, rv);
         goto abort_after_fsm_snapshot;
@@ -1881,6 +2378,7 @@ abort_after_fsm_snapshot:
         raft_free(snapshot->bufs[i].base);
     }
     raft_free(snapshot->bufs);
+    raft_free(snapshot->dir);
 abort_after_config_copy:
     raft_configuration_close(&snapshot->configuration);
 abort:
@@ -1964,12 +2462,15 @@ int replicationApply(struct raft *r)
     assert(r->state == RAFT_LEADER || r->state == RAFT_FOLLOWER);
     assert(r->last_applied <= r->commit_index);
 
+    cdcUpdate(r);
+
     if (r->last_applied == r->commit_index) {
         /* Nothing to do. */
         goto err_take_snapshot;
     }
 
     r->apply_status = 0;
+    r->apply_window.throttled = false;
     while(r->last_applying < r->commit_index) {
         if (r->apply_status != 0)
             break;
@@ -1988,10 +2489,18 @@ int replicationApply(struct raft *r)
         }
 
         assert(entry->type == RAFT_COMMAND || entry->type == RAFT_BARRIER ||
-               entry->type == RAFT_CHANGE);
+               entry->type == RAFT_CHANGE || entry->type == RAFT_SEGMENTS ||
+               entry->type == RAFT_PACKED);
 
         switch (entry->type) {
             case RAFT_COMMAND:
+            case RAFT_SEGMENTS:
+            case RAFT_PACKED:
+                if (applyWindowFull(r, entry->buf.len)) {
+                    applyWindowHold(r, index);
+                    goto err_take_snapshot;
+                }
+                applyWindowDispatch(r, index);
                 r->last_applying = index;
                 r->nr_applying += 1;
                 rv = applyCommand(r, index, entry);
@@ -2014,6 +2523,7 @@ int replicationApply(struct raft *r)
                 applyBarrier(r, index);
                 r->last_applied = index;
                 r->last_applying = index;
+                readUpdate(r);
                 break;
             case RAFT_CHANGE:
                 if (r->last_applying > r->last_applied)
@@ -2022,6 +2532,7 @@ int replicationApply(struct raft *r)
                 applyChange(r, index);
                 r->last_applied = index;
                 r->last_applying = index;
+                readUpdate(r);
                 break;
             default:/* For coverity. This case can't be taken. */
                 break;
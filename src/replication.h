@@ -5,16 +5,26 @@
 
 #include "../include/raft.h"
 
+/* Entries acquired from the log for AppendEntries requests. Requests sending
+ * the same range of entries in the same term share a single payload, so the
+ * entries are acquired once and I/O backends can encode them once. */
+struct appendEntriesPayload
+{
+    raft_term term;              /* Term in which entries were acquired. */
+    raft_index index;            /* Index of the first entry. */
+    unsigned n;                  /* Length of the entries array. */
+    unsigned refs;               /* Requests referencing the payload. */
+    struct raft_entry entries[]; /* Entries referenced by the requests. */
+};
+
 /* Context of a RAFT_IO_APPEND_ENTRIES request that was submitted with
  * raft_io_>send(). */
 struct sendAppendEntries
 {
-    struct raft *raft;          /* Instance sending the entries. */
-    struct raft_io_send send;   /* Underlying I/O send request. */
-    raft_index index;           /* Index of the first entry in the request. */
-    unsigned n;                 /* Length of the entries array. */
-    raft_id server_id;          /* Destination server. */
-    struct raft_entry entries[]; /* Entries referenced in the request. */
+    struct raft *raft;                    /* Instance sending the entries. */
+    struct raft_io_send send;             /* Underlying I/O send request. */
+    struct appendEntriesPayload *payload; /* Entries sent, NULL if none. */
+    raft_id server_id;                    /* Destination server. */
 };
 /* Send AppendEntries RPC messages to all followers to which no AppendEntries
  * was sent in the last heartbeat interval. */
@@ -89,6 +99,13 @@ int replicationInstallSnapshot(struct raft *r,
                                raft_index *rejected,
                                bool *async);
 
+/* Install a file-based snapshot whose files have all been received in the
+ * staging area. Ownership of the configuration in @args is transferred.
+ *
+ * It must be called only by followers. */
+int replicationInstallSnapshotFiles(struct raft *r,
+                                    struct raft_install_snapshot_chunk *args);
+
 /* Returns `true` if the raft instance is currently installing a snapshot */
 bool replicationInstallSnapshotBusy(struct raft *r);
 
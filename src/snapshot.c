@@ -20,6 +20,11 @@ void snapshotClose(struct raft_snapshot *s)
 {
     unsigned i;
     configurationClose(&s->configuration);
+    if (snapshotHasFiles(s)) {
+        raft_free(s->dir);
+        raft_free(s->files);
+        return;
+    }
     for (i = 0; i < s->n_bufs; i++) {
         raft_free(s->bufs[i].base);
     }
@@ -36,9 +41,18 @@ int snapshotRestore(struct raft *r, struct raft_snapshot *snapshot)
 {
     int rv;
 
-    assert(snapshot->n_bufs == 1);
-
-    rv = r->fsm->restore(r->fsm, &snapshot->bufs[0]);
+    if (snapshotHasFiles(snapshot)) {
+        if (r->fsm->version < 4 || r->fsm->restore_dir == NULL) {
+            evtErrf("E-1528-292", "raft(%llx) fsm can't restore snapshot dir",
+                    r->id);
+            rv = RAFT_INVALID;
+            goto err;
+        }
+        rv = r->fsm->restore_dir(r->fsm, snapshot->dir);
+    } else {
+        assert(snapshot->n_bufs == 1);
+        rv = r->fsm->restore(r->fsm, &snapshot->bufs[0]);
+    }
     if (rv != 0) {
         evtErrf("E-1528-234", "raft(%llx) restore snapshot failed %d", r->id, rv);
         goto err;
@@ -63,8 +77,13 @@ int snapshotRestore(struct raft *r, struct raft_snapshot *snapshot)
     r->last_stored = snapshot->index;
 
     /* Don't free the snapshot data buffer, as ownership has been transferred to
-     * the fsm. */
-    raft_free(snapshot->bufs);
+     * the fsm. The files of a file-based snapshot stay where they are. */
+    if (snapshotHasFiles(snapshot)) {
+        raft_free(snapshot->dir);
+        raft_free(snapshot->files);
+    } else {
+        raft_free(snapshot->bufs);
+    }
 
     return 0;
 err:
@@ -74,6 +93,42 @@ err:
     return rv;
 }
 
+/* Copy the directory and file list of a file-based snapshot. */
+static int snapshotCopyFiles(const struct raft_snapshot *src,
+                             struct raft_snapshot *dst)
+{
+    size_t len;
+
+    dst->bufs = NULL;
+    dst->n_bufs = 0;
+    dst->files = NULL;
+    dst->n_files = src->n_files;
+    dst->dir = NULL;
+
+    if (src->dir != NULL) {
+        len = strlen(src->dir) + 1;
+        dst->dir = raft_malloc(len);
+        if (dst->dir == NULL) {
+            goto oom;
+        }
+        memcpy(dst->dir, src->dir, len);
+    }
+    if (src->files != NULL && src->n_files > 0) {
+        dst->files = raft_malloc(src->n_files * sizeof *dst->files);
+        if (dst->files == NULL) {
+            goto oom;
+        }
+        memcpy(dst->files, src->files, src->n_files * sizeof *dst->files);
+    }
+    return 0;
+
+oom:
+    evtErrf("E-1528-293", "%s", "malloc");
+    raft_free(dst->dir);
+    configurationClose(&dst->configuration);
+    return RAFT_NOMEM;
+}
+
 int snapshotCopy(const struct raft_snapshot *src, struct raft_snapshot *dst)
 {
     int rv;
@@ -83,6 +138,7 @@ int snapshotCopy(const struct raft_snapshot *src, struct raft_snapshot *dst)
 
     dst->term = src->term;
     dst->index = src->index;
+    dst->configuration_index = src->configuration_index;
 
     rv = configurationCopy(&src->configuration, &dst->configuration);
     if (rv != 0) {
@@ -90,6 +146,13 @@ int snapshotCopy(const struct raft_snapshot *src, struct raft_snapshot *dst)
         return rv;
     }
 
+    if (snapshotHasFiles(src)) {
+        return snapshotCopyFiles(src, dst);
+    }
+    dst->dir = NULL;
+    dst->files = NULL;
+    dst->n_files = 0;
+
     size = 0;
     for (i = 0; i < src->n_bufs; i++) {
         size += src->bufs[i].len;
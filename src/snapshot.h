@@ -3,6 +3,9 @@
 
 #include "../include/raft.h"
 
+/* Whether the given snapshot is a file-based one, see raft_fsm->checkpoint. */
+#define snapshotHasFiles(S) ((S)->bufs == NULL)
+
 /* Release all memory associated with the given snapshot. */
 void snapshotClose(struct raft_snapshot *s);
 
@@ -22,7 +25,8 @@ int snapshotRestore(struct raft *r, struct raft_snapshot *snapshot);
 /* Make a full deep copy of a snapshot object.
  *
  * All data buffers in the source snapshot will be compacted in a single buffer
- * in the destination snapshot. */
+ * in the destination snapshot. For a file-based snapshot only the directory
+ * path and the file list are copied. */
 int snapshotCopy(const struct raft_snapshot *src, struct raft_snapshot *dst);
 
 #endif /* RAFT_SNAPSHOT_H */
@@ -0,0 +1,163 @@
+#include "snapshot_cache.h"
+
+#include "assert.h"
+#include "event.h"
+#include "queue.h"
+#include "snapshot.h"
+#include "tracing.h"
+
+#ifdef ENABLE_TRACE
+#define tracef(...) Tracef(r->tracer, __VA_ARGS__)
+#else
+#define tracef(...)
+#endif
+
+/* A snapshot loaded once and shared by all the requests referencing it. */
+struct snapshotCacheEntry
+{
+    struct raft *raft;                /* Instance owning the cache */
+    struct raft_io_snapshot_get get;  /* Load request */
+    struct raft_snapshot *snapshot;   /* Loaded snapshot, NULL while loading */
+    unsigned refs;                    /* Requests using or awaiting it */
+    queue waiting;                    /* Requests awaiting the load */
+};
+
+void snapshotCacheInit(struct raft *r)
+{
+    r->snapshot.cache = NULL;
+}
+
+static void snapshotCacheDetach(struct snapshotCacheEntry *entry)
+{
+    struct raft *r = entry->raft;
+    if (r->snapshot.cache == entry) {
+        r->snapshot.cache = NULL;
+    }
+}
+
+static void snapshotCacheUnref(struct snapshotCacheEntry *entry)
+{
+    assert(entry->refs > 0);
+    entry->refs -= 1;
+    if (entry->refs > 0) {
+        return;
+    }
+    snapshotCacheDetach(entry);
+    if (entry->snapshot != NULL) {
+        snapshotDestroy(entry->snapshot);
+    }
+    raft_free(entry);
+}
+
+static void snapshotCacheLoadCb(struct raft_io_snapshot_get *get,
+                                struct raft_snapshot *snapshot,
+                                int status)
+{
+    struct snapshotCacheEntry *entry = get->data;
+    struct snapshotCacheGet *req;
+    queue *head;
+
+    if (status != 0) {
+        /* Let later requests try again. */
+        snapshotCacheDetach(entry);
+    } else {
+        entry->snapshot = snapshot;
+    }
+
+    /* Each callback might release its reference, keep the entry alive until
+     * all of them have fired. */
+    entry->refs += 1;
+    while (!QUEUE_IS_EMPTY(&entry->waiting)) {
+        head = QUEUE_HEAD(&entry->waiting);
+        req = QUEUE_DATA(head, struct snapshotCacheGet, queue);
+        QUEUE_REMOVE(head);
+        if (status != 0) {
+            req->entry = NULL;
+            entry->refs -= 1;
+            req->cb(req, NULL, status);
+        } else {
+            req->cb(req, snapshot, 0);
+        }
+    }
+    snapshotCacheUnref(entry);
+}
+
+/* Start loading a new copy of the latest snapshot and make it the shared
+ * one. */
+static int snapshotCacheLoad(struct raft *r)
+{
+    struct snapshotCacheEntry *entry;
+    int rv;
+
+    entry = raft_malloc(sizeof *entry);
+    if (entry == NULL) {
+        evtErrf("E-1528-291", "raft(%llx) snapshot cache alloc failed", r->id);
+        return RAFT_NOMEM;
+    }
+    entry->raft = r;
+    entry->snapshot = NULL;
+    entry->refs = 0;
+    entry->get.data = entry;
+    QUEUE_INIT(&entry->waiting);
+
+    rv = r->io->snapshot_get(r->io, &entry->get, snapshotCacheLoadCb);
+    if (rv != 0) {
+        raft_free(entry);
+        return rv;
+    }
+    r->snapshot.cache = entry;
+    return 0;
+}
+
+int snapshotCacheGet(struct raft *r,
+                     struct snapshotCacheGet *req,
+                     snapshotCacheGetCb cb)
+{
+    struct snapshotCacheEntry *entry = r->snapshot.cache;
+    int rv;
+
+    /* A copy older than the latest snapshot taken can't be reused. */
+    if (entry != NULL && entry->snapshot != NULL &&
+        entry->snapshot->index != r->log.snapshot.last_index) {
+        snapshotCacheDetach(entry);
+        entry = NULL;
+    }
+
+    if (entry == NULL) {
+        rv = snapshotCacheLoad(r);
+        if (rv != 0) {
+            return rv;
+        }
+        entry = r->snapshot.cache;
+    } else {
+        tracef("share snapshot cache with %u requests", entry->refs);
+    }
+
+    req->entry = entry;
+    req->cb = cb;
+    entry->refs += 1;
+
+    if (entry->snapshot == NULL) {
+        QUEUE_PUSH(&entry->waiting, &req->queue);
+        return 0;
+    }
+
+    cb(req, entry->snapshot, 0);
+    return 0;
+}
+
+void snapshotCacheRelease(struct snapshotCacheGet *req)
+{
+    assert(req->entry != NULL);
+    snapshotCacheUnref(req->entry);
+    req->entry = NULL;
+}
+
+void snapshotCacheInvalidate(struct raft *r)
+{
+    if (r->snapshot.cache != NULL) {
+        snapshotCacheDetach(r->snapshot.cache);
+    }
+}
+
+#undef tracef
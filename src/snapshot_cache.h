@@ -0,0 +1,45 @@
+/* Shared copy of the snapshot being sent to followers. */
+
+#ifndef SNAPSHOT_CACHE_H_
+#define SNAPSHOT_CACHE_H_
+
+#include "../include/raft.h"
+
+struct snapshotCacheGet;
+struct snapshotCacheEntry;
+
+typedef void (*snapshotCacheGetCb)(struct snapshotCacheGet *req,
+                                   struct raft_snapshot *snapshot,
+                                   int status);
+
+/* Request to obtain the shared copy of the latest snapshot. */
+struct snapshotCacheGet
+{
+    void *data;                       /* User data */
+    struct snapshotCacheEntry *entry; /* Entry holding the snapshot */
+    snapshotCacheGetCb cb;            /* Completion callback */
+    void *queue[2];                   /* Waiting for the snapshot to load */
+};
+
+/* Initialize the snapshot cache of a raft instance. */
+void snapshotCacheInit(struct raft *r);
+
+/* Obtain the latest snapshot, loading it through raft_io->snapshot_get() only
+ * if no copy of it is already loaded or being loaded. Concurrent and
+ * subsequent requests share the same copy, until it's superseded.
+ *
+ * On success the callback receives a reference to the snapshot, which must be
+ * given back with snapshotCacheRelease() and must not be modified. */
+int snapshotCacheGet(struct raft *r,
+                     struct snapshotCacheGet *req,
+                     snapshotCacheGetCb cb);
+
+/* Drop the reference obtained by a successful request, releasing the snapshot
+ * when no other request uses it. */
+void snapshotCacheRelease(struct snapshotCacheGet *req);
+
+/* Stop sharing the cached copy because a newer snapshot was stored. Requests
+ * still using it keep their reference. */
+void snapshotCacheInvalidate(struct raft *r);
+
+#endif /* SNAPSHOT_CACHE_H_ */
@@ -0,0 +1,589 @@
+#include "snapshot_transfer.h"
+
+#include <string.h>
+
+#include "assert.h"
+#include "configuration.h"
+#include "convert.h"
+#include "event.h"
+#include "progress.h"
+#include "queue.h"
+#include "replication.h"
+#include "tracing.h"
+
+#ifdef ENABLE_TRACE
+#define tracef(...) Tracef(r->tracer, __VA_ARGS__)
+#else
+#define tracef(...)
+#endif
+
+#define SENDS(R) ((queue *)&(R)->snapshot.sends)
+
+/* A file-based snapshot being sent to a follower. */
+struct snapshotSend
+{
+    struct raft *raft;                 /* Instance sending the snapshot */
+    raft_id server_id;                 /* Destination server */
+    struct snapshotCacheGet get;       /* Reference to the snapshot */
+    struct raft_snapshot *snapshot;    /* Snapshot being sent */
+    unsigned file;                     /* File of the current chunk */
+    unsigned long long offset;         /* Offset of the current chunk */
+    struct raft_buffer buf;            /* Current chunk data */
+    struct raft_io_snapshot_read read; /* Read of the current chunk */
+    struct raft_io_send send;          /* Send of the current chunk */
+    bool reading;                      /* Read in flight */
+    bool sending;                      /* Send in flight */
+    bool acked;                        /* Ack received while sending */
+    unsigned ack_file;                 /* Position asked for by the ack */
+    unsigned long long ack_offset;
+    bool aborted;                      /* Release once nothing is in flight */
+    queue queue;                       /* Link in the sends queue */
+};
+
+/* A received chunk being written to the staging area. */
+struct snapshotRecvWrite
+{
+    struct raft *raft;
+    raft_id leader;                          /* Sender of the chunk */
+    struct raft_install_snapshot_chunk args; /* Chunk being written */
+    struct raft_io_snapshot_write req;
+};
+
+void snapshotTransferInit(struct raft *r)
+{
+    QUEUE_INIT(SENDS(r));
+    memset(&r->snapshot.recv, 0, sizeof r->snapshot.recv);
+}
+
+static void sendDestroy(struct snapshotSend *s)
+{
+    snapshotCacheRelease(&s->get);
+    raft_free(s->buf.base);
+    raft_free(s);
+}
+
+/* Stop the transfer, releasing it as soon as nothing is in flight. */
+static void sendAbort(struct snapshotSend *s)
+{
+    if (s->aborted) {
+        return;
+    }
+    s->aborted = true;
+    QUEUE_REMOVE(&s->queue);
+    if (!s->reading && !s->sending) {
+        sendDestroy(s);
+    }
+}
+
+/* Whether the destination still expects the snapshot, in which case @i is set
+ * to its progress index. */
+static bool sendExpected(struct snapshotSend *s, unsigned *i)
+{
+    struct raft *r = s->raft;
+    if (r->state != RAFT_LEADER) {
+        return false;
+    }
+    *i = configurationIndexOf(&r->configuration, s->server_id);
+    if (*i == r->configuration.n) {
+        return false;
+    }
+    return progressState(r, *i) == PROGRESS__SNAPSHOT;
+}
+
+/* Give up after an error. The next probe of the destination starts a new
+ * transfer, which resumes from where this one stopped. */
+static void sendFail(struct snapshotSend *s)
+{
+    unsigned i;
+    if (sendExpected(s, &i)) {
+        progressAbortSnapshot(s->raft, i);
+    }
+    sendAbort(s);
+}
+
+static struct snapshotSend *sendLookup(struct raft *r, raft_id id)
+{
+    struct snapshotSend *s;
+    queue *head;
+    QUEUE_FOREACH(head, SENDS(r))
+    {
+        s = QUEUE_DATA(head, struct snapshotSend, queue);
+        if (s->server_id == id) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static void sendMove(struct snapshotSend *s, unsigned file,
+                     unsigned long long offset);
+
+/* Whether the current chunk is the last one of the snapshot. */
+static bool sendIsLast(const struct snapshotSend *s)
+{
+    const struct raft_snapshot *snapshot = s->snapshot;
+    if (s->file + 1 < snapshot->n_files) {
+        return false;
+    }
+    return s->file >= snapshot->n_files ||
+           s->offset + s->buf.len == snapshot->files[s->file].size;
+}
+
+static void sendChunkCb(struct raft_io_send *send, int status)
+{
+    struct snapshotSend *s = send->data;
+    struct raft *r = s->raft;
+    bool last = sendIsLast(s);
+
+    s->sending = false;
+    raft_free(s->buf.base);
+    s->buf.base = NULL;
+    s->buf.len = 0;
+
+    if (s->aborted) {
+        sendDestroy(s);
+        return;
+    }
+    if (status != 0) {
+        if (status != RAFT_NOCONNECTION) {
+            evtErrf("E-1528-313", "raft(%llx) send snapshot chunk failed %d",
+                    r->id, status);
+        }
+        sendFail(s);
+        return;
+    }
+    /* The receiver installs the snapshot once it has the last chunk, and
+     * its AppendEntries result completes the transfer. */
+    if (last) {
+        sendAbort(s);
+        return;
+    }
+    if (s->acked) {
+        s->acked = false;
+        sendMove(s, s->ack_file, s->ack_offset);
+    }
+}
+
+/* Send the current chunk. */
+static int sendChunk(struct snapshotSend *s, unsigned i)
+{
+    struct raft *r = s->raft;
+    const struct raft_snapshot *snapshot = s->snapshot;
+    struct raft_message message;
+    struct raft_install_snapshot_chunk *args = &message.install_snapshot_chunk;
+    int rv;
+
+    message.type = RAFT_IO_INSTALL_SNAPSHOT_CHUNK;
+    message.server_id = s->server_id;
+
+    args->term = r->current_term;
+    args->last_index = snapshot->index;
+    args->last_term = snapshot->term;
+    args->conf = snapshot->configuration;
+    args->conf_index = snapshot->configuration_index;
+    args->n_files = snapshot->n_files;
+    args->file = s->file;
+    memset(args->name, 0, sizeof args->name);
+    args->size = 0;
+    if (s->file < snapshot->n_files) {
+        strcpy(args->name, snapshot->files[s->file].name);
+        args->size = snapshot->files[s->file].size;
+    }
+    args->offset = s->offset;
+    args->data = s->buf;
+
+    s->send.data = s;
+    s->sending = true;
+    rv = r->io->send(r->io, &s->send, &message, sendChunkCb);
+    if (rv != 0) {
+        s->sending = false;
+        return rv;
+    }
+    progressUpdateSnapshotLastSend(r, i);
+    return 0;
+}
+
+static void sendReadCb(struct raft_io_snapshot_read *read, int status)
+{
+    struct snapshotSend *s = read->data;
+    struct raft *r = s->raft;
+    unsigned i;
+    int rv;
+
+    s->reading = false;
+    if (s->aborted) {
+        sendDestroy(s);
+        return;
+    }
+    if (status != 0) {
+        evtErrf("E-1528-294", "raft(%llx) read snapshot %llu file %u failed %d",
+                r->id, s->snapshot->index, s->file, status);
+        sendFail(s);
+        return;
+    }
+    if (!sendExpected(s, &i)) {
+        sendAbort(s);
+        return;
+    }
+    rv = sendChunk(s, i);
+    if (rv != 0) {
+        if (rv != RAFT_NOCONNECTION) {
+            evtErrf("E-1528-295", "raft(%llx) send failed %d", r->id, rv);
+        }
+        sendFail(s);
+    }
+}
+
+/* Read and send the chunk at the given position. */
+static void sendMove(struct snapshotSend *s, unsigned file,
+                     unsigned long long offset)
+{
+    struct raft *r = s->raft;
+    const struct raft_snapshot_file *f;
+    unsigned long long len;
+    unsigned i;
+    int rv;
+
+    if (!sendExpected(s, &i)) {
+        sendAbort(s);
+        return;
+    }
+
+    /* The receiver has all the files and is installing the snapshot, its
+     * AppendEntries result completes the transfer. */
+    if (file >= s->snapshot->n_files) {
+        sendAbort(s);
+        return;
+    }
+
+    f = &s->snapshot->files[file];
+    if (offset > f->size) {
+        evtErrf("E-1528-296", "raft(%llx) %llx bad snapshot offset %llu",
+                r->id, s->server_id, offset);
+        sendFail(s);
+        return;
+    }
+    s->file = file;
+    s->offset = offset;
+
+    len = f->size - offset;
+    if (len > r->snapshot.chunk_size) {
+        len = r->snapshot.chunk_size;
+    }
+    if (len == 0) {
+        rv = sendChunk(s, i);
+        goto out;
+    }
+
+    s->buf.base = raft_malloc(len);
+    if (s->buf.base == NULL) {
+        rv = RAFT_NOMEM;
+        goto out;
+    }
+    s->buf.len = len;
+    s->read.data = s;
+    s->reading = true;
+    rv = r->io->snapshot_read(r->io, &s->read, s->snapshot, file, offset,
+                              &s->buf, sendReadCb);
+    if (rv != 0) {
+        s->reading = false;
+        raft_free(s->buf.base);
+        s->buf.base = NULL;
+        s->buf.len = 0;
+    }
+
+out:
+    if (rv != 0) {
+        if (rv != RAFT_NOCONNECTION) {
+            evtErrf("E-1528-297", "raft(%llx) send snapshot chunk failed %d",
+                    r->id, rv);
+        }
+        sendFail(s);
+    }
+}
+
+int snapshotTransferStart(struct raft *r,
+                          unsigned i,
+                          struct snapshotCacheGet *get,
+                          struct raft_snapshot *snapshot)
+{
+    raft_id id = r->configuration.servers[i].id;
+    struct snapshotSend *s;
+    int rv;
+
+    if (r->io->version < 2 || r->io->snapshot_read == NULL) {
+        evtErrf("E-1528-298", "raft(%llx) io can't send snapshot files", r->id);
+        return RAFT_INVALID;
+    }
+
+    /* A new transfer to the same server supersedes the previous one. */
+    s = sendLookup(r, id);
+    if (s != NULL) {
+        sendAbort(s);
+    }
+
+    s = raft_malloc(sizeof *s);
+    if (s == NULL) {
+        evtErrf("E-1528-299", "%s", "malloc");
+        return RAFT_NOMEM;
+    }
+    s->raft = r;
+    s->server_id = id;
+    s->get = *get;
+    s->snapshot = snapshot;
+    s->file = 0;
+    s->offset = 0;
+    s->buf.base = NULL;
+    s->buf.len = 0;
+    s->reading = false;
+    s->sending = false;
+    s->acked = false;
+    s->aborted = false;
+
+    /* Start with an empty chunk, asking where to resume from. */
+    tracef("sending snapshot files with last index %llu to %llu",
+           snapshot->index, id);
+    rv = sendChunk(s, i);
+    if (rv != 0) {
+        raft_free(s);
+        return rv;
+    }
+    QUEUE_PUSH(SENDS(r), &s->queue);
+    return 0;
+}
+
+void snapshotTransferAck(struct raft *r,
+                         raft_id id,
+                         const struct raft_install_snapshot_chunk_result *result)
+{
+    struct snapshotSend *s;
+
+    s = sendLookup(r, id);
+    if (s == NULL || s->reading || result->last_index != s->snapshot->index) {
+        tracef("ignore stale snapshot chunk result from %llu", id);
+        return;
+    }
+    if (s->sending) {
+        s->acked = true;
+        s->ack_file = result->file;
+        s->ack_offset = result->offset;
+        return;
+    }
+    sendMove(s, result->file, result->offset);
+}
+
+bool snapshotTransferActive(struct raft *r, raft_id id)
+{
+    return sendLookup(r, id) != NULL;
+}
+
+void snapshotTransferAbortAll(struct raft *r)
+{
+    struct snapshotSend *s;
+    queue *head;
+    while (!QUEUE_IS_EMPTY(SENDS(r))) {
+        head = QUEUE_HEAD(SENDS(r));
+        s = QUEUE_DATA(head, struct snapshotSend, queue);
+        sendAbort(s);
+    }
+}
+
+static void recvReplyCb(struct raft_io_send *req, int status)
+{
+    (void)status;
+    raft_free(req);
+}
+
+/* Tell the leader which chunk to send next. */
+static int recvReply(struct raft *r, raft_id id, raft_index index)
+{
+    struct raft_message message;
+    struct raft_install_snapshot_chunk_result *result =
+        &message.install_snapshot_chunk_result;
+    struct raft_io_send *req;
+    int rv;
+
+    message.type = RAFT_IO_INSTALL_SNAPSHOT_CHUNK_RESULT;
+    message.server_id = id;
+    result->term = r->current_term;
+    result->last_index = index;
+    result->file = r->snapshot.recv.file;
+    result->offset = r->snapshot.recv.offset;
+
+    req = raft_malloc(sizeof *req);
+    if (req == NULL) {
+        evtErrf("E-1528-300", "%s", "malloc");
+        return RAFT_NOMEM;
+    }
+    req->data = r;
+    rv = r->io->send(r->io, req, &message, recvReplyCb);
+    if (rv != 0) {
+        raft_free(req);
+        if (rv != RAFT_NOCONNECTION) {
+            evtErrf("E-1528-301", "raft(%llx) send failed %d", r->id, rv);
+            return rv;
+        }
+    }
+    return 0;
+}
+
+/* Release the memory owned by a received chunk. */
+static void recvChunkClose(struct raft_install_snapshot_chunk *args)
+{
+    raft_configuration_close(&args->conf);
+    raft_free(args->data.base);
+}
+
+/* Whether the chunk belongs to the snapshot being received. Chunks of the same
+ * snapshot sent by another leader might come from different files. */
+static bool recvMatches(struct raft *r,
+                        raft_id id,
+                        const struct raft_install_snapshot_chunk *args)
+{
+    return r->snapshot.recv.leader == id &&
+           r->snapshot.recv.index == args->last_index &&
+           r->snapshot.recv.term == args->last_term &&
+           r->snapshot.recv.n_files == args->n_files;
+}
+
+/* Install the snapshot if all its files have been received, or ask the leader
+ * for the next chunk otherwise. Takes ownership of the chunk configuration. */
+static int recvProceed(struct raft *r,
+                       raft_id id,
+                       struct raft_install_snapshot_chunk *args)
+{
+    int rv;
+
+    if (r->snapshot.recv.file < r->snapshot.recv.n_files ||
+        r->state != RAFT_FOLLOWER || r->snapshot.pending.term != 0 ||
+        r->snapshot.put.data != NULL) {
+        raft_configuration_close(&args->conf);
+        return recvReply(r, id, args->last_index);
+    }
+
+    tracef("received all files of snapshot %llu", args->last_index);
+    r->snapshot.recv.index = 0;
+    rv = replicationInstallSnapshotFiles(r, args);
+    if (rv != 0) {
+        evtErrf("E-1528-302", "raft(%llx) install snapshot files failed %d",
+                r->id, rv);
+        raft_configuration_close(&args->conf);
+    }
+    return rv;
+}
+
+static void recvWriteCb(struct raft_io_snapshot_write *req, int status)
+{
+    struct snapshotRecvWrite *w = req->data;
+    struct raft *r = w->raft;
+    struct raft_install_snapshot_chunk *args = &w->args;
+    int rv;
+
+    r->snapshot.recv.writing = false;
+    raft_free(args->data.base);
+    args->data.base = NULL;
+
+    if (r->state == RAFT_UNAVAILABLE) {
+        goto out;
+    }
+    if (status != 0) {
+        evtErrf("E-1528-303", "raft(%llx) write snapshot %llu file %s failed %d",
+                r->id, args->last_index, args->name, status);
+        /* Start over, the leader will retry. */
+        r->snapshot.recv.index = 0;
+        goto out;
+    }
+
+    r->snapshot.recv.offset += args->data.len;
+    if (r->snapshot.recv.offset == args->size) {
+        r->snapshot.recv.file += 1;
+        r->snapshot.recv.offset = 0;
+    }
+    rv = recvProceed(r, w->leader, args);
+    if (rv != 0) {
+        convertToUnavailable(r);
+    }
+    raft_free(w);
+    return;
+
+out:
+    raft_configuration_close(&args->conf);
+    raft_free(w);
+}
+
+int snapshotTransferRecv(struct raft *r,
+                         raft_id id,
+                         struct raft_install_snapshot_chunk *args)
+{
+    struct snapshotRecvWrite *w;
+    int rv;
+
+    /* If we are taking or installing a snapshot, or still writing the previous
+     * chunk, ignore the chunk, the leader will eventually retry. */
+    if (r->snapshot.pending.term != 0 || r->snapshot.put.data != NULL ||
+        r->snapshot.recv.writing) {
+        recvChunkClose(args);
+        return 0;
+    }
+
+    if (!recvMatches(r, id, args)) {
+        tracef("start receiving snapshot %llu", args->last_index);
+        r->snapshot.recv.leader = id;
+        r->snapshot.recv.index = args->last_index;
+        r->snapshot.recv.term = args->last_term;
+        r->snapshot.recv.n_files = args->n_files;
+        r->snapshot.recv.file = 0;
+        r->snapshot.recv.offset = 0;
+    }
+
+    /* Resume from where we got to, if the leader is elsewhere or just asking.
+     * Empty files are written with an empty chunk. */
+    if (args->file != r->snapshot.recv.file ||
+        args->offset != r->snapshot.recv.offset ||
+        r->snapshot.recv.file >= r->snapshot.recv.n_files ||
+        (args->data.len == 0 && args->offset != args->size)) {
+        raft_free(args->data.base);
+        return recvProceed(r, id, args);
+    }
+
+    if (args->offset + args->data.len > args->size ||
+        strnlen(args->name, sizeof args->name) == sizeof args->name) {
+        evtErrf("E-1528-304", "raft(%llx) malformed snapshot chunk from %llx",
+                r->id, id);
+        recvChunkClose(args);
+        return 0;
+    }
+
+    if (r->io->version < 2 || r->io->snapshot_write == NULL) {
+        evtErrf("E-1528-305", "raft(%llx) io can't receive snapshot files",
+                r->id);
+        recvChunkClose(args);
+        return 0;
+    }
+
+    w = raft_malloc(sizeof *w);
+    if (w == NULL) {
+        evtErrf("E-1528-306", "%s", "malloc");
+        recvChunkClose(args);
+        return RAFT_NOMEM;
+    }
+    w->raft = r;
+    w->leader = id;
+    w->args = *args;
+    w->req.data = w;
+
+    r->snapshot.recv.writing = true;
+    rv = r->io->snapshot_write(r->io, &w->req, w->args.last_term,
+                               w->args.last_index, w->args.file, w->args.name,
+                               w->args.offset, &w->args.data, recvWriteCb);
+    if (rv != 0) {
+        evtErrf("E-1528-307", "raft(%llx) snapshot write failed %d", r->id, rv);
+        r->snapshot.recv.writing = false;
+        raft_free(w);
+        recvChunkClose(args);
+        return rv;
+    }
+    return 0;
+}
+
+#undef tracef
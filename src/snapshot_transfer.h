@@ -0,0 +1,38 @@
+/* Chunked, resumable transfer of file-based snapshots. */
+
+#ifndef SNAPSHOT_TRANSFER_H_
+#define SNAPSHOT_TRANSFER_H_
+
+#include "../include/raft.h"
+#include "snapshot_cache.h"
+
+/* Initialize the state of file-based snapshot transfers. */
+void snapshotTransferInit(struct raft *r);
+
+/* Start sending the given file-based snapshot to the i'th server, taking over
+ * the reference to it held by @get. Chunks are sent one at a time, starting
+ * from wherever the receiver got to with an earlier transfer. */
+int snapshotTransferStart(struct raft *r,
+                          unsigned i,
+                          struct snapshotCacheGet *get,
+                          struct raft_snapshot *snapshot);
+
+/* Send the chunk the receiver asked for with the given result. */
+void snapshotTransferAck(struct raft *r,
+                         raft_id id,
+                         const struct raft_install_snapshot_chunk_result *result);
+
+/* Whether snapshot files are being sent to the given server. */
+bool snapshotTransferActive(struct raft *r, raft_id id);
+
+/* Stop all transfers, because leadership was lost. */
+void snapshotTransferAbortAll(struct raft *r);
+
+/* Write a chunk received from the given leader to the staging area, and install
+ * the snapshot once all its files have been received. Ownership of the chunk
+ * data and configuration is transferred. */
+int snapshotTransferRecv(struct raft *r,
+                         raft_id id,
+                         struct raft_install_snapshot_chunk *args);
+
+#endif /* SNAPSHOT_TRANSFER_H_ */
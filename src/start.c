@@ -82,12 +82,12 @@ int restoreEntries(struct raft *r,
     int rv;
     logStart(&r->log, snapshot_index, snapshot_term, start_index);
     r->last_stored = start_index - 1;
+    rv = logAppendEntries(&r->log, entries, (unsigned)n);
+    if (rv != 0) {
+        goto err;
+    }
     for (i = 0; i < n; i++) {
         struct raft_entry *entry = &entries[i];
-	rv = logAppend(&r->log, entry->term, entry->type, &entry->buf, entry->batch);
-        if (rv != 0) {
-            goto err;
-        }
         r->last_stored++;
         if (entry->type == RAFT_CHANGE) {
             if (conf != NULL) {
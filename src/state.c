@@ -49,3 +49,20 @@ raft_index raft_commit_index(struct raft *r)
 {
     return r->commit_index;
 }
+
+raft_index raft_durable_index(struct raft *r)
+{
+    raft_index index = r->last_stored;
+    raft_index durable;
+
+    if (r->io->version >= 4 && r->io->durable_index != NULL) {
+        durable = r->io->durable_index(r->io);
+        if (durable < index) {
+            index = durable;
+        }
+    }
+    if (index < r->log.snapshot.last_index) {
+        index = r->log.snapshot.last_index;
+    }
+    return index;
+}
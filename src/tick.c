@@ -1,14 +1,20 @@
 #include "../include/raft.h"
+#include "adaptive.h"
 #include "assert.h"
 #include "configuration.h"
 #include "convert.h"
 #include "election.h"
+#include "forward.h"
 #include "membership.h"
+#include "pack.h"
 #include "progress.h"
+#include "read.h"
 #include "replication.h"
 #include "tracing.h"
 #include "event.h"
 #include "snapshot_sampler.h"
+#include "publish.h"
+#include "watchdog.h"
 
 #ifdef ENABLE_TRACE
 #define tracef(...) Tracef(r->tracer, __VA_ARGS__)
@@ -25,6 +31,9 @@ static int tickFollower(struct raft *r)
     assert(r != NULL);
     assert(r->state == RAFT_FOLLOWER);
 
+    readTick(r);
+    forwardTick(r);
+
     server = configurationGet(&r->configuration, r->id);
 
     /* If we have been removed from the configuration, or maybe we didn't
@@ -251,6 +260,11 @@ static int tickLeader(struct raft *r)
         return 0;
     }
 
+    /* Don't hold packed commands longer than a tick. */
+    packFlush(r);
+
+    adaptiveTick(r);
+
     if ((r->ticks % r->tick_snapshot_frequency) == 0) {
         /* Try to apply and take snapshot*/
         rv = replicationApply(r);
@@ -366,11 +380,9 @@ static int tick(struct raft *r)
     return rv;
 }
 
-void tickCb(struct raft_io *io)
+static void tickRun(struct raft *r)
 {
-    struct raft *r;
     int rv;
-    r = io->data;
     /* skip the tick if we are updating the meta */
     if (r->io->state != RAFT_IO_AVAILABLE) {
         return;
@@ -391,4 +403,16 @@ void tickCb(struct raft_io *io)
     }
 }
 
+void tickCb(struct raft_io *io)
+{
+    struct raft *r = io->data;
+    struct watchdogTimer timer;
+
+    watchdogTick(r);
+    watchdogEnter(r, &timer);
+    tickRun(r);
+    publishUpdate(r);
+    watchdogExit(r, &timer, "tick");
+}
+
 #undef tracef
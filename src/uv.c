@@ -56,14 +56,14 @@ static int uvMaintenance(const char *dir, char* errmsg)
         filename = entry.name;
         /* Remove leftover tmp-files */
         if (strncmp(filename, TMP_FILE_PREFIX, strlen(TMP_FILE_PREFIX)) == 0) {
-            UvFsRemoveFile(dir, filename, errmsg); /* Ignore errors */
+            UvFsRemoveTree(dir, filename, errmsg); /* Ignore errors */
             continue;
         }
 
         /* Remove orphaned snapshot files */
         bool orphan = false;
         if ((UvSnapshotIsOrphan(dir, filename, &orphan) == 0) && orphan) {
-            UvFsRemoveFile(dir, filename, errmsg); /* Ignore errors */
+            UvFsRemoveTree(dir, filename, errmsg); /* Ignore errors */
             continue;
         }
 
@@ -92,6 +92,18 @@ static int uvInit(struct raft_io *io, raft_id id, const char *address)
     if (rv != 0) {
         return rv;
     }
+    if (strcmp(uv->snapshot_dir, uv->dir) != 0) {
+        rv = UvFsCheckDir(uv->snapshot_dir, io->errmsg);
+        if (rv != 0) {
+            return rv;
+        }
+    }
+    if (strcmp(uv->metadata_dir, uv->dir) != 0) {
+        rv = UvFsCheckDir(uv->metadata_dir, io->errmsg);
+        if (rv != 0) {
+            return rv;
+        }
+    }
 
     /* Probe file system capabilities */
     rv = UvFsProbeCapabilities(uv->dir, &direct_io, &uv->async_io, io->errmsg);
@@ -105,8 +117,21 @@ static int uvInit(struct raft_io *io, raft_id id, const char *address)
     if (rv != 0) {
         return rv;
     }
+    if (strcmp(uv->snapshot_dir, uv->dir) != 0) {
+        rv = uvMaintenance(uv->snapshot_dir, io->errmsg);
+        if (rv != 0) {
+            return rv;
+        }
+    }
+    if (strcmp(uv->metadata_dir, uv->dir) != 0 &&
+        strcmp(uv->metadata_dir, uv->snapshot_dir) != 0) {
+        rv = uvMaintenance(uv->metadata_dir, io->errmsg);
+        if (rv != 0) {
+            return rv;
+        }
+    }
 
-    rv = uvMetadataLoad(uv->dir, &metadata, io->errmsg);
+    rv = uvMetadataLoad(uv->metadata_dir, &metadata, io->errmsg);
     if (rv != 0) {
         return rv;
     }
@@ -190,6 +215,18 @@ void uvMaybeFireCloseCb(struct uv *uv)
     if (!QUEUE_IS_EMPTY(&uv->snapshot_get_reqs)) {
         return;
     }
+    if (!QUEUE_IS_EMPTY(&uv->snapshot_io_reqs)) {
+        return;
+    }
+    if (!QUEUE_IS_EMPTY(&uv->entries_read_reqs)) {
+        return;
+    }
+    if (uv->sync_timer.data != NULL) {
+        return;
+    }
+    if (uv->sync_work.data != NULL) {
+        return;
+    }
     if (!QUEUE_IS_EMPTY(&uv->aborting)) {
         return;
     }
@@ -230,6 +267,7 @@ static void uvClose(struct raft_io *io, bool clean, raft_io_close_cb cb)
     UvSendClose(uv);
     UvRecvClose(uv);
     uvAppendClose(uv);
+    UvSyncClose(uv);
     if (uv->transport->data != NULL) {
         uv->transport->close(uv->transport, uvTransportCloseCb);
     }
@@ -348,6 +386,7 @@ static int uvLoadSnapshotAndEntries(struct uv *uv,
     struct uvSegmentInfo *segments;
     size_t n_snapshots;
     size_t n_segments;
+    uint64_t start;
     int rv;
 
     *snapshot = NULL;
@@ -356,8 +395,10 @@ static int uvLoadSnapshotAndEntries(struct uv *uv,
     *n = 0;
 
     /* List available snapshots and segments. */
+    start = uv_hrtime();
     rv = UvList(uv, &snapshots, &n_snapshots, &segments, &n_segments,
                 uv->io->errmsg);
+    uv->load_stats.list = uv_hrtime() - start;
     if (rv != 0) {
         goto err;
     }
@@ -370,8 +411,10 @@ static int uvLoadSnapshotAndEntries(struct uv *uv,
             rv = RAFT_NOMEM;
             goto err;
         }
+        start = uv_hrtime();
         rv = UvSnapshotLoad(uv, &snapshots[n_snapshots - 1], *snapshot,
                             uv->io->errmsg);
+        uv->load_stats.snapshot = uv_hrtime() - start;
         if (rv != 0) {
             HeapFree(*snapshot);
             *snapshot = NULL;
@@ -462,6 +505,7 @@ static int uvLoad(struct raft_io *io,
 {
     struct uv *uv;
     raft_index last_index;
+    uint64_t start;
     int rv;
     uv = io->impl;
 
@@ -469,8 +513,13 @@ static int uvLoad(struct raft_io *io,
     *voted_for = uv->metadata.voted_for;
     *snapshot = NULL;
 
+    memset(&uv->load_stats, 0, sizeof uv->load_stats);
+    uv->loading = true;
+    start = uv_hrtime();
     rv =
         uvLoadSnapshotAndEntries(uv, snapshot, start_index, entries, n_entries);
+    uv->load_stats.total = uv_hrtime() - start;
+    uv->loading = false;
     if (rv != 0) {
         return rv;
     }
@@ -484,6 +533,10 @@ static int uvLoad(struct raft_io *io,
     /* Set the index of the next entry that will be appended. */
     uv->append_next_index = last_index + 1;
 
+    /* Loading syncs open segments while closing them. */
+    uv->written_index = last_index;
+    uv->durable_index = last_index;
+
     return 0;
 }
 
@@ -646,6 +699,8 @@ int raft_uv_init(struct raft_io *io,
     uv->io = io;
     uv->loop = loop;
     strcpy(uv->dir, dir);
+    strcpy(uv->snapshot_dir, dir);
+    strcpy(uv->metadata_dir, dir);
     uv->transport = transport;
     uv->transport->data = NULL;
     uv->tracer = &NoopTracer;
@@ -659,9 +714,14 @@ int raft_uv_init(struct raft_io *io,
 #else
     uv->snapshot_compression = false;
 #endif
+    uv->segment_compression = false;
+    uv->segment_compression_tail = 0;
     uv->segment_size = UV__MAX_SEGMENT_SIZE;
     uv->block_size = 0;
+    uv->page_cache = 0;
+    uv->readahead_size = 0;
     QUEUE_INIT(&uv->clients);
+    uv->send_batch = NULL;
     QUEUE_INIT(&uv->servers);
     uv->connect_retry_delay = CONNECT_RETRY_DELAY;
     uv->prepare_inflight = NULL;
@@ -674,10 +734,30 @@ int raft_uv_init(struct raft_io *io,
     QUEUE_INIT(&uv->append_writing_reqs);
     uv->barrier = NULL;
     QUEUE_INIT(&uv->finalize_reqs);
+    QUEUE_INIT(&uv->finalize_batch);
+    uv->finalize_len = 0;
     uv->finalize_work.data = NULL;
+    uv->compressing = false;
+    uv->compressed_index = 0;
     uv->truncate_work.data = NULL;
     QUEUE_INIT(&uv->snapshot_get_reqs);
     uv->snapshot_put_work.data = NULL;
+    uv->snapshot_put_deferred = false;
+    QUEUE_INIT(&uv->snapshot_io_reqs);
+    QUEUE_INIT(&uv->entries_read_reqs);
+    uv->stage_term = 0;
+    uv->stage_index = 0;
+    uv->relaxed = false;
+    uv->sync_interval = 0;
+    uv->sync_bytes = 0;
+    uv->unsynced_bytes = 0;
+    uv->written_index = 0;
+    uv->durable_index = 0;
+    uv->syncing_index = 0;
+    uv->syncing_bytes = 0;
+    uv->sync_timer.data = NULL;
+    uv->sync_work.data = NULL;
+    uv->sync_status = 0;
     uv->timer.data = NULL;
     uv->tick_cb = NULL; /* Set by raft_io->start() */
     uv->recv_cb = NULL; /* Set by raft_io->start() */
@@ -686,7 +766,7 @@ int raft_uv_init(struct raft_io *io,
     uv->close_cb = NULL;
 
     /* Set the raft_io implementation. */
-    io->version = 1; /* future-proof'ing */
+    io->version = 4; /* future-proof'ing */
     io->impl = uv;
     io->init = uvInit;
     io->close = uvClose;
@@ -702,6 +782,10 @@ int raft_uv_init(struct raft_io *io,
     io->send = UvSend;
     io->snapshot_put = UvSnapshotPut;
     io->snapshot_get = UvSnapshotGet;
+    io->snapshot_read = UvSnapshotRead;
+    io->snapshot_write = UvSnapshotWrite;
+    io->entries_read = UvEntriesRead;
+    io->durable_index = UvDurableIndex;
     io->time = uvTime;
     io->time_us = uvTime;
     io->random = uvRandom;
@@ -730,6 +814,70 @@ void raft_uv_set_segment_size(struct raft_io *io, size_t size)
     uv->segment_size = size;
 }
 
+void raft_uv_set_page_cache_policy(struct raft_io *io,
+                                   unsigned flags,
+                                   size_t readahead)
+{
+    struct uv *uv;
+    uv = io->impl;
+    uv->page_cache = flags;
+    uv->readahead_size = readahead;
+}
+
+int raft_uv_set_durability(struct raft_io *io,
+                           int mode,
+                           unsigned sync_interval,
+                           size_t sync_bytes)
+{
+    struct uv *uv;
+    uv = io->impl;
+    if (mode != RAFT_UV_DURABLE && mode != RAFT_UV_RELAXED) {
+        return RAFT_INVALID;
+    }
+    /* Entries would never become durable. */
+    if (mode == RAFT_UV_RELAXED && sync_interval == 0 && sync_bytes == 0) {
+        return RAFT_INVALID;
+    }
+    uv->relaxed = mode == RAFT_UV_RELAXED;
+    uv->sync_interval = sync_interval;
+    uv->sync_bytes = sync_bytes;
+    return 0;
+}
+
+int raft_uv_set_dirs(struct raft_io *io,
+                     const char *snapshot_dir,
+                     const char *metadata_dir)
+{
+    struct uv *uv;
+    uv = io->impl;
+    if ((snapshot_dir != NULL && !UV__DIR_HAS_VALID_LEN(snapshot_dir)) ||
+        (metadata_dir != NULL && !UV__DIR_HAS_VALID_LEN(metadata_dir))) {
+        ErrMsgPrintf(io->errmsg, "directory path too long");
+        return RAFT_NAMETOOLONG;
+    }
+    if (snapshot_dir != NULL) {
+        strcpy(uv->snapshot_dir, snapshot_dir);
+    }
+    if (metadata_dir != NULL) {
+        strcpy(uv->metadata_dir, metadata_dir);
+    }
+    return 0;
+}
+
+void raft_uv_usage(struct raft_io *io, struct raft_uv_usage *usage)
+{
+    struct uv *uv;
+    uv = io->impl;
+    *usage = uv->usage;
+}
+
+void raft_uv_load_stats(struct raft_io *io, struct raft_uv_load_stats *stats)
+{
+    struct uv *uv;
+    uv = io->impl;
+    *stats = uv->load_stats;
+}
+
 void raft_uv_set_block_size(struct raft_io *io, size_t size)
 {
     struct uv *uv;
@@ -750,6 +898,22 @@ int raft_uv_set_snapshot_compression(struct raft_io *io, bool compressed)
     return 0;
 }
 
+int raft_uv_set_segment_compression(struct raft_io *io,
+                                    bool compressed,
+                                    raft_index tail)
+{
+    struct uv *uv;
+    uv = io->impl;
+#ifndef LZ4_AVAILABLE
+    if (compressed) {
+        return RAFT_INVALID;
+    }
+#endif
+    uv->segment_compression = compressed;
+    uv->segment_compression_tail = tail;
+    return 0;
+}
+
 void raft_uv_set_connect_retry_delay(struct raft_io *io, unsigned msecs)
 {
     struct uv *uv;
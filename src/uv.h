@@ -4,6 +4,7 @@
 #define UV_H_
 
 #include "../include/raft.h"
+#include "../include/raft/uv.h"
 #include "err.h"
 #include "queue.h"
 #include "tracing.h"
@@ -33,6 +34,10 @@
  * index, creation timestamp (milliseconds since epoch). */
 #define UV__SNAPSHOT_META_TEMPLATE UV__SNAPSHOT_TEMPLATE UV__SNAPSHOT_META_SUFFIX
 
+/* Template string for the directory where the files of a file-based snapshot
+ * being received are staged: snapshot term and index. */
+#define UV__SNAPSHOT_STAGE_TEMPLATE TMP_FILE_PREFIX "stage-%llu-%llu"
+
 /* State codes. */
 enum {
     UV__PRISTINE, /* Metadata cache populated and I/O capabilities probed */
@@ -56,18 +61,25 @@ struct uv
 {
     struct raft_io *io;                  /* I/O object we're implementing */
     struct uv_loop_s *loop;              /* UV event loop */
-    char dir[UV__DIR_LEN];               /* Data directory */
+    char dir[UV__DIR_LEN];               /* Data directory, for segments */
+    char snapshot_dir[UV__DIR_LEN];      /* Snapshots directory */
+    char metadata_dir[UV__DIR_LEN];      /* Metadata directory */
     struct raft_uv_transport *transport; /* Network transport */
     struct raft_tracer *tracer;          /* Debug tracing */
     raft_id id;                          /* Server ID */
     int state;                           /* Current state */
     bool snapshot_compression;           /* If compression is enabled */
+    bool segment_compression;            /* If closed segments are compressed */
+    raft_index segment_compression_tail; /* Trailing entries left as they are */
     bool errored;                        /* If a disk I/O error was hit */
     bool direct_io;                      /* Whether direct I/O is supported */
     bool async_io;                       /* Whether async I/O is supported */
     size_t segment_size;                 /* Initial size of open segments. */
     size_t block_size;                   /* Block size of the data dir */
+    unsigned page_cache;                 /* Page-cache policy flags */
+    size_t readahead_size;               /* Max bytes prefetched per segment */
     queue clients;                       /* Outbound connections */
+    struct uvSendBatch *send_batch;      /* Latest encoded AppendEntries */
     queue servers;                       /* Inbound connections */
     unsigned connect_retry_delay;        /* Client connection retry delay */
     void *prepare_inflight;              /* Segment being prepared */
@@ -80,10 +92,34 @@ struct uv
     queue append_writing_reqs;           /* Append requests in flight */
     struct UvBarrier *barrier;           /* Inflight barrier request */
     queue finalize_reqs;                 /* Segments waiting to be closed */
+    queue finalize_batch;                /* Segments being closed */
+    unsigned finalize_len;               /* Segments waiting or being closed */
     struct uv_work_s finalize_work;      /* Resize and rename segments */
+    bool compressing;                    /* Finalize work compresses segments */
+    raft_index compressed_index;         /* Last entry of compressed segments */
     struct uv_work_s truncate_work;      /* Execute truncate log requests */
     queue snapshot_get_reqs;             /* Inflight get snapshot requests */
     struct uv_work_s snapshot_put_work;  /* Execute snapshot put requests */
+    bool snapshot_put_deferred;          /* Put waits for compression to end */
+    queue snapshot_io_reqs;              /* Inflight snapshot file reads/writes */
+    queue entries_read_reqs;             /* Inflight reads of closed segments */
+    raft_term stage_term;                /* Term of the staged snapshot */
+    raft_index stage_index;              /* Index of the staged snapshot */
+    bool relaxed;                        /* Appends complete before syncing */
+    unsigned sync_interval;              /* Msecs between background syncs */
+    size_t sync_bytes;                   /* Bytes written that force a sync */
+    size_t unsynced_bytes;               /* Bytes written since last sync */
+    raft_index written_index;            /* Last entry written */
+    raft_index durable_index;            /* Last entry known to be synced */
+    raft_index syncing_index;            /* Last entry the sync will cover */
+    size_t syncing_bytes;                /* Bytes the sync will cover */
+    struct uv_timer_s sync_timer;        /* Periodic background sync */
+    struct uv_work_s sync_work;          /* Sync open segments */
+    int sync_status;                     /* Result of the background sync */
+    char sync_errmsg[RAFT_ERRMSG_BUF_SIZE]; /* Error of the background sync */
+    struct raft_uv_usage usage;          /* Disk and network usage */
+    struct raft_uv_load_stats load_stats; /* Breakdown of the last load */
+    bool loading;                        /* Whether load_stats is updated */
     struct uvMetadata metadata;          /* Cache of metadata on disk */
     struct uv_timer_s timer;             /* Timer for periodic ticks */
     raft_io_tick_cb tick_cb;             /* Invoked when the timer expires */
@@ -267,11 +303,43 @@ int UvSnapshotPut(struct raft_io *io,
                   const struct raft_snapshot *snapshot,
                   raft_io_snapshot_put_cb cb);
 
+/* Start a snapshot put request that was deferred because closed segments were
+ * being compressed. */
+void UvSnapshotPutResume(struct uv *uv);
+
 /* Implementation of raft_io->snapshot_get (defined in uv_snapshot.c). */
 int UvSnapshotGet(struct raft_io *io,
                   struct raft_io_snapshot_get *req,
                   raft_io_snapshot_get_cb cb);
 
+/* Implementation of raft_io->snapshot_read (defined in uv_snapshot.c). */
+int UvSnapshotRead(struct raft_io *io,
+                   struct raft_io_snapshot_read *req,
+                   const struct raft_snapshot *snapshot,
+                   unsigned file,
+                   unsigned long long offset,
+                   struct raft_buffer *buf,
+                   raft_io_snapshot_read_cb cb);
+
+/* Implementation of raft_io->snapshot_write (defined in uv_snapshot.c). */
+int UvSnapshotWrite(struct raft_io *io,
+                    struct raft_io_snapshot_write *req,
+                    raft_term term,
+                    raft_index index,
+                    unsigned file,
+                    const char *name,
+                    unsigned long long offset,
+                    const struct raft_buffer *buf,
+                    raft_io_snapshot_write_cb cb);
+
+/* Implementation of raft_io->entries_read (defined in uv_segment.c). Entries
+ * are read from the closed segment containing the given index. */
+int UvEntriesRead(struct raft_io *io,
+                  struct raft_io_entries_read *req,
+                  raft_index index,
+                  unsigned max,
+                  raft_io_entries_read_cb cb);
+
 /* Return a list of all snapshots and segments found in the data directory. Both
  * snapshots and segments are ordered by filename (closed segments come before
  * open ones). */
@@ -388,4 +456,20 @@ void UvRecvClose(struct uv *uv);
 
 void uvMaybeFireCloseCb(struct uv *uv);
 
+/* Record that the entries up to @index have been written to an open segment,
+ * along with the number of bytes written. In relaxed durability mode this
+ * starts a background sync if enough bytes have accumulated, otherwise the
+ * entries are already durable. */
+void UvSyncWritten(struct uv *uv, raft_index index, size_t n);
+
+/* Forget about written entries from @next_index onward, since they are about
+ * to be truncated or replaced by a snapshot. */
+void UvSyncReset(struct uv *uv, raft_index next_index);
+
+/* Stop the periodic background sync. */
+void UvSyncClose(struct uv *uv);
+
+/* Implementation of raft_io->durable_index. */
+raft_index UvDurableIndex(struct raft_io *io);
+
 #endif /* UV_H_ */
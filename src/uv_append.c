@@ -201,6 +201,7 @@ static void uvAliveSegmentWriteCb(struct UvWriterReq *write, const int status)
 
     s->written = s->next_block * uv->block_size + s->pending.n;
     s->last_index = s->pending_last_index;
+    UvSyncWritten(uv, s->last_index, s->buf.len);
 
     /* Update our write markers.
      *
@@ -404,8 +405,11 @@ static int uvAliveSegmentReady(struct uv *uv,
                                struct uvAliveSegment *segment)
 {
     int rv;
-    rv = UvWriterInit(&segment->writer, uv->loop, fd, uv->direct_io,
-                      uv->async_io, 1, uv->io->errmsg);
+    /* In relaxed durability mode writes go through the page cache, which
+     * kernel AIO doesn't handle asynchronously. */
+    rv = UvWriterInit(&segment->writer, uv->loop, fd,
+                      uv->direct_io && !uv->relaxed,
+                      uv->async_io && !uv->relaxed, 1, uv->io->errmsg);
     if (rv != 0) {
         ErrMsgWrapf(uv->io->errmsg, "setup writer for open-%llu", counter);
         return rv;
@@ -734,6 +738,7 @@ int UvBarrier(struct uv *uv,
 
     /* The next entry will be appended at this index. */
     uv->append_next_index = next_index;
+    UvSyncReset(uv, next_index);
 
     /* Arrange for all open segments not already involved in other barriers to
      * be finalized as soon as their append requests get completed and mark them
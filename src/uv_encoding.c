@@ -6,6 +6,7 @@
 #include "assert.h"
 #include "byte.h"
 #include "configuration.h"
+#include "entry.h"
 
 /**
  * Size of the request preamble.
@@ -41,7 +42,8 @@ static size_t sizeofAppendEntries(const struct raft_append_entries *p)
            sizeof(uint64_t) + /* Previous log entry term */
            sizeof(uint64_t) + /* Leader's commit index */
            sizeof(uint64_t) + /* Number of entries in the batch */
-           16 * p->n_entries /* One header per entry */;
+           16 * p->n_entries + /* One header per entry */
+           sizeof(uint64_t) /* Leader's adaptive timeouts */;
 }
 
 static size_t sizeofAppendEntriesResult(void)
@@ -64,6 +66,47 @@ static size_t sizeofInstallSnapshot(const struct raft_install_snapshot *p)
            sizeof(uint64_t);  /* Length of snapshot data */
 }
 
+static size_t sizeofInstallSnapshotChunk(
+    const struct raft_install_snapshot_chunk *p)
+{
+    size_t conf_size = configurationEncodedSize(&p->conf);
+    return sizeof(uint64_t) +        /* Leader's term. */
+           sizeof(uint64_t) +        /* Snapshot's last index */
+           sizeof(uint64_t) +        /* Term of last index */
+           sizeof(uint64_t) +        /* Configuration's index */
+           sizeof(uint64_t) +        /* Length of configuration */
+           conf_size +               /* Configuration data */
+           sizeof(uint32_t) +        /* Number of files */
+           sizeof(uint32_t) +        /* Index of the file */
+           RAFT_SNAPSHOT_NAME_LEN +  /* Name of the file */
+           sizeof(uint64_t) +        /* Size of the file */
+           sizeof(uint64_t) +        /* Offset of the chunk */
+           sizeof(uint64_t);         /* Length of chunk data */
+}
+
+static size_t sizeofInstallSnapshotChunkResult(void)
+{
+    return sizeof(uint64_t) + /* Term. */
+           sizeof(uint64_t) + /* Snapshot's last index */
+           sizeof(uint64_t) + /* Index of the file */
+           sizeof(uint64_t) /* Offset in the file */;
+}
+
+static size_t sizeofForward(void)
+{
+    return sizeof(uint64_t) + /* Follower's term. */
+           sizeof(uint64_t) + /* Batch ID */
+           sizeof(uint64_t) /* Length of commands data */;
+}
+
+static size_t sizeofForwardResult(void)
+{
+    return sizeof(uint64_t) + /* Term. */
+           sizeof(uint64_t) + /* Batch ID */
+           sizeof(uint64_t) + /* Status */
+           sizeof(uint64_t) /* Index of the first command */;
+}
+
 static size_t sizeofTimeoutNow(void)
 {
     return sizeof(uint64_t) + /* Term. */
@@ -106,7 +149,11 @@ static void encodeRequestVoteResult(const struct raft_request_vote_result *p,
     bytePut32(&cursor, p->pre_vote);
 }
 
-static void encodeAppendEntries(const struct raft_append_entries *p, void *buf)
+/* Size of the AppendEntries fields preceding the batch header. */
+#define APPEND_ENTRIES_FIELDS_SIZE (4 * sizeof(uint64_t))
+
+static void encodeAppendEntriesFields(const struct raft_append_entries *p,
+                                      void *buf)
 {
     void *cursor;
 
@@ -116,8 +163,69 @@ static void encodeAppendEntries(const struct raft_append_entries *p, void *buf)
     bytePut64(&cursor, p->prev_log_index); /* Previous index. */
     bytePut64(&cursor, p->prev_log_term);  /* Previous term. */
     bytePut64(&cursor, p->leader_commit);  /* Commit index. */
+}
 
-    uvEncodeBatchHeader(p->entries, p->n_entries, cursor);
+/* Encode the adaptive timeouts, which are the last word of the AppendEntries
+ * header so that older decoders ignore them. */
+static void encodeAppendEntriesTimeouts(const struct raft_append_entries *p,
+                                        void *header,
+                                        size_t len)
+{
+    void *cursor = (uint8_t *)header + len - sizeof(uint64_t);
+
+    bytePut32(&cursor, p->election_timeout);
+    bytePut32(&cursor, p->heartbeat_timeout);
+}
+
+static void encodeAppendEntries(const struct raft_append_entries *p, void *buf)
+{
+    encodeAppendEntriesFields(p, buf);
+    uvEncodeBatchHeader(p->entries, p->n_entries,
+                        (uint8_t *)buf + APPEND_ENTRIES_FIELDS_SIZE);
+    encodeAppendEntriesTimeouts(p, buf, sizeofAppendEntries(p));
+}
+
+/* Return the number of buffers needed to send the payload of the given
+ * entries, one per segment for entries made of segments. */
+static unsigned countEntriesPayload(const struct raft_entry *entries,
+                                    unsigned n)
+{
+    unsigned n_bufs = 0;
+    unsigned i;
+    for (i = 0; i < n; i++) {
+        if (entries[i].type == RAFT_SEGMENTS) {
+            const struct raft_segments *segs = entries[i].buf.base;
+            n_bufs += segs->n;
+        } else {
+            n_bufs += 1;
+        }
+    }
+    return n_bufs;
+}
+
+/* Point @bufs to the payload of the given entries. */
+static void encodeEntriesPayload(const struct raft_entry *entries,
+                                 unsigned n,
+                                 uv_buf_t *bufs)
+{
+    unsigned i;
+    unsigned j;
+    unsigned k = 0;
+    for (i = 0; i < n; i++) {
+        const struct raft_entry *entry = &entries[i];
+        if (entry->type == RAFT_SEGMENTS) {
+            const struct raft_segments *segs = entry->buf.base;
+            for (j = 0; j < segs->n; j++) {
+                bufs[k].base = segs->bufs[j].base;
+                bufs[k].len = segs->bufs[j].len;
+                k++;
+            }
+            continue;
+        }
+        bufs[k].base = entry->buf.base;
+        bufs[k].len = entry->buf.len;
+        k++;
+    }
 }
 
 static void encodeAppendEntriesResult(
@@ -149,6 +257,62 @@ static void encodeInstallSnapshot(const struct raft_install_snapshot *p,
     bytePut64(&cursor, p->data.len); /* Snapshot data size. */
 }
 
+static void encodeInstallSnapshotChunk(
+    const struct raft_install_snapshot_chunk *p,
+    void *buf)
+{
+    void *cursor;
+    size_t conf_size = configurationEncodedSize(&p->conf);
+
+    cursor = buf;
+
+    bytePut64(&cursor, p->term);       /* Leader's term. */
+    bytePut64(&cursor, p->last_index); /* Snapshot last index. */
+    bytePut64(&cursor, p->last_term);  /* Term of last index. */
+    bytePut64(&cursor, p->conf_index); /* Configuration index. */
+    bytePut64(&cursor, conf_size);     /* Configuration length. */
+    configurationEncodeToBuf(&p->conf, cursor);
+    cursor = (uint8_t *)cursor + conf_size;
+    bytePut32(&cursor, p->n_files); /* Number of files. */
+    bytePut32(&cursor, p->file);    /* Index of the file. */
+    memcpy(cursor, p->name, RAFT_SNAPSHOT_NAME_LEN);
+    cursor = (uint8_t *)cursor + RAFT_SNAPSHOT_NAME_LEN;
+    bytePut64(&cursor, p->size);     /* File size. */
+    bytePut64(&cursor, p->offset);   /* Chunk offset. */
+    bytePut64(&cursor, p->data.len); /* Chunk data size. */
+}
+
+static void encodeInstallSnapshotChunkResult(
+    const struct raft_install_snapshot_chunk_result *p,
+    void *buf)
+{
+    void *cursor = buf;
+
+    bytePut64(&cursor, p->term);
+    bytePut64(&cursor, p->last_index);
+    bytePut64(&cursor, p->file);
+    bytePut64(&cursor, p->offset);
+}
+
+static void encodeForward(const struct raft_forward *p, void *buf)
+{
+    void *cursor = buf;
+
+    bytePut64(&cursor, p->term);
+    bytePut64(&cursor, p->id);
+    bytePut64(&cursor, p->data.len);
+}
+
+static void encodeForwardResult(const struct raft_forward_result *p, void *buf)
+{
+    void *cursor = buf;
+
+    bytePut64(&cursor, p->term);
+    bytePut64(&cursor, p->id);
+    bytePut64(&cursor, (uint64_t)(int64_t)p->status);
+    bytePut64(&cursor, p->index);
+}
+
 static void encodeTimeoutNow(const struct raft_timeout_now *p, void *buf)
 {
     void *cursor = buf;
@@ -187,6 +351,19 @@ int uvEncodeMessage(const struct raft_message *message,
         case RAFT_IO_TIMEOUT_NOW:
             header.len += sizeofTimeoutNow();
             break;
+        case RAFT_IO_INSTALL_SNAPSHOT_CHUNK:
+            header.len +=
+                sizeofInstallSnapshotChunk(&message->install_snapshot_chunk);
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT_CHUNK_RESULT:
+            header.len += sizeofInstallSnapshotChunkResult();
+            break;
+        case RAFT_IO_FORWARD:
+            header.len += sizeofForward();
+            break;
+        case RAFT_IO_FORWARD_RESULT:
+            header.len += sizeofForwardResult();
+            break;
         default:
             return RAFT_MALFORMED;
     };
@@ -222,17 +399,36 @@ int uvEncodeMessage(const struct raft_message *message,
         case RAFT_IO_TIMEOUT_NOW:
             encodeTimeoutNow(&message->timeout_now, cursor);
             break;
+        case RAFT_IO_INSTALL_SNAPSHOT_CHUNK:
+            encodeInstallSnapshotChunk(&message->install_snapshot_chunk,
+                                       cursor);
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT_CHUNK_RESULT:
+            encodeInstallSnapshotChunkResult(
+                &message->install_snapshot_chunk_result, cursor);
+            break;
+        case RAFT_IO_FORWARD:
+            encodeForward(&message->forward, cursor);
+            break;
+        case RAFT_IO_FORWARD_RESULT:
+            encodeForwardResult(&message->forward_result, cursor);
+            break;
     };
 
     *n_bufs = 1;
 
-    /* For AppendEntries request we also send the entries payload. */
+    /* For AppendEntries request we also send the entries payload, with one
+     * buffer per segment for entries made of segments. */
     if (message->type == RAFT_IO_APPEND_ENTRIES) {
-        *n_bufs += message->append_entries.n_entries;
+        *n_bufs += countEntriesPayload(message->append_entries.entries,
+                                       message->append_entries.n_entries);
     }
 
-    /* For InstallSnapshot request we also send the snapshot payload. */
-    if (message->type == RAFT_IO_INSTALL_SNAPSHOT) {
+    /* For InstallSnapshot and InstallSnapshotChunk requests we also send the
+     * snapshot payload, and for Forward requests the commands. */
+    if (message->type == RAFT_IO_INSTALL_SNAPSHOT ||
+        message->type == RAFT_IO_INSTALL_SNAPSHOT_CHUNK ||
+        message->type == RAFT_IO_FORWARD) {
         *n_bufs += 1;
     }
 
@@ -244,13 +440,8 @@ int uvEncodeMessage(const struct raft_message *message,
     (*bufs)[0] = header;
 
     if (message->type == RAFT_IO_APPEND_ENTRIES) {
-        unsigned i;
-        for (i = 0; i < message->append_entries.n_entries; i++) {
-            const struct raft_entry *entry =
-                &message->append_entries.entries[i];
-            (*bufs)[i + 1].base = entry->buf.base;
-            (*bufs)[i + 1].len = entry->buf.len;
-        }
+        encodeEntriesPayload(message->append_entries.entries,
+                             message->append_entries.n_entries, &(*bufs)[1]);
     }
 
     if (message->type == RAFT_IO_INSTALL_SNAPSHOT) {
@@ -258,11 +449,93 @@ int uvEncodeMessage(const struct raft_message *message,
         (*bufs)[1].len = message->install_snapshot.data.len;
     }
 
+    if (message->type == RAFT_IO_INSTALL_SNAPSHOT_CHUNK) {
+        (*bufs)[1].base = message->install_snapshot_chunk.data.base;
+        (*bufs)[1].len = message->install_snapshot_chunk.data.len;
+    }
+
+    if (message->type == RAFT_IO_FORWARD) {
+        (*bufs)[1].base = message->forward.data.base;
+        (*bufs)[1].len = message->forward.data.len;
+    }
+
+    return 0;
+
+oom_after_header_alloc:
+    raft_free(header.base);
+
+oom:
+    return RAFT_NOMEM;
+}
+
+int uvEncodeBatch(const struct raft_append_entries *p,
+                  uv_buf_t **bufs,
+                  unsigned *n_bufs)
+{
+    uv_buf_t header;
+
+    /* The batch header is followed by whatever trails the AppendEntries
+     * fields in the message header. */
+    header.len = sizeofAppendEntries(p) - APPEND_ENTRIES_FIELDS_SIZE;
+    header.base = raft_malloc(header.len);
+    if (header.base == NULL) {
+        goto oom;
+    }
+    memset(header.base, 0, header.len);
+    uvEncodeBatchHeader(p->entries, p->n_entries, header.base);
+    encodeAppendEntriesTimeouts(p, header.base, header.len);
+
+    *n_bufs = 1 + countEntriesPayload(p->entries, p->n_entries);
+    *bufs = raft_calloc(*n_bufs, sizeof **bufs);
+    if (*bufs == NULL) {
+        goto oom_after_header_alloc;
+    }
+    (*bufs)[0] = header;
+    encodeEntriesPayload(p->entries, p->n_entries, &(*bufs)[1]);
+
     return 0;
 
 oom_after_header_alloc:
     raft_free(header.base);
+oom:
+    return RAFT_NOMEM;
+}
 
+int uvEncodeAppendEntries(const struct raft_message *message,
+                          const uv_buf_t batch[],
+                          unsigned n_batch,
+                          uv_buf_t **bufs,
+                          unsigned *n_bufs)
+{
+    const struct raft_append_entries *p = &message->append_entries;
+    uv_buf_t header;
+    void *cursor;
+
+    assert(message->type == RAFT_IO_APPEND_ENTRIES);
+
+    header.len = RAFT_IO_UV__PREAMBLE_SIZE + APPEND_ENTRIES_FIELDS_SIZE;
+    header.base = raft_malloc(header.len);
+    if (header.base == NULL) {
+        goto oom;
+    }
+
+    cursor = header.base;
+    bytePut64(&cursor, message->type);
+    bytePut64(&cursor, sizeofAppendEntries(p));
+    encodeAppendEntriesFields(p, cursor);
+
+    *n_bufs = 1 + n_batch;
+    *bufs = raft_calloc(*n_bufs, sizeof **bufs);
+    if (*bufs == NULL) {
+        goto oom_after_header_alloc;
+    }
+    (*bufs)[0] = header;
+    memcpy(&(*bufs)[1], batch, n_batch * sizeof *batch);
+
+    return 0;
+
+oom_after_header_alloc:
+    raft_free(header.base);
 oom:
     return RAFT_NOMEM;
 }
@@ -284,7 +557,7 @@ void uvEncodeBatchHeader(const struct raft_entry *entries,
         bytePut64(&cursor, entry->term);
 
         /* Message type (Either RAFT_COMMAND or RAFT_CHANGE) */
-        bytePut8(&cursor, (uint8_t)entry->type);
+        bytePut8(&cursor, (uint8_t)entryEncodedType(entry));
 
         cursor = (uint8_t *)cursor + 3; /* Unused */
 
@@ -356,7 +629,7 @@ int uvDecodeBatchHeader(const void *batch,
         entry->type = byteGet8(&cursor);
 
         if (entry->type != RAFT_COMMAND && entry->type != RAFT_BARRIER &&
-            entry->type != RAFT_CHANGE) {
+            entry->type != RAFT_CHANGE && entry->type != RAFT_PACKED) {
             rv = RAFT_MALFORMED;
             goto err_after_alloc;
         }
@@ -400,6 +673,16 @@ static int decodeAppendEntries(const uv_buf_t *buf,
         return rv;
     }
 
+    /* Senders predating adaptive timeouts don't encode them. */
+    args->election_timeout = 0;
+    args->heartbeat_timeout = 0;
+    if (buf->len >= sizeofAppendEntries(args)) {
+        cursor = (const uint8_t *)buf->base + sizeofAppendEntries(args) -
+                 sizeof(uint64_t);
+        args->election_timeout = byteGet32(&cursor);
+        args->heartbeat_timeout = byteGet32(&cursor);
+    }
+
     return 0;
 }
 
@@ -444,6 +727,82 @@ static int decodeInstallSnapshot(const uv_buf_t *buf,
     return 0;
 }
 
+static int decodeInstallSnapshotChunk(const uv_buf_t *buf,
+                                      struct raft_install_snapshot_chunk *args)
+{
+    const void *cursor;
+    struct raft_buffer conf;
+    int rv;
+
+    assert(buf != NULL);
+    assert(args != NULL);
+
+    cursor = buf->base;
+
+    args->term = byteGet64(&cursor);
+    args->last_index = byteGet64(&cursor);
+    args->last_term = byteGet64(&cursor);
+    args->conf_index = byteGet64(&cursor);
+    conf.len = (size_t)byteGet64(&cursor);
+    conf.base = (void *)cursor;
+    configurationInit(&args->conf);
+    rv = configurationDecode(&conf, &args->conf);
+    if (rv != 0) {
+        return rv;
+    }
+    cursor = (const uint8_t *)cursor + conf.len;
+    args->n_files = byteGet32(&cursor);
+    args->file = byteGet32(&cursor);
+    memcpy(args->name, cursor, RAFT_SNAPSHOT_NAME_LEN);
+    args->name[RAFT_SNAPSHOT_NAME_LEN - 1] = 0;
+    cursor = (const uint8_t *)cursor + RAFT_SNAPSHOT_NAME_LEN;
+    args->size = byteGet64(&cursor);
+    args->offset = byteGet64(&cursor);
+    args->data.len = (size_t)byteGet64(&cursor);
+    args->data.base = NULL;
+
+    return 0;
+}
+
+static void decodeInstallSnapshotChunkResult(
+    const uv_buf_t *buf,
+    struct raft_install_snapshot_chunk_result *p)
+{
+    const void *cursor;
+
+    cursor = buf->base;
+
+    p->term = byteGet64(&cursor);
+    p->last_index = byteGet64(&cursor);
+    p->file = (unsigned)byteGet64(&cursor);
+    p->offset = byteGet64(&cursor);
+}
+
+static void decodeForward(const uv_buf_t *buf, struct raft_forward *p)
+{
+    const void *cursor;
+
+    cursor = buf->base;
+
+    p->term = byteGet64(&cursor);
+    p->id = byteGet64(&cursor);
+    p->data.len = (size_t)byteGet64(&cursor);
+    p->data.base = NULL;
+}
+
+static void decodeForwardResult(const uv_buf_t *buf,
+                                struct raft_forward_result *p)
+{
+    const void *cursor;
+
+    cursor = buf->base;
+
+    p->term = byteGet64(&cursor);
+    p->id = byteGet64(&cursor);
+    p->status = (int)(int64_t)byteGet64(&cursor);
+    p->index = byteGet64(&cursor);
+}
+
 static void decodeTimeoutNow(const uv_buf_t *buf, struct raft_timeout_now *p)
 {
     const void *cursor;
@@ -492,6 +851,22 @@ int uvDecodeMessage(const unsigned long type,
         case RAFT_IO_TIMEOUT_NOW:
             decodeTimeoutNow(header, &message->timeout_now);
             break;
+        case RAFT_IO_INSTALL_SNAPSHOT_CHUNK:
+            rv = decodeInstallSnapshotChunk(header,
+                                            &message->install_snapshot_chunk);
+            *payload_len += message->install_snapshot_chunk.data.len;
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT_CHUNK_RESULT:
+            decodeInstallSnapshotChunkResult(
+                header, &message->install_snapshot_chunk_result);
+            break;
+        case RAFT_IO_FORWARD:
+            decodeForward(header, &message->forward);
+            *payload_len += message->forward.data.len;
+            break;
+        case RAFT_IO_FORWARD_RESULT:
+            decodeForwardResult(header, &message->forward_result);
+            break;
         default:
             rv = RAFT_IOERR;
             break;
@@ -14,6 +14,22 @@ int uvEncodeMessage(const struct raft_message *message,
                     uv_buf_t **bufs,
                     unsigned *n_bufs);
 
+/* Encode the batch header of an AppendEntries message, followed by the
+ * buffers pointing to the entries payload. Only the first buffer is allocated,
+ * so the result can be shared by messages sending the same entries. */
+int uvEncodeBatch(const struct raft_append_entries *p,
+                  uv_buf_t **bufs,
+                  unsigned *n_bufs);
+
+/* Like uvEncodeMessage(), but for an AppendEntries message whose batch was
+ * already encoded with uvEncodeBatch(). Only the first buffer, holding the
+ * per-message fields, is newly allocated. */
+int uvEncodeAppendEntries(const struct raft_message *message,
+                          const uv_buf_t batch[],
+                          unsigned n_batch,
+                          uv_buf_t **bufs,
+                          unsigned *n_bufs);
+
 int uvDecodeMessage(unsigned long type,
                     const uv_buf_t *header,
                     struct raft_message *message,
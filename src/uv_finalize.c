@@ -1,7 +1,9 @@
 #include "assert.h"
+#include "compress.h"
 #include "heap.h"
 #include "queue.h"
 #include "uv.h"
+#include "uv_fs.h"
 #include "uv_os.h"
 
 #if 0
@@ -23,17 +25,15 @@ struct uvDyingSegment
     queue queue;            /* Link to finalize queue */
 };
 
-/* Run all blocking syscalls involved in closing a used open segment.
+/* Close or remove a single dying segment, without syncing the directory.
  *
  * An open segment is closed by truncating its length to the number of bytes
  * that were actually written into it and then renaming it. */
-static void uvFinalizeWorkCb(uv_work_t *work)
+static int uvFinalizeSegment(struct uvDyingSegment *segment, char *errmsg)
 {
-    struct uvDyingSegment *segment = work->data;
     struct uv *uv = segment->uv;
     char filename1[UV__FILENAME_LEN];
     char filename2[UV__FILENAME_LEN];
-    char errmsg[RAFT_ERRMSG_BUF_SIZE];
     int rv;
 
     sprintf(filename1, UV__OPEN_TEMPLATE, segment->counter);
@@ -46,48 +46,250 @@ static void uvFinalizeWorkCb(uv_work_t *work)
      * closed or aborted before making any write), just remove it. */
     if (segment->used == 0) {
         rv = UvFsRemoveFile(uv->dir, filename1, errmsg);
-        if (rv != 0) {
-            goto err;
-        }
-        goto sync;
+    } else {
+        rv = UvFsTruncateAndRenameFile(uv->dir, segment->used, filename1,
+                                       filename2, errmsg);
+    }
+    if (rv != 0) {
+        tracef("truncate segment %s: %s", filename1, errmsg);
+        return rv;
     }
 
-    /* Truncate and rename the segment.*/
-    rv = UvFsTruncateAndRenameFile(uv->dir, segment->used, filename1, filename2,
-                                   errmsg);
+    /* The segment has just been synced, so its pages can be dropped right
+     * away. Failing to do so is harmless. */
+    if (segment->used > 0 && !uv->direct_io &&
+        (uv->page_cache & RAFT_UV_DROP_BEHIND)) {
+        UvFsDropCache(uv->dir, filename2, errmsg);
+    }
+    return 0;
+}
+
+/* Sink of a compressed segment, counting the bytes written so far. */
+struct uvCompressSink
+{
+    struct UvFsStream stream;
+    size_t written;
+};
+
+static int uvCompressSinkWrite(void *arg, const void *buf, size_t len)
+{
+    struct uvCompressSink *sink = arg;
+    sink->written += len;
+    return UvFsStreamWrite(&sink->stream, buf, len);
+}
+
+/* Rewrite the given closed segment as a compressed temporary file and rename
+ * it over the original. Segments that are already compressed or that wouldn't
+ * shrink are left alone. Set @replaced to true if the file was replaced. */
+static int uvCompressSegment(struct uv *uv,
+                             const char *filename,
+                             bool *replaced,
+                             char *errmsg)
+{
+    char tmp[UV__FILENAME_LEN + sizeof TMP_FILE_PREFIX];
+    struct uvCompressSink sink;
+    struct raft_buffer buf;
+    uint8_t magic[4];
+    int rv;
+
+    *replaced = false;
+
+    buf.base = magic;
+    buf.len = sizeof magic;
+    rv = UvFsReadFileInto(uv->dir, filename, &buf, errmsg);
     if (rv != 0) {
-        goto err;
+        return rv;
+    }
+    if (IsCompressed(magic, sizeof magic)) {
+        return 0;
     }
 
-sync:
-    rv = UvFsSyncDir(uv->dir, errmsg);
+    rv = UvFsReadFile(uv->dir, filename, &buf, errmsg);
     if (rv != 0) {
-        goto err;
+        return rv;
     }
 
-    segment->status = 0;
-    return;
+    sprintf(tmp, TMP_FILE_FMT, filename);
+    sink.written = 0;
+    rv = UvFsStreamOpen(&sink.stream, uv->dir, tmp, 0, false, 0, errmsg);
+    if (rv != 0) {
+        goto out;
+    }
+    rv = CompressStream(&buf, 1, true, uvCompressSinkWrite, &sink, errmsg);
+    if (rv != 0) {
+        UvFsStreamAbort(&sink.stream);
+        goto err_after_tmp_open;
+    }
+    rv = UvFsStreamClose(&sink.stream);
+    if (rv != 0) {
+        goto err_after_tmp_open;
+    }
+    if (sink.written >= buf.len) {
+        goto err_after_tmp_open;
+    }
+
+    rv = UvFsRenameFile(uv->dir, tmp, filename, errmsg);
+    if (rv != 0) {
+        goto err_after_tmp_open;
+    }
+    *replaced = true;
+    goto out;
 
-err:
-    tracef("truncate segment %s: %s", filename1, errmsg);
-    assert(rv != 0);
-    segment->status = rv;
+err_after_tmp_open:
+    UvFsRemoveFile(uv->dir, tmp, errmsg);
+out:
+    HeapFree(buf.base);
+    return rv;
 }
 
-static int uvFinalizeStart(struct uvDyingSegment *segment);
-static void uvFinalizeAfterWorkCb(uv_work_t *work, int status)
+/* Compress the closed segments that were not compressed yet, skipping the ones
+ * holding any of the last entries within the configured tail.
+ *
+ * This is an optimization, so failures just stop the pass and are retried the
+ * next time a batch of segments gets finalized. */
+static void uvFinalizeCompress(struct uv *uv)
 {
-    struct uvDyingSegment *segment = work->data;
-    struct uv *uv = segment->uv;
+    struct uvSnapshotInfo *snapshots;
+    struct uvSegmentInfo *segments;
+    struct uvSegmentInfo *segment;
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    size_t n_snapshots;
+    size_t n_segments;
+    raft_index last = 0;
+    bool replaced;
+    bool synced = true;
+    size_t i;
+    int rv;
+
+    rv = UvList(uv, &snapshots, &n_snapshots, &segments, &n_segments, errmsg);
+    if (rv != 0) {
+        tracef("list for compression: %s", errmsg);
+        return;
+    }
+    if (snapshots != NULL) {
+        HeapFree(snapshots);
+    }
+
+    for (i = 0; i < n_segments; i++) {
+        if (!segments[i].is_open && segments[i].end_index > last) {
+            last = segments[i].end_index;
+        }
+    }
+
+    for (i = 0; i < n_segments; i++) {
+        segment = &segments[i];
+        if (segment->is_open || segment->end_index <= uv->compressed_index) {
+            continue;
+        }
+        if (segment->end_index + uv->segment_compression_tail > last) {
+            break;
+        }
+        rv = uvCompressSegment(uv, segment->filename, &replaced, errmsg);
+        if (rv != 0) {
+            tracef("compress segment %s: %s", segment->filename, errmsg);
+            break;
+        }
+        if (replaced) {
+            synced = false;
+        }
+        uv->compressed_index = segment->end_index;
+    }
+
+    if (segments != NULL) {
+        HeapFree(segments);
+    }
+
+    if (!synced) {
+        rv = UvFsSyncDir(uv->dir, errmsg);
+        if (rv != 0) {
+            tracef("sync dir: %s", errmsg);
+        }
+    }
+}
+
+/* Run all blocking syscalls involved in closing the batch of dying segments.
+ *
+ * Each segment is renamed (or removed) on its own, and the data directory is
+ * then synced once for the whole batch. */
+static void uvFinalizeWorkCb(uv_work_t *work)
+{
+    struct uv *uv = work->data;
+    struct uvDyingSegment *segment;
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    bool renamed = false;
+    queue *head;
+    int rv;
+
+    QUEUE_FOREACH(head, &uv->finalize_batch)
+    {
+        segment = QUEUE_DATA(head, struct uvDyingSegment, queue);
+        segment->status = uvFinalizeSegment(segment, errmsg);
+        if (segment->status == 0) {
+            renamed = true;
+        }
+    }
+
+    if (renamed) {
+        rv = UvFsSyncDir(uv->dir, errmsg);
+        if (rv != 0) {
+            tracef("sync dir: %s", errmsg);
+            QUEUE_FOREACH(head, &uv->finalize_batch)
+            {
+                segment = QUEUE_DATA(head, struct uvDyingSegment, queue);
+                if (segment->status == 0) {
+                    segment->status = rv;
+                }
+            }
+            return;
+        }
+    }
+
+    if (uv->compressing) {
+        uvFinalizeCompress(uv);
+    }
+}
+
+/* Release all segments of the current batch, returning true if any of them
+ * failed to be finalized. */
+static bool uvFinalizeBatchDone(struct uv *uv)
+{
+    struct uvDyingSegment *segment;
+    bool errored = false;
     queue *head;
+
+    while (!QUEUE_IS_EMPTY(&uv->finalize_batch)) {
+        head = QUEUE_HEAD(&uv->finalize_batch);
+        segment = QUEUE_DATA(head, struct uvDyingSegment, queue);
+        QUEUE_REMOVE(&segment->queue);
+        if (segment->status != 0) {
+            errored = true;
+        }
+        assert(uv->finalize_len > 0);
+        uv->finalize_len -= 1;
+        HeapFree(segment);
+    }
+
+    return errored;
+}
+
+static int uvFinalizeStart(struct uv *uv);
+static void uvFinalizeAfterWorkCb(uv_work_t *work, int status)
+{
+    struct uv *uv = work->data;
     int rv;
 
     assert(status == 0); /* We don't cancel worker requests */
     uv->finalize_work.data = NULL;
-    if (segment->status != 0) {
+    uv->compressing = false;
+    if (uvFinalizeBatchDone(uv)) {
         uv->errored = true;
     }
-    HeapFree(segment);
+
+    /* A snapshot put might have been waiting for compression to end, since
+     * it removes old segments. */
+    if (uv->snapshot_put_deferred) {
+        UvSnapshotPutResume(uv);
+    }
 
     /* If we have no more dismissed segments to close, check if there's a
      * barrier to unblock or if we are done closing. */
@@ -99,34 +301,44 @@ static void uvFinalizeAfterWorkCb(uv_work_t *work, int status)
         return;
     }
 
-    /* Grab a new dismissed segment to close. */
-    head = QUEUE_HEAD(&uv->finalize_reqs);
-    segment = QUEUE_DATA(head, struct uvDyingSegment, queue);
-    QUEUE_REMOVE(&segment->queue);
-
-    rv = uvFinalizeStart(segment);
+    /* Grab all the dismissed segments queued in the meantime. */
+    rv = uvFinalizeStart(uv);
     if (rv != 0) {
-        HeapFree(segment);
+        uvFinalizeBatchDone(uv);
         uv->errored = true;
     }
 }
 
-/* Start finalizing an open segment. */
-static int uvFinalizeStart(struct uvDyingSegment *segment)
+/* Start finalizing all the queued open segments as a single batch. */
+static int uvFinalizeStart(struct uv *uv)
 {
-    struct uv *uv = segment->uv;
+    queue *head;
     int rv;
 
     assert(uv->finalize_work.data == NULL);
-    assert(segment->counter > 0);
+    assert(QUEUE_IS_EMPTY(&uv->finalize_batch));
+    assert(!QUEUE_IS_EMPTY(&uv->finalize_reqs));
+
+    while (!QUEUE_IS_EMPTY(&uv->finalize_reqs)) {
+        head = QUEUE_HEAD(&uv->finalize_reqs);
+        QUEUE_REMOVE(head);
+        QUEUE_PUSH(&uv->finalize_batch, head);
+    }
+
+    uv->finalize_work.data = uv;
 
-    uv->finalize_work.data = segment;
+    /* Compression rewrites closed segments, so it's skipped while a snapshot
+     * put might be removing them. */
+    uv->compressing = uv->segment_compression && !uv->closing &&
+                      uv->snapshot_put_work.data == NULL;
 
     rv = uv_queue_work(uv->loop, &uv->finalize_work, uvFinalizeWorkCb,
                        uvFinalizeAfterWorkCb);
     if (rv != 0) {
-        ErrMsgPrintf(uv->io->errmsg, "start to truncate segment file %llu: %s",
-                     segment->counter, uv_strerror(rv));
+        uv->finalize_work.data = NULL;
+        uv->compressing = false;
+        ErrMsgPrintf(uv->io->errmsg, "start to finalize segment files: %s",
+                     uv_strerror(rv));
         return RAFT_IOERR;
     }
 
@@ -157,21 +369,30 @@ int UvFinalize(struct uv *uv,
     segment->used = used;
     segment->first_index = first_index;
     segment->last_index = last_index;
+    segment->status = 0;
+
+    QUEUE_PUSH(&uv->finalize_reqs, &segment->queue);
+    uv->finalize_len += 1;
 
-    /* If we're already processing a segment, let's put the request in the queue
-     * and wait. */
+    /* If we're already processing a batch, the segment will be picked up by
+     * the next one. */
     if (uv->finalize_work.data != NULL) {
-        QUEUE_PUSH(&uv->finalize_reqs, &segment->queue);
         return 0;
     }
 
-    rv = uvFinalizeStart(segment);
+    rv = uvFinalizeStart(uv);
     if (rv != 0) {
-        HeapFree(segment);
+        uvFinalizeBatchDone(uv);
         return rv;
     }
 
     return 0;
 }
 
+unsigned raft_uv_finalize_queue_len(struct raft_io *io)
+{
+    struct uv *uv = io->impl;
+    return uv->finalize_len;
+}
+
 #undef tracef
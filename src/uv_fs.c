@@ -169,6 +169,7 @@ int UvFsOpenFileForReading(const char *dir,
 int UvFsAllocateFile(const char *dir,
                      const char *filename,
                      size_t size,
+                     bool dsync,
                      uv_file *fd,
                      char *errmsg)
 {
@@ -179,7 +180,9 @@ int UvFsAllocateFile(const char *dir,
     UvOsJoin(dir, filename, path);
 
     /* TODO: use RWF_DSYNC instead, if available. */
-    flags |= O_DSYNC;
+    if (dsync) {
+        flags |= O_DSYNC;
+    }
 
     rv = uvFsOpenFile(dir, filename, flags, S_IRUSR | S_IWUSR, fd, errmsg);
     if (rv != 0) {
@@ -259,6 +262,243 @@ err:
     return rv;
 }
 
+int UvFsStreamOpen(struct UvFsStream *s,
+                   const char *dir,
+                   const char *filename,
+                   size_t size,
+                   bool direct,
+                   size_t block_size,
+                   char *errmsg)
+{
+    char path[UV__PATH_SZ];
+    int flags = UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_EXCL;
+    int rv;
+
+    s->block_size = block_size != 0 ? block_size : 4096;
+    assert(UV__FS_STREAM_CHUNK_SIZE % s->block_size == 0);
+    s->len = 0;
+    s->offset = 0;
+    s->errmsg = errmsg;
+
+    s->buf = raft_aligned_alloc(s->block_size, UV__FS_STREAM_CHUNK_SIZE);
+    if (s->buf == NULL) {
+        ErrMsgOom(errmsg);
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+
+    rv = uvFsOpenFile(dir, filename, flags, S_IRUSR | S_IWUSR, &s->fd, errmsg);
+    if (rv != 0) {
+        goto err_after_buf_alloc;
+    }
+
+    if (size > 0) {
+        rv = UvOsFallocate(s->fd, 0, (off_t)size);
+        if (rv != 0) {
+            if (rv == UV_ENOSPC) {
+                ErrMsgPrintf(errmsg, "not enough space to allocate %zu bytes",
+                             size);
+                rv = RAFT_NOSPACE;
+            } else {
+                UvOsErrMsg(errmsg, "posix_allocate", rv);
+                rv = RAFT_IOERR;
+            }
+            goto err_after_open;
+        }
+    }
+
+    /* Direct I/O is best effort, fall back to buffered writes. */
+    s->direct = direct && UvOsSetDirectIo(s->fd) == 0;
+
+    return 0;
+
+err_after_open:
+    UvOsClose(s->fd);
+    UvOsJoin(dir, filename, path);
+    UvOsUnlink(path);
+err_after_buf_alloc:
+    raft_aligned_free(s->block_size, s->buf);
+err:
+    assert(rv != 0);
+    return rv;
+}
+
+/* Write @len bytes at the current stream offset. */
+static int uvFsStreamWriteAt(struct UvFsStream *s, const void *data, size_t len)
+{
+    uv_buf_t buf;
+    int rv;
+
+    buf.base = (char *)data;
+    buf.len = len;
+    rv = UvOsWrite(s->fd, &buf, 1, s->offset);
+    if (rv != (int)len) {
+        if (rv < 0) {
+            UvOsErrMsg(s->errmsg, "write", rv);
+        } else {
+            ErrMsgPrintf(s->errmsg, "short write: %d only bytes written", rv);
+        }
+        return RAFT_IOERR;
+    }
+    s->offset += (off_t)len;
+    return 0;
+}
+
+int UvFsStreamWrite(struct UvFsStream *s, const void *data, size_t len)
+{
+    const char *cursor = data;
+    size_t n;
+    int rv;
+
+    while (len > 0) {
+        /* Large buffered writes don't need staging. */
+        if (s->len == 0 && !s->direct && len >= UV__FS_STREAM_CHUNK_SIZE) {
+            return uvFsStreamWriteAt(s, cursor, len);
+        }
+        n = UV__FS_STREAM_CHUNK_SIZE - s->len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy((char *)s->buf + s->len, cursor, n);
+        s->len += n;
+        cursor += n;
+        len -= n;
+        if (s->len == UV__FS_STREAM_CHUNK_SIZE) {
+            rv = uvFsStreamWriteAt(s, s->buf, s->len);
+            if (rv != 0) {
+                return rv;
+            }
+            s->len = 0;
+        }
+    }
+
+    return 0;
+}
+
+int UvFsStreamClose(struct UvFsStream *s)
+{
+    off_t size = s->offset + (off_t)s->len;
+    size_t len = s->len;
+    int rv;
+
+    /* Direct writes must cover whole blocks, the padding is trimmed below. */
+    if (s->direct && len % s->block_size != 0) {
+        size_t padded = len + s->block_size - len % s->block_size;
+        memset((char *)s->buf + len, 0, padded - len);
+        len = padded;
+    }
+    if (len > 0) {
+        rv = uvFsStreamWriteAt(s, s->buf, len);
+        if (rv != 0) {
+            goto err;
+        }
+    }
+
+    rv = UvOsTruncate(s->fd, size);
+    if (rv != 0) {
+        UvOsErrMsg(s->errmsg, "ftruncate", rv);
+        rv = RAFT_IOERR;
+        goto err;
+    }
+    rv = UvOsFdatasync(s->fd);
+    if (rv != 0) {
+        UvOsErrMsg(s->errmsg, "fdatasync", rv);
+        rv = RAFT_IOERR;
+        goto err;
+    }
+
+    raft_aligned_free(s->block_size, s->buf);
+    rv = UvOsClose(s->fd);
+    if (rv != 0) {
+        UvOsErrMsg(s->errmsg, "close", rv);
+        return RAFT_IOERR;
+    }
+    return 0;
+
+err:
+    UvFsStreamAbort(s);
+    return rv;
+}
+
+void UvFsStreamAbort(struct UvFsStream *s)
+{
+    raft_aligned_free(s->block_size, s->buf);
+    UvOsClose(s->fd);
+}
+
+int UvFsDropCache(const char *dir, const char *filename, char *errmsg)
+{
+    uv_file fd;
+    int rv;
+
+    rv = uvFsOpenFile(dir, filename, O_RDONLY, 0, &fd, errmsg);
+    if (rv != 0) {
+        return rv;
+    }
+
+    /* Dirty pages can't be dropped, write them back first. */
+    rv = UvOsSyncFileRange(fd, 0, 0);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "sync_file_range", rv);
+        rv = RAFT_IOERR;
+        goto out;
+    }
+    rv = UvOsFadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "posix_fadvise", rv);
+        rv = RAFT_IOERR;
+        goto out;
+    }
+
+out:
+    UvOsClose(fd);
+    return rv;
+}
+
+int UvFsReadahead(const char *dir,
+                  const char *filename,
+                  size_t size,
+                  char *errmsg)
+{
+    uv_file fd;
+    int rv;
+
+    rv = uvFsOpenFile(dir, filename, O_RDONLY, 0, &fd, errmsg);
+    if (rv != 0) {
+        return rv;
+    }
+
+    /* WILLNEED starts populating the page cache, which is shared with the
+     * descriptor later used for reading. */
+    rv = UvOsFadvise(fd, 0, (off_t)size, POSIX_FADV_WILLNEED);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "posix_fadvise", rv);
+        rv = RAFT_IOERR;
+    }
+
+    UvOsClose(fd);
+    return rv;
+}
+
+int UvFsRenameFile(const char *dir,
+                   const char *filename1,
+                   const char *filename2,
+                   char *errmsg)
+{
+    char path1[UV__PATH_SZ];
+    char path2[UV__PATH_SZ];
+    int rv;
+
+    UvOsJoin(dir, filename1, path1);
+    UvOsJoin(dir, filename2, path2);
+    rv = UvOsRename(path1, path2);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "rename", rv);
+        return RAFT_IOERR;
+    }
+    return 0;
+}
+
 int UvFsMakeFile(const char *dir,
                  const char *filename,
                  struct raft_buffer *bufs,
@@ -511,6 +751,74 @@ int UvFsRemoveFile(const char *dir, const char *filename, char *errmsg)
     return 0;
 }
 
+int UvFsRemoveTree(const char *dir, const char *filename, char *errmsg)
+{
+    char path[UV__PATH_SZ];
+    struct uv_fs_s req;
+    struct uv_dirent_s entry;
+    bool is_dir;
+    int n;
+    int i;
+    int rv;
+    int rv2;
+
+    rv = UvFsIsDir(dir, filename, &is_dir, errmsg);
+    if (rv != 0) {
+        return rv;
+    }
+    if (!is_dir) {
+        return UvFsRemoveFile(dir, filename, errmsg);
+    }
+
+    UvOsJoin(dir, filename, path);
+    n = uv_fs_scandir(NULL, &req, path, 0, NULL);
+    if (n < 0) {
+        UvOsErrMsg(errmsg, "scandir", n);
+        return RAFT_IOERR;
+    }
+    rv = 0;
+    for (i = 0; i < n; i++) {
+        rv2 = uv_fs_scandir_next(&req, &entry);
+        assert(rv2 == 0); /* Can't fail in libuv */
+        if (rv == 0) {
+            rv = UvFsRemoveTree(path, entry.name, errmsg);
+        }
+    }
+    rv2 = uv_fs_scandir_next(&req, &entry);
+    assert(rv2 == UV_EOF);
+    if (rv != 0) {
+        return rv;
+    }
+
+    rv = uv_fs_rmdir(NULL, &req, path, NULL);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "rmdir", rv);
+        return RAFT_IOERR;
+    }
+    return 0;
+}
+
+int UvFsIsDir(const char *dir,
+              const char *filename,
+              bool *is_dir,
+              char *errmsg)
+{
+    uv_stat_t sb;
+    char path[UV__PATH_SZ];
+    int rv;
+
+    UvOsJoin(dir, filename, path);
+
+    rv = UvOsStat(path, &sb);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "stat", rv);
+        return RAFT_IOERR;
+    }
+    *is_dir = (sb.st_mode & S_IFMT) == S_IFDIR;
+
+    return 0;
+}
+
 int UvFsTruncateAndRenameFile(const char *dir,
                               size_t size,
                               const char *filename1,
@@ -733,8 +1041,8 @@ int UvFsProbeCapabilities(const char *dir,
 
     /* Create a temporary probe file. */
     UvFsRemoveFile(dir, UV__FS_PROBE_FILE, ignored);
-    rv = UvFsAllocateFile(dir, UV__FS_PROBE_FILE, UV__FS_PROBE_FILE_SIZE, &fd,
-                          errmsg);
+    rv = UvFsAllocateFile(dir, UV__FS_PROBE_FILE, UV__FS_PROBE_FILE_SIZE, true,
+                          &fd, errmsg);
     if (rv != 0) {
         ErrMsgWrapf(errmsg, "create I/O capabilities probe file");
         goto err;
@@ -36,10 +36,12 @@ int UvFsFileIsEmpty(const char *dir,
                     char *errmsg);
 
 /* Create the given file in the given directory and allocate the given size to
- * it, returning its file descriptor. The file must not exist yet. */
+ * it, returning its file descriptor. The file must not exist yet. If DSYNC is
+ * true the file is opened with O_DSYNC. */
 int UvFsAllocateFile(const char *dir,
                      const char *filename,
                      size_t size,
+                     bool dsync,
                      uv_file *fd,
                      char *errmsg);
 
@@ -64,6 +66,61 @@ int UvFsMakeOrOverwriteFile(const char *dir,
                             const struct raft_buffer *buf,
                             char *errmsg);
 
+/* Size of the staging buffer of a file stream. */
+#define UV__FS_STREAM_CHUNK_SIZE (4 * 1024 * 1024)
+
+/* Sequential writer that stages data into a large aligned buffer and writes it
+ * out in full chunks, optionally bypassing the page cache with O_DIRECT. */
+struct UvFsStream
+{
+    uv_file fd;        /* Open file */
+    bool direct;       /* Whether O_DIRECT is in effect */
+    size_t block_size; /* Alignment of direct writes */
+    void *buf;         /* Staging buffer */
+    size_t len;        /* Bytes staged in the buffer */
+    off_t offset;      /* File offset of the staging buffer */
+    char *errmsg;      /* Where to report errors */
+};
+
+/* Create the given file, which must not exist yet, and prepare it for being
+ * written sequentially. If @size is not zero, that much space is preallocated.
+ * If @direct is true, O_DIRECT is used when the file system supports it. */
+int UvFsStreamOpen(struct UvFsStream *s,
+                   const char *dir,
+                   const char *filename,
+                   size_t size,
+                   bool direct,
+                   size_t block_size,
+                   char *errmsg);
+
+/* Append data to the stream. */
+int UvFsStreamWrite(struct UvFsStream *s, const void *data, size_t len);
+
+/* Write out any staged data, trim the file to the amount of data written,
+ * fdatasync() it and close it. The directory is not synced. */
+int UvFsStreamClose(struct UvFsStream *s);
+
+/* Close the stream without flushing it. */
+void UvFsStreamAbort(struct UvFsStream *s);
+
+/* Write back any dirty page of the given file and drop its pages from the page
+ * cache. This is only an hint to the kernel. */
+int UvFsDropCache(const char *dir, const char *filename, char *errmsg);
+
+/* Ask the kernel to start reading the first @size bytes of the given file into
+ * the page cache, or all of it if @size is zero. This is only an hint to the
+ * kernel. */
+int UvFsReadahead(const char *dir,
+                  const char *filename,
+                  size_t size,
+                  char *errmsg);
+
+/* Synchronously rename a file. The directory is not synced. */
+int UvFsRenameFile(const char *dir,
+                   const char *filename1,
+                   const char *filename2,
+                   char *errmsg);
+
 /* Check if the given file descriptor has reached the end of the file. */
 bool UvFsIsAtEof(uv_file fd);
 
@@ -93,6 +150,15 @@ int UvFsReadFileInto(const char *dir,
 /* Synchronously remove a file, calling the unlink() system call. */
 int UvFsRemoveFile(const char *dir, const char *filename, char *errmsg);
 
+/* Synchronously remove a file, or a directory along with the files in it. */
+int UvFsRemoveTree(const char *dir, const char *filename, char *errmsg);
+
+/* Check whether the given file is a directory. */
+int UvFsIsDir(const char *dir,
+              const char *filename,
+              bool *is_dir,
+              char *errmsg);
+
 /* Synchronously truncate a file to the given size and then rename it. */
 int UvFsTruncateAndRenameFile(const char *dir,
                               size_t size,
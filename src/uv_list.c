@@ -30,12 +30,15 @@ static bool uvListShouldIgnore(const char *filename)
     return result;
 }
 
-int UvList(struct uv *uv,
-           struct uvSnapshotInfo *snapshots[],
-           size_t *n_snapshots,
-           struct uvSegmentInfo *segments[],
-           size_t *n_segments,
-           char *errmsg)
+/* Scan @dir, appending the snapshots and segments found to the given lists.
+ * If @snapshots or @segments is NULL, files of that kind are ignored. */
+static int uvListDir(struct uv *uv,
+                     const char *dir,
+                     struct uvSnapshotInfo *snapshots[],
+                     size_t *n_snapshots,
+                     struct uvSegmentInfo *segments[],
+                     size_t *n_segments,
+                     char *errmsg)
 {
     struct uv_fs_s req;
     struct uv_dirent_s entry;
@@ -44,18 +47,12 @@ int UvList(struct uv *uv,
     int rv;
     int rv2;
 
-    n = uv_fs_scandir(NULL, &req, uv->dir, 0, NULL);
+    n = uv_fs_scandir(NULL, &req, dir, 0, NULL);
     if (n < 0) {
         ErrMsgPrintf(errmsg, "scan data directory: %s", uv_strerror(n));
         return RAFT_IOERR;
     }
 
-    *snapshots = NULL;
-    *n_snapshots = 0;
-
-    *segments = NULL;
-    *n_segments = 0;
-
     rv = 0;
 
     for (i = 0; i < n; i++) {
@@ -79,23 +76,27 @@ int UvList(struct uv *uv,
 
         /* Append to the snapshot list if it's a snapshot metadata filename and
          * a valid associated snapshot file exists. */
-        rv = UvSnapshotInfoAppendIfMatch(uv, filename, snapshots, n_snapshots,
-                                         &appended);
-        if (appended || rv != 0) {
-            if (rv == 0) {
-                tracef("snapshot %s", filename);
+        if (snapshots != NULL) {
+            rv = UvSnapshotInfoAppendIfMatch(uv, filename, snapshots,
+                                             n_snapshots, &appended);
+            if (appended || rv != 0) {
+                if (rv == 0) {
+                    tracef("snapshot %s", filename);
+                }
+                continue;
             }
-            continue;
         }
 
         /* Append to the segment list if it's a segment filename */
-        rv = uvSegmentInfoAppendIfMatch(entry.name, segments, n_segments,
-                                        &appended);
-        if (appended || rv != 0) {
-            if (rv == 0) {
-                tracef("segment %s", filename);
+        if (segments != NULL) {
+            rv = uvSegmentInfoAppendIfMatch(entry.name, segments, n_segments,
+                                            &appended);
+            if (appended || rv != 0) {
+                if (rv == 0) {
+                    tracef("segment %s", filename);
+                }
+                continue;
             }
-            continue;
         }
 
         tracef("ignore %s", filename);
@@ -104,8 +105,43 @@ int UvList(struct uv *uv,
     rv2 = uv_fs_scandir_next(&req, &entry);
     assert(rv2 == UV_EOF);
 
-    if (rv != 0 && *segments != NULL) {
-        raft_free(*segments);
+    return rv;
+}
+
+int UvList(struct uv *uv,
+           struct uvSnapshotInfo *snapshots[],
+           size_t *n_snapshots,
+           struct uvSegmentInfo *segments[],
+           size_t *n_segments,
+           char *errmsg)
+{
+    bool separate = strcmp(uv->dir, uv->snapshot_dir) != 0;
+    int rv;
+
+    *snapshots = NULL;
+    *n_snapshots = 0;
+
+    *segments = NULL;
+    *n_segments = 0;
+
+    /* Snapshots live in the segments directory unless configured otherwise. */
+    rv = uvListDir(uv, uv->dir, separate ? NULL : snapshots, n_snapshots,
+                   segments, n_segments, errmsg);
+    if (rv == 0 && separate) {
+        rv = uvListDir(uv, uv->snapshot_dir, snapshots, n_snapshots, NULL,
+                       NULL, errmsg);
+    }
+
+    if (rv != 0) {
+        if (*snapshots != NULL) {
+            raft_free(*snapshots);
+            *snapshots = NULL;
+        }
+        if (*segments != NULL) {
+            raft_free(*segments);
+            *segments = NULL;
+        }
+        return rv;
     }
 
     if (*snapshots != NULL) {
@@ -116,7 +152,7 @@ int UvList(struct uv *uv,
         uvSegmentSort(*segments, *n_segments);
     }
 
-    return rv;
+    return 0;
 }
 
 #undef tracef
@@ -191,7 +191,8 @@ int uvMetadataStore(struct uv *uv, const struct uvMetadata *metadata)
     /* Write the metadata file, creating it if it does not exist. */
     buf.base = content;
     buf.len = sizeof content;
-    rv = UvFsMakeOrOverwriteFile(uv->dir, filename, &buf, uv->io->errmsg);
+    rv = UvFsMakeOrOverwriteFile(uv->metadata_dir, filename, &buf,
+                                 uv->io->errmsg);
     if (rv != 0) {
         ErrMsgWrapf(uv->io->errmsg, "persist %s", filename);
         return rv;
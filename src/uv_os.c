@@ -109,6 +109,33 @@ int UvOsFdatasync(uv_file fd)
     return uv_fs_fdatasync(NULL, &req, fd, NULL);
 }
 
+int UvOsFadvise(uv_file fd, off_t offset, off_t len, int advice)
+{
+    int rv;
+    rv = posix_fadvise(fd, offset, len, advice);
+    /* Like posix_fallocate(), errno is not set. */
+    return -rv;
+}
+
+int UvOsSyncFileRange(uv_file fd, off_t offset, off_t len)
+{
+    int rv;
+#if defined(SYNC_FILE_RANGE_WRITE)
+    rv = sync_file_range(fd, offset, len,
+                         SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                             SYNC_FILE_RANGE_WAIT_AFTER);
+    if (rv == -1) {
+        return -errno;
+    }
+    return 0;
+#else
+    (void)offset;
+    (void)len;
+    rv = UvOsFdatasync(fd);
+    return rv;
+#endif
+}
+
 int UvOsStat(const char *path, uv_stat_t *sb)
 {
     struct uv_fs_s req;
@@ -142,6 +169,12 @@ int UvOsRename(const char *path1, const char *path2)
     return uv_fs_rename(NULL, &req, path1, path2, NULL);
 }
 
+int UvOsMkdir(const char *path)
+{
+    struct uv_fs_s req;
+    return uv_fs_mkdir(NULL, &req, path, DEFAULT_DIR_PERM, NULL);
+}
+
 void UvOsJoin(const char *dir, const char *filename, char *path)
 {
     assert(UV__DIR_HAS_VALID_LEN(dir));
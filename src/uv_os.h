@@ -89,6 +89,13 @@ int UvOsFdatasync(uv_file fd);
 /* Portable stat() */
 int UvOsStat(const char *path, uv_stat_t *sb);
 
+/* Portable posix_fadvise() */
+int UvOsFadvise(uv_file fd, off_t offset, off_t len, int advice);
+
+/* Write back dirty pages of a file range and wait for completion, using
+ * sync_file_range() where available. */
+int UvOsSyncFileRange(uv_file fd, off_t offset, off_t len);
+
 /* Portable write() */
 int UvOsWrite(uv_file fd,
               const uv_buf_t bufs[],
@@ -101,6 +108,9 @@ int UvOsUnlink(const char *path);
 /* Portable rename() */
 int UvOsRename(const char *path1, const char *path2);
 
+/* Portable mkdir() */
+int UvOsMkdir(const char *path);
+
 /* Join dir and filename into a full OS path. */
 void UvOsJoin(const char *dir, const char *filename, char *path);
 
@@ -101,6 +101,9 @@ static void uvServerDestroy(struct uvServer *s)
             case RAFT_IO_INSTALL_SNAPSHOT:
                 configurationClose(&s->message.install_snapshot.conf);
                 break;
+            case RAFT_IO_INSTALL_SNAPSHOT_CHUNK:
+                configurationClose(&s->message.install_snapshot_chunk.conf);
+                break;
         }
     }
     if (s->payload.base != NULL) {
@@ -224,6 +227,7 @@ static void uvServerReadCb(uv_stream_t *stream,
 
         /* We shouldn't have read more data than the pending amount. */
         assert(n <= s->buf.len);
+        s->uv->usage.bytes_received += n;
 
         /* Advance the read window */
         s->buf.base += n;
@@ -290,6 +294,13 @@ static void uvServerReadCb(uv_stream_t *stream,
                 case RAFT_IO_INSTALL_SNAPSHOT:
                     s->message.install_snapshot.data.base = s->payload.base;
                     break;
+                case RAFT_IO_INSTALL_SNAPSHOT_CHUNK:
+                    s->message.install_snapshot_chunk.data.base =
+                        s->payload.base;
+                    break;
+                case RAFT_IO_FORWARD:
+                    s->message.forward.data.base = s->payload.base;
+                    break;
                 default:
                     /* We should never have read a payload in the first place */
                     assert(0);
@@ -7,6 +7,7 @@
 #include "array.h"
 #include "assert.h"
 #include "byte.h"
+#include "compress.h"
 #include "configuration.h"
 #include "entry.h"
 #include "heap.h"
@@ -156,19 +157,36 @@ int uvSegmentKeepTrailing(struct uv *uv,
     return 0;
 }
 
-/* Read a segment file and return its format version. */
+/* Read a segment file and return its format version. Closed segments that were
+ * compressed in the background are transparently decompressed. */
 static int uvReadSegmentFile(struct uv *uv,
                              const char *filename,
                              struct raft_buffer *buf,
                              uint64_t *format)
 {
     char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    struct raft_buffer decompressed;
+    uint64_t start = uv_hrtime();
     int rv;
     rv = UvFsReadFile(uv->dir, filename, buf, errmsg);
     if (rv != 0) {
         ErrMsgTransfer(errmsg, uv->io->errmsg, "read file");
         return RAFT_IOERR;
     }
+    if (IsCompressed(buf->base, buf->len)) {
+        rv = Decompress(*buf, &decompressed, errmsg);
+        HeapFree(buf->base);
+        if (rv != 0) {
+            ErrMsgTransfer(errmsg, uv->io->errmsg, "decompress");
+            return rv;
+        }
+        *buf = decompressed;
+    }
+    if (uv->loading) {
+        uv->load_stats.read += uv_hrtime() - start;
+        uv->load_stats.n_segments++;
+        uv->load_stats.bytes_read += buf->len;
+    }
     if (buf->len < 8) {
         ErrMsgPrintf(uv->io->errmsg, "file has only %zu bytes", buf->len);
         HeapFree(buf->base);
@@ -221,6 +239,7 @@ static int uvLoadEntriesBatch(struct uv *uv,
     uint32_t crc2;             /* Actual checksum */
     char errmsg[RAFT_ERRMSG_BUF_SIZE];
     size_t start;
+    uint64_t now;
     int rv;
 
     /* Save the current offset, to provide more information when logging. */
@@ -277,8 +296,12 @@ static int uvLoadEntriesBatch(struct uv *uv,
     }
 
     /* Check batch header integrity. */
+    now = uv_hrtime();
     crc1 = byteFlip32(((uint32_t *)checksums)[0]);
     crc2 = byteCrc32(header.base, header.len, 0);
+    if (uv->loading) {
+        uv->load_stats.crc += uv_hrtime() - now;
+    }
     if (crc1 != crc2) {
         ErrMsgPrintf(uv->io->errmsg, "header checksum mismatch");
         rv = RAFT_CORRUPT;
@@ -286,7 +309,11 @@ static int uvLoadEntriesBatch(struct uv *uv,
     }
 
     /* Decode the batch header, allocating the entries array. */
+    now = uv_hrtime();
     rv = uvDecodeBatchHeader(header.base, entries, n_entries);
+    if (uv->loading) {
+        uv->load_stats.decode += uv_hrtime() - now;
+    }
     if (rv != 0) {
         goto err;
     }
@@ -307,16 +334,24 @@ static int uvLoadEntriesBatch(struct uv *uv,
     }
 
     /* Check batch data integrity. */
+    now = uv_hrtime();
     crc1 = byteFlip32(((uint32_t *)checksums)[1]);
     crc2 = byteCrc32(data.base, data.len, 0);
+    if (uv->loading) {
+        uv->load_stats.crc += uv_hrtime() - now;
+    }
     if (crc1 != crc2) {
         ErrMsgPrintf(uv->io->errmsg, "data checksum mismatch");
         rv = RAFT_CORRUPT;
         goto err_after_header_decode;
     }
 
+    now = uv_hrtime();
     uvDecodeEntriesBatch(content->base, *offset - data.len, *entries,
                          *n_entries);
+    if (uv->loading) {
+        uv->load_stats.decode += uv_hrtime() - now;
+    }
 
     *last = *offset == content->len;
 
@@ -744,7 +779,7 @@ int uvSegmentBufferAppend(struct uvSegmentBuffer *b,
         /* TODO: enforce the requirement of 8-byte alignment also in the
          * higher-level APIs. */
         assert(entry->buf.len % sizeof(uint64_t) == 0);
-        memcpy(cursor, entry->buf.base, entry->buf.len);
+        entryDataCopy(entry, cursor);
         crc2 = byteCrc32(cursor, entry->buf.len, crc2);
         cursor = (uint8_t *)cursor + entry->buf.len;
     }
@@ -802,6 +837,7 @@ int uvSegmentLoadAll(struct uv *uv,
     raft_index next_index;          /* Next entry to load from disk */
     struct raft_entry *tmp_entries; /* Entries in current segment */
     size_t tmp_n;                   /* Number of entries in current segment */
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
     size_t i;
     int rv;
 
@@ -813,11 +849,21 @@ int uvSegmentLoadAll(struct uv *uv,
 
     next_index = start_index;
 
+    if (uv->page_cache & RAFT_UV_READAHEAD) {
+        UvFsReadahead(uv->dir, infos[0].filename, uv->readahead_size, errmsg);
+    }
+
     for (i = 0; i < n_infos; i++) {
         struct uvSegmentInfo *info = &infos[i];
 
         tracef("load segment %s", info->filename);
 
+        /* Let the kernel fetch the next segment while this one is decoded. */
+        if ((uv->page_cache & RAFT_UV_READAHEAD) && i + 1 < n_infos) {
+            UvFsReadahead(uv->dir, infos[i + 1].filename, uv->readahead_size,
+                          errmsg);
+        }
+
         if (info->is_open) {
             rv = uvLoadOpenSegment(uv, info, entries, n_entries, &next_index);
             ErrMsgWrapf(uv->io->errmsg, "load open segment %s", info->filename);
@@ -855,6 +901,12 @@ int uvSegmentLoadAll(struct uv *uv,
 
             raft_free(tmp_entries);
             next_index += tmp_n;
+
+            /* The entries now live in memory, keep the page cache for the
+             * FSM. */
+            if (uv->page_cache & RAFT_UV_DROP_BEHIND) {
+                UvFsDropCache(uv->dir, info->filename, errmsg);
+            }
         }
     }
 
@@ -1053,4 +1105,139 @@ out:
     return rv;
 }
 
+/* Read of entries from a closed segment. */
+struct uvEntriesRead
+{
+    struct uv *uv;
+    struct raft_io_entries_read *req;
+    raft_index index;           /* Index of the first entry to read */
+    unsigned max;               /* Max number of entries to return */
+    struct raft_entry *entries; /* Entries read */
+    size_t n;                   /* Number of entries read */
+    struct uv_work_s work;
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    int status;
+    queue queue;
+};
+
+static void uvEntriesReadWorkCb(uv_work_t *work)
+{
+    struct uvEntriesRead *read = work->data;
+    struct uv *uv = read->uv;
+    struct uvSnapshotInfo *snapshots;
+    struct uvSegmentInfo *segments;
+    struct uvSegmentInfo *segment = NULL;
+    size_t n_snapshots;
+    size_t n_segments;
+    size_t skip;
+    size_t i;
+    int rv;
+
+    rv = UvList(uv, &snapshots, &n_snapshots, &segments, &n_segments,
+                read->errmsg);
+    if (rv != 0) {
+        read->status = rv;
+        return;
+    }
+    if (snapshots != NULL) {
+        HeapFree(snapshots);
+    }
+
+    for (i = 0; i < n_segments; i++) {
+        if (!segments[i].is_open && segments[i].first_index <= read->index &&
+            segments[i].end_index >= read->index) {
+            segment = &segments[i];
+            break;
+        }
+    }
+    if (segment == NULL) {
+        ErrMsgPrintf(read->errmsg, "no closed segment with entry %llu",
+                     read->index);
+        rv = RAFT_NOTFOUND;
+        goto out;
+    }
+
+    rv = uvSegmentLoadClosed(uv, segment, &read->entries, &read->n);
+    if (rv != 0) {
+        ErrMsgPrintf(read->errmsg, "load %s", segment->filename);
+        goto out;
+    }
+
+    /* All the entries of a segment share the same batch, which holds the whole
+     * file, so the ones not requested are just dropped from the array. */
+    skip = (size_t)(read->index - segment->first_index);
+    read->n -= skip;
+    if (read->n > read->max) {
+        read->n = read->max;
+    }
+    memmove(read->entries, &read->entries[skip],
+            read->n * sizeof *read->entries);
+
+out:
+    if (segments != NULL) {
+        HeapFree(segments);
+    }
+    read->status = rv;
+}
+
+static void uvEntriesReadAfterWorkCb(uv_work_t *work, int status)
+{
+    struct uvEntriesRead *read = work->data;
+    struct raft_io_entries_read *req = read->req;
+    struct raft_entry *entries = read->entries;
+    unsigned n = (unsigned)read->n;
+    int req_status = read->status;
+    struct uv *uv = read->uv;
+    assert(status == 0);
+    if (req_status != 0) {
+        tracef("read entries: %s", read->errmsg);
+        entries = NULL;
+        n = 0;
+    }
+    QUEUE_REMOVE(&read->queue);
+    HeapFree(read);
+    req->cb(req, entries, n, req_status);
+    uvMaybeFireCloseCb(uv);
+}
+
+int UvEntriesRead(struct raft_io *io,
+                  struct raft_io_entries_read *req,
+                  raft_index index,
+                  unsigned max,
+                  raft_io_entries_read_cb cb)
+{
+    struct uv *uv;
+    struct uvEntriesRead *read;
+    int rv;
+
+    uv = io->impl;
+    assert(!uv->closing);
+    assert(max > 0);
+
+    read = HeapMalloc(sizeof *read);
+    if (read == NULL) {
+        return RAFT_NOMEM;
+    }
+    read->uv = uv;
+    read->req = req;
+    read->index = index;
+    read->max = max;
+    read->entries = NULL;
+    read->n = 0;
+    read->status = 0;
+    read->work.data = read;
+    req->cb = cb;
+
+    QUEUE_PUSH(&uv->entries_read_reqs, &read->queue);
+    rv = uv_queue_work(uv->loop, &read->work, uvEntriesReadWorkCb,
+                       uvEntriesReadAfterWorkCb);
+    if (rv != 0) {
+        QUEUE_REMOVE(&read->queue);
+        HeapFree(read);
+        ErrMsgPrintf(io->errmsg, "queue read of entries: %s", uv_strerror(rv));
+        return RAFT_IOERR;
+    }
+    return 0;
+}
+
 #undef tracef
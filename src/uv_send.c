@@ -55,29 +55,106 @@ struct uvClient
     bool closing;                   /* True after calling uvClientAbort */
 };
 
+/* Batch header and payload buffers of an AppendEntries message, encoded once
+ * and shared by all the requests sending the same entries array.
+ *
+ * The core shares the entries array among the requests sending the same
+ * range, and keeps it alive until they complete, so the array address
+ * identifies the batch as long as any request using it is in flight. */
+struct uvSendBatch
+{
+    struct uv *uv;                    /* libuv I/O implementation object */
+    const struct raft_entry *entries; /* Entries the batch was encoded from */
+    unsigned n_entries;               /* Number of entries */
+    unsigned election_timeout;        /* Adaptive timeouts encoded in it */
+    unsigned heartbeat_timeout;
+    unsigned refs;                    /* Send requests using the batch */
+    uv_buf_t *bufs;                   /* Batch header and entries payload */
+    unsigned n_bufs;                  /* Number of buffers */
+};
+
 /* Hold state for a single send RPC message request. */
 struct uvSend
 {
-    struct uvClient *client;  /* Client connected to the target server */
-    struct raft_io_send *req; /* User request */
-    uv_buf_t *bufs;           /* Encoded raft RPC message to send */
-    unsigned n_bufs;          /* Number of buffers */
-    uv_write_t write;         /* Stream write request */
-    queue queue;              /* Pending send requests queue */
+    struct uvClient *client;   /* Client connected to the target server */
+    struct raft_io_send *req;  /* User request */
+    struct uvSendBatch *batch; /* Shared AppendEntries batch, if any */
+    uv_buf_t *bufs;            /* Encoded raft RPC message to send */
+    unsigned n_bufs;           /* Number of buffers */
+    uv_write_t write;          /* Stream write request */
+    queue queue;               /* Pending send requests queue */
 };
 
+/* Return the encoded batch of the given AppendEntries message, reusing the
+ * latest one if it was encoded from the same entries. */
+static int uvSendBatchGet(struct uv *uv,
+                          const struct raft_append_entries *args,
+                          struct uvSendBatch **batch)
+{
+    struct uvSendBatch *b = uv->send_batch;
+    int rv;
+
+    if (b != NULL && b->entries == args->entries &&
+        b->n_entries == args->n_entries &&
+        b->election_timeout == args->election_timeout &&
+        b->heartbeat_timeout == args->heartbeat_timeout) {
+        b->refs += 1;
+        *batch = b;
+        return 0;
+    }
+
+    b = HeapMalloc(sizeof *b);
+    if (b == NULL) {
+        return RAFT_NOMEM;
+    }
+    rv = uvEncodeBatch(args, &b->bufs, &b->n_bufs);
+    if (rv != 0) {
+        HeapFree(b);
+        return rv;
+    }
+    b->uv = uv;
+    b->entries = args->entries;
+    b->n_entries = args->n_entries;
+    b->election_timeout = args->election_timeout;
+    b->heartbeat_timeout = args->heartbeat_timeout;
+    b->refs = 1;
+    uv->send_batch = b;
+    *batch = b;
+    return 0;
+}
+
+static void uvSendBatchPut(struct uvSendBatch *b)
+{
+    struct uv *uv = b->uv;
+    assert(b->refs > 0);
+    b->refs -= 1;
+    if (b->refs > 0) {
+        return;
+    }
+    if (uv->send_batch == b) {
+        uv->send_batch = NULL;
+    }
+    HeapFree(b->bufs[0].base);
+    HeapFree(b->bufs);
+    HeapFree(b);
+}
+
 /* Free all memory used by the given send request object, including the object
  * itself. */
 static void uvSendDestroy(struct uvSend *s)
 {
     if (s->bufs != NULL) {
         /* Just release the first buffer. Further buffers are entry or snapshot
-         * payloads, which we were passed but we don't own. */
+         * payloads, which we were passed but we don't own, or belong to the
+         * shared batch. */
         HeapFree(s->bufs[0].base);
 
         /* Release the buffers array. */
         HeapFree(s->bufs);
     }
+    if (s->batch != NULL) {
+        uvSendBatchPut(s->batch);
+    }
     HeapFree(s);
 }
 
@@ -183,8 +260,15 @@ static void uvSendWriteCb(struct uv_write_s *write, const int status)
     struct uvSend *send = write->data;
     struct uvClient *c = send->client;
     struct raft_io_send *req = send->req;
+    unsigned i;
     int cb_status = 0;
 
+    if (status == 0) {
+        for (i = 0; i < send->n_bufs; i++) {
+            c->uv->usage.bytes_sent += send->bufs[i].len;
+        }
+    }
+
     /* If the write failed and we're not currently closing, let's consider the
      * current stream handle as busted and start disconnecting (unless we're
      * already doing so). We'll trigger a new connection attempt once the handle
@@ -474,9 +558,24 @@ int UvSend(struct raft_io *io,
         goto err;
     }
     send->req = req;
+    send->batch = NULL;
     req->cb = cb;
 
-    rv = uvEncodeMessage(message, &send->bufs, &send->n_bufs);
+    /* Followers at the same index are sent the same entries, encode their
+     * batch only once. */
+    if (message->type == RAFT_IO_APPEND_ENTRIES &&
+        message->append_entries.n_entries > 0) {
+        rv = uvSendBatchGet(uv, &message->append_entries, &send->batch);
+        if (rv != 0) {
+            send->bufs = NULL;
+            goto err_after_send_alloc;
+        }
+        rv = uvEncodeAppendEntries(message, send->batch->bufs,
+                                   send->batch->n_bufs, &send->bufs,
+                                   &send->n_bufs);
+    } else {
+        rv = uvEncodeMessage(message, &send->bufs, &send->n_bufs);
+    }
     if (rv != 0) {
         send->bufs = NULL;
         goto err_after_send_alloc;
@@ -1,6 +1,8 @@
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/uio.h>
+#include <unistd.h>
 
 #include "array.h"
 #include "assert.h"
@@ -10,6 +12,7 @@
 #include "heap.h"
 #include "uv.h"
 #include "uv_encoding.h"
+#include "uv_fs.h"
 #include "uv_os.h"
 
 #if 0
@@ -82,6 +85,7 @@ int UvSnapshotInfoAppendIfMatch(struct uv *uv,
     bool matched;
     char snapshot_filename[UV__FILENAME_LEN];
     bool exists;
+    bool is_dir;
     bool is_empty;
     char errmsg[RAFT_ERRMSG_BUF_SIZE];
     int rv;
@@ -98,7 +102,7 @@ int UvSnapshotInfoAppendIfMatch(struct uv *uv,
      * finishing the snapshot, or that another thread is still busy writing the
      * snapshot. */
     uvSnapshotFilenameOf(&info, snapshot_filename);
-    rv = UvFsFileExists(uv->dir, snapshot_filename, &exists, errmsg);
+    rv = UvFsFileExists(uv->snapshot_dir, snapshot_filename, &exists, errmsg);
     if (rv != 0) {
         tracef("stat %s: %s", snapshot_filename, errmsg);
         rv = RAFT_IOERR;
@@ -109,11 +113,22 @@ int UvSnapshotInfoAppendIfMatch(struct uv *uv,
         return 0;
     }
 
+    /* The files of a file-based snapshot are in a directory. */
+    rv = UvFsIsDir(uv->snapshot_dir, snapshot_filename, &is_dir, errmsg);
+    if (rv != 0) {
+        tracef("stat %s: %s", snapshot_filename, errmsg);
+        return rv;
+    }
+    if (is_dir) {
+        goto append;
+    }
+
     /* TODO This check is strictly not needed, snapshot files are created by
      * renaming fully written and synced tmp-files. Leaving it here, just to be
      * extra-safe. Can probably be removed once more data integrity checks are
      * performed at startup. */
-    rv = UvFsFileIsEmpty(uv->dir, snapshot_filename, &is_empty, errmsg);
+    rv = UvFsFileIsEmpty(uv->snapshot_dir, snapshot_filename, &is_empty,
+                         errmsg);
     if (rv != 0) {
         tracef("is_empty %s: %s", snapshot_filename, errmsg);
         rv = RAFT_IOERR;
@@ -124,6 +139,7 @@ int UvSnapshotInfoAppendIfMatch(struct uv *uv,
         return 0;
     }
 
+append:
     ARRAY__APPEND(struct uvSnapshotInfo, info, infos, n_infos, rv);
     if (rv == -1) {
         return RAFT_NOMEM;
@@ -230,7 +246,7 @@ static int uvSnapshotLoadMeta(struct uv *uv,
     snapshot->term = info->term;
     snapshot->index = info->index;
 
-    rv = UvFsOpenFileForReading(uv->dir, info->filename, &fd, errmsg);
+    rv = UvFsOpenFileForReading(uv->snapshot_dir, info->filename, &fd, errmsg);
     if (rv != 0) {
         tracef("open %s: %s", info->filename, errmsg);
         rv = RAFT_IOERR;
@@ -311,6 +327,101 @@ err:
     return rv;
 }
 
+/* List the regular files in the directory of a file-based snapshot. */
+static int uvSnapshotListFiles(const char *dir,
+                               struct raft_snapshot_file **files,
+                               unsigned *n_files,
+                               char *errmsg)
+{
+    struct uv_fs_s req;
+    struct uv_dirent_s entry;
+    struct raft_snapshot_file file;
+    bool is_dir;
+    off_t size;
+    int n;
+    int i;
+    int rv;
+    int rv2;
+
+    *files = NULL;
+    *n_files = 0;
+
+    n = uv_fs_scandir(NULL, &req, dir, 0, NULL);
+    if (n < 0) {
+        ErrMsgPrintf(errmsg, "scan snapshot directory: %s", uv_strerror(n));
+        return RAFT_IOERR;
+    }
+
+    rv = 0;
+    for (i = 0; i < n; i++) {
+        rv2 = uv_fs_scandir_next(&req, &entry);
+        assert(rv2 == 0); /* Can't fail in libuv */
+        if (rv != 0) {
+            continue;
+        }
+        if (strlen(entry.name) >= RAFT_SNAPSHOT_NAME_LEN) {
+            ErrMsgPrintf(errmsg, "snapshot file name too long: %s",
+                         entry.name);
+            rv = RAFT_INVALID;
+            continue;
+        }
+        rv = UvFsIsDir(dir, entry.name, &is_dir, errmsg);
+        if (rv != 0 || is_dir) {
+            continue;
+        }
+        rv = UvFsFileSize(dir, entry.name, &size, errmsg);
+        if (rv != 0) {
+            continue;
+        }
+        memset(file.name, 0, sizeof file.name);
+        strcpy(file.name, entry.name);
+        file.size = (unsigned long long)size;
+        ARRAY__APPEND(struct raft_snapshot_file, file, files, n_files, rv);
+        if (rv == -1) {
+            rv = RAFT_NOMEM;
+        }
+    }
+
+    rv2 = uv_fs_scandir_next(&req, &entry);
+    assert(rv2 == UV_EOF);
+
+    if (rv != 0 && *files != NULL) {
+        HeapFree(*files);
+        *files = NULL;
+        *n_files = 0;
+    }
+    return rv;
+}
+
+/* Populate the data portion of a file-based snapshot, pointing it to the
+ * snapshot directory. */
+static int uvSnapshotLoadFiles(struct uv *uv,
+                               const char *filename,
+                               struct raft_snapshot *snapshot,
+                               char *errmsg)
+{
+    char path[UV__PATH_SZ];
+    int rv;
+
+    UvOsJoin(uv->snapshot_dir, filename, path);
+
+    snapshot->bufs = NULL;
+    snapshot->n_bufs = 0;
+    snapshot->dir = HeapMalloc(strlen(path) + 1);
+    if (snapshot->dir == NULL) {
+        return RAFT_NOMEM;
+    }
+    strcpy(snapshot->dir, path);
+
+    rv = uvSnapshotListFiles(path, &snapshot->files, &snapshot->n_files,
+                             errmsg);
+    if (rv != 0) {
+        HeapFree(snapshot->dir);
+        return rv;
+    }
+    return 0;
+}
+
 /* Load the snapshot data file and populate the data portion of the given
  * snapshot object accordingly. */
 static int uvSnapshotLoadData(struct uv *uv,
@@ -320,11 +431,23 @@ static int uvSnapshotLoadData(struct uv *uv,
 {
     char filename[UV__FILENAME_LEN];
     struct raft_buffer buf;
+    bool is_dir;
     int rv;
 
     uvSnapshotFilenameOf(info, filename);
 
-    rv = UvFsReadFile(uv->dir, filename, &buf, errmsg);
+    rv = UvFsIsDir(uv->snapshot_dir, filename, &is_dir, errmsg);
+    if (rv != 0) {
+        goto err;
+    }
+    if (is_dir) {
+        return uvSnapshotLoadFiles(uv, filename, snapshot, errmsg);
+    }
+    snapshot->dir = NULL;
+    snapshot->files = NULL;
+    snapshot->n_files = 0;
+
+    rv = UvFsReadFile(uv->snapshot_dir, filename, &buf, errmsg);
     if (rv != 0) {
         tracef("stat %s: %s", filename, errmsg);
         goto err;
@@ -418,13 +541,13 @@ static int uvSnapshotKeepLastTwo(struct uv *uv,
     for (i = 0; i < n - 2; i++) {
         struct uvSnapshotInfo *snapshot = &snapshots[i];
         char filename[UV__FILENAME_LEN];
-        rv = UvFsRemoveFile(uv->dir, snapshot->filename, errmsg);
+        rv = UvFsRemoveFile(uv->snapshot_dir, snapshot->filename, errmsg);
         if (rv != 0) {
             tracef("unlink %s: %s", snapshot->filename, errmsg);
             return RAFT_IOERR;
         }
         uvSnapshotFilenameOf(snapshot, filename);
-        rv = UvFsRemoveFile(uv->dir, filename, errmsg);
+        rv = UvFsRemoveTree(uv->snapshot_dir, filename, errmsg);
         if (rv != 0) {
             tracef("unlink %s: %s", filename, errmsg);
             return RAFT_IOERR;
@@ -462,7 +585,10 @@ static int uvRemoveOldSegmentsAndSnapshots(struct uv *uv,
             goto out;
         }
     }
-    rv = UvFsSyncDir(uv->dir, errmsg);
+    rv = UvFsSyncDir(uv->snapshot_dir, errmsg);
+    if (rv == 0 && strcmp(uv->dir, uv->snapshot_dir) != 0) {
+        rv = UvFsSyncDir(uv->dir, errmsg);
+    }
 
 out:
     if (snapshots != NULL) {
@@ -474,65 +600,298 @@ out:
     return rv;
 }
 
-static int makeFileCompressed(const char *dir,
-                           const char *filename,
-                           struct raft_buffer *bufs,
-                           unsigned n_bufs,
-                           char *errmsg)
+static int uvSnapshotStreamWrite(void *arg, const void *buf, size_t len)
 {
+    return UvFsStreamWrite(arg, buf, len);
+}
+
+/* Stream the snapshot data into the given temporary file, compressing it chunk
+ * by chunk if needed. */
+static int uvSnapshotPutData(struct uvSnapshotPut *put, const char *filename)
+{
+    struct uv *uv = put->uv;
+    const struct raft_snapshot *snapshot = put->snapshot;
+    struct UvFsStream stream;
+    size_t size = 0;
+    bool direct_io;
+    unsigned i;
     int rv;
 
-    struct raft_buffer compressed = {0};
-    rv = Compress(bufs, n_bufs, &compressed, errmsg);
+    for (i = 0; i < snapshot->n_bufs; i++) {
+        size += snapshot->bufs[i].len;
+    }
+
+    /* Direct I/O support was only probed in the segments directory. */
+    direct_io = uv->direct_io && strcmp(uv->dir, uv->snapshot_dir) == 0;
+    rv = UvFsStreamOpen(&stream, uv->snapshot_dir, filename, size, direct_io,
+                        uv->block_size, put->errmsg);
     if (rv != 0) {
-        ErrMsgWrapf(errmsg, "compress %s", filename);
-        return RAFT_IOERR;
+        return rv;
+    }
+
+    if (uv->snapshot_compression) {
+        rv = CompressStream(snapshot->bufs, snapshot->n_bufs, false,
+                            uvSnapshotStreamWrite, &stream, put->errmsg);
+    } else {
+        for (i = 0; i < snapshot->n_bufs && rv == 0; i++) {
+            rv = UvFsStreamWrite(&stream, snapshot->bufs[i].base,
+                                 snapshot->bufs[i].len);
+        }
+    }
+    if (rv != 0) {
+        UvFsStreamAbort(&stream);
+        return rv;
+    }
+
+    return UvFsStreamClose(&stream);
+}
+
+/* Copy the content of @in into @out, retrying interrupted and short reads and
+ * writes. */
+static int uvSnapshotCopyFile(uv_file in, uv_file out)
+{
+    char buf[64 * 1024];
+    ssize_t n;
+    ssize_t w;
+    size_t done;
+
+    for (;;) {
+        n = read(in, buf, sizeof buf);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return n < 0 ? -1 : 0;
+        }
+        done = 0;
+        while (done < (size_t)n) {
+            w = write(out, buf + done, (size_t)n - done);
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w <= 0) {
+                return -1;
+            }
+            done += (size_t)w;
+        }
     }
+}
 
-    rv = UvFsMakeFile(dir, filename, &compressed, 1, errmsg);
-    raft_free(compressed.base);
+/* Copy the files in @src into the new directory @dst, removing them from
+ * @src. Used when @src is on another file system. */
+static int uvSnapshotMoveFiles(const char *src, const char *dst, char *errmsg)
+{
+    struct raft_snapshot_file *files;
+    unsigned n_files;
+    char src_path[UV__PATH_SZ];
+    char dst_path[UV__PATH_SZ];
+    struct uv_fs_s req;
+    uv_file in;
+    uv_file out;
+    unsigned i;
+    int rv;
+
+    rv = uvSnapshotListFiles(src, &files, &n_files, errmsg);
+    if (rv != 0) {
+        return rv;
+    }
+    rv = UvOsMkdir(dst);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "mkdir", rv);
+        rv = RAFT_IOERR;
+        goto out;
+    }
+
+    for (i = 0; i < n_files; i++) {
+        UvOsJoin(src, files[i].name, src_path);
+        UvOsJoin(dst, files[i].name, dst_path);
+        rv = UvOsOpen(src_path, UV_FS_O_RDONLY, 0, &in);
+        if (rv != 0) {
+            UvOsErrMsg(errmsg, "open", rv);
+            rv = RAFT_IOERR;
+            goto out;
+        }
+        rv = UvOsOpen(dst_path, UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_EXCL,
+                      S_IRUSR | S_IWUSR, &out);
+        if (rv != 0) {
+            UvOsClose(in);
+            UvOsErrMsg(errmsg, "open", rv);
+            rv = RAFT_IOERR;
+            goto out;
+        }
+        rv = uvSnapshotCopyFile(in, out);
+        UvOsClose(in);
+        UvOsClose(out);
+        if (rv != 0) {
+            ErrMsgPrintf(errmsg, "copy %s", files[i].name);
+            rv = RAFT_IOERR;
+            goto out;
+        }
+        UvOsUnlink(src_path);
+    }
+    uv_fs_rmdir(NULL, &req, src, NULL);
+
+out:
+    HeapFree(files);
     return rv;
 }
 
+/* Fsync all the files in the given directory and the directory itself. */
+static int uvSnapshotSyncFiles(const char *dir, char *errmsg)
+{
+    struct raft_snapshot_file *files;
+    unsigned n_files;
+    char path[UV__PATH_SZ];
+    uv_file fd;
+    unsigned i;
+    int rv;
+
+    rv = uvSnapshotListFiles(dir, &files, &n_files, errmsg);
+    if (rv != 0) {
+        return rv;
+    }
+    for (i = 0; i < n_files; i++) {
+        UvOsJoin(dir, files[i].name, path);
+        rv = UvOsOpen(path, UV_FS_O_RDONLY, 0, &fd);
+        if (rv != 0) {
+            UvOsErrMsg(errmsg, "open", rv);
+            rv = RAFT_IOERR;
+            break;
+        }
+        rv = UvOsFsync(fd);
+        UvOsClose(fd);
+        if (rv != 0) {
+            UvOsErrMsg(errmsg, "fsync", rv);
+            rv = RAFT_IOERR;
+            break;
+        }
+    }
+    HeapFree(files);
+    if (rv != 0) {
+        return rv;
+    }
+    return UvFsSyncDir(dir, errmsg);
+}
+
+/* Move the files of a file-based snapshot into the given temporary directory
+ * and sync them. The files are either the FSM checkpoint or, if the snapshot
+ * has no directory, the ones staged while receiving it. */
+static int uvSnapshotPutFiles(struct uvSnapshotPut *put, const char *filename)
+{
+    struct uv *uv = put->uv;
+    const struct raft_snapshot *snapshot = put->snapshot;
+    char stage[UV__FILENAME_LEN];
+    char path[UV__PATH_SZ];
+    bool exists;
+    int rv;
+
+    UvOsJoin(uv->snapshot_dir, filename, path);
+
+    if (snapshot->dir != NULL) {
+        rv = UvOsRename(snapshot->dir, path);
+        if (rv == UV_EXDEV) {
+            rv = uvSnapshotMoveFiles(snapshot->dir, path, put->errmsg);
+        } else if (rv != 0) {
+            UvOsErrMsg(put->errmsg, "rename", rv);
+            rv = RAFT_IOERR;
+        }
+    } else {
+        sprintf(stage, UV__SNAPSHOT_STAGE_TEMPLATE, snapshot->term,
+                snapshot->index);
+        rv = UvFsFileExists(uv->snapshot_dir, stage, &exists, put->errmsg);
+        if (rv == 0 && exists) {
+            rv = UvFsRenameFile(uv->snapshot_dir, stage, filename, put->errmsg);
+        } else if (rv == 0) {
+            /* A snapshot without files. */
+            rv = UvOsMkdir(path);
+            if (rv != 0) {
+                UvOsErrMsg(put->errmsg, "mkdir", rv);
+                rv = RAFT_IOERR;
+            }
+        }
+    }
+    if (rv != 0) {
+        return rv;
+    }
+
+    return uvSnapshotSyncFiles(path, put->errmsg);
+}
+
+/* Write the metadata into the given temporary file. */
+static int uvSnapshotPutMeta(struct uvSnapshotPut *put, const char *filename)
+{
+    struct UvFsStream stream;
+    unsigned i;
+    int rv;
+
+    rv = UvFsStreamOpen(&stream, put->uv->snapshot_dir, filename, 0, false, 0,
+                        put->errmsg);
+    if (rv != 0) {
+        return rv;
+    }
+    for (i = 0; i < 2; i++) {
+        rv = UvFsStreamWrite(&stream, put->meta.bufs[i].base,
+                             put->meta.bufs[i].len);
+        if (rv != 0) {
+            UvFsStreamAbort(&stream);
+            return rv;
+        }
+    }
+    return UvFsStreamClose(&stream);
+}
+
+/* Persist the snapshot data and metadata files.
+ *
+ * Both files are first fully written and synced under temporary names, then
+ * renamed into place, data first, and made durable with a single directory
+ * sync. A crash in between leaves at most an orphan file, which is removed at
+ * startup. */
 static void uvSnapshotPutWorkCb(uv_work_t *work)
 {
     struct uvSnapshotPut *put = work->data;
     struct uv *uv = put->uv;
     char metadata[UV__FILENAME_LEN];
     char snapshot[UV__FILENAME_LEN];
+    char tmp_metadata[UV__FILENAME_LEN + sizeof TMP_FILE_PREFIX];
+    char tmp_snapshot[UV__FILENAME_LEN + sizeof TMP_FILE_PREFIX];
     char errmsg[RAFT_ERRMSG_BUF_SIZE];
     int rv;
 
     sprintf(metadata, UV__SNAPSHOT_META_TEMPLATE, put->snapshot->term,
             put->snapshot->index, put->meta.timestamp);
-
-    rv = UvFsMakeFile(uv->dir, metadata, put->meta.bufs, 2, put->errmsg);
-    if (rv != 0) {
-        ErrMsgWrapf(put->errmsg, "write %s", metadata);
-        put->status = RAFT_IOERR;
-        return;
-    }
-
     sprintf(snapshot, UV__SNAPSHOT_TEMPLATE, put->snapshot->term,
             put->snapshot->index, put->meta.timestamp);
+    sprintf(tmp_metadata, TMP_FILE_FMT, metadata);
+    sprintf(tmp_snapshot, TMP_FILE_FMT, snapshot);
 
-    if (uv->snapshot_compression) {
-        rv = makeFileCompressed(uv->dir, snapshot, put->snapshot->bufs,
-                                put->snapshot->n_bufs, put->errmsg);
+    /* File-based snapshots have no buffers. */
+    if (put->snapshot->bufs == NULL) {
+        rv = uvSnapshotPutFiles(put, tmp_snapshot);
     } else {
-        rv = UvFsMakeFile(uv->dir, snapshot, put->snapshot->bufs,
-                          put->snapshot->n_bufs, put->errmsg);
+        rv = uvSnapshotPutData(put, tmp_snapshot);
     }
-
     if (rv != 0) {
         ErrMsgWrapf(put->errmsg, "write %s", snapshot);
-        UvFsRemoveFile(uv->dir, metadata, errmsg);
-        UvFsRemoveFile(uv->dir, snapshot, errmsg);
-        put->status = RAFT_IOERR;
-        return;
+        goto err_after_data;
+    }
+
+    rv = uvSnapshotPutMeta(put, tmp_metadata);
+    if (rv != 0) {
+        ErrMsgWrapf(put->errmsg, "write %s", metadata);
+        goto err_after_data;
+    }
+
+    rv = UvFsRenameFile(uv->snapshot_dir, tmp_snapshot, snapshot, put->errmsg);
+    if (rv != 0) {
+        goto err_after_meta;
+    }
+    rv = UvFsRenameFile(uv->snapshot_dir, tmp_metadata, metadata, put->errmsg);
+    if (rv != 0) {
+        UvFsRemoveTree(uv->snapshot_dir, snapshot, errmsg);
+        goto err_after_meta;
     }
 
-    rv = UvFsSyncDir(uv->dir, put->errmsg);
+    rv = UvFsSyncDir(uv->snapshot_dir, put->errmsg);
     if (rv != 0) {
         put->status = RAFT_IOERR;
         return;
@@ -548,6 +907,12 @@ static void uvSnapshotPutWorkCb(uv_work_t *work)
     put->status = 0;
 
     return;
+
+err_after_meta:
+    UvFsRemoveFile(uv->snapshot_dir, tmp_metadata, errmsg);
+err_after_data:
+    UvFsRemoveTree(uv->snapshot_dir, tmp_snapshot, errmsg);
+    put->status = RAFT_IOERR;
 }
 
 /* Finish the put request, releasing all associated memory and invoking its
@@ -589,6 +954,13 @@ static void uvSnapshotPutStart(struct uvSnapshotPut *put)
     }
 
     uv->snapshot_put_work.data = put;
+
+    /* Old segments can't be removed while they are being compressed. */
+    if (uv->compressing) {
+        uv->snapshot_put_deferred = true;
+        return;
+    }
+
     rv = uv_queue_work(uv->loop, &uv->snapshot_put_work, uvSnapshotPutWorkCb,
                        uvSnapshotPutAfterWorkCb);
     if (rv != 0) {
@@ -598,6 +970,16 @@ static void uvSnapshotPutStart(struct uvSnapshotPut *put)
     }
 }
 
+void UvSnapshotPutResume(struct uv *uv)
+{
+    struct uvSnapshotPut *put = uv->snapshot_put_work.data;
+    assert(put != NULL);
+    assert(uv->snapshot_put_deferred);
+    assert(!uv->compressing);
+    uv->snapshot_put_deferred = false;
+    uvSnapshotPutStart(put);
+}
+
 static void uvSnapshotPutBarrierCb(struct UvBarrier *barrier)
 {
     struct uvSnapshotPut *put = barrier->data;
@@ -651,6 +1033,12 @@ int UvSnapshotPut(struct raft_io *io,
 
     req->cb = cb;
 
+    /* The staged files of a received snapshot are moved away. */
+    if (snapshot->bufs == NULL && snapshot->dir == NULL) {
+        uv->stage_term = 0;
+        uv->stage_index = 0;
+    }
+
     /* Prepare the buffers for the metadata file. */
     put->meta.bufs[0].base = put->meta.header;
     put->meta.bufs[0].len = sizeof put->meta.header;
@@ -789,4 +1177,227 @@ err:
     return rv;
 }
 
+/* Read or write of a chunk of a file-based snapshot. */
+struct uvSnapshotIo
+{
+    struct uv *uv;
+    struct raft_io_snapshot_read *read;   /* Read request, or NULL */
+    struct raft_io_snapshot_write *write; /* Write request, or NULL */
+    char path[UV__PATH_SZ];               /* File to read or write */
+    char stage[UV__FILENAME_LEN];         /* Staging directory of a write */
+    char stale[UV__FILENAME_LEN];         /* Staging directory to discard */
+    unsigned long long offset;            /* Offset in the file */
+    struct raft_buffer *buf;              /* Data read or written */
+    struct uv_work_s work;
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    int status;
+    queue queue;
+};
+
+static void uvSnapshotReadWorkCb(uv_work_t *work)
+{
+    struct uvSnapshotIo *io = work->data;
+    struct uv_fs_s req;
+    uv_buf_t buf;
+    uv_file fd;
+    int rv;
+
+    rv = UvOsOpen(io->path, UV_FS_O_RDONLY, 0, &fd);
+    if (rv != 0) {
+        UvOsErrMsg(io->errmsg, "open", rv);
+        io->status = RAFT_IOERR;
+        return;
+    }
+    buf.base = io->buf->base;
+    buf.len = io->buf->len;
+    rv = uv_fs_read(NULL, &req, fd, &buf, 1, (int64_t)io->offset, NULL);
+    UvOsClose(fd);
+    if (rv < 0) {
+        UvOsErrMsg(io->errmsg, "read", rv);
+        io->status = RAFT_IOERR;
+        return;
+    }
+    io->buf->len = (size_t)rv;
+    io->status = 0;
+}
+
+static void uvSnapshotWriteWorkCb(uv_work_t *work)
+{
+    struct uvSnapshotIo *io = work->data;
+    struct uv *uv = io->uv;
+    char path[UV__PATH_SZ];
+    uv_buf_t buf;
+    uv_file fd;
+    int flags;
+    int rv;
+
+    if (io->stale[0] != 0) {
+        /* Ignore errors */
+        UvFsRemoveTree(uv->snapshot_dir, io->stale, io->errmsg);
+    }
+
+    UvOsJoin(uv->snapshot_dir, io->stage, path);
+    rv = UvOsMkdir(path);
+    if (rv != 0 && rv != UV_EEXIST) {
+        UvOsErrMsg(io->errmsg, "mkdir", rv);
+        io->status = RAFT_IOERR;
+        return;
+    }
+
+    flags = UV_FS_O_WRONLY | UV_FS_O_CREAT;
+    if (io->offset == 0) {
+        flags |= UV_FS_O_TRUNC;
+    }
+    rv = UvOsOpen(io->path, flags, S_IRUSR | S_IWUSR, &fd);
+    if (rv != 0) {
+        UvOsErrMsg(io->errmsg, "open", rv);
+        io->status = RAFT_IOERR;
+        return;
+    }
+    buf.base = io->buf->base;
+    buf.len = io->buf->len;
+    rv = UvOsWrite(fd, &buf, 1, (int64_t)io->offset);
+    UvOsClose(fd);
+    if (rv != (int)buf.len) {
+        ErrMsgPrintf(io->errmsg, "write %.200s", io->path);
+        io->status = RAFT_IOERR;
+        return;
+    }
+    io->status = 0;
+}
+
+static void uvSnapshotIoAfterWorkCb(uv_work_t *work, int status)
+{
+    struct uvSnapshotIo *io = work->data;
+    struct raft_io_snapshot_read *read = io->read;
+    struct raft_io_snapshot_write *write = io->write;
+    int req_status = io->status;
+    struct uv *uv = io->uv;
+    assert(status == 0);
+    if (req_status != 0) {
+        tracef("snapshot file io: %s", io->errmsg);
+    }
+    QUEUE_REMOVE(&io->queue);
+    HeapFree(io);
+    if (read != NULL) {
+        read->cb(read, req_status);
+    } else {
+        write->cb(write, req_status);
+    }
+    uvMaybeFireCloseCb(uv);
+}
+
+/* Queue the given read or write of a snapshot file. */
+static int uvSnapshotIoStart(struct uvSnapshotIo *io, uv_work_cb work_cb)
+{
+    struct uv *uv = io->uv;
+    int rv;
+
+    io->work.data = io;
+    QUEUE_PUSH(&uv->snapshot_io_reqs, &io->queue);
+    rv = uv_queue_work(uv->loop, &io->work, work_cb, uvSnapshotIoAfterWorkCb);
+    if (rv != 0) {
+        QUEUE_REMOVE(&io->queue);
+        tracef("snapshot file io: %s", uv_strerror(rv));
+        return RAFT_IOERR;
+    }
+    return 0;
+}
+
+int UvSnapshotRead(struct raft_io *io,
+                   struct raft_io_snapshot_read *req,
+                   const struct raft_snapshot *snapshot,
+                   unsigned file,
+                   unsigned long long offset,
+                   struct raft_buffer *buf,
+                   raft_io_snapshot_read_cb cb)
+{
+    struct uv *uv;
+    struct uvSnapshotIo *read;
+    int rv;
+
+    uv = io->impl;
+    assert(!uv->closing);
+    assert(snapshot->dir != NULL && file < snapshot->n_files);
+
+    read = HeapMalloc(sizeof *read);
+    if (read == NULL) {
+        return RAFT_NOMEM;
+    }
+    read->uv = uv;
+    read->read = req;
+    read->write = NULL;
+    snprintf(read->path, sizeof read->path, "%s/%s", snapshot->dir,
+             snapshot->files[file].name);
+    read->offset = offset;
+    read->buf = buf;
+    req->cb = cb;
+
+    rv = uvSnapshotIoStart(read, uvSnapshotReadWorkCb);
+    if (rv != 0) {
+        HeapFree(read);
+        return rv;
+    }
+    return 0;
+}
+
+int UvSnapshotWrite(struct raft_io *io,
+                    struct raft_io_snapshot_write *req,
+                    raft_term term,
+                    raft_index index,
+                    unsigned file,
+                    const char *name,
+                    unsigned long long offset,
+                    const struct raft_buffer *buf,
+                    raft_io_snapshot_write_cb cb)
+{
+    struct uv *uv;
+    struct uvSnapshotIo *write;
+    int rv;
+
+    uv = io->impl;
+    assert(!uv->closing);
+
+    /* Snapshot directories are flat. */
+    if (strchr(name, '/') != NULL || strcmp(name, ".") == 0 ||
+        strcmp(name, "..") == 0 || strlen(name) == 0) {
+        ErrMsgPrintf(io->errmsg, "invalid snapshot file name: %s", name);
+        return RAFT_INVALID;
+    }
+
+    write = HeapMalloc(sizeof *write);
+    if (write == NULL) {
+        return RAFT_NOMEM;
+    }
+    write->uv = uv;
+    write->read = NULL;
+    write->write = req;
+    sprintf(write->stage, UV__SNAPSHOT_STAGE_TEMPLATE, term, index);
+    snprintf(write->path, sizeof write->path, "%s/%s/%s", uv->snapshot_dir,
+             write->stage, name);
+    write->offset = offset;
+    write->buf = (struct raft_buffer *)buf;
+    req->cb = cb;
+
+    /* Discard whatever was staged for another snapshot, or for this one if
+     * the transfer started over. */
+    write->stale[0] = 0;
+    if (uv->stage_term != term || uv->stage_index != index ||
+        (file == 0 && offset == 0)) {
+        if (uv->stage_index != 0) {
+            sprintf(write->stale, UV__SNAPSHOT_STAGE_TEMPLATE, uv->stage_term,
+                    uv->stage_index);
+        }
+        uv->stage_term = term;
+        uv->stage_index = index;
+    }
+
+    rv = uvSnapshotIoStart(write, uvSnapshotWriteWorkCb);
+    if (rv != 0) {
+        HeapFree(write);
+        return rv;
+    }
+    return 0;
+}
+
 #undef tracef
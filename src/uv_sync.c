@@ -0,0 +1,193 @@
+#include "assert.h"
+#include "heap.h"
+#include "uv.h"
+#include "uv_os.h"
+
+/* In relaxed durability mode open segments are written without O_DIRECT and
+ * O_DSYNC, so append requests complete once their data is in the page cache.
+ * A background fdatasync() of the open segments then runs either periodically
+ * or after enough bytes have been written, and advances the durable index to
+ * the last entry that had been written when it started.
+ *
+ * Closed segments don't need to be synced, since finalizing an open segment
+ * fsync()s it before renaming it. */
+
+#define tracef(...) Tracef(uv->tracer, __VA_ARGS__)
+
+/* Sync all open segments, including the ones waiting to be finalized. */
+static void uvSyncWorkCb(uv_work_t *work)
+{
+    struct uv *uv = work->data;
+    struct uvSnapshotInfo *snapshots;
+    struct uvSegmentInfo *segments;
+    size_t n_snapshots;
+    size_t n_segments;
+    char path[UV__PATH_SZ];
+    uv_file fd;
+    size_t i;
+    int rv;
+
+    rv = UvList(uv, &snapshots, &n_snapshots, &segments, &n_segments,
+                uv->sync_errmsg);
+    if (rv != 0) {
+        goto out;
+    }
+    if (snapshots != NULL) {
+        HeapFree(snapshots);
+    }
+
+    for (i = 0; i < n_segments; i++) {
+        if (!segments[i].is_open) {
+            continue;
+        }
+        UvOsJoin(uv->dir, segments[i].filename, path);
+        rv = UvOsOpen(path, UV_FS_O_RDONLY, 0, &fd);
+        if (rv == UV_ENOENT) {
+            /* Finalized in the meantime, which syncs it. */
+            rv = 0;
+            continue;
+        }
+        if (rv != 0) {
+            UvOsErrMsg(uv->sync_errmsg, "open", rv);
+            rv = RAFT_IOERR;
+            break;
+        }
+        rv = UvOsFdatasync(fd);
+        UvOsClose(fd);
+        if (rv != 0) {
+            UvOsErrMsg(uv->sync_errmsg, "fdatasync", rv);
+            rv = RAFT_IOERR;
+            break;
+        }
+    }
+
+    if (segments != NULL) {
+        HeapFree(segments);
+    }
+out:
+    uv->sync_status = rv;
+}
+
+static void uvSyncMaybeStart(struct uv *uv);
+static void uvSyncAfterWorkCb(uv_work_t *work, int status)
+{
+    struct uv *uv = work->data;
+    assert(status == 0);
+
+    uv->sync_work.data = NULL;
+    if (uv->sync_status != 0) {
+        /* Pages that failed to be written back might have been dropped, so
+         * appending more entries can't be trusted anymore. */
+        tracef("background sync: %s", uv->sync_errmsg);
+        uv->errored = true;
+    } else {
+        if (uv->syncing_index > uv->durable_index) {
+            uv->durable_index = uv->syncing_index;
+        }
+        uv->usage.bytes_synced += uv->syncing_bytes;
+    }
+
+    if (uv->closing) {
+        uvMaybeFireCloseCb(uv);
+        return;
+    }
+    if (uv->sync_bytes > 0 && uv->unsynced_bytes >= uv->sync_bytes) {
+        uvSyncMaybeStart(uv);
+    }
+}
+
+/* Start a background sync, unless one is already running or there's nothing
+ * to sync. */
+static void uvSyncMaybeStart(struct uv *uv)
+{
+    int rv;
+
+    if (uv->closing || uv->errored || uv->sync_work.data != NULL ||
+        uv->written_index <= uv->durable_index) {
+        return;
+    }
+
+    uv->syncing_index = uv->written_index;
+    uv->syncing_bytes = uv->unsynced_bytes;
+    uv->unsynced_bytes = 0;
+    uv->sync_status = 0;
+    uv->sync_work.data = uv;
+    rv = uv_queue_work(uv->loop, &uv->sync_work, uvSyncWorkCb,
+                       uvSyncAfterWorkCb);
+    if (rv != 0) {
+        /* Try again at the next round. */
+        tracef("queue background sync: %s", uv_strerror(rv));
+        uv->sync_work.data = NULL;
+    }
+}
+
+static void uvSyncTimerCb(uv_timer_t *timer)
+{
+    struct uv *uv = timer->data;
+    uvSyncMaybeStart(uv);
+}
+
+void UvSyncWritten(struct uv *uv, raft_index index, size_t n)
+{
+    int rv;
+
+    uv->written_index = index;
+    uv->usage.bytes_appended += n;
+    if (!uv->relaxed) {
+        /* Written with O_DSYNC. */
+        uv->durable_index = index;
+        uv->usage.bytes_synced += n;
+        return;
+    }
+
+    if (uv->sync_interval > 0 && uv->sync_timer.data == NULL) {
+        rv = uv_timer_init(uv->loop, &uv->sync_timer);
+        assert(rv == 0); /* This should never fail */
+        uv->sync_timer.data = uv;
+        rv = uv_timer_start(&uv->sync_timer, uvSyncTimerCb, uv->sync_interval,
+                            uv->sync_interval);
+        assert(rv == 0);
+    }
+
+    uv->unsynced_bytes += n;
+    if (uv->sync_bytes > 0 && uv->unsynced_bytes >= uv->sync_bytes) {
+        uvSyncMaybeStart(uv);
+    }
+}
+
+void UvSyncReset(struct uv *uv, raft_index next_index)
+{
+    if (uv->written_index >= next_index) {
+        uv->written_index = next_index - 1;
+    }
+    if (uv->syncing_index >= next_index) {
+        uv->syncing_index = next_index - 1;
+    }
+    if (uv->durable_index >= next_index) {
+        uv->durable_index = next_index - 1;
+    }
+}
+
+static void uvSyncTimerCloseCb(uv_handle_t *handle)
+{
+    struct uv *uv = handle->data;
+    assert(uv->closing);
+    uv->sync_timer.data = NULL;
+    uvMaybeFireCloseCb(uv);
+}
+
+void UvSyncClose(struct uv *uv)
+{
+    assert(uv->closing);
+    if (uv->sync_timer.data != NULL) {
+        uv_close((uv_handle_t *)&uv->sync_timer, uvSyncTimerCloseCb);
+    }
+}
+
+raft_index UvDurableIndex(struct raft_io *io)
+{
+    struct uv *uv = io->impl;
+    return uv->durable_index;
+}
+
+#undef tracef
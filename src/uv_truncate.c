@@ -132,6 +132,10 @@ static void uvTruncateBarrierCb(struct UvBarrier *barrier)
     assert(uv->finalize_work.data == NULL);
     assert(uv->truncate_work.data == NULL);
 
+    /* Truncated segments are rewritten uncompressed and new ones can end below
+     * the compression watermark, so start scanning again from scratch. */
+    uv->compressed_index = 0;
+
     uv->truncate_work.data = truncate;
     rv = uv_queue_work(uv->loop, &uv->truncate_work, uvTruncateWorkCb,
                        uvTruncateAfterWorkCb);
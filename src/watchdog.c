@@ -0,0 +1,126 @@
+#include "watchdog.h"
+
+#include <time.h>
+
+#include "event.h"
+#include "metric.h"
+
+/* CPU time consumed by the calling thread, in nanoseconds. */
+static unsigned long long watchdogCpuNow(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return 0;
+    }
+    return (unsigned long long)ts.tv_sec * 1000000000ULL +
+           (unsigned long long)ts.tv_nsec;
+}
+
+void watchdogInit(struct raft *r)
+{
+    r->watchdog.threshold = 0;
+    r->watchdog.last_tick = 0;
+    r->watchdog.ticked = false;
+    r->watchdog.nr_stalls = 0;
+    r->watchdog.max_duration = 0;
+    r->watchdog.max_tick_lateness = 0;
+    metricInit(&r->watchdog.tick_lateness);
+    r->usage.cpu = false;
+    r->usage.cpu_ns = 0;
+    r->usage.nr_callbacks = 0;
+    r->usage.bytes_appended = 0;
+}
+
+void watchdogEnter(struct raft *r, struct watchdogTimer *timer)
+{
+    timer->on = r->watchdog.threshold != 0;
+    timer->start = timer->on ? r->io->time_us(r->io) : 0;
+    timer->cpu_on = r->usage.cpu;
+    timer->cpu = timer->cpu_on ? watchdogCpuNow() : 0;
+}
+
+void watchdogExit(struct raft *r,
+                  const struct watchdogTimer *timer,
+                  const char *name)
+{
+    unsigned long long cpu;
+    raft_time duration;
+
+    if (timer->cpu_on) {
+        cpu = watchdogCpuNow();
+        if (cpu > timer->cpu) {
+            r->usage.cpu_ns += cpu - timer->cpu;
+        }
+        r->usage.nr_callbacks += 1;
+    }
+    if (!timer->on) {
+        return;
+    }
+    duration = r->io->time_us(r->io) - timer->start;
+    if (duration > r->watchdog.max_duration) {
+        r->watchdog.max_duration = duration;
+    }
+    if (duration < r->watchdog.threshold) {
+        return;
+    }
+    r->watchdog.nr_stalls += 1;
+    evtWarnf("W-1528-319", "raft(%llx) %s callback took %llu", r->id, name,
+             duration);
+}
+
+void watchdogTick(struct raft *r)
+{
+    raft_time now;
+    raft_time lateness = 0;
+
+    if (r->watchdog.threshold == 0) {
+        r->watchdog.ticked = false;
+        return;
+    }
+
+    now = r->io->time(r->io);
+    if (r->watchdog.ticked &&
+        now - r->watchdog.last_tick > r->heartbeat_timeout) {
+        lateness = now - r->watchdog.last_tick - r->heartbeat_timeout;
+    }
+    r->watchdog.last_tick = now;
+    if (!r->watchdog.ticked) {
+        r->watchdog.ticked = true;
+        return;
+    }
+
+    metricSampleLatency(&r->watchdog.tick_lateness, lateness);
+    if (lateness > r->watchdog.max_tick_lateness) {
+        r->watchdog.max_tick_lateness = lateness;
+    }
+    /* A whole tick was missed. */
+    if (lateness >= r->heartbeat_timeout) {
+        evtWarnf("W-1528-320", "raft(%llx) tick late by %llu ms", r->id,
+                 lateness);
+    }
+}
+
+void raft_set_watchdog(struct raft *r, raft_time threshold)
+{
+    r->watchdog.threshold = threshold;
+}
+
+void raft_watchdog_stats(struct raft *r, struct raft_watchdog_stats *stats)
+{
+    stats->nr_stalls = r->watchdog.nr_stalls;
+    stats->max_duration = r->watchdog.max_duration;
+    stats->tick_lateness = r->watchdog.tick_lateness.latency;
+    stats->max_tick_lateness = r->watchdog.max_tick_lateness;
+}
+
+void raft_set_cpu_accounting(struct raft *r, bool enabled)
+{
+    r->usage.cpu = enabled;
+}
+
+void raft_usage(struct raft *r, struct raft_usage *usage)
+{
+    usage->cpu_ns = r->usage.cpu_ns;
+    usage->nr_callbacks = r->usage.nr_callbacks;
+    usage->bytes_appended = r->usage.bytes_appended;
+}
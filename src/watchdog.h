@@ -0,0 +1,33 @@
+/* Watchdog reporting library callbacks that stall the event loop, and
+ * accounting of the CPU time spent in them. */
+
+#ifndef WATCHDOG_H_
+#define WATCHDOG_H_
+
+#include "../include/raft.h"
+
+/* Start time of a watched callback. */
+struct watchdogTimer
+{
+    raft_time start;          /* time_us() when the callback was entered */
+    bool on;                  /* Whether the watchdog was enabled then */
+    unsigned long long cpu;   /* Thread CPU time when it was entered */
+    bool cpu_on;              /* Whether CPU accounting was enabled then */
+};
+
+/* Initialize the watchdog and usage state of a raft instance. */
+void watchdogInit(struct raft *r);
+
+/* Record the entry of a watched callback. */
+void watchdogEnter(struct raft *r, struct watchdogTimer *timer);
+
+/* Record the exit of the callback with the given name, reporting it if it took
+ * longer than the configured threshold. */
+void watchdogExit(struct raft *r,
+                  const struct watchdogTimer *timer,
+                  const char *name);
+
+/* Sample how late the current tick is compared to the tick interval. */
+void watchdogTick(struct raft *r);
+
+#endif /* WATCHDOG_H_ */
@@ -0,0 +1,158 @@
+#include "../lib/cluster.h"
+#include "../lib/runner.h"
+
+/******************************************************************************
+ *
+ * Fixture
+ *
+ *****************************************************************************/
+
+struct fixture
+{
+    FIXTURE_CLUSTER;
+};
+
+static void *setUp(const MunitParameter params[], MUNIT_UNUSED void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SETUP_CLUSTER(3);
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    TEAR_DOWN_CLUSTER;
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+/* The fixture clock has millisecond resolution and its time_us() returns
+ * milliseconds too, so scale it to get round trips in microseconds. */
+static raft_time timeUs(struct raft_io *io)
+{
+    return io->time(io) * 1000;
+}
+
+/* Get the timeouts in use by the I'th server. */
+#define TIMEOUTS(I, OUT) raft_adaptive_timeouts(CLUSTER_RAFT(I), OUT)
+
+/* Make the fixture's io->random() return MSECS on all followers, so that it
+ * stays within the bounds of the timeouts they learn. */
+#define RANDOMIZE(MSECS)                                                     \
+    {                                                                        \
+        unsigned i_;                                                         \
+        for (i_ = 1; i_ < CLUSTER_N; i_++) {                                 \
+            raft_fixture_set_randomized_election_timeout(&f->cluster, i_,    \
+                                                         MSECS);             \
+        }                                                                    \
+    }
+
+/******************************************************************************
+ *
+ * raft_set_adaptive_timeouts
+ *
+ *****************************************************************************/
+
+SUITE(raft_set_adaptive_timeouts)
+
+/* The leader derives its timeouts from the heartbeat round trips, and the
+ * followers adopt them. */
+TEST(raft_set_adaptive_timeouts, derive, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_adaptive_timeouts t;
+    unsigned i;
+    int rv;
+    (void)params;
+
+    CLUSTER_RAFT(0)->io->time_us = timeUs;
+    CLUSTER_SET_NETWORK_LATENCY(0, 20);
+    CLUSTER_SET_NETWORK_LATENCY(1, 20);
+    CLUSTER_SET_NETWORK_LATENCY(2, 20);
+    RANDOMIZE(500);
+
+    /* Let heartbeats stamped with the old clock come back first. */
+    CLUSTER_STEP_UNTIL_ELAPSED(200);
+    rv = raft_set_adaptive_timeouts(CLUSTER_RAFT(0), 150, 5000);
+    munit_assert_int(rv, ==, 0);
+
+    CLUSTER_STEP_UNTIL_ELAPSED(2000);
+    TIMEOUTS(0, &t);
+    munit_assert_int(t.n_samples, >=, 8);
+    munit_assert_int(t.rtt, ==, 40000);
+    munit_assert_int(t.election_timeout, ==, 400);
+    munit_assert_int(t.heartbeat_timeout, ==, 100);
+
+    for (i = 1; i < CLUSTER_N; i++) {
+        TIMEOUTS(i, &t);
+        munit_assert_int(t.election_timeout, ==, 400);
+        munit_assert_int(t.heartbeat_timeout, ==, 100);
+    }
+    return MUNIT_OK;
+}
+
+/* The election timeout doesn't go below the configured minimum. */
+TEST(raft_set_adaptive_timeouts, min, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_adaptive_timeouts t;
+    int rv;
+    (void)params;
+
+    RANDOMIZE(200);
+    rv = raft_set_adaptive_timeouts(CLUSTER_RAFT(0), 150, 5000);
+    munit_assert_int(rv, ==, 0);
+    CLUSTER_STEP_UNTIL_ELAPSED(2000);
+    TIMEOUTS(0, &t);
+    munit_assert_int(t.election_timeout, ==, 150);
+    TIMEOUTS(1, &t);
+    munit_assert_int(t.election_timeout, ==, 150);
+    return MUNIT_OK;
+}
+
+/* Followers go back to their static timeouts once the leader stops adapting
+ * them. */
+TEST(raft_set_adaptive_timeouts, disable, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_adaptive_timeouts t;
+    unsigned election_timeout = CLUSTER_RAFT(1)->election_timeout;
+    (void)params;
+
+    RANDOMIZE(200);
+    raft_set_adaptive_timeouts(CLUSTER_RAFT(0), 150, 5000);
+    CLUSTER_STEP_UNTIL_ELAPSED(2000);
+    TIMEOUTS(1, &t);
+    munit_assert_int(t.election_timeout, ==, 150);
+
+    RANDOMIZE(election_timeout);
+    raft_set_adaptive_timeouts(CLUSTER_RAFT(0), 0, 0);
+    CLUSTER_STEP_UNTIL_ELAPSED(500);
+    TIMEOUTS(1, &t);
+    munit_assert_int(t.election_timeout, ==, election_timeout);
+    return MUNIT_OK;
+}
+
+/* The bounds must be consistent with the heartbeat timeout. */
+TEST(raft_set_adaptive_timeouts, invalid, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    int rv;
+    (void)params;
+
+    rv = raft_set_adaptive_timeouts(CLUSTER_RAFT(0), 500, 200);
+    munit_assert_int(rv, ==, RAFT_INVALID);
+    rv = raft_set_adaptive_timeouts(CLUSTER_RAFT(0),
+                                    CLUSTER_RAFT(0)->heartbeat_timeout, 5000);
+    munit_assert_int(rv, ==, RAFT_INVALID);
+    return MUNIT_OK;
+}
@@ -1,6 +1,8 @@
 #include "../lib/cluster.h"
 #include "../lib/runner.h"
 #include "../lib/munit_mock.h"
+#include "../../src/log.h"
+#include "../../src/byte.h"
 
 /******************************************************************************
  *
@@ -125,6 +127,45 @@ TEST(raft_apply, first, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* An FSM keeping payloads gets the memory of the log entry itself, which stays
+ * valid after a snapshot removes the entry from the log. */
+TEST(raft_apply, holdPayload, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft *r = CLUSTER_RAFT(0);
+    const struct raft_buffer *held;
+    const void *cursor;
+    unsigned i;
+
+    for (i = 0; i < CLUSTER_N; i++) {
+        FsmEnableHold(CLUSTER_FSM(i));
+        raft_set_snapshot_threshold(CLUSTER_RAFT(i), 3);
+        raft_set_snapshot_trailing(CLUSTER_RAFT(i), 0);
+    }
+
+    APPLY(0);
+    held = FsmGetHeld(CLUSTER_FSM(0));
+    munit_assert_ptr_not_null(held);
+    munit_assert_ptr_equal(held->base,
+                           logGet(&r->log, r->last_applied)->buf.base);
+
+    APPLY(0);
+    CLUSTER_STEP_UNTIL_APPLIED(CLUSTER_N, 3, 2000);
+    CLUSTER_STEP_UNTIL_ELAPSED(200);
+    munit_assert_int(logSnapshotIndex(&r->log), ==, 3);
+    munit_assert_int(logNumEntries(&r->log), ==, 0);
+
+    for (i = 0; i < CLUSTER_N; i++) {
+        held = FsmGetHeld(CLUSTER_FSM(i));
+        munit_assert_ptr_not_null(held);
+        cursor = held->base;
+        munit_assert_int(byteGet64(&cursor), ==, 1 /* SET_X */);
+        munit_assert_int(byteGet64(&cursor), ==, 123);
+        FsmReleaseHeld(CLUSTER_FSM(i));
+    }
+    return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * Failure scenarios
@@ -220,4 +261,598 @@ TEST(raft_apply, appendLeaderFail, setUp, tearDown, 0, NULL)
     APPLY_SUBMIT_ERROR(0, RAFT_NOMEM);
     CLUSTER_RAFT(0)->io->append = append;
     return MUNIT_OK;
-}
\ No newline at end of file
+}
+/******************************************************************************
+ *
+ * Apply window
+ *
+ *****************************************************************************/
+
+#define DEFERRED_MAX 16
+
+/* FSM apply implementation that holds requests until explicitly fired. */
+static struct
+{
+    struct raft_fsm_apply *reqs[DEFERRED_MAX];
+    raft_fsm_apply_cb cbs[DEFERRED_MAX];
+    unsigned n;
+} deferred;
+
+static int deferredApply(struct raft_fsm *fsm,
+                         struct raft_fsm_apply *req,
+                         const struct raft_buffer *buf,
+                         raft_fsm_apply_cb cb)
+{
+    (void)fsm;
+    (void)buf;
+    munit_assert_int(deferred.n, <, DEFERRED_MAX);
+    deferred.reqs[deferred.n] = req;
+    deferred.cbs[deferred.n] = cb;
+    deferred.n++;
+    return 0;
+}
+
+/* Complete the oldest deferred apply request. */
+static void deferredFire(void)
+{
+    struct raft_fsm_apply *req = deferred.reqs[0];
+    raft_fsm_apply_cb cb = deferred.cbs[0];
+
+    munit_assert_int(deferred.n, >, 0);
+    deferred.n--;
+    memmove(deferred.reqs, &deferred.reqs[1], deferred.n * sizeof *deferred.reqs);
+    memmove(deferred.cbs, &deferred.cbs[1], deferred.n * sizeof *deferred.cbs);
+    cb(req, NULL, 0);
+}
+
+/* Submit N apply requests to the I'th server. */
+#define APPLY_SUBMIT_N(I, N)                                               \
+    struct raft_apply _reqs[N];                                            \
+    struct result _results[N];                                             \
+    unsigned _i;                                                           \
+    for (_i = 0; _i < N; _i++) {                                           \
+        struct raft_buffer _buf;                                           \
+        int _rv;                                                           \
+        FsmEncodeSetX(123, &_buf);                                         \
+        _results[_i].status = 0;                                           \
+        _results[_i].done = false;                                         \
+        _reqs[_i].data = &_results[_i];                                    \
+        _rv = raft_apply(CLUSTER_RAFT(I), &_reqs[_i], &_buf, 1,            \
+                         applyCbAssertResult);                             \
+        munit_assert_int(_rv, ==, 0);                                      \
+    }
+
+/* At most max_entries entries are handed to the FSM at the same time, the
+ * others are dispatched as in-flight ones complete. */
+TEST(raft_apply, windowEntries, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply_window_setting setting = {2, 0, false, 0};
+    struct raft_apply_window_stats stats;
+    unsigned i;
+
+    deferred.n = 0;
+    CLUSTER_RAFT(0)->fsm->apply = deferredApply;
+    raft_set_apply_window(CLUSTER_RAFT(0), &setting);
+    APPLY_SUBMIT_N(0, 5);
+    CLUSTER_STEP_UNTIL_COMMITTED(0, _reqs[4].index, 2000);
+
+    raft_apply_window_stats(CLUSTER_RAFT(0), &stats);
+    munit_assert_int(stats.nr_applying, ==, 2);
+    munit_assert_int(stats.applying_bytes, ==, 32);
+    munit_assert_int(stats.nr_pending, ==, 3);
+    munit_assert_int(stats.nr_throttled, >, 0);
+    munit_assert_int(deferred.n, ==, 2);
+
+    for (i = 0; i < 5; i++) {
+        munit_assert_int(deferred.n, ==, i < 3 ? 2 : 5 - i);
+        deferredFire();
+        munit_assert_true(_results[i].done);
+    }
+    munit_assert_int(deferred.n, ==, 0);
+    munit_assert_int(CLUSTER_LAST_APPLIED(0), ==, _reqs[4].index);
+
+    raft_apply_window_stats(CLUSTER_RAFT(0), &stats);
+    munit_assert_int(stats.nr_applying, ==, 0);
+    munit_assert_int(stats.applying_bytes, ==, 0);
+    munit_assert_int(stats.nr_pending, ==, 0);
+    return MUNIT_OK;
+}
+
+/* The time committed entries are held back by the window is exported
+ * separately from the time spent in the FSM. */
+TEST(raft_apply, windowQueueLatency, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply_window_setting setting = {1, 0, false, 0};
+    struct raft_apply_window_stats stats;
+
+    deferred.n = 0;
+    CLUSTER_RAFT(0)->fsm->apply = deferredApply;
+    raft_set_apply_window(CLUSTER_RAFT(0), &setting);
+    APPLY_SUBMIT_N(0, 2);
+    CLUSTER_STEP_UNTIL_COMMITTED(0, _reqs[1].index, 2000);
+    munit_assert_int(deferred.n, ==, 1);
+
+    raft_apply_window_stats(CLUSTER_RAFT(0), &stats);
+    munit_assert_int(stats.nr_throttled, >, 0);
+    munit_assert_int(stats.queue_latency, ==, 0);
+
+    /* The second entry waits in the queue until the first one completes. */
+    CLUSTER_STEP_UNTIL_ELAPSED(100);
+    deferredFire();
+    munit_assert_int(deferred.n, ==, 1);
+    raft_apply_window_stats(CLUSTER_RAFT(0), &stats);
+    munit_assert_int(stats.queue_latency, >=, 100);
+
+    /* Once dispatched, its time in the FSM doesn't count as queue time. */
+    CLUSTER_STEP_UNTIL_ELAPSED(300);
+    deferredFire();
+    raft_apply_window_stats(CLUSTER_RAFT(0), &stats);
+    munit_assert_int(stats.queue_latency, <, 300);
+    munit_assert_int(stats.apply_latency, >=, 200);
+    munit_assert_int(CLUSTER_LAST_APPLIED(0), ==, _reqs[1].index);
+    return MUNIT_OK;
+}
+
+/* The byte limit throttles apply as well, but one entry is always allowed in
+ * flight. */
+TEST(raft_apply, windowBytes, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply_window_setting setting = {0, 8, false, 0};
+    unsigned i;
+
+    deferred.n = 0;
+    CLUSTER_RAFT(0)->fsm->apply = deferredApply;
+    raft_set_apply_window(CLUSTER_RAFT(0), &setting);
+    APPLY_SUBMIT_N(0, 3);
+    CLUSTER_STEP_UNTIL_COMMITTED(0, _reqs[2].index, 2000);
+
+    for (i = 0; i < 3; i++) {
+        munit_assert_int(deferred.n, ==, 1);
+        deferredFire();
+    }
+    munit_assert_int(deferred.n, ==, 0);
+    munit_assert_int(CLUSTER_LAST_APPLIED(0), ==, _reqs[2].index);
+    return MUNIT_OK;
+}
+
+/* In adaptive mode the window shrinks when apply latency exceeds the
+ * target. */
+TEST(raft_apply, windowAdaptive, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply_window_setting setting = {4, 0, true, 10};
+    struct raft_apply_window_stats stats;
+    unsigned i;
+
+    deferred.n = 0;
+    CLUSTER_RAFT(0)->fsm->apply = deferredApply;
+    raft_set_apply_window(CLUSTER_RAFT(0), &setting);
+    APPLY_SUBMIT_N(0, 8);
+    CLUSTER_STEP_UNTIL_COMMITTED(0, _reqs[7].index, 2000);
+    munit_assert_int(deferred.n, ==, 4);
+
+    CLUSTER_STEP_UNTIL_ELAPSED(100);
+    for (i = 0; i < 4; i++) {
+        deferredFire();
+    }
+    raft_apply_window_stats(CLUSTER_RAFT(0), &stats);
+    munit_assert_int(stats.window, ==, 2);
+    munit_assert_int(stats.apply_latency, >=, 100);
+
+    /* Entries dispatched before the window shrank are still in flight. */
+    munit_assert_int(deferred.n, ==, 3);
+    deferredFire();
+    munit_assert_int(deferred.n, ==, 2);
+
+    while (deferred.n > 0) {
+        deferredFire();
+    }
+    munit_assert_int(CLUSTER_LAST_APPLIED(0), ==, _reqs[7].index);
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * raft_apply_segments
+ *
+ *****************************************************************************/
+
+/* Encode a SET_X command split into two segments. */
+static void encodeSetXSegments(int value, struct raft_buffer segs[2])
+{
+    struct raft_buffer buf;
+    unsigned i;
+
+    FsmEncodeSetX(value, &buf);
+    for (i = 0; i < 2; i++) {
+        segs[i].len = 8;
+        segs[i].base = raft_malloc(segs[i].len);
+        munit_assert_ptr_not_null(segs[i].base);
+        memcpy(segs[i].base, (char *)buf.base + 8 * i, segs[i].len);
+    }
+    raft_free(buf.base);
+}
+
+/* Submit a SET_X command made of two segments. */
+#define APPLY_SEGMENTS_SUBMIT(I, VALUE)                                  \
+    struct raft_buffer _segs[2];                                         \
+    unsigned _n_segs[1] = {2};                                           \
+    struct raft_apply _req;                                              \
+    struct result _result = {0, false};                                  \
+    int _rv;                                                             \
+    encodeSetXSegments(VALUE, _segs);                                    \
+    _req.data = &_result;                                                \
+    _rv = raft_apply_segments(CLUSTER_RAFT(I), &_req, _segs, _n_segs, 1, \
+                              applyCbAssertResult);                      \
+    munit_assert_int(_rv, ==, 0);
+
+static unsigned segmentsApplied;
+
+/* FSM apply_segments implementation that concatenates the segments and
+ * forwards them to the regular apply method. */
+static int segmentsApply(struct raft_fsm *fsm,
+                         struct raft_fsm_apply *req,
+                         const struct raft_buffer bufs[],
+                         unsigned n,
+                         raft_fsm_apply_cb cb)
+{
+    struct raft_buffer buf;
+    unsigned i;
+    int rv;
+
+    munit_assert_int(n, ==, 2);
+    buf.len = 0;
+    buf.base = munit_malloc(16);
+    for (i = 0; i < n; i++) {
+        memcpy((char *)buf.base + buf.len, bufs[i].base, bufs[i].len);
+        buf.len += bufs[i].len;
+    }
+    rv = fsm->apply(fsm, req, &buf, cb);
+    free(buf.base);
+    segmentsApplied++;
+    return rv;
+}
+
+SUITE(raft_apply_segments)
+
+/* The leader keeps the segments in its log and concatenates them for an FSM
+ * that doesn't implement apply_segments, followers get a regular command. */
+TEST(raft_apply_segments, concatenated, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPLY_SEGMENTS_SUBMIT(0, 456);
+    APPLY_WAIT;
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 456);
+    munit_assert_int(logGet(&CLUSTER_RAFT(0)->log, _req.index)->type, ==,
+                     RAFT_SEGMENTS);
+
+    CLUSTER_STEP_UNTIL_APPLIED(1, _req.index, 2000);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(1)), ==, 456);
+    munit_assert_int(logGet(&CLUSTER_RAFT(1)->log, _req.index)->type, ==,
+                     RAFT_COMMAND);
+    return MUNIT_OK;
+}
+
+/* An FSM implementing apply_segments gets the segments as they are. */
+TEST(raft_apply_segments, fsm, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    segmentsApplied = 0;
+    CLUSTER_RAFT(0)->fsm->version = 2;
+    CLUSTER_RAFT(0)->fsm->apply_segments = segmentsApply;
+    APPLY_SEGMENTS_SUBMIT(0, 789);
+    APPLY_WAIT;
+    munit_assert_int(segmentsApplied, ==, 1);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 789);
+    return MUNIT_OK;
+}
+
+/* If the instance is not the leader, the segments are left to the caller. */
+TEST(raft_apply_segments, notLeader, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_buffer segs[2];
+    unsigned n_segs[1] = {2};
+    struct raft_apply req;
+    int rv;
+
+    encodeSetXSegments(1, segs);
+    rv = raft_apply_segments(CLUSTER_RAFT(1), &req, segs, n_segs, 1, NULL);
+    munit_assert_int(rv, ==, RAFT_NOTLEADER);
+    raft_free(segs[0].base);
+    raft_free(segs[1].base);
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * Command packing
+ *
+ *****************************************************************************/
+
+/* Submit N requests to add 1 to x to the I'th server. */
+#define PACK_SUBMIT_N(I, N)                                                \
+    struct raft_apply _reqs[N];                                            \
+    struct result _results[N];                                             \
+    unsigned _i;                                                           \
+    for (_i = 0; _i < N; _i++) {                                           \
+        struct raft_buffer _buf;                                           \
+        int _rv;                                                           \
+        FsmEncodeAddX(1, &_buf);                                           \
+        _results[_i].status = 0;                                           \
+        _results[_i].done = false;                                         \
+        _reqs[_i].data = &_results[_i];                                    \
+        _rv = raft_apply(CLUSTER_RAFT(I), &_reqs[_i], &_buf, 1,            \
+                         applyCbAssertResult);                             \
+        munit_assert_int(_rv, ==, 0);                                      \
+    }
+
+/* Enable packing on the I'th server. */
+#define PACK_ENABLE(I, MAX_CMDS)                                 \
+    {                                                            \
+        struct raft_pack_setting _setting = {MAX_CMDS, 1024, 64}; \
+        raft_set_pack(CLUSTER_RAFT(I), &_setting);               \
+    }
+
+SUITE(raft_apply_pack)
+
+/* Commands submitted while an entry is being written are packed into a single
+ * entry, and each request gets its own callback. */
+TEST(raft_apply_pack, packed, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    const struct raft_entry *entry;
+    unsigned i;
+
+    PACK_ENABLE(0, 8);
+    PACK_SUBMIT_N(0, 4);
+
+    /* The first command didn't have to wait and got its own entry. */
+    munit_assert_int(_reqs[1].index, ==, 0);
+    CLUSTER_STEP_UNTIL_APPLIED(0, _reqs[0].index + 1, 2000);
+    for (i = 0; i < 4; i++) {
+        munit_assert_true(_results[i].done);
+    }
+    munit_assert_int(CLUSTER_RAFT(0)->pack.nr_packed, ==, 1);
+    munit_assert_int(_reqs[1].index, ==, _reqs[0].index + 1);
+    munit_assert_int(_reqs[3].index, ==, _reqs[1].index);
+    entry = logGet(&CLUSTER_RAFT(0)->log, _reqs[1].index);
+    munit_assert_int(entry->type, ==, RAFT_PACKED);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 4);
+
+    CLUSTER_STEP_UNTIL_APPLIED(1, _reqs[1].index, 2000);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(1)), ==, 4);
+    return MUNIT_OK;
+}
+
+/* A new entry is started when the current one is full. */
+TEST(raft_apply_pack, full, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    PACK_ENABLE(0, 2);
+    PACK_SUBMIT_N(0, 5);
+    munit_assert_int(CLUSTER_RAFT(0)->pack.nr_packed, ==, 1);
+    CLUSTER_STEP_UNTIL_APPLIED(0, _reqs[0].index + 2, 2000);
+    munit_assert_int(CLUSTER_RAFT(0)->pack.nr_packed, ==, 2);
+    munit_assert_int(_reqs[4].index, ==, _reqs[0].index + 2);
+    munit_assert_true(_results[4].done);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 5);
+    return MUNIT_OK;
+}
+
+/* Commands that are too big get their own entry, after the packed ones. */
+TEST(raft_apply_pack, tooBig, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_pack_setting setting = {8, 1024, 8};
+    raft_set_pack(CLUSTER_RAFT(0), &setting);
+    PACK_SUBMIT_N(0, 3);
+    munit_assert_int(_reqs[1].index, ==, _reqs[0].index + 1);
+    munit_assert_int(_reqs[2].index, ==, _reqs[0].index + 2);
+    CLUSTER_STEP_UNTIL_APPLIED(0, _reqs[2].index, 2000);
+    munit_assert_int(CLUSTER_RAFT(0)->pack.nr_packed, ==, 0);
+    return MUNIT_OK;
+}
+
+/* Commands still being packed fail if leadership is lost. */
+TEST(raft_apply_pack, leadershipLost, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    PACK_ENABLE(0, 8);
+    PACK_SUBMIT_N(0, 3);
+    _results[0].status = RAFT_LEADERSHIPLOST;
+    _results[1].status = RAFT_LEADERSHIPLOST;
+    _results[2].status = RAFT_LEADERSHIPLOST;
+    CLUSTER_DEPOSE;
+    munit_assert_true(_results[1].done);
+    munit_assert_true(_results[2].done);
+    return MUNIT_OK;
+}
+
+/* Whether the third server has persisted all the entries of the leader. */
+static bool thirdServerHasCaughtUp(struct raft_fixture *f, void *arg)
+{
+    (void)arg;
+    return logLastIndex(&raft_fixture_get(f, 2)->log) ==
+           logLastIndex(&raft_fixture_get(f, 0)->log);
+}
+
+/* Whether the leader has appended the entry promoting the third server. */
+static bool promotionAppended(struct raft_fixture *f, void *arg)
+{
+    (void)arg;
+    return raft_fixture_get(f, 0)->leader_state.promotee_id == 0;
+}
+
+/* Commands packed while a server catches up are written before the entry that
+ * promotes it. */
+TEST(raft_apply_pack, promotion, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft *r = CLUSTER_RAFT(0);
+    struct raft_change add;
+    struct raft_change assign;
+    const struct raft_entry *entry;
+    raft_index change_index;
+    int rv;
+
+    CLUSTER_ADD(&add);
+    CLUSTER_STEP_UNTIL_APPLIED(0, logLastIndex(&r->log), 2000);
+    rv = raft_assign(r, &assign, CLUSTER_RAFT(2)->id, RAFT_VOTER, NULL);
+    munit_assert_int(rv, ==, 0);
+
+    /* Submit the commands while the result that completes the catch-up is
+     * on its way, keeping the first command's write in flight so the others
+     * are packed. */
+    CLUSTER_STEP_UNTIL(thirdServerHasCaughtUp, NULL, 2000);
+    munit_assert_int(r->leader_state.promotee_id, !=, 0);
+    CLUSTER_SET_DISK_LATENCY(0, 500);
+    PACK_ENABLE(0, 8);
+    PACK_SUBMIT_N(0, 3);
+    munit_assert_int(r->pack.n, ==, 2);
+
+    CLUSTER_STEP_UNTIL(promotionAppended, NULL, 2000);
+    change_index = r->configuration_uncommitted_index;
+    munit_assert_int(_reqs[1].index, ==, _reqs[0].index + 1);
+    munit_assert_int(change_index, ==, _reqs[1].index + 1);
+    entry = logGet(&r->log, _reqs[1].index);
+    munit_assert_int(entry->type, ==, RAFT_PACKED);
+    entry = logGet(&r->log, change_index);
+    munit_assert_int(entry->type, ==, RAFT_CHANGE);
+
+    CLUSTER_STEP_UNTIL_APPLIED(0, change_index, 3000);
+    munit_assert_true(_results[2].done);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 3);
+    return MUNIT_OK;
+}
+
+static int (*fsmApply)(struct raft_fsm *fsm,
+                       struct raft_fsm_apply *req,
+                       const struct raft_buffer *buf,
+                       raft_fsm_apply_cb cb);
+static unsigned failApplyCall;
+static unsigned applyCalls;
+
+/* FSM apply implementation failing the failApplyCall'th call. */
+static int failingApply(struct raft_fsm *fsm,
+                        struct raft_fsm_apply *req,
+                        const struct raft_buffer *buf,
+                        raft_fsm_apply_cb cb)
+{
+    applyCalls++;
+    if (applyCalls == failApplyCall) {
+        cb(req, NULL, RAFT_IOERR);
+        return 0;
+    }
+    return fsmApply(fsm, req, buf, cb);
+}
+
+/* If a packed command fails, the commands before it are not applied again
+ * when the entry is retried, and their requests succeed. */
+TEST(raft_apply_pack, failInTheMiddle, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply reqs[4];
+    struct result results[4] = {{0, false}, {0, false}, {RAFT_IOERR, false},
+                                {RAFT_IOERR, false}};
+    unsigned i;
+
+    fsmApply = CLUSTER_RAFT(0)->fsm->apply;
+    CLUSTER_RAFT(0)->fsm->apply = failingApply;
+    applyCalls = 0;
+    /* The first command gets its own entry, fail the second packed one. */
+    failApplyCall = 3;
+    PACK_ENABLE(0, 8);
+    for (i = 0; i < 4; i++) {
+        struct raft_buffer buf;
+        FsmEncodeAddX(1 << i, &buf);
+        reqs[i].data = &results[i];
+        munit_assert_int(raft_apply(CLUSTER_RAFT(0), &reqs[i], &buf, 1,
+                                    applyCbAssertResult),
+                         ==, 0);
+    }
+    CLUSTER_STEP_UNTIL_APPLIED(0, reqs[0].index + 1, 3000);
+    for (i = 0; i < 4; i++) {
+        munit_assert_true(results[i].done);
+    }
+    munit_assert_int(CLUSTER_RAFT(0)->pack.nr_packed, ==, 1);
+    munit_assert_int(applyCalls, ==, 5);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 15);
+    return MUNIT_OK;
+}
+
+static void *packedResults[8];
+static unsigned packedApplied;
+
+/* FSM apply_packed implementation that returns a distinct result for each
+ * command. */
+static int packedApply(struct raft_fsm *fsm,
+                       struct raft_fsm_apply *req,
+                       struct raft_packed *cmds,
+                       raft_fsm_apply_cb cb)
+{
+    struct raft_buffer cmd;
+    unsigned i = 0;
+
+    (void)fsm;
+    while (raft_packed_next(cmds, &cmd)) {
+        munit_assert_int(cmd.len, ==, 16);
+        packedResults[i] = &packedResults[i];
+        i++;
+    }
+    munit_assert_int(i, ==, cmds->n);
+    packedApplied++;
+    cb(req, packedResults, 0);
+    return 0;
+}
+
+struct packedResult
+{
+    unsigned pos; /* Position of the command in the packed entry */
+    bool done;
+};
+
+static void applyCbAssertPackedResult(struct raft_apply *req,
+                                      int status,
+                                      void *result)
+{
+    struct packedResult *r = req->data;
+    munit_assert_int(status, ==, 0);
+    munit_assert_ptr_equal(result, &packedResults[r->pos]);
+    r->done = true;
+}
+
+/* An FSM implementing apply_packed gets all the commands at once, and the
+ * results are dispatched to each request. */
+TEST(raft_apply_pack, fsm, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply reqs[4];
+    struct packedResult results[4];
+    unsigned i;
+
+    packedApplied = 0;
+    CLUSTER_RAFT(0)->fsm->version = 3;
+    CLUSTER_RAFT(0)->fsm->apply_packed = packedApply;
+    PACK_ENABLE(0, 8);
+    for (i = 0; i < 4; i++) {
+        struct raft_buffer buf;
+        FsmEncodeAddX(1, &buf);
+        /* The first command gets its own entry. */
+        results[i].pos = i == 0 ? 0 : i - 1;
+        results[i].done = false;
+        reqs[i].data = &results[i];
+        munit_assert_int(raft_apply(CLUSTER_RAFT(0), &reqs[i], &buf, 1,
+                                    i == 0 ? NULL : applyCbAssertPackedResult),
+                         ==, 0);
+    }
+    CLUSTER_STEP_UNTIL_APPLIED(0, reqs[0].index + 1, 2000);
+    munit_assert_int(packedApplied, ==, 1);
+    for (i = 1; i < 4; i++) {
+        munit_assert_true(results[i].done);
+    }
+    return MUNIT_OK;
+}
@@ -0,0 +1,338 @@
+#include "../lib/cluster.h"
+#include "../lib/runner.h"
+
+/******************************************************************************
+ *
+ * Fixture
+ *
+ *****************************************************************************/
+
+#define MAX_BATCH 2
+
+/* Subscriber checking that entries are streamed in order. */
+struct consumer
+{
+    struct raft_cdc sub;
+    raft_index next;    /* Index expected in the next batch */
+    unsigned n_batches; /* Number of batches delivered */
+    bool release;       /* Release batches from within the callback */
+    bool holding;       /* Whether a batch is held */
+    bool ended;         /* Whether the subscription has ended */
+    int status;         /* Status the subscription ended with */
+};
+
+struct fixture
+{
+    FIXTURE_CLUSTER;
+    struct consumer consumer;
+};
+
+static void *setUp(const MunitParameter params[], MUNIT_UNUSED void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SETUP_CLUSTER(3);
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+    memset(&f->consumer, 0, sizeof f->consumer);
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    TEAR_DOWN_CLUSTER;
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+static void cdcCb(struct raft_cdc *sub,
+                  raft_index index,
+                  const struct raft_entry entries[],
+                  unsigned n,
+                  int status)
+{
+    struct consumer *c = sub->data;
+    unsigned i;
+
+    if (status != 0) {
+        munit_assert_int(n, ==, 0);
+        c->ended = true;
+        c->status = status;
+        return;
+    }
+
+    munit_assert_false(c->holding);
+    munit_assert_int(index, ==, c->next);
+    munit_assert_int(n, >, 0);
+    munit_assert_int(n, <=, MAX_BATCH);
+    for (i = 0; i < n; i++) {
+        munit_assert_int(entries[i].term, >, 0);
+    }
+    c->next += n;
+    c->n_batches += 1;
+    if (c->release) {
+        raft_cdc_release(sub);
+    } else {
+        c->holding = true;
+    }
+}
+
+static bool cdcHasEnded(struct raft_fixture *f, void *arg)
+{
+    struct consumer *c = arg;
+    (void)f;
+    return c->ended;
+}
+
+/* Subscribe to the stream of the I'th server starting at INDEX. */
+#define SUBSCRIBE(I, INDEX)                                                \
+    {                                                                      \
+        int _rv;                                                           \
+        f->consumer.sub.data = &f->consumer;                               \
+        f->consumer.next = INDEX;                                          \
+        _rv = raft_cdc_subscribe(CLUSTER_RAFT(I), &f->consumer.sub, INDEX, \
+                                 MAX_BATCH, cdcCb);                        \
+        munit_assert_int(_rv, ==, 0);                                      \
+    }
+
+/* Release the batch held by the consumer. */
+#define RELEASE                                 \
+    {                                           \
+        munit_assert_true(f->consumer.holding); \
+        f->consumer.holding = false;            \
+        raft_cdc_release(&f->consumer.sub);     \
+    }
+
+/* Set the snapshot threshold and trailing on all servers of the cluster. */
+#define SET_SNAPSHOT(THRESHOLD, TRAILING)                            \
+    {                                                                \
+        unsigned _i;                                                 \
+        for (_i = 0; _i < CLUSTER_N; _i++) {                         \
+            raft_set_snapshot_threshold(CLUSTER_RAFT(_i), THRESHOLD); \
+            raft_set_snapshot_trailing(CLUSTER_RAFT(_i), TRAILING);   \
+        }                                                            \
+    }
+
+/******************************************************************************
+ *
+ * raft_cdc_subscribe
+ *
+ *****************************************************************************/
+
+SUITE(raft_cdc_subscribe)
+
+/* Committed entries are streamed in order, both on the leader and on a
+ * follower. */
+TEST(raft_cdc_subscribe, stream, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    unsigned i;
+    (void)params;
+
+    f->consumer.release = true;
+    SUBSCRIBE(1, 1);
+    for (i = 0; i < 5; i++) {
+        CLUSTER_MAKE_PROGRESS;
+    }
+    CLUSTER_STEP_UNTIL_APPLIED(1, CLUSTER_LAST_APPLIED(0), 2000);
+    munit_assert_int(f->consumer.next, ==, CLUSTER_RAFT(1)->commit_index + 1);
+    munit_assert_int(f->consumer.n_batches, >=, 4);
+    raft_cdc_unsubscribe(&f->consumer.sub);
+    return MUNIT_OK;
+}
+
+/* Entries committed before subscribing are delivered right away. */
+TEST(raft_cdc_subscribe, backlog, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    (void)params;
+
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    f->consumer.release = true;
+    SUBSCRIBE(0, 2);
+    munit_assert_int(f->consumer.next, ==, CLUSTER_RAFT(0)->commit_index + 1);
+    raft_cdc_unsubscribe(&f->consumer.sub);
+    return MUNIT_OK;
+}
+
+/* No other batch is delivered until the current one is released. */
+TEST(raft_cdc_subscribe, backpressure, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    (void)params;
+
+    SUBSCRIBE(0, 1);
+    munit_assert_int(f->consumer.n_batches, ==, 1);
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    munit_assert_int(f->consumer.n_batches, ==, 1);
+
+    f->consumer.release = true;
+    RELEASE;
+    munit_assert_int(f->consumer.next, ==, CLUSTER_RAFT(0)->commit_index + 1);
+    raft_cdc_unsubscribe(&f->consumer.sub);
+    return MUNIT_OK;
+}
+
+/* Log compaction keeps the entries that a subscriber hasn't consumed yet. */
+TEST(raft_cdc_subscribe, compaction, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_index next;
+    unsigned i;
+    (void)params;
+
+    SET_SNAPSHOT(3, 1);
+    SUBSCRIBE(0, 1);
+    next = f->consumer.next;
+    for (i = 0; i < 6; i++) {
+        CLUSTER_MAKE_PROGRESS;
+    }
+    munit_assert_int(CLUSTER_RAFT(0)->log.snapshot.last_index, >, 0);
+    munit_assert_int(CLUSTER_RAFT(0)->log.offset + 1, <=, next);
+
+    /* Once consumed, entries are removed by the next compaction. */
+    f->consumer.release = true;
+    RELEASE;
+    for (i = 0; i < 4; i++) {
+        CLUSTER_MAKE_PROGRESS;
+    }
+    munit_assert_int(CLUSTER_RAFT(0)->log.offset + 1, >, next);
+    munit_assert_int(f->consumer.next, ==, CLUSTER_RAFT(0)->commit_index + 1);
+    raft_cdc_unsubscribe(&f->consumer.sub);
+    return MUNIT_OK;
+}
+
+/* Compaction doesn't wait for subscribers lagging more than the max lag, which
+ * then read entries from disk. */
+TEST(raft_cdc_subscribe, maxLag, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    unsigned i;
+    (void)params;
+
+    SET_SNAPSHOT(3, 1);
+    raft_set_cdc_max_lag(CLUSTER_RAFT(0), 2);
+    SUBSCRIBE(0, 1);
+    for (i = 0; i < 8; i++) {
+        CLUSTER_MAKE_PROGRESS;
+    }
+    munit_assert_int(CLUSTER_RAFT(0)->log.offset + 1, >, f->consumer.next);
+
+    f->consumer.release = true;
+    RELEASE;
+    CLUSTER_STEP_UNTIL_ELAPSED(100);
+    munit_assert_int(f->consumer.next, ==, CLUSTER_RAFT(0)->commit_index + 1);
+    raft_cdc_unsubscribe(&f->consumer.sub);
+    return MUNIT_OK;
+}
+
+/* The max lag bounds the entries kept for a subscriber, not the ones kept in
+ * addition to the snapshot trailing: compaction keeps the larger of the two. */
+TEST(raft_cdc_subscribe, maxLagTrailing, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft *r = CLUSTER_RAFT(0);
+    unsigned i;
+    (void)params;
+
+    /* The trailing is larger than the max lag, so it wins. */
+    SET_SNAPSHOT(3, 4);
+    raft_set_cdc_max_lag(r, 2);
+    SUBSCRIBE(0, 1);
+    for (i = 0; i < 8; i++) {
+        CLUSTER_MAKE_PROGRESS;
+    }
+    munit_assert_int(r->log.snapshot.last_index, >, 4);
+    munit_assert_int(r->log.snapshot.last_index - r->log.offset, ==, 4);
+
+    /* The max lag is larger than the trailing, so it wins. */
+    raft_set_cdc_max_lag(r, 6);
+    for (i = 0; i < 8; i++) {
+        CLUSTER_MAKE_PROGRESS;
+    }
+    munit_assert_int(r->log.snapshot.last_index - r->log.offset, ==, 6);
+    raft_cdc_unsubscribe(&f->consumer.sub);
+    return MUNIT_OK;
+}
+
+/* Entries removed from memory are read from disk. */
+TEST(raft_cdc_subscribe, disk, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    unsigned i;
+    (void)params;
+
+    SET_SNAPSHOT(3, 1);
+    for (i = 0; i < 6; i++) {
+        CLUSTER_MAKE_PROGRESS;
+    }
+    munit_assert_int(CLUSTER_RAFT(0)->log.offset, >, 1);
+
+    f->consumer.release = true;
+    SUBSCRIBE(0, 1);
+    munit_assert_int(f->consumer.n_batches, ==, 0);
+    CLUSTER_STEP_UNTIL_ELAPSED(100);
+    munit_assert_int(f->consumer.next, ==, CLUSTER_RAFT(0)->commit_index + 1);
+    raft_cdc_unsubscribe(&f->consumer.sub);
+    return MUNIT_OK;
+}
+
+/* The subscription ends if the entries are gone from disk too. */
+TEST(raft_cdc_subscribe, notFound, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    unsigned i;
+    (void)params;
+
+    SET_SNAPSHOT(3, 0);
+    for (i = 0; i < 3; i++) {
+        CLUSTER_MAKE_PROGRESS;
+    }
+    munit_assert_int(CLUSTER_RAFT(0)->log.snapshot.last_index, >, 0);
+
+    SUBSCRIBE(0, 1);
+    CLUSTER_STEP_UNTIL(cdcHasEnded, &f->consumer, 100);
+    munit_assert_int(f->consumer.status, ==, RAFT_NOTFOUND);
+    munit_assert_int(f->consumer.n_batches, ==, 0);
+    return MUNIT_OK;
+}
+
+/* A subscription still holding a batch is canceled when the instance is
+ * closed, which the fixture teardown does. */
+TEST(raft_cdc_subscribe, close, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    (void)params;
+
+    SUBSCRIBE(2, 1);
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_APPLIED(2, CLUSTER_LAST_APPLIED(0), 2000);
+    munit_assert_true(f->consumer.holding);
+    munit_assert_false(f->consumer.ended);
+    return MUNIT_OK;
+}
+
+/* Invalid arguments are rejected. */
+TEST(raft_cdc_subscribe, invalid, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    int rv;
+    (void)params;
+
+    rv = raft_cdc_subscribe(CLUSTER_RAFT(0), &f->consumer.sub, 0, MAX_BATCH,
+                            cdcCb);
+    munit_assert_int(rv, ==, RAFT_INVALID);
+    rv = raft_cdc_subscribe(CLUSTER_RAFT(0), &f->consumer.sub, 1, 0, cdcCb);
+    munit_assert_int(rv, ==, RAFT_INVALID);
+    return MUNIT_OK;
+}
@@ -690,13 +690,13 @@ TEST(etcd_migrate, logReplication, setUp, tearDown, 0, NULL)
 	//check the log data
 	void *base = NULL;
 	for (unsigned a = 1; a < 4; a++) {
-		base = (char *)CLUSTER_RAFT(i)->log.entries[a].buf.base + 8;
+		base = (char *)logGet(&CLUSTER_RAFT(i)->log, a + 1)->buf.base + 8;
 		munit_assert_uint64(a*111, ==, byteGet64((const void **)&base));
 
-		base = (char *)CLUSTER_RAFT(j)->log.entries[a].buf.base + 8;
+		base = (char *)logGet(&CLUSTER_RAFT(j)->log, a + 1)->buf.base + 8;
 		munit_assert_uint64(a*111, ==, byteGet64((const void **)&base));
 
-		base = (char *)CLUSTER_RAFT(k)->log.entries[a].buf.base + 8;
+		base = (char *)logGet(&CLUSTER_RAFT(k)->log, a + 1)->buf.base + 8;
 		munit_assert_uint64(a*111, ==, byteGet64((const void **)&base));
 	}
 
@@ -0,0 +1,186 @@
+#include "../lib/cluster.h"
+#include "../lib/runner.h"
+
+/******************************************************************************
+ *
+ * Fixture
+ *
+ *****************************************************************************/
+
+struct fixture
+{
+    FIXTURE_CLUSTER;
+};
+
+static void *setUp(const MunitParameter params[], MUNIT_UNUSED void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SETUP_CLUSTER(2);
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_APPLIED(1, CLUSTER_LAST_APPLIED(0), 2000);
+    CLUSTER_STEP_UNTIL_ELAPSED(200);
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    TEAR_DOWN_CLUSTER;
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+struct result
+{
+    int status;
+    bool done;
+};
+
+static void readCbAssertResult(struct raft_follower_read *req, int status)
+{
+    struct result *result = req->data;
+    munit_assert_int(status, ==, result->status);
+    result->done = true;
+}
+
+static bool readCbHasFired(struct raft_fixture *f, void *arg)
+{
+    struct result *result = arg;
+    (void)f;
+    return result->done;
+}
+
+/* Submit a follower read request. */
+#define READ_SUBMIT(I, MAX_STALENESS, TIMEOUT)                          \
+    struct raft_follower_read _req;                                     \
+    struct result _result = {0, false};                                 \
+    int _rv;                                                            \
+    _req.data = &_result;                                               \
+    _rv = raft_follower_read(CLUSTER_RAFT(I), &_req, MAX_STALENESS,     \
+                             TIMEOUT, readCbAssertResult);              \
+    munit_assert_int(_rv, ==, 0)
+
+/* Expect the read callback to fire with the given status. */
+#define READ_EXPECT(STATUS) _result.status = STATUS
+
+/* Wait until the read request completes. */
+#define READ_WAIT(MAX_MSECS) \
+    CLUSTER_STEP_UNTIL(readCbHasFired, &_result, MAX_MSECS)
+
+/******************************************************************************
+ *
+ * raft_follower_read_state
+ *
+ *****************************************************************************/
+
+SUITE(raft_follower_read_state)
+
+/* A follower that has applied the leader's commit index reports a bounded
+ * staleness. */
+TEST(raft_follower_read_state, fresh, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_follower_read_state state;
+
+    raft_follower_read_state(CLUSTER_RAFT(1), &state);
+    munit_assert_int(state.applied_index, ==, CLUSTER_LAST_APPLIED(1));
+    munit_assert_int(state.fresh_index, >, 0);
+    munit_assert_int(state.fresh_index, <=, state.applied_index);
+    munit_assert_int(state.fresh_as_of, >, 0);
+    munit_assert_int(state.leader_time, <=, state.fresh_as_of);
+    munit_assert_int(state.staleness, <=, 200);
+    return MUNIT_OK;
+}
+
+/* Staleness grows while the leader can't reach the follower. */
+TEST(raft_follower_read_state, disconnected, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_follower_read_state state;
+
+    CLUSTER_DISCONNECT(0, 1);
+    CLUSTER_STEP_UNTIL_ELAPSED(500);
+    raft_follower_read_state(CLUSTER_RAFT(1), &state);
+    munit_assert_int(state.staleness, >=, 500);
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * raft_follower_read
+ *
+ *****************************************************************************/
+
+SUITE(raft_follower_read)
+
+/* If the bound is already met the callback fires immediately. */
+TEST(raft_follower_read, immediate, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    READ_SUBMIT(1, 1000, 0);
+    munit_assert_true(_result.done);
+    munit_assert_int(_req.index, ==, CLUSTER_LAST_APPLIED(1));
+    return MUNIT_OK;
+}
+
+/* The request waits until a new AppendEntries request makes the follower
+ * fresh enough. */
+TEST(raft_follower_read, wait, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    CLUSTER_DISCONNECT(0, 1);
+    CLUSTER_STEP_UNTIL_ELAPSED(500);
+    READ_SUBMIT(1, 200, 0);
+    munit_assert_false(_result.done);
+    CLUSTER_RECONNECT(0, 1);
+    READ_WAIT(1000);
+    munit_assert_int(_req.index, ==, CLUSTER_LAST_APPLIED(1));
+    return MUNIT_OK;
+}
+
+/* The request fails if the bound is not met within the timeout. */
+TEST(raft_follower_read, timeout, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    CLUSTER_DISCONNECT(0, 1);
+    CLUSTER_STEP_UNTIL_ELAPSED(500);
+    READ_SUBMIT(1, 200, 300);
+    READ_EXPECT(RAFT_BUSY);
+    READ_WAIT(1000);
+    munit_assert_int(CLUSTER_STATE(1), ==, RAFT_FOLLOWER);
+    return MUNIT_OK;
+}
+
+/* The request is canceled when the follower converts to candidate. */
+TEST(raft_follower_read, canceled, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    CLUSTER_DISCONNECT(0, 1);
+    CLUSTER_STEP_UNTIL_ELAPSED(500);
+    READ_SUBMIT(1, 200, 0);
+    READ_EXPECT(RAFT_CANCELED);
+    READ_WAIT(5000);
+    munit_assert_int(CLUSTER_STATE(1), ==, RAFT_CANDIDATE);
+    return MUNIT_OK;
+}
+
+/* Reads can't be served by the leader. */
+TEST(raft_follower_read, notFollower, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_follower_read req;
+    int rv;
+
+    rv = raft_follower_read(CLUSTER_RAFT(0), &req, 1000, 0,
+                            readCbAssertResult);
+    munit_assert_int(rv, ==, RAFT_BADROLE);
+    return MUNIT_OK;
+}
@@ -0,0 +1,208 @@
+#include "../lib/cluster.h"
+#include "../lib/runner.h"
+
+/******************************************************************************
+ *
+ * Fixture
+ *
+ *****************************************************************************/
+
+struct fixture
+{
+    FIXTURE_CLUSTER;
+};
+
+static void *setUp(const MunitParameter params[], MUNIT_UNUSED void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    unsigned i;
+    SETUP_CLUSTER(3);
+    CLUSTER_BOOTSTRAP;
+    for (i = 0; i < CLUSTER_N; i++) {
+        raft_set_forwarding(CLUSTER_RAFT(i), true);
+    }
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    TEAR_DOWN_CLUSTER;
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+struct result
+{
+    int status;
+    raft_index index;
+    bool done;
+};
+
+static void applyCb(struct raft_apply *req, int status, void *result)
+{
+    struct result *r = req->data;
+    munit_assert_ptr_null(result);
+    r->status = status;
+    r->index = req->index;
+    r->done = true;
+}
+
+static bool applyCbHasFired(struct raft_fixture *f, void *arg)
+{
+    struct result *result = arg;
+    (void)f;
+    return result->done;
+}
+
+/* Submit to the I'th server a request to add N to x. */
+#define APPLY_SUBMIT(I, REQ, RESULT, N)                                  \
+    {                                                                    \
+        struct raft_buffer buf_;                                         \
+        int rv_;                                                         \
+        FsmEncodeAddX(N, &buf_);                                         \
+        (REQ)->data = RESULT;                                            \
+        rv_ = raft_apply(CLUSTER_RAFT(I), REQ, &buf_, 1, applyCb);       \
+        munit_assert_int(rv_, ==, 0);                                    \
+    }
+
+/* Wait until an apply request completes. */
+#define APPLY_WAIT(RESULT) CLUSTER_STEP_UNTIL(applyCbHasFired, RESULT, 5000)
+
+/******************************************************************************
+ *
+ * raft_set_forwarding
+ *
+ *****************************************************************************/
+
+SUITE(raft_set_forwarding)
+
+/* A command submitted to a follower is appended by the leader, and the request
+ * completes once the leader applied it. */
+TEST(raft_set_forwarding, follower, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply req;
+    struct result result = {-1, 0, false};
+    (void)params;
+
+    APPLY_SUBMIT(1, &req, &result, 3);
+    APPLY_WAIT(&result);
+    munit_assert_int(result.status, ==, 0);
+    munit_assert_int(result.index, ==, 2);
+    munit_assert_int(CLUSTER_LAST_APPLIED(0), >=, 2);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 3);
+
+    CLUSTER_STEP_UNTIL_APPLIED(1, 2, 2000);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(1)), ==, 3);
+    return MUNIT_OK;
+}
+
+/* Commands submitted while a batch is being sent go together in the next
+ * batch, and each request gets the index of its own command. */
+TEST(raft_set_forwarding, batch, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply reqs[3];
+    struct result results[3] = {{-1, 0, false}, {-1, 0, false}, {-1, 0, false}};
+    unsigned i;
+    (void)params;
+
+    for (i = 0; i < 3; i++) {
+        APPLY_SUBMIT(1, &reqs[i], &results[i], 1);
+    }
+    APPLY_WAIT(&results[2]);
+    munit_assert_int(CLUSTER_N_SEND(1, RAFT_IO_FORWARD), ==, 2);
+    for (i = 0; i < 3; i++) {
+        munit_assert_true(results[i].done);
+        munit_assert_int(results[i].status, ==, 0);
+        munit_assert_int(results[i].index, ==, 2 + i);
+    }
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 3);
+    return MUNIT_OK;
+}
+
+/* Forwarding is off by default. */
+TEST(raft_set_forwarding, disabled, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_buffer buf;
+    struct raft_apply req;
+    int rv;
+    (void)params;
+
+    raft_set_forwarding(CLUSTER_RAFT(1), false);
+    FsmEncodeAddX(1, &buf);
+    rv = raft_apply(CLUSTER_RAFT(1), &req, &buf, 1, applyCb);
+    munit_assert_int(rv, ==, RAFT_NOTLEADER);
+    raft_free(buf.base);
+    return MUNIT_OK;
+}
+
+/* If no result arrives, the request fails after twice the election
+ * timeout. */
+TEST(raft_set_forwarding, timeout, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply req;
+    struct result result = {-1, 0, false};
+    (void)params;
+
+    APPLY_SUBMIT(1, &req, &result, 1);
+    CLUSTER_SATURATE_BOTHWAYS(0, 1);
+    APPLY_WAIT(&result);
+    munit_assert_int(result.status, ==, RAFT_NOCONNECTION);
+    munit_assert_int(result.index, ==, 0);
+    return MUNIT_OK;
+}
+
+/* If the batch can't be sent, raft_apply() fails and the callback doesn't
+ * fire. */
+TEST(raft_set_forwarding, sendFails, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_buffer buf;
+    struct raft_apply req;
+    struct result result = {-1, 0, false};
+    int rv;
+    (void)params;
+
+    CLUSTER_IO_FAULT_LOCATIONS(1, RAFT_IOFAULT_SEND);
+    CLUSTER_IO_FAULT(1, 0, 1);
+    FsmEncodeAddX(1, &buf);
+    req.data = &result;
+    rv = raft_apply(CLUSTER_RAFT(1), &req, &buf, 1, applyCb);
+    munit_assert_int(rv, ==, RAFT_NOCONNECTION);
+    munit_assert_false(result.done);
+    raft_free(buf.base);
+
+    APPLY_SUBMIT(1, &req, &result, 2);
+    APPLY_WAIT(&result);
+    munit_assert_int(result.status, ==, 0);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 2);
+    return MUNIT_OK;
+}
+
+/* A batch sent in an older term is rejected. */
+TEST(raft_set_forwarding, staleTerm, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply req;
+    struct result result = {-1, 0, false};
+    (void)params;
+
+    APPLY_SUBMIT(1, &req, &result, 1);
+    CLUSTER_RAFT(0)->current_term += 1;
+    APPLY_WAIT(&result);
+    munit_assert_int(result.status, ==, RAFT_NOTLEADER);
+    munit_assert_int(CLUSTER_N_RECV(0, RAFT_IO_FORWARD), ==, 1);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 0);
+    return MUNIT_OK;
+}
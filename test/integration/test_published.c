@@ -0,0 +1,119 @@
+#include "../lib/cluster.h"
+#include "../lib/runner.h"
+
+/******************************************************************************
+ *
+ * Fixture
+ *
+ *****************************************************************************/
+
+struct fixture
+{
+    FIXTURE_CLUSTER;
+};
+
+static void *setUp(const MunitParameter params[], MUNIT_UNUSED void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SETUP_CLUSTER(3);
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    TEAR_DOWN_CLUSTER;
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+/* Get the published state of the I'th server. */
+#define PUBLISHED(I, P) raft_published(CLUSTER_RAFT(I), P)
+
+/* Assert that the published state of the I'th server matches its current
+ * state. */
+#define ASSERT_PUBLISHED(I)                                             \
+    {                                                                   \
+        struct raft *r_ = CLUSTER_RAFT(I);                              \
+        struct raft_published p_;                                       \
+        PUBLISHED(I, &p_);                                              \
+        munit_assert_int(p_.state, ==, raft_state(r_));                 \
+        munit_assert_int(p_.term, ==, r_->current_term);                \
+        munit_assert_int(p_.commit_index, ==, r_->commit_index);        \
+        munit_assert_int(p_.last_applied, ==, r_->last_applied);        \
+        munit_assert_int(p_.last_stored, ==, r_->last_stored);          \
+    }
+
+/******************************************************************************
+ *
+ * raft_published
+ *
+ *****************************************************************************/
+
+SUITE(raft_published)
+
+/* The leader publishes itself as leader, along with the match index of every
+ * server. */
+TEST(raft_published, leader, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_published p;
+    unsigned i;
+    (void)params;
+
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_APPLIED(CLUSTER_N, 2, 2000);
+    ASSERT_PUBLISHED(0);
+    PUBLISHED(0, &p);
+    munit_assert_int(p.state, ==, RAFT_LEADER);
+    munit_assert_int(p.leader_id, ==, 1);
+    munit_assert_int(p.commit_index, ==, 2);
+    munit_assert_int(p.n_peers, ==, 3);
+    for (i = 0; i < p.n_peers; i++) {
+        munit_assert_int(p.peers[i].id, ==, i + 1);
+        munit_assert_int(p.peers[i].match_index, ==,
+                         CLUSTER_RAFT(0)->leader_state.progress[i].match_index);
+    }
+    return MUNIT_OK;
+}
+
+/* Followers publish the known leader and their own indexes, but no peers. */
+TEST(raft_published, follower, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_published p;
+    (void)params;
+
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_APPLIED(CLUSTER_N, 2, 2000);
+    ASSERT_PUBLISHED(1);
+    PUBLISHED(1, &p);
+    munit_assert_int(p.state, ==, RAFT_FOLLOWER);
+    munit_assert_int(p.leader_id, ==, 1);
+    munit_assert_int(p.last_applied, ==, 2);
+    munit_assert_int(p.n_peers, ==, 0);
+    return MUNIT_OK;
+}
+
+/* A deposed leader publishes its new state right away. */
+TEST(raft_published, depose, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_published p;
+    (void)params;
+
+    CLUSTER_DEPOSE;
+    ASSERT_PUBLISHED(0);
+    PUBLISHED(0, &p);
+    munit_assert_int(p.state, !=, RAFT_LEADER);
+    munit_assert_int(p.n_peers, ==, 0);
+    return MUNIT_OK;
+}
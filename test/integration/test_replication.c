@@ -1,5 +1,6 @@
 #include "../lib/cluster.h"
 #include "../lib/runner.h"
+#include "../../src/replication.h"
 
 /******************************************************************************
  *
@@ -293,6 +294,32 @@ TEST(replication, sendPipeline, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* Followers in pipeline mode at the same next index are sent the same entries
+ * payload, which is released once all the sends have completed. */
+TEST(replication, sendSharedPayload, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct appendEntriesPayload *payload;
+    struct raft_apply req;
+    CLUSTER_GROW;
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_APPLIED(CLUSTER_N, 2, 1000);
+
+    CLUSTER_APPLY_ADD_X(0, &req, 1, NULL);
+    payload = CLUSTER_RAFT(0)->append_payload;
+    munit_assert_ptr_not_null(payload);
+    munit_assert_int(payload->index, ==, 3);
+    munit_assert_uint(payload->n, ==, 1);
+    munit_assert_uint(payload->refs, ==, 2);
+
+    CLUSTER_STEP_UNTIL_APPLIED(CLUSTER_N, 3, 1000);
+    munit_assert_ptr_null(CLUSTER_RAFT(0)->append_payload);
+    return MUNIT_OK;
+}
+
 /* A follower disconnects while in probe mode. */
 TEST(replication, sendDisconnect, setUp, tearDown, 0, NULL)
 {
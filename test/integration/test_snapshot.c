@@ -1,6 +1,7 @@
 #include "../lib/cluster.h"
 #include "../lib/runner.h"
 #include "../lib/munit_mock.h"
+#include "../../src/log.h"
 #include "../../src/snapshot.h"
 #include "../../include/raft.h"
 
@@ -839,6 +840,7 @@ TEST(snapshot, trailingMockIncrRefs, setUp, tearDown, 0, NULL)
     struct fixture *f = data;
     (void)params;
     struct raft *leader = CLUSTER_RAFT(0);
+    raft_term term;
     return MUNIT_SKIP;
     /* Set very low threshold and trailing entries number */
     SET_SNAPSHOT_THRESHOLD(3);
@@ -850,11 +852,12 @@ TEST(snapshot, trailingMockIncrRefs, setUp, tearDown, 0, NULL)
 
     /* Apply a few of entries, to force a snapshot to be taken. */
     CLUSTER_MAKE_PROGRESS;
-    refsIncrTest(&leader->log, leader->log.entries[1].term, 2);
+    term = logTermOf(&leader->log, 2);
+    refsIncrTest(&leader->log, term, 2);
     CLUSTER_MAKE_PROGRESS;
     CLUSTER_MAKE_PROGRESS;
     CLUSTER_MAKE_PROGRESS;
-    refsDecrTest(&leader->log, leader->log.entries[1].term, 2);
+    refsDecrTest(&leader->log, term, 2);
     CLUSTER_MAKE_PROGRESS;
     //leader take snapshot at 3，因为index 2的日志还在被引用，所以只释放了index 1,3
     //leader take snapshot at 6，从index 2处开始释放，最终释放了index 2,4,5,6
@@ -872,4 +875,141 @@ TEST(snapshot, trailingMockIncrRefs, setUp, tearDown, 0, NULL)
     CLUSTER_STEP_UNTIL_APPLIED(2, 9, 2000);
 
     return MUNIT_OK;
-}
\ No newline at end of file
+}
+static void *setUp5(const MunitParameter params[],
+                    MUNIT_UNUSED void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SETUP_CLUSTER(5);
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+    return f;
+}
+
+static unsigned snapshotGetCount;
+static int (*snapshotGetOrig)(struct raft_io *io,
+                              struct raft_io_snapshot_get *req,
+                              raft_io_snapshot_get_cb cb);
+
+static int countSnapshotGet(struct raft_io *io,
+                            struct raft_io_snapshot_get *req,
+                            raft_io_snapshot_get_cb cb)
+{
+    snapshotGetCount++;
+    return snapshotGetOrig(io, req, cb);
+}
+
+static bool snapshotCacheInUse(struct raft_fixture *f, void *arg)
+{
+    (void)arg;
+    return raft_fixture_get(f, 0)->snapshot.cache != NULL;
+}
+
+/* Followers that need the same snapshot at the same time share a single copy
+ * of it, which is released once all the sends are done. */
+TEST(snapshot, installSharedCopy, setUp5, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    (void)params;
+
+    SET_SNAPSHOT_THRESHOLD(3);
+    SET_SNAPSHOT_TRAILING(1);
+    CLUSTER_SATURATE_BOTHWAYS(0, 3);
+    CLUSTER_SATURATE_BOTHWAYS(0, 4);
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+
+    snapshotGetCount = 0;
+    snapshotGetOrig = CLUSTER_RAFT(0)->io->snapshot_get;
+    CLUSTER_RAFT(0)->io->snapshot_get = countSnapshotGet;
+
+    CLUSTER_DESATURATE_BOTHWAYS(0, 3);
+    CLUSTER_DESATURATE_BOTHWAYS(0, 4);
+    CLUSTER_STEP_UNTIL(snapshotCacheInUse, NULL, 1000);
+    CLUSTER_STEP_UNTIL_APPLIED(3, 4, 5000);
+    CLUSTER_STEP_UNTIL_APPLIED(4, 4, 5000);
+
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_INSTALL_SNAPSHOT), ==, 2);
+    munit_assert_uint(snapshotGetCount, ==, 1);
+    CLUSTER_STEP_UNTIL_ELAPSED(100);
+    munit_assert_ptr_null(CLUSTER_RAFT(0)->snapshot.cache);
+
+    CLUSTER_RAFT(0)->io->snapshot_get = snapshotGetOrig;
+    return MUNIT_OK;
+}
+
+/* Switch all servers to file-based snapshots sent in chunks of the given
+ * size. */
+#define ENABLE_FILE_SNAPSHOTS(CHUNK_SIZE)                                  \
+    {                                                                      \
+        unsigned i;                                                        \
+        for (i = 0; i < CLUSTER_N; i++) {                                  \
+            FsmEnableFiles(CLUSTER_FSM(i));                                \
+            raft_set_snapshot_chunk_size(CLUSTER_RAFT(i), CHUNK_SIZE);     \
+        }                                                                  \
+    }
+
+/* Install a file-based snapshot on a follower that has fallen behind. */
+TEST(snapshot, installFiles, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    (void)params;
+
+    ENABLE_FILE_SNAPSHOTS(3);
+    SET_SNAPSHOT_THRESHOLD(3);
+    SET_SNAPSHOT_TRAILING(1);
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+
+    CLUSTER_DESATURATE_BOTHWAYS(0, 2);
+    CLUSTER_STEP_UNTIL_APPLIED(2, 4, 5000);
+
+    /* An empty chunk asking where to start, then two 8-byte files in chunks
+     * of 3 bytes. */
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_INSTALL_SNAPSHOT), ==, 0);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_INSTALL_SNAPSHOT_CHUNK), ==, 7);
+    munit_assert_int(CLUSTER_N_RECV(2, RAFT_IO_INSTALL_SNAPSHOT_CHUNK), ==, 7);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(2)), ==, FsmGetX(CLUSTER_FSM(0)));
+    return MUNIT_OK;
+}
+
+/* A file-based snapshot transfer that gets interrupted resumes from the last
+ * chunk the follower received. */
+TEST(snapshot, installFilesResume, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft *follower = CLUSTER_RAFT(2);
+    (void)params;
+
+    ENABLE_FILE_SNAPSHOTS(3);
+    SET_SNAPSHOT_THRESHOLD(3);
+    SET_SNAPSHOT_TRAILING(1);
+    SET_SNAPSHOT_TIMEOUT(200);
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+
+    /* Cut the follower off after it got the first file. */
+    CLUSTER_DESATURATE_BOTHWAYS(0, 2);
+    while (follower->snapshot.recv.file < 1) {
+        CLUSTER_STEP;
+    }
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+    CLUSTER_STEP_UNTIL_ELAPSED(300);
+    munit_assert_int(follower->snapshot.recv.file, ==, 1);
+
+    CLUSTER_DESATURATE_BOTHWAYS(0, 2);
+    CLUSTER_STEP_UNTIL_APPLIED(2, 4, 5000);
+
+    /* The first file was not sent again. */
+    munit_assert_int(CLUSTER_N_RECV(2, RAFT_IO_INSTALL_SNAPSHOT_CHUNK), <, 11);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(2)), ==, FsmGetX(CLUSTER_FSM(0)));
+    return MUNIT_OK;
+}
@@ -182,6 +182,55 @@ TEST(append, finalizeSegment, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* Several filled segments are finalized together, and the finalize queue drains
+ * once they have all been renamed. */
+TEST(append, finalizeSeveralSegments, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND(MAX_SEGMENT_BLOCKS, SEGMENT_BLOCK_SIZE);
+    APPEND(MAX_SEGMENT_BLOCKS, SEGMENT_BLOCK_SIZE);
+    APPEND(1, 64);
+    while (raft_uv_finalize_queue_len(&f->io) > 0) {
+        LOOP_RUN(1);
+    }
+    munit_assert_true(
+        DirHasFile(f->dir, "0000000000000001-0000000000000004"));
+    munit_assert_true(
+        DirHasFile(f->dir, "0000000000000005-0000000000000008"));
+    munit_assert_false(DirHasFile(f->dir, "open-1"));
+    munit_assert_false(DirHasFile(f->dir, "open-2"));
+    return MUNIT_OK;
+}
+
+/* With segment compression on, finalized segments are rewritten as LZ4 frames
+ * and loaded back transparently. */
+TEST(append, compressSegments, setUp, tearDownDeps, 0, NULL)
+{
+    struct fixture *f = data;
+    uint8_t magic[4];
+    int rv;
+    rv = raft_uv_set_segment_compression(&f->io, true, 0);
+    if (rv == RAFT_INVALID) {
+        return MUNIT_SKIP;
+    }
+    munit_assert_int(rv, ==, 0);
+    APPEND(MAX_SEGMENT_BLOCKS, SEGMENT_BLOCK_SIZE);
+    APPEND(MAX_SEGMENT_BLOCKS, SEGMENT_BLOCK_SIZE);
+    APPEND(1, 64);
+    while (raft_uv_finalize_queue_len(&f->io) > 0) {
+        LOOP_RUN(1);
+    }
+    DirReadFile(f->dir, "0000000000000001-0000000000000004", magic,
+                sizeof magic);
+    munit_assert_int(magic[0], ==, 0x04);
+    munit_assert_int(magic[1], ==, 0x22);
+    munit_assert_int(magic[2], ==, 0x4D);
+    munit_assert_int(magic[3], ==, 0x18);
+    ASSERT_ENTRIES(2 * MAX_SEGMENT_BLOCKS + 1,
+                   2 * MAX_SEGMENT_BLOCKS * SEGMENT_BLOCK_SIZE + 64);
+    return MUNIT_OK;
+}
+
 /* The very first batch of entries to append is bigger than the regular open
  * segment size. */
 TEST(append, firstBig, setUp, tearDownDeps, 0, NULL)
@@ -682,3 +731,55 @@ TEST(append, barrierNoOpenSegments, setUp, tearDown, 0, NULL)
     APPEND_WAIT(2);
     return MUNIT_OK;
 }
+
+/* In durable mode, entries are durable as soon as the append completes. */
+TEST(append, durableIndex, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND(2, 64);
+    munit_assert_int(f->io.durable_index(&f->io), ==, 2);
+    return MUNIT_OK;
+}
+
+/* Written bytes are accounted, and synced as well in durable mode. */
+TEST(append, usage, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_uv_usage usage;
+    APPEND(2, 64);
+    raft_uv_usage(&f->io, &usage);
+    munit_assert_int(usage.bytes_appended, >=, 2 * 64);
+    munit_assert_int(usage.bytes_synced, ==, usage.bytes_appended);
+    return MUNIT_OK;
+}
+
+/* In relaxed mode, the durable index catches up once the background sync
+ * completes. */
+TEST(append, relaxed, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct uv *uv = f->io.impl;
+    bool durable = false;
+    int rv;
+    rv = raft_uv_set_durability(&f->io, RAFT_UV_RELAXED, 1, 0);
+    munit_assert_int(rv, ==, 0);
+    APPEND(2, 64);
+    while (!durable) {
+        LOOP_RUN(1);
+        durable = f->io.durable_index(&f->io) == 2;
+    }
+    munit_assert_false(uv->errored);
+    return MUNIT_OK;
+}
+
+/* Unknown modes and relaxed mode without any sync trigger are rejected. */
+TEST(append, relaxedInvalid, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    int rv;
+    rv = raft_uv_set_durability(&f->io, 2, 1, 0);
+    munit_assert_int(rv, ==, RAFT_INVALID);
+    rv = raft_uv_set_durability(&f->io, RAFT_UV_RELAXED, 0, 0);
+    munit_assert_int(rv, ==, RAFT_INVALID);
+    return MUNIT_OK;
+}
@@ -249,3 +249,61 @@ TEST(init, metadataOneAndTwoSameVersion, setUp, tearDown, 0, NULL)
                "metadata1 and metadata2 are both at version 2");
     return MUNIT_OK;
 }
+
+/* Metadata files are read from the configured metadata directory. */
+TEST(init, metadataDir, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    char *dir = f->dir;
+    char *metadata_dir = DirSetUp(params, NULL);
+    int rv;
+    f->dir = metadata_dir;
+    WRITE_METADATA_FILE(1, /* Metadata file index                  */
+                        1, /* Format                               */
+                        0, /* Version                              */
+                        1, /* Term                                 */
+                        0 /* Voted for                            */);
+    f->dir = dir;
+    rv = raft_uv_init(&f->io, &f->loop, f->dir, &f->transport);
+    munit_assert_int(rv, ==, 0);
+    rv = raft_uv_set_dirs(&f->io, NULL, metadata_dir);
+    munit_assert_int(rv, ==, 0);
+    rv = f->io.init(&f->io, 1, "1");
+    munit_assert_int(rv, ==, RAFT_CORRUPT);
+    munit_assert_string_equal(
+        f->io.errmsg, "decode content of metadata1: version is set to zero");
+    CLOSE;
+    DirTearDown(metadata_dir);
+    return MUNIT_OK;
+}
+
+/* The configured snapshot directory does not exist. */
+TEST(init, snapshotDirDoesNotExist, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    int rv;
+    rv = raft_uv_init(&f->io, &f->loop, f->dir, &f->transport);
+    munit_assert_int(rv, ==, 0);
+    rv = raft_uv_set_dirs(&f->io, "/foo/bar/egg/baz", NULL);
+    munit_assert_int(rv, ==, 0);
+    rv = f->io.init(&f->io, 1, "1");
+    munit_assert_int(rv, ==, RAFT_NOTFOUND);
+    munit_assert_string_equal(f->io.errmsg,
+                              "directory '/foo/bar/egg/baz' does not exist");
+    CLOSE;
+    return MUNIT_OK;
+}
+
+/* The configured directories are too long. */
+TEST(init, setDirsTooLong, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    int rv;
+    rv = raft_uv_init(&f->io, &f->loop, f->dir, &f->transport);
+    munit_assert_int(rv, ==, 0);
+    rv = raft_uv_set_dirs(&f->io, LONG_DIR, NULL);
+    munit_assert_int(rv, ==, RAFT_NAMETOOLONG);
+    munit_assert_string_equal(f->io.errmsg, "directory path too long");
+    raft_uv_close(&f->io);
+    return MUNIT_OK;
+}
@@ -1111,3 +1111,24 @@ TEST(load, openSegmentWithBadFormat, setUp, tearDown, 0, NULL)
                "load open segment open-1: unexpected format version 2");
     return MUNIT_OK;
 }
+
+/* The time spent in each stage of the load is recorded. */
+TEST(load, stats, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_uv_load_stats stats;
+    APPEND(2, 1);
+    LOAD(0,    /* term */
+         0,    /* voted for */
+         NULL, /* snapshot */
+         1,    /* start index */
+         1,    /* data for first loaded entry */
+         2     /* n entries */
+    );
+    raft_uv_load_stats(&f->io, &stats);
+    munit_assert_int(stats.n_segments, ==, 1);
+    munit_assert_int(stats.bytes_read, >, 0);
+    munit_assert_int(stats.snapshot, ==, 0);
+    munit_assert_true(stats.total >= stats.list + stats.read);
+    return MUNIT_OK;
+}
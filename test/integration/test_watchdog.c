@@ -0,0 +1,157 @@
+#include "../lib/cluster.h"
+#include "../lib/runner.h"
+
+/******************************************************************************
+ *
+ * Fixture
+ *
+ *****************************************************************************/
+
+struct fixture
+{
+    FIXTURE_CLUSTER;
+};
+
+static void *setUp(const MunitParameter params[], MUNIT_UNUSED void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SETUP_CLUSTER(3);
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    TEAR_DOWN_CLUSTER;
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+/* Clock advancing by 10 at each reading, so every callback looks slow. */
+static raft_time slowTimeUs(struct raft_io *io)
+{
+    static raft_time now = 0;
+    (void)io;
+    now += 10;
+    return now;
+}
+
+/* Get the watchdog stats of the I'th server. */
+#define STATS(I, STATS) raft_watchdog_stats(CLUSTER_RAFT(I), STATS)
+
+/******************************************************************************
+ *
+ * raft_set_watchdog
+ *
+ *****************************************************************************/
+
+SUITE(raft_set_watchdog)
+
+/* Nothing is measured when the watchdog is disabled, which is the default. */
+TEST(raft_set_watchdog, disabled, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_watchdog_stats stats;
+    (void)params;
+
+    CLUSTER_RAFT(0)->io->time_us = slowTimeUs;
+    CLUSTER_MAKE_PROGRESS;
+    STATS(0, &stats);
+    munit_assert_int(stats.nr_stalls, ==, 0);
+    munit_assert_int(stats.max_duration, ==, 0);
+    munit_assert_int(stats.max_tick_lateness, ==, 0);
+    return MUNIT_OK;
+}
+
+/* Callbacks taking longer than the threshold are counted. */
+TEST(raft_set_watchdog, stall, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_watchdog_stats stats;
+    (void)params;
+
+    raft_set_watchdog(CLUSTER_RAFT(0), 10);
+    CLUSTER_MAKE_PROGRESS;
+    STATS(0, &stats);
+    munit_assert_int(stats.nr_stalls, ==, 0);
+
+    CLUSTER_RAFT(0)->io->time_us = slowTimeUs;
+    CLUSTER_MAKE_PROGRESS;
+    STATS(0, &stats);
+    munit_assert_int(stats.nr_stalls, >, 0);
+    munit_assert_int(stats.max_duration, >=, 10);
+    return MUNIT_OK;
+}
+
+/* Ticks firing on schedule are not late. */
+TEST(raft_set_watchdog, tickOnTime, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_watchdog_stats stats;
+    (void)params;
+
+    raft_set_watchdog(CLUSTER_RAFT(0), 10);
+    CLUSTER_STEP_UNTIL_ELAPSED(1000);
+    STATS(0, &stats);
+    munit_assert_int(stats.tick_lateness, ==, 0);
+    munit_assert_int(stats.max_tick_lateness, ==, 0);
+    return MUNIT_OK;
+}
+
+/* Ticks firing less often than the heartbeat timeout are late. */
+TEST(raft_set_watchdog, tickLate, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_watchdog_stats stats;
+    unsigned timeout = CLUSTER_RAFT(1)->heartbeat_timeout;
+    (void)params;
+
+    raft_set_watchdog(CLUSTER_RAFT(1), 10);
+    raft_set_heartbeat_timeout(CLUSTER_RAFT(1), timeout / 2);
+    CLUSTER_STEP_UNTIL_ELAPSED(1000);
+    STATS(1, &stats);
+    munit_assert_int(stats.tick_lateness, ==, timeout - timeout / 2);
+    munit_assert_int(stats.max_tick_lateness, ==, timeout - timeout / 2);
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * raft_usage
+ *
+ *****************************************************************************/
+
+SUITE(raft_usage)
+
+/* Entry bytes written to disk are always accounted, CPU time only when
+ * enabled. */
+TEST(raft_usage, account, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_usage before;
+    struct raft_usage usage;
+    (void)params;
+
+    raft_usage(CLUSTER_RAFT(1), &before);
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_APPLIED(1, CLUSTER_LAST_APPLIED(0), 2000);
+    raft_usage(CLUSTER_RAFT(1), &usage);
+    munit_assert_int(usage.bytes_appended, >, before.bytes_appended);
+    munit_assert_int(usage.nr_callbacks, ==, 0);
+    munit_assert_int(usage.cpu_ns, ==, 0);
+
+    raft_set_cpu_accounting(CLUSTER_RAFT(1), true);
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_APPLIED(1, CLUSTER_LAST_APPLIED(0), 2000);
+    raft_usage(CLUSTER_RAFT(1), &usage);
+    munit_assert_int(usage.nr_callbacks, >, 0);
+    return MUNIT_OK;
+}
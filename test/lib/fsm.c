@@ -1,5 +1,11 @@
 #include "fsm.h"
 
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "../../src/byte.h"
 #include "munit.h"
 
@@ -8,6 +14,7 @@ struct fsm
 {
     int x;
     int y;
+    struct raft_payload *held; /* Last payload kept by apply_hold */
 };
 
 /* Command codes */
@@ -110,12 +117,153 @@ void FsmInit(struct raft_fsm *fsm)
 
     f->x = 0;
     f->y = 0;
+    f->held = NULL;
 
     fsm->version = 1;
     fsm->data = f;
     fsm->apply = fsmApply;
     fsm->snapshot = fsmSnapshot;
     fsm->restore = fsmRestore;
+    fsm->apply_segments = NULL;
+    fsm->apply_packed = NULL;
+    fsm->checkpoint = NULL;
+    fsm->restore_dir = NULL;
+    fsm->apply_hold = NULL;
+}
+
+/* Write the given value to the file with the given name in @dir. */
+static int fsmWriteFile(const char *dir, const char *name, int value)
+{
+    char path[1024];
+    uint8_t buf[sizeof(uint64_t)];
+    void *cursor = buf;
+    ssize_t n;
+    int fd;
+
+    bytePut64(&cursor, value);
+    snprintf(path, sizeof path, "%s/%s", dir, name);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return RAFT_IOERR;
+    }
+    n = write(fd, buf, sizeof buf);
+    close(fd);
+    return n == sizeof buf ? 0 : RAFT_IOERR;
+}
+
+/* Read the value in the file with the given name in @dir. */
+static int fsmReadFile(const char *dir, const char *name, int *value)
+{
+    char path[1024];
+    uint8_t buf[sizeof(uint64_t)];
+    const void *cursor = buf;
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof path, "%s/%s", dir, name);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return RAFT_IOERR;
+    }
+    n = read(fd, buf, sizeof buf);
+    close(fd);
+    if (n != sizeof buf) {
+        return RAFT_IOERR;
+    }
+    *value = (int)byteGet64(&cursor);
+    return 0;
+}
+
+static int fsmCheckpoint(struct raft_fsm *fsm, char **dir)
+{
+    struct fsm *f = fsm->data;
+    char tmpl[] = "/tmp/raft-fsm-XXXXXX";
+    int rv;
+
+    if (mkdtemp(tmpl) == NULL) {
+        return RAFT_IOERR;
+    }
+    rv = fsmWriteFile(tmpl, "x", f->x);
+    if (rv == 0) {
+        rv = fsmWriteFile(tmpl, "y", f->y);
+    }
+    if (rv != 0) {
+        return rv;
+    }
+    *dir = raft_malloc(sizeof tmpl);
+    if (*dir == NULL) {
+        return RAFT_NOMEM;
+    }
+    strcpy(*dir, tmpl);
+    return 0;
+}
+
+static int fsmRestoreDir(struct raft_fsm *fsm, const char *dir)
+{
+    struct fsm *f = fsm->data;
+    int x;
+    int y;
+    int rv;
+
+    rv = fsmReadFile(dir, "x", &x);
+    if (rv == 0) {
+        rv = fsmReadFile(dir, "y", &y);
+    }
+    if (rv != 0) {
+        return rv;
+    }
+    f->x = x;
+    f->y = y;
+    return 0;
+}
+
+void FsmEnableFiles(struct raft_fsm *fsm)
+{
+    fsm->version = 4;
+    fsm->checkpoint = fsmCheckpoint;
+    fsm->restore_dir = fsmRestoreDir;
+}
+
+/* Apply the command and keep its payload, like a store keeping the last value
+ * written. */
+static int fsmApplyHold(struct raft_fsm *fsm,
+                        struct raft_fsm_apply *req,
+                        struct raft_payload *payload,
+                        raft_fsm_apply_cb cb)
+{
+    struct fsm *f = fsm->data;
+    int rv;
+
+    rv = fsmApply(fsm, req, &payload->buf, cb);
+    if (rv != 0) {
+        return rv;
+    }
+    if (f->held != NULL) {
+        raft_payload_release(f->held);
+    }
+    f->held = payload;
+    return 0;
+}
+
+void FsmEnableHold(struct raft_fsm *fsm)
+{
+    fsm->version = 5;
+    fsm->apply_hold = fsmApplyHold;
+}
+
+const struct raft_buffer *FsmGetHeld(struct raft_fsm *fsm)
+{
+    struct fsm *f = fsm->data;
+    return f->held != NULL ? &f->held->buf : NULL;
+}
+
+void FsmReleaseHeld(struct raft_fsm *fsm)
+{
+    struct fsm *f = fsm->data;
+    if (f->held != NULL) {
+        raft_payload_release(f->held);
+        f->held = NULL;
+    }
 }
 
 void FsmClose(struct raft_fsm *fsm)
@@ -9,6 +9,20 @@
 
 void FsmInit(struct raft_fsm *fsm);
 
+/* Switch to file-based snapshots, holding x and y in two files in a temporary
+ * directory. */
+void FsmEnableFiles(struct raft_fsm *fsm);
+
+/* Keep the payload of the last applied command instead of copying it. */
+void FsmEnableHold(struct raft_fsm *fsm);
+
+/* Return the payload kept by an FSM with FsmEnableHold(), if any. */
+const struct raft_buffer *FsmGetHeld(struct raft_fsm *fsm);
+
+/* Release the payload kept by an FSM, which must happen before its raft
+ * instance is closed. */
+void FsmReleaseHeld(struct raft_fsm *fsm);
+
 void FsmClose(struct raft_fsm *fsm);
 
 /* Encode a command to set x to the given value. */
@@ -295,6 +295,99 @@ TEST(Compress, compressBeginFailed, NULL, NULL, 0, NULL)
     free(buf.base);
     return MUNIT_OK;
 }
+
+/* Accumulate streamed chunks into a growing buffer. */
+struct streamSink
+{
+    struct raft_buffer buf;
+    unsigned n_writes;
+    unsigned fail_at; /* Fail the n'th write, if not zero. */
+};
+
+static int streamSinkWrite(void *arg, const void *data, size_t len)
+{
+    struct streamSink *sink = arg;
+    sink->n_writes++;
+    if (sink->n_writes == sink->fail_at) {
+        return RAFT_IOERR;
+    }
+    sink->buf.base = realloc(sink->buf.base, sink->buf.len + len);
+    munit_assert_ptr_not_null(sink->buf.base);
+    memcpy((char *)sink->buf.base + sink->buf.len, data, len);
+    sink->buf.len += len;
+    return 0;
+}
+
+/* Streamed compression produces a frame that decompresses to the input. */
+TEST(Compress, compressStream, NULL, NULL, 0, NULL)
+{
+    char errmsg[RAFT_ERRMSG_BUF_SIZE] = {0};
+    struct raft_buffer decompressed = {0};
+    struct raft_buffer bufs[2];
+    struct streamSink sink = {{NULL, 0}, 0, 0};
+    uint8_t sha1_virgin[20] = {0};
+    uint8_t sha1_decompressed[20] = {1};
+
+    bufs[0] = getBufWithRandom(3 * 1024 * 1024 + 17);
+    bufs[1] = getBufWithNonRandom(1024 * 1024);
+    sha1(bufs, 2, sha1_virgin);
+
+    munit_assert_int(CompressStream(bufs, 2, false, streamSinkWrite, &sink, errmsg),
+                     ==, 0);
+    munit_assert_uint(sink.n_writes, >, 2);
+    munit_assert_true(IsCompressed(sink.buf.base, sink.buf.len));
+    munit_assert_int(Decompress(sink.buf, &decompressed, errmsg), ==, 0);
+    munit_assert_ulong(decompressed.len, ==, bufs[0].len + bufs[1].len);
+    sha1(&decompressed, 1, sha1_decompressed);
+    munit_assert_int(memcmp(sha1_virgin, sha1_decompressed, 20), ==, 0);
+
+    free(bufs[0].base);
+    free(bufs[1].base);
+    free(sink.buf.base);
+    raft_free(decompressed.base);
+    return MUNIT_OK;
+}
+
+/* Frames made of independent blocks flag them in the frame descriptor and
+ * decompress as usual. */
+TEST(Compress, compressStreamIndependent, NULL, NULL, 0, NULL)
+{
+    char errmsg[RAFT_ERRMSG_BUF_SIZE] = {0};
+    struct raft_buffer decompressed = {0};
+    struct streamSink sink = {{NULL, 0}, 0, 0};
+    struct raft_buffer buf = getBufWithNonRandom(3 * 1024 * 1024 + 17);
+
+    munit_assert_int(CompressStream(&buf, 1, true, streamSinkWrite, &sink,
+                                    errmsg),
+                     ==, 0);
+    munit_assert_true(IsCompressed(sink.buf.base, sink.buf.len));
+    /* Bit 5 of the FLG byte is the block independence flag. */
+    munit_assert_true(((uint8_t *)sink.buf.base)[4] & (1 << 5));
+    munit_assert_int(Decompress(sink.buf, &decompressed, errmsg), ==, 0);
+    munit_assert_ulong(decompressed.len, ==, buf.len);
+    munit_assert_int(memcmp(decompressed.base, buf.base, buf.len), ==, 0);
+
+    free(buf.base);
+    free(sink.buf.base);
+    raft_free(decompressed.base);
+    return MUNIT_OK;
+}
+
+/* A failing write aborts the stream with its error code. */
+TEST(Compress, compressStreamWriteFailed, NULL, NULL, 0, NULL)
+{
+    char errmsg[RAFT_ERRMSG_BUF_SIZE] = {0};
+    struct streamSink sink = {{NULL, 0}, 0, 2};
+    struct raft_buffer buf = getBufWithRandom(2 * 1024 * 1024);
+
+    munit_assert_int(CompressStream(&buf, 1, false, streamSinkWrite, &sink, errmsg),
+                     ==, RAFT_IOERR);
+    munit_assert_uint(sink.n_writes, ==, 2);
+
+    free(buf.base);
+    free(sink.buf.base);
+    return MUNIT_OK;
+}
 #else
 
 TEST(Compress, lz4Disabled, NULL, NULL, 0, NULL)
@@ -1242,6 +1242,78 @@ TEST(logRestore, wipe, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/******************************************************************************
+ *
+ * logHold
+ *
+ *****************************************************************************/
+
+SUITE(logHold)
+
+/* A held payload outlives its entry. */
+TEST(logHold, truncate, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    void *base;
+    unsigned id;
+    int rv;
+
+    APPEND(1 /* term */);
+    base = GET(1)->buf.base;
+    rv = logHold(&f->log, 1, &id);
+    munit_assert_int(rv, ==, 0);
+    munit_assert_uint(id, !=, 0);
+    munit_assert_ptr_equal(GET(1)->batch, base);
+
+    TRUNCATE(1 /* index */);
+    munit_assert_string_equal((const char *)base, "hello");
+
+    logUnhold(&f->log, id);
+    return MUNIT_OK;
+}
+
+/* Entries acquired before the payload was held release it through the batch it
+ * was moved to. */
+TEST(logHold, acquired, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry *entries;
+    unsigned n;
+    unsigned id;
+    int rv;
+
+    APPEND(1 /* term */);
+    ACQUIRE(1 /* index */);
+    rv = logHold(&f->log, 1, &id);
+    munit_assert_int(rv, ==, 0);
+    munit_assert_ptr_null(entries[0].batch);
+
+    TRUNCATE(1 /* index */);
+    RELEASE(1 /* index */);
+    ASSERT_REFCOUNT(1 /* index */, 0 /* count */);
+
+    logUnhold(&f->log, id);
+    return MUNIT_OK;
+}
+
+/* Holding an entry of a batch keeps the whole batch alive. */
+TEST(logHold, batch, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    const void *base;
+    unsigned id;
+
+    APPEND_BATCH(3 /* n entries */);
+    base = GET(2)->buf.base;
+    munit_assert_int(logHold(&f->log, 2, &id), ==, 0);
+
+    TRUNCATE(1 /* index */);
+    munit_assert_int(*(const uint64_t *)base, ==, 1000);
+
+    logUnhold(&f->log, id);
+    return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * logHook
@@ -1340,6 +1412,90 @@ TEST(logHook, remove, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* Range hooks. */
+static struct raft_log_hook g_range_hook;
+static unsigned g_range_calls;
+static unsigned g_range_entries;
+static raft_index g_range_next;
+
+static void hookEntriesRange(struct raft_log_hook *hook,
+                             raft_index first,
+                             unsigned n,
+                             const struct raft_entry entries[])
+{
+    unsigned i;
+    (void)hook;
+
+    munit_assert_int(first, ==, g_range_next);
+    for (i = 0; i < n; i++) {
+        munit_assert_int(entries[i].term, ==, 1);
+        munit_assert_int(entries[i].type, ==, RAFT_COMMAND);
+    }
+    g_range_calls += 1;
+    g_range_entries += n;
+    g_range_next = first + n;
+}
+
+/* Append a series of N commands with a single logAppendCommands call. */
+#define APPEND_COMMANDS(N)                                        {                                                                 struct raft_buffer bufs_[N];                                  int i_;                                                       int rv_;                                                      for (i_ = 0; i_ < N; i_++) {                                      bufs_[i_].base = raft_entry_malloc(8);                        bufs_[i_].len = 8;                                        }                                                             rv_ = logAppendCommands(&f->log, 1, bufs_, N);                munit_assert_int(rv_, ==, 0);                             }
+
+/* A series of appended entries is reported with a single call, and the
+ * per-entry hook is not invoked. */
+TEST(logHook, entriesAdd, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+
+    memset(&g_range_hook, 0, sizeof g_range_hook);
+    g_range_hook.entry_add = hookEntryAdd;
+    g_range_hook.entries_add = hookEntriesRange;
+    g_hook_entry_add_num = 0;
+    g_range_calls = 0;
+    g_range_entries = 0;
+    g_range_next = 1;
+    logSetHook(&f->log, &g_range_hook);
+
+    APPEND_COMMANDS(10);
+    munit_assert_uint(g_range_calls, ==, 1);
+    munit_assert_uint(g_range_entries, ==, 10);
+    munit_assert_uint64(g_hook_entry_add_num, ==, 0);
+
+    APPEND(1);
+    munit_assert_uint(g_range_calls, ==, 2);
+    munit_assert_uint(g_range_entries, ==, 11);
+    return MUNIT_OK;
+}
+
+/* Compaction and truncation report the removed entries in spans. */
+TEST(logHook, entriesRemove, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+
+    memset(&g_range_hook, 0, sizeof g_range_hook);
+    g_range_hook.entry_remove = hookEntryRemove;
+    g_range_hook.entries_remove = hookEntriesRange;
+    g_hook_entry_remove_num = 0;
+    g_range_calls = 0;
+    g_range_entries = 0;
+    g_range_next = 1;
+    logSetHook(&f->log, &g_range_hook);
+
+    APPEND_COMMANDS(200);
+    SNAPSHOT(150, 10);
+    munit_assert_uint(g_range_calls, ==, 3);
+    munit_assert_uint(g_range_entries, ==, 140);
+
+    g_range_calls = 0;
+    g_range_next = 181;
+    logTruncate(&f->log, 181);
+    munit_assert_uint(g_range_calls, ==, 1);
+    munit_assert_uint(g_range_entries, ==, 160);
+    munit_assert_uint64(g_hook_entry_remove_num, ==, 0);
+
+    /* The remaining entries are reported when the log is closed. */
+    g_range_next = 141;
+    return MUNIT_OK;
+}
+
 SUITE(logHasExternalRef)
 
 TEST(logHasExternalRef, no, setUp, tearDown, 0, NULL)